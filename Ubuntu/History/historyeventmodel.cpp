@@ -29,7 +29,7 @@
 #include <QTimerEvent>
 
 HistoryEventModel::HistoryEventModel(QObject *parent) :
-    HistoryModel(parent), mCanFetchMore(true)
+    HistoryModel(parent), mCanFetchMore(true), mPageRequested(false)
 {
     // configure the roles
     mRoles = HistoryModel::roleNames();
@@ -51,6 +51,7 @@ HistoryEventModel::HistoryEventModel(QObject *parent) :
     mRoles[CallDurationRole] = "callDuration";
     mRoles[RemoteParticipantRole] = "remoteParticipant";
     mRoles[SubjectAsAliasRole] = "subjectAsAlias";
+    mRoles[TextMatchSnippetRole] = "textMatchSnippet";
 }
 
 int HistoryEventModel::rowCount(const QModelIndex &parent) const
@@ -201,6 +202,11 @@ QVariant HistoryEventModel::eventData(const History::Event &event, int role) con
             return textEvent.subject();
         }
         break;
+    case TextMatchSnippetRole:
+        if (!textEvent.isNull()) {
+            result = textEvent.matchSnippet();
+        }
+        break;
     }
 
     return result;
@@ -217,12 +223,23 @@ bool HistoryEventModel::canFetchMore(const QModelIndex &parent) const
 
 void HistoryEventModel::fetchMore(const QModelIndex &parent)
 {
-    if (parent.isValid() || !mFilter || mView.isNull()) {
+    if (parent.isValid() || !mFilter || mView.isNull() || mPageRequested) {
         return;
     }
 
-    History::Events events = fetchNextPage();
+    // the page is appended once it arrives, so the GUI is not blocked meanwhile
+    mPageRequested = true;
+    mView->requestNextPage();
+}
 
+void HistoryEventModel::onPageReady(const History::Events &events)
+{
+    mPageRequested = false;
+    appendPage(events);
+}
+
+void HistoryEventModel::appendPage(const History::Events &events)
+{
     if (events.isEmpty()) {
         mCanFetchMore = false;
         Q_EMIT canFetchMoreChanged();
@@ -356,6 +373,9 @@ void HistoryEventModel::updateQuery()
     }
 
     mView = History::Manager::instance()->queryEvents((History::EventType)mType, querySort, queryFilter);
+    // let the pages grow while the list is scrolled fast, and get the next one ready in the meantime
+    mView->setPageSize(0);
+    mView->setReadAhead(true);
     connect(mView.data(),
             SIGNAL(eventsAdded(History::Events)),
             SLOT(onEventsAdded(History::Events)));
@@ -371,8 +391,12 @@ void HistoryEventModel::updateQuery()
     connect(mView.data(),
             SIGNAL(invalidated()),
             SLOT(triggerQueryUpdate()));
+    connect(mView.data(),
+            SIGNAL(pageReady(History::Events)),
+            SLOT(onPageReady(History::Events)));
 
     mCanFetchMore = true;
+    mPageRequested = false;
     Q_EMIT canFetchMoreChanged();
 
     Q_FOREACH(const QVariant &attachment, mAttachmentCache) {
@@ -463,8 +487,3 @@ void HistoryEventModel::onThreadsRemoved(const History::Threads &threads)
         }
     }
 }
-
-History::Events HistoryEventModel::fetchNextPage()
-{
-    return mView->nextPage();
-}
@@ -50,6 +50,7 @@ public:
         CallDurationRole,
         RemoteParticipantRole,
         SubjectAsAliasRole,
+        TextMatchSnippetRole,
         LastEventRole
     };
 
@@ -74,14 +75,16 @@ protected Q_SLOTS:
     virtual void onEventsModified(const History::Events &events);
     virtual void onEventsRemoved(const History::Events &events);
     virtual void onThreadsRemoved(const History::Threads &threads);
+    void onPageReady(const History::Events &events);
 
 protected:
-    History::Events fetchNextPage();
+    virtual void appendPage(const History::Events &events);
 
 private:
     History::EventViewPtr mView;
     History::Events mEvents;
     bool mCanFetchMore;
+    bool mPageRequested;
     QHash<int, QByteArray> mRoles;
     mutable QMap<History::TextEvent, QList<QVariant> > mAttachmentCache;
 };
@@ -73,14 +73,8 @@ QVariant HistoryGroupedEventsModel::data(const QModelIndex &index, int role) con
     return result;
 }
 
-void HistoryGroupedEventsModel::fetchMore(const QModelIndex &parent)
+void HistoryGroupedEventsModel::appendPage(const History::Events &events)
 {
-    if (!canFetchMore(parent)) {
-        return;
-    }
-
-    History::Events events = fetchNextPage();
-
     // History already deliver us the events in the right order
     // but we might have added new entries in the added, removed, modified events.
     // still, it is less expensive to do a sequential search starting from the bottom
@@ -35,6 +35,10 @@ HistoryGroupedThreadsModel::HistoryGroupedThreadsModel(QObject *parent) :
     mGroupThreads = true;
     mRoles = HistoryThreadModel::roleNames();
     mRoles[ThreadsRole] = "threads";
+
+    connect(History::Manager::instance(),
+            SIGNAL(threadReady(int, History::Thread)),
+            SLOT(onGroupedThreadReady(int, History::Thread)));
 }
 
 QVariant HistoryGroupedThreadsModel::data(const QModelIndex &index, int role) const
@@ -82,13 +86,8 @@ QVariant HistoryGroupedThreadsModel::data(const QModelIndex &index, int role) co
     return result;
 }
 
-void HistoryGroupedThreadsModel::fetchMore(const QModelIndex &parent)
+void HistoryGroupedThreadsModel::appendPage(const History::Threads &threads)
 {
-    if (!canFetchMore(parent)) {
-        return;
-    }
-
-    const History::Threads &threads = fetchNextPage();
     Q_FOREACH(const History::Thread &thread, threads) {
         processThreadGrouping(thread);
 
@@ -97,7 +96,6 @@ void HistoryGroupedThreadsModel::fetchMore(const QModelIndex &parent)
             watchContactInfo(thread.accountId(), participant.identifier(), participant.properties());
         }
     }
-    notifyDataChanged();
 
     if (threads.isEmpty()) {
         mCanFetchMore = false;
@@ -222,6 +220,7 @@ void HistoryGroupedThreadsModel::updateQuery()
         mGroups.clear();
         endRemoveRows();
     }
+    mPendingGroupings.clear();
 
     HistoryThreadModel::updateQuery();
 }
@@ -233,7 +232,6 @@ void HistoryGroupedThreadsModel::onThreadsAdded(const History::Threads &threads)
     }
 
     fetchParticipantsIfNeeded(threads);
-    notifyDataChanged();
 }
 
 void HistoryGroupedThreadsModel::onThreadsModified(const History::Threads &threads)
@@ -242,7 +240,6 @@ void HistoryGroupedThreadsModel::onThreadsModified(const History::Threads &threa
         processThreadGrouping(thread);
     }
     fetchParticipantsIfNeeded(threads);
-    notifyDataChanged();
 }
 
 void HistoryGroupedThreadsModel::onThreadsRemoved(const History::Threads &threads)
@@ -292,9 +289,27 @@ void HistoryGroupedThreadsModel::onThreadParticipantsChanged(const History::Thre
 
 void HistoryGroupedThreadsModel::processThreadGrouping(const History::Thread &thread)
 {
+    // the grouped thread is requested in the background and processed by onGroupedThreadReady()
     QVariantMap queryProperties;
     queryProperties[History::FieldGroupingProperty] = mGroupingProperty;
-    History::Thread groupedThread = History::Manager::instance()->getSingleThread((History::EventType)mType, thread.accountId(), thread.threadId(), queryProperties);
+    int requestId = History::Manager::instance()->requestSingleThread((History::EventType)mType, thread.accountId(),
+                                                                      thread.threadId(), queryProperties);
+    mPendingGroupings[requestId] = thread;
+}
+
+void HistoryGroupedThreadsModel::onGroupedThreadReady(int requestId, const History::Thread &groupedThread)
+{
+    if (!mPendingGroupings.contains(requestId)) {
+        return;
+    }
+
+    History::Thread thread = mPendingGroupings.take(requestId);
+    applyThreadGrouping(thread, groupedThread);
+    notifyDataChanged();
+}
+
+void HistoryGroupedThreadsModel::applyThreadGrouping(const History::Thread &thread, const History::Thread &groupedThread)
+{
     if (groupedThread.properties().isEmpty()) {
         removeThreadFromGroup(thread);
         return;
@@ -56,7 +56,6 @@ public:
 
     virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex &index, int role) const;
-    Q_INVOKABLE void fetchMore(const QModelIndex &parent = QModelIndex());
     virtual QHash<int, QByteArray> roleNames() const;
     Q_INVOKABLE QVariant get(int row) const;
 
@@ -64,6 +63,7 @@ Q_SIGNALS:
     void groupingPropertyChanged();
 
 protected:
+    void appendPage(const History::Threads &threads);
     int existingPositionForEntry(const History::Thread &thread) const;
     void removeGroup(const HistoryThreadGroup &group);
     void updateDisplayedThread(HistoryThreadGroup &group);
@@ -81,6 +81,8 @@ protected Q_SLOTS:
 
 private Q_SLOTS:
     void processThreadGrouping(const History::Thread &thread);
+    void onGroupedThreadReady(int requestId, const History::Thread &groupedThread);
+    void applyThreadGrouping(const History::Thread &thread, const History::Thread &groupedThread);
     void removeThreadFromGroup(const History::Thread &thread);
     void markGroupAsChanged(const HistoryThreadGroup &group);
     void notifyDataChanged();
@@ -90,6 +92,7 @@ private:
 
     HistoryThreadGroupList mGroups;
     QList<HistoryThreadGroup> mChangedGroups;
+    QMap<int, History::Thread> mPendingGroupings;
     QHash<int, QByteArray> mRoles;
 };
 
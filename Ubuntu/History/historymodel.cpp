@@ -30,12 +30,14 @@
 #include "utils_p.h"
 #include "voiceevent.h"
 #include <QTimerEvent>
+#include <algorithm>
 #include <QCryptographicHash>
 #include <QDebug>
 
 HistoryModel::HistoryModel(QObject *parent) :
     QAbstractListModel(parent), mFilter(0), mSort(new HistoryQmlSort(this)),
-    mType(EventTypeText), mMatchContacts(false), mUpdateTimer(0), mEventWritingTimer(0), mThreadWritingTimer(0), mWaitingForQml(false)
+    mType(EventTypeText), mMatchContacts(false), mUpdateTimer(0), mEventWritingTimer(0), mThreadWritingTimer(0), mWaitingForQml(false),
+    mRowContactKeysValid(false), mContactKeyRowsValid(false), mEmittingContactChanges(false)
 {
     // configure the roles
     mRoles[AccountIdRole] = "accountId";
@@ -52,9 +54,21 @@ HistoryModel::HistoryModel(QObject *parent) :
     connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SIGNAL(countChanged()));
     connect(this, SIGNAL(modelReset()), this, SIGNAL(countChanged()));
 
+    // keep the contact keys of the rows up-to-date
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(onRowsInserted(QModelIndex,int,int)));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(onRowsRemoved(QModelIndex,int,int)));
+    connect(this, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(onRowsChanged(QModelIndex,QModelIndex)));
+    connect(this, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), SLOT(invalidateContactKeys()));
+    connect(this, SIGNAL(layoutChanged()), SLOT(invalidateContactKeys()));
+    connect(this, SIGNAL(modelReset()), SLOT(invalidateContactKeys()));
+
     // reset the view when the service is stopped or started
     connect(History::Manager::instance(), SIGNAL(serviceRunningChanged()),
             this, SLOT(triggerQueryUpdate()));
+    connect(History::Manager::instance(), SIGNAL(historyReset()),
+            this, SLOT(triggerQueryUpdate()));
+    connect(History::Manager::instance(), SIGNAL(eventsWritten(int, bool)),
+            this, SLOT(onEventsWritten(int, bool)));
 
     // create the view and get some objects
     triggerQueryUpdate();
@@ -251,6 +265,7 @@ void HistoryModel::setMatchContacts(bool value)
     } else {
         History::ContactMatcher::instance()->disconnect(this);
     }
+    invalidateContactKeys();
 
     // mark all indexes as changed
     if (rowCount() > 0) {
@@ -393,27 +408,144 @@ void HistoryModel::onContactInfoChanged(const QString &accountId, const QString
         return;
     }
 
-    QList<QModelIndex> changedIndexes;
-    int count = rowCount();
-    for (int i = 0; i < count; ++i) {
+    ensureContactKeys();
+
+    // FIXME: right now we might be grouping threads from different accounts, so we are not enforcing
+    // the accountId to be the same as the one from the contact info, but maybe we need to do that
+    // in the future?
+    QList<int> candidateRows = mContactKeyRows.value(identifier.toLower());
+    if (History::Utils::matchFlagsForAccount(accountId) & History::MatchPhoneNumber) {
+        candidateRows += mContactKeyRows.value(History::PhoneUtils::comparisonKey(History::PhoneUtils::normalizePhoneNumber(identifier)));
+    }
+    std::sort(candidateRows.begin(), candidateRows.end());
+    candidateRows.erase(std::unique(candidateRows.begin(), candidateRows.end()), candidateRows.end());
+
+    QList<int> changedRows;
+    Q_FOREACH(int row, candidateRows) {
         // WARNING: do not use mEvents directly to verify which indexes to change as there is the
         // HistoryGroupedEventsModel which is based on this model and handles the items in a different way
-        QModelIndex idx = index(i);
-        QVariantMap properties = idx.data(PropertiesRole).toMap();
+        QVariantMap properties = index(row).data(PropertiesRole).toMap();
         History::Participants participants = History::Participants::fromVariantList(properties[History::FieldParticipants].toList());
         Q_FOREACH(const History::Participant &participant, participants) {
-            // FIXME: right now we might be grouping threads from different accounts, so we are not enforcing
-            // the accountId to be the same as the one from the contact info, but maybe we need to do that
-            // in the future?
             if (History::Utils::compareIds(accountId, History::ContactMatcher::normalizeId(participant.identifier()), identifier)) {
-                changedIndexes << idx;
+                changedRows << row;
+                break;
             }
         }
     }
 
-    // now emit the dataChanged signal to all changed indexes
-    Q_FOREACH(const QModelIndex &idx, changedIndexes) {
-        Q_EMIT dataChanged(idx, idx);
+    // now emit the dataChanged signal once for each range of changed rows
+    mEmittingContactChanges = true;
+    int i = 0;
+    while (i < changedRows.count()) {
+        int first = changedRows[i];
+        int last = first;
+        while (++i < changedRows.count() && changedRows[i] == last + 1) {
+            last++;
+        }
+        Q_EMIT dataChanged(index(first), index(last));
+    }
+    mEmittingContactChanges = false;
+}
+
+void HistoryModel::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (!mRowContactKeysValid) {
+        return;
+    }
+
+    for (int row = first; row <= last; ++row) {
+        mRowContactKeys.insert(row, contactKeys(row));
+    }
+    mContactKeyRowsValid = false;
+}
+
+void HistoryModel::onRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (!mRowContactKeysValid) {
+        return;
+    }
+
+    mRowContactKeys.erase(mRowContactKeys.begin() + first, mRowContactKeys.begin() + last + 1);
+    mContactKeyRowsValid = false;
+}
+
+void HistoryModel::onRowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    // the rows changed because of contact info changes keep the same participants
+    if (!mRowContactKeysValid || mEmittingContactChanges) {
+        return;
+    }
+
+    if (!topLeft.isValid() || bottomRight.row() >= mRowContactKeys.count()) {
+        invalidateContactKeys();
+        return;
+    }
+
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+        QStringList keys = contactKeys(row);
+        if (keys != mRowContactKeys[row]) {
+            mRowContactKeys[row] = keys;
+            mContactKeyRowsValid = false;
+        }
+    }
+}
+
+void HistoryModel::invalidateContactKeys()
+{
+    mRowContactKeys.clear();
+    mContactKeyRows.clear();
+    mRowContactKeysValid = false;
+    mContactKeyRowsValid = false;
+}
+
+/// the keys the participants of the row can be found by: their case folded identifiers, and their
+/// phone number comparison keys.
+/// The phone keys are indexed for every participant, whatever the account of the row and whether the
+/// identifier parses as a phone number or not: the contact info changes are compared using the flags of
+/// the account they come from, and two identifiers only match as phone numbers if they share that key.
+QStringList HistoryModel::contactKeys(int row) const
+{
+    QStringList keys;
+    if (!mMatchContacts) {
+        return keys;
+    }
+
+    QVariantMap properties = index(row).data(PropertiesRole).toMap();
+    History::Participants participants = History::Participants::fromVariantList(properties[History::FieldParticipants].toList());
+    Q_FOREACH(const History::Participant &participant, participants) {
+        QString identifier = History::ContactMatcher::normalizeId(participant.identifier());
+        keys << identifier.toLower();
+        keys << History::PhoneUtils::comparisonKey(History::PhoneUtils::normalizePhoneNumber(identifier));
+    }
+    keys.removeDuplicates();
+    return keys;
+}
+
+/// the keys of the rows are only read when a contact changes for the first time, and the rows of each key
+/// are only worked out again after the rows changed
+void HistoryModel::ensureContactKeys()
+{
+    if (!mRowContactKeysValid) {
+        mRowContactKeys.clear();
+        int count = rowCount();
+        for (int row = 0; row < count; ++row) {
+            mRowContactKeys << contactKeys(row);
+        }
+        mRowContactKeysValid = true;
+        mContactKeyRowsValid = false;
+    }
+
+    if (!mContactKeyRowsValid) {
+        mContactKeyRows.clear();
+        for (int row = 0; row < mRowContactKeys.count(); ++row) {
+            Q_FOREACH(const QString &key, mRowContactKeys[row]) {
+                mContactKeyRows[key] << row;
+            }
+        }
+        mContactKeyRowsValid = true;
     }
 }
 
@@ -440,9 +572,10 @@ void HistoryModel::timerEvent(QTimerEvent *event)
             return;
         }
 
-        if (History::Manager::instance()->writeEvents(mEventWritingQueue)) {
-            mEventWritingQueue.clear();
-        }
+        // write in the background, the events are queued again if that fails
+        int requestId = History::Manager::instance()->requestWriteEvents(mEventWritingQueue);
+        mPendingEventWrites[requestId] = mEventWritingQueue;
+        mEventWritingQueue.clear();
     } else if (event->timerId() == mThreadWritingTimer) {
         killTimer(mThreadWritingTimer);
         mThreadWritingTimer = 0;
@@ -456,6 +589,18 @@ void HistoryModel::timerEvent(QTimerEvent *event)
     }
 }
 
+void HistoryModel::onEventsWritten(int requestId, bool success)
+{
+    if (!mPendingEventWrites.contains(requestId)) {
+        return;
+    }
+
+    History::Events events = mPendingEventWrites.take(requestId);
+    if (!success) {
+        mEventWritingQueue = events + mEventWritingQueue;
+    }
+}
+
 bool HistoryModel::lessThan(const QVariantMap &left, const QVariantMap &right) const
 {
     QStringList sortFields = sort()->sortField().split(",");
@@ -73,7 +73,8 @@ public:
         MatchCaseInsensitive = History::MatchCaseInsensitive,
         MatchContains = History::MatchContains,
         MatchPhoneNumber = History::MatchPhoneNumber,
-        MatchNotEquals = History::MatchNotEquals
+        MatchNotEquals = History::MatchNotEquals,
+        MatchFullText = History::MatchFullText
     };
 
     enum MessageStatus
@@ -202,12 +203,19 @@ protected Q_SLOTS:
     virtual void updateQuery() = 0;
     void onContactInfoChanged(const QString &accountId, const QString &identifier, const QVariantMap &contactInfo);
     void watchContactInfo(const QString &accountId, const QString &identifier, const QVariantMap &currentInfo);
+    void onEventsWritten(int requestId, bool success);
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void onRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onRowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void invalidateContactKeys();
 
 protected:
     virtual void timerEvent(QTimerEvent *event);
     bool lessThan(const QVariantMap &left, const QVariantMap &right) const;
     int positionForItem(const QVariantMap &item) const;
     bool isAscending() const;
+    QStringList contactKeys(int row) const;
+    void ensureContactKeys();
 
     HistoryQmlFilter *mFilter;
     HistoryQmlSort *mSort;
@@ -216,12 +224,21 @@ protected:
 
 private:
     History::Events mEventWritingQueue;
+    QMap<int, History::Events> mPendingEventWrites;
     int mUpdateTimer;
     int mEventWritingTimer;
     int mThreadWritingTimer;
     bool mWaitingForQml;
     History::Threads mThreadWritingQueue;
     QHash<int, QByteArray> mRoles;
+
+    // the contact keys of the participants of each row, and the rows for each key, so that
+    // contact changes only need to check the rows they might affect
+    QList<QStringList> mRowContactKeys;
+    QHash<QString, QList<int> > mContactKeyRows;
+    bool mRowContactKeysValid;
+    bool mContactKeyRowsValid;
+    bool mEmittingContactChanges;
 };
 
 #endif // HISTORYMODEL_H
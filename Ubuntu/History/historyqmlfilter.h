@@ -40,7 +40,8 @@ public:
         MatchCaseInsensitive = History::MatchCaseInsensitive,
         MatchContains = History::MatchContains,
         MatchPhoneNumber = History::MatchPhoneNumber,
-        MatchNotEquals = History::MatchNotEquals
+        MatchNotEquals = History::MatchNotEquals,
+        MatchFullText = History::MatchFullText
     };
 
     explicit HistoryQmlFilter(QObject *parent = 0);
@@ -32,7 +32,7 @@ Q_DECLARE_METATYPE(History::TextEventAttachments)
 Q_DECLARE_METATYPE(QList<QVariantMap>)
 
 HistoryThreadModel::HistoryThreadModel(QObject *parent) :
-    HistoryModel(parent), mCanFetchMore(true), mGroupThreads(false)
+    HistoryModel(parent), mCanFetchMore(true), mPageRequested(false), mGroupThreads(false)
 {
     qRegisterMetaType<QList<QVariantMap> >();
     qDBusRegisterMetaType<QList<QVariantMap> >();
@@ -209,11 +209,24 @@ bool HistoryThreadModel::canFetchMore(const QModelIndex &parent) const
 
 void HistoryThreadModel::fetchMore(const QModelIndex &parent)
 {
-    if (parent.isValid() || mThreadView.isNull()) {
+    if (parent.isValid() || mThreadView.isNull() || mPageRequested) {
         return;
     }
 
-    History::Threads threads = fetchNextPage();
+    // the page is appended once it arrives, so the GUI is not blocked meanwhile
+    mPageRequested = true;
+    mThreadView->requestNextPage();
+}
+
+void HistoryThreadModel::onPageReady(const History::Threads &threads)
+{
+    mPageRequested = false;
+    fetchParticipantsIfNeeded(threads);
+    appendPage(threads);
+}
+
+void HistoryThreadModel::appendPage(const History::Threads &threads)
+{
     if (threads.isEmpty()) {
         mCanFetchMore = false;
         Q_EMIT canFetchMoreChanged();
@@ -281,6 +294,9 @@ void HistoryThreadModel::updateQuery()
     }
 
     mThreadView = History::Manager::instance()->queryThreads((History::EventType)mType, querySort, queryFilter, properties);
+    // let the pages grow while the list is scrolled fast, and get the next one ready in the meantime
+    mThreadView->setPageSize(0);
+    mThreadView->setReadAhead(true);
     connect(mThreadView.data(),
             SIGNAL(threadsAdded(History::Threads)),
             SLOT(onThreadsAdded(History::Threads)));
@@ -297,6 +313,9 @@ void HistoryThreadModel::updateQuery()
     connect(mThreadView.data(),
             SIGNAL(invalidated()),
             SLOT(triggerQueryUpdate()));
+    connect(mThreadView.data(),
+            SIGNAL(pageReady(History::Threads)),
+            SLOT(onPageReady(History::Threads)));
 
     Q_FOREACH(const QVariant &attachment, mAttachmentCache) {
         HistoryQmlTextEventAttachment *qmlAttachment = attachment.value<HistoryQmlTextEventAttachment *>();
@@ -308,6 +327,7 @@ void HistoryThreadModel::updateQuery()
 
     // and fetch again
     mCanFetchMore = true;
+    mPageRequested = false;
     Q_EMIT canFetchMoreChanged();
     fetchMore(QModelIndex());
 }
@@ -406,10 +426,3 @@ void HistoryThreadModel::onThreadsRemoved(const History::Threads &threads)
     // removed by another client, it will still show up when a new page is requested. Maybe it
     // should be handle internally in History::ThreadView?
 }
-
-History::Threads HistoryThreadModel::fetchNextPage()
-{
-    History::Threads threads = mThreadView->nextPage();
-    fetchParticipantsIfNeeded(threads);
-    return threads;
-}
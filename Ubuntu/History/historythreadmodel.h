@@ -77,11 +77,13 @@ protected Q_SLOTS:
     virtual void onThreadsModified(const History::Threads &threads);
     virtual void onThreadsRemoved(const History::Threads &threads);
     virtual void onThreadParticipantsChanged(const History::Thread &thread, const History::Participants &added, const History::Participants &removed, const History::Participants &modified);
+    void onPageReady(const History::Threads &threads);
 
 protected:
     void fetchParticipantsIfNeeded(const History::Threads &threads);
-    History::Threads fetchNextPage();
+    virtual void appendPage(const History::Threads &threads);
     bool mCanFetchMore;
+    bool mPageRequested;
     bool mGroupThreads;
 
 private:
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "databaseworker.h"
+#include <QCoreApplication>
+#include <QEvent>
+
+static QEvent::Type taskEventType()
+{
+    static QEvent::Type type = (QEvent::Type) QEvent::registerEventType();
+    return type;
+}
+
+class TaskEvent : public QEvent
+{
+public:
+    explicit TaskEvent(const DatabaseWorker::Task &task)
+        : QEvent(taskEventType()), mTask(task) { }
+
+    DatabaseWorker::Task mTask;
+};
+
+static thread_local DatabaseWorker *currentWorker = 0;
+
+// events posted to the same receiver are delivered in order, which is what keeps the tasks sequential
+class TaskRunner : public QObject
+{
+public:
+    explicit TaskRunner(DatabaseWorker *worker = 0, QAtomicInt *pendingTasks = 0)
+        : QObject(), mWorker(worker), mPendingTasks(pendingTasks) { }
+
+    bool event(QEvent *event) override
+    {
+        if (event->type() != taskEventType()) {
+            return QObject::event(event);
+        }
+
+        if (mWorker) {
+            currentWorker = mWorker;
+        }
+        static_cast<TaskEvent*>(event)->mTask();
+        if (mPendingTasks) {
+            mPendingTasks->deref();
+        }
+        return true;
+    }
+
+private:
+    DatabaseWorker *mWorker;
+    QAtomicInt *mPendingTasks;
+};
+
+DatabaseWorker::DatabaseWorker(QObject *parent)
+    : QObject(parent), mWorkerRunner(new TaskRunner(this, &mPendingTasks)), mOwnerRunner(new TaskRunner())
+{
+    mThread.setObjectName("HistoryDatabaseWorker");
+    mOwnerRunner->setParent(this);
+    mWorkerRunner->moveToThread(&mThread);
+    connect(&mThread, SIGNAL(finished()), mWorkerRunner, SLOT(deleteLater()));
+}
+
+DatabaseWorker::~DatabaseWorker()
+{
+    stop();
+}
+
+void DatabaseWorker::start()
+{
+    mThread.start();
+}
+
+/// finishes the tasks already queued and stops the worker thread
+void DatabaseWorker::stop()
+{
+    if (!mThread.isRunning()) {
+        return;
+    }
+
+    enqueue([this]() {
+        mThread.quit();
+    });
+    mThread.wait();
+}
+
+void DatabaseWorker::enqueue(const Task &task)
+{
+    mPendingTasks.ref();
+    QCoreApplication::postEvent(mWorkerRunner, new TaskEvent(task));
+}
+
+void DatabaseWorker::post(const Task &task)
+{
+    QCoreApplication::postEvent(mOwnerRunner, new TaskEvent(task));
+}
+
+bool DatabaseWorker::isWorkerThread() const
+{
+    return QThread::currentThread() == &mThread;
+}
+
+int DatabaseWorker::pendingTasks() const
+{
+    return mPendingTasks.load();
+}
+
+QObject *DatabaseWorker::context() const
+{
+    return mWorkerRunner;
+}
+
+/// returns the worker running the current task, or null if not called from a worker thread
+DatabaseWorker *DatabaseWorker::current()
+{
+    return currentWorker;
+}
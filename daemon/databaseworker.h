@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DATABASEWORKER_H
+#define DATABASEWORKER_H
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QThread>
+#include <functional>
+
+class TaskRunner;
+
+/// Runs all the backend operations of the daemon in a single thread, in the order they were queued.
+/// The objects created by the tasks (the plugin, the views, the contact matcher) live in that thread
+/// and get their D-Bus calls and events delivered there.
+class DatabaseWorker : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void()> Task;
+
+    explicit DatabaseWorker(QObject *parent = 0);
+    ~DatabaseWorker();
+
+    void start();
+    void stop();
+
+    // runs the task in the worker thread
+    void enqueue(const Task &task);
+    // runs the task in the thread the worker was created in, used to hand the results back
+    void post(const Task &task);
+
+    bool isWorkerThread() const;
+    int pendingTasks() const;
+
+    // an object living in the worker thread, to be used as parent of objects created by the tasks
+    QObject *context() const;
+
+    static DatabaseWorker *current();
+
+private:
+    QThread mThread;
+    TaskRunner *mWorkerRunner;
+    TaskRunner *mOwnerRunner;
+    QAtomicInt mPendingTasks;
+};
+
+#endif // DATABASEWORKER_H
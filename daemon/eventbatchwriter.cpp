@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "eventbatchwriter.h"
+#include "plugin.h"
+#include "types.h"
+#include <QMap>
+#include <QPair>
+
+EventBatchWriter::EventBatchWriter(History::Plugin *backend)
+    : mBackend(backend)
+{
+}
+
+/// writes the events and reads their threads back, returns false and rolls the batch back if any write failed.
+/// The results of the previous call are discarded.
+bool EventBatchWriter::write(const QList<QVariantMap> &events, const QVariantMap &properties)
+{
+    mNewEvents.clear();
+    mModifiedEvents.clear();
+    mThreads.clear();
+
+    if (!mBackend) {
+        return false;
+    }
+
+    QList<QVariantMap> newEvents;
+    QList<QVariantMap> modifiedEvents;
+    // the threads touched by the batch, only read once all the events are written
+    QMap<QString, QVariantMap> threads;
+    typedef QPair<QList<QVariantMap>*, int> EventIndex;
+    QMap<QString, QList<EventIndex> > voiceEvents;
+
+    mBackend->beginBatchOperation();
+
+    Q_FOREACH(const QVariantMap &event, events) {
+        History::EventType type = (History::EventType) event[History::FieldType].toInt();
+        History::EventWriteResult result = History::EventWriteNone;
+        QVariantMap savedEvent = event;
+
+        // and finally write the event
+        switch (type) {
+        case History::EventTypeText:
+            result = mBackend->writeTextEvent(savedEvent);
+            break;
+        case History::EventTypeVoice:
+            result = mBackend->writeVoiceEvent(savedEvent);
+            break;
+        case History::EventTypeNull:
+            qWarning("EventBatchWriter::write: Got EventTypeNull, ignoring this event!");
+            continue;
+        }
+
+        QList<QVariantMap> *target = 0;
+
+        // check if the event was a new one or a modification to an existing one
+        switch (result) {
+        case History::EventWriteCreated:
+            target = &newEvents;
+            break;
+        case History::EventWriteModified:
+            target = &modifiedEvents;
+            break;
+        case History::EventWriteError:
+            mBackend->rollbackBatchOperation();
+            return false;
+        case History::EventWriteNone:
+            break;
+        }
+
+        QString hash = hashThread(event);
+        threads[hash] = event;
+        if (target) {
+            *target << savedEvent;
+            // voice events carry the participants of their thread, set once the thread is read
+            if (type == History::EventTypeVoice) {
+                voiceEvents[hash] << qMakePair(target, target->count() - 1);
+            }
+        }
+    }
+
+    // get the threads AFTER the events are written to make sure they are up-to-date
+    QMap<QString, QVariantMap>::iterator it = threads.begin();
+    while (it != threads.end()) {
+        const QVariantMap &event = it.value();
+        QVariantMap thread = mBackend->getSingleThread((History::EventType) event[History::FieldType].toInt(),
+                                                       event[History::FieldAccountId].toString(),
+                                                       event[History::FieldThreadId].toString(),
+                                                       properties);
+        if (thread.isEmpty()) {
+            it = threads.erase(it);
+            continue;
+        }
+
+        Q_FOREACH(const EventIndex &index, voiceEvents[it.key()]) {
+            (*index.first)[index.second][History::FieldParticipants] = thread[History::FieldParticipants];
+        }
+        it.value() = thread;
+        ++it;
+    }
+
+    mBackend->endBatchOperation();
+
+    mNewEvents = newEvents;
+    mModifiedEvents = modifiedEvents;
+    mThreads = threads.values();
+    return true;
+}
+
+QList<QVariantMap> EventBatchWriter::newEvents() const
+{
+    return mNewEvents;
+}
+
+QList<QVariantMap> EventBatchWriter::modifiedEvents() const
+{
+    return mModifiedEvents;
+}
+
+QList<QVariantMap> EventBatchWriter::threads() const
+{
+    return mThreads;
+}
+
+QString EventBatchWriter::hashThread(const QVariantMap &thread)
+{
+    QString hash = QString::number(thread[History::FieldType].toInt());
+    hash += "#-#" + thread[History::FieldAccountId].toString();
+    hash += "#-#" + thread[History::FieldThreadId].toString();
+    return hash;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENTBATCHWRITER_H
+#define EVENTBATCHWRITER_H
+
+#include <QList>
+#include <QVariantMap>
+
+namespace History
+{
+class Plugin;
+}
+
+/// Writes a batch of events through the plugin in a single batch operation. The threads the events
+/// belong to are only read once all the events are written, once per thread instead of once per event.
+class EventBatchWriter
+{
+public:
+    explicit EventBatchWriter(History::Plugin *backend);
+
+    bool write(const QList<QVariantMap> &events, const QVariantMap &properties = QVariantMap());
+
+    QList<QVariantMap> newEvents() const;
+    QList<QVariantMap> modifiedEvents() const;
+    QList<QVariantMap> threads() const;
+
+    static QString hashThread(const QVariantMap &thread);
+
+private:
+    History::Plugin *mBackend;
+    QList<QVariantMap> mNewEvents;
+    QList<QVariantMap> mModifiedEvents;
+    QList<QVariantMap> mThreads;
+};
+
+#endif // EVENTBATCHWRITER_H
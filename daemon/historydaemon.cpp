@@ -20,7 +20,9 @@
  */
 
 #include "historydaemon.h"
+#include "eventbatchwriter.h"
 #include "telepathyhelper_p.h"
+#include "contactmatcher_p.h"
 #include "filter.h"
 #include "sort.h"
 #include "utils_p.h"
@@ -29,8 +31,10 @@
 #include "plugin.h"
 #include "pluginthreadview.h"
 #include "plugineventview.h"
+#include "recordstream_p.h"
 #include "textevent.h"
 
+#include <QFile>
 #include <QStandardPaths>
 #include <QCryptographicHash>
 #include <TelepathyQt/CallChannel>
@@ -44,6 +48,20 @@ Q_DECLARE_METATYPE(RolesMap)
 
 const constexpr static int AdminRole = 2;
 
+// the database is checkpointed once there were no writes for checkpointIdleInterval,
+// but never later than checkpointMaxDelay after the first write not checkpointed yet
+const constexpr static int checkpointIdleInterval = 5000;
+const constexpr static int checkpointMaxDelay = 60000;
+
+// the contact cache is saved at most once every contactCacheSaveInterval when idle, and when quitting
+const constexpr static int contactCacheSaveInterval = 600000;
+
+// the views are paged in up to maxReaderThreads threads, each with its own database connection
+const constexpr static int maxReaderThreads = 4;
+
+// bulk imports are committed every importChunkSize records
+const constexpr static int importChunkSize = 1000;
+
 enum ChannelGroupChangeReason
 {
     ChannelGroupChangeReasonNone = 0,
@@ -81,13 +99,13 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, RolesMap &roles)
     return argument;
 }
 
-bool foundAsMemberInThread(const Tp::ContactPtr& contact, QVariantMap thread)
+bool foundAsMemberInThread(const QString &contactId, QVariantMap thread)
 {
     Q_FOREACH (QVariant participant, thread[History::FieldParticipants].toList()) {
         // found if same identifier and as member into thread info
         QVariantMap participantMap = participant.toMap();
         if (History::Utils::compareIds(thread[History::FieldAccountId].toString(),
-                                       contact->id(),
+                                       contactId,
                                        participantMap[History::FieldIdentifier].toString()) &&
                 participantMap[History::FieldParticipantState].toUInt() == History::ParticipantStateRegular)
         {
@@ -97,11 +115,11 @@ bool foundAsMemberInThread(const Tp::ContactPtr& contact, QVariantMap thread)
     return false;
 }
 
-bool foundInThread(const Tp::ContactPtr& contact, QVariantMap thread)
+bool foundInThread(const QString &contactId, QVariantMap thread)
 {
     Q_FOREACH (QVariant participant, thread[History::FieldParticipants].toList()) {
         if (History::Utils::compareIds(thread[History::FieldAccountId].toString(),
-                                       contact->id(),
+                                       contactId,
                                        participant.toMap()[History::FieldIdentifier].toString()))
         {
             return true;
@@ -110,19 +128,28 @@ bool foundInThread(const Tp::ContactPtr& contact, QVariantMap thread)
     return false;
 }
 
+// the contact details needed by the database worker, as the telepathy objects can only be used in the main thread
+QVariantMap contactToMap(const Tp::ContactPtr &contact)
+{
+    QVariantMap map;
+    map[History::FieldIdentifier] = contact->id();
+    map[History::FieldAlias] = contact->alias();
+    return map;
+}
+
 HistoryDaemon::HistoryDaemon(QObject *parent)
-    : QObject(parent), mCallObserver(this), mTextObserver(this)
+    : QObject(parent), mCallObserver(this), mTextObserver(this), mNextReader(0)
 {
     qRegisterMetaType<HandleRolesMap>();
     qDBusRegisterMetaType<HandleRolesMap>();
-    // get the first plugin
-    if (!History::PluginManager::instance()->plugins().isEmpty()) {
-        mBackend = History::PluginManager::instance()->plugins().first();
-    }
 
-    // FIXME: maybe we should only set the plugin as ready after the contact cache was generated
+    // the calls queued before the contact cache is ready are only answered after it gets generated
     connect(History::TelepathyHelper::instance(), &History::TelepathyHelper::setupReady, [&]() {
-        mBackend->generateContactCache();
+        mWorker.enqueue([this]() {
+            if (mBackend) {
+                mBackend->generateContactCache();
+            }
+        });
         mDBus.connectToBus();
     });
 
@@ -150,10 +177,74 @@ HistoryDaemon::HistoryDaemon(QObject *parent)
     // FIXME: we need to do this in a better way, but for now this should do
     mProtocolFlags["ofono"] = History::MatchPhoneNumber;
     mProtocolFlags["multimedia"] = History::MatchPhoneNumber;
+
+    mCheckpointTimer.setSingleShot(true);
+    mCheckpointTimer.setInterval(checkpointIdleInterval);
+    connect(&mCheckpointTimer, SIGNAL(timeout()), SLOT(onCheckpointTimeout()));
+
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, [this]() {
+        mWorker.enqueue([this]() {
+            if (mBackend) {
+                mBackend->checkpoint();
+                mBackend->saveContactCache();
+            }
+        });
+        // wait for the tasks queued so far, the cache save included
+        mWorker.stop();
+    });
+
+    // the plugin is loaded in the worker thread, as it can only be used from there
+    mWorker.start();
+    mWorker.enqueue([this]() {
+        // get the first plugin
+        if (!History::PluginManager::instance()->plugins().isEmpty()) {
+            mBackend = History::PluginManager::instance()->plugins().first();
+        }
+
+        // the contact matcher needs to live in this thread, as the readers forward their lookups to it
+        History::ContactMatcher::instance();
+
+        if (mBackend && mBackend->supportsConcurrentReads()) {
+            mWorker.post([this]() {
+                startReaders();
+            });
+        }
+    });
 }
 
 HistoryDaemon::~HistoryDaemon()
 {
+    Q_FOREACH(DatabaseWorker *reader, mReaders) {
+        reader->stop();
+    }
+    mWorker.stop();
+}
+
+DatabaseWorker *HistoryDaemon::worker()
+{
+    return &mWorker;
+}
+
+/// returns the worker where a new view should be created.
+/// Views are spread over the reader threads, so that several clients can page through them at the same time.
+DatabaseWorker *HistoryDaemon::viewWorker()
+{
+    if (mReaders.isEmpty()) {
+        return &mWorker;
+    }
+    mNextReader = (mNextReader + 1) % mReaders.count();
+    return mReaders[mNextReader];
+}
+
+void HistoryDaemon::startReaders()
+{
+    int count = qBound(1, QThread::idealThreadCount(), maxReaderThreads);
+    for (int i = 0; i < count; ++i) {
+        DatabaseWorker *reader = new DatabaseWorker(this);
+        reader->start();
+        mReaders << reader;
+    }
+    qDebug() << "Using" << count << "database reader threads";
 }
 
 HistoryDaemon *HistoryDaemon::instance()
@@ -162,6 +253,39 @@ HistoryDaemon *HistoryDaemon::instance()
     return self;
 }
 
+void HistoryDaemon::scheduleCheckpoint()
+{
+    // the writes happen in the worker thread, but the timer belongs to the main one
+    mWorker.post([this]() {
+        if (!mCheckpointPending.isValid()) {
+            mCheckpointPending.start();
+        } else if (mCheckpointPending.elapsed() >= checkpointMaxDelay) {
+            // writes kept coming for too long, don't let the journal grow any further
+            onCheckpointTimeout();
+            return;
+        }
+
+        // restart the timer so that the checkpoint doesn't happen in the middle of a burst of writes
+        mCheckpointTimer.start();
+    });
+}
+
+void HistoryDaemon::onCheckpointTimeout()
+{
+    mCheckpointTimer.stop();
+    mCheckpointPending.invalidate();
+    mWorker.enqueue([this]() {
+        if (!mBackend) {
+            return;
+        }
+        mBackend->checkpoint();
+        if (!mContactCacheSaved.isValid() || mContactCacheSaved.elapsed() >= contactCacheSaveInterval) {
+            mBackend->saveContactCache();
+            mContactCacheSaved.start();
+        }
+    });
+}
+
 void HistoryDaemon::onRolesChanged(const HandleRolesMap &added, const HandleRolesMap &removed)
 {
     ChannelInterfaceRolesInterface *roles_interface = qobject_cast<ChannelInterfaceRolesInterface*>(sender());
@@ -187,16 +311,25 @@ void HistoryDaemon::onRolesChanged(const HandleRolesMap &added, const HandleRole
         
     mRolesMap[channel->objectPath()] = rolesMap;
 
+    QString accountId = channel->property(History::FieldAccountId).toString();
+    QString threadId = channel->targetId();
     QVariantMap properties = propertiesFromChannel(channel);
-    QVariantMap thread = threadForProperties(channel->property(History::FieldAccountId).toString(),
-                                             History::EventTypeText,
-                                             properties,
-                                             matchFlagsForChannel(channel),
-                                             false);
-    if (!thread.isEmpty()) {
-        writeRolesInformationEvents(thread, channel, rolesMap);
-        updateRoomRoles(channel, rolesMap);
-    }
+    History::MatchFlags matchFlags = matchFlagsForChannel(channel);
+    QStringList adminIds = adminIdsFromChannel(channel, rolesMap);
+    uint selfRoles = rolesMap[channel->groupSelfContact()->handle().at(0)];
+    QVariantMap participantsRoles = participantsRolesFromChannel(channel, rolesMap);
+
+    mWorker.enqueue([=]() {
+        QVariantMap thread = threadForProperties(accountId,
+                                                 History::EventTypeText,
+                                                 properties,
+                                                 matchFlags,
+                                                 false);
+        if (!thread.isEmpty()) {
+            writeRolesInformationEvents(thread, adminIds, selfRoles);
+            updateRoomRoles(accountId, threadId, participantsRoles, selfRoles);
+        }
+    });
 }
 
 QVariantMap HistoryDaemon::propertiesFromChannel(const Tp::ChannelPtr &textChannel)
@@ -379,12 +512,17 @@ QString HistoryDaemon::queryThreads(int type, const QVariantMap &sort, const QVa
     History::Filter theFilter = History::Filter::fromProperties(filter);
     History::PluginThreadView *view = mBackend->queryThreads((History::EventType)type, theSort, theFilter, properties);
 
-    if (!view) {
+    // views with a filter the backend cannot handle are refused right away
+    if (!view || !view->IsValid()) {
+        delete view;
         return QString();
     }
 
+    // the clients subscribing to the view only get the changes matching it
+    view->setSubscriptionFilter((History::EventType)type, theFilter);
+
     // FIXME: maybe we should keep a list of views to manually remove them at some point?
-    view->setParent(this);
+    view->setParent(DatabaseWorker::current()->context());
     return view->objectPath();
 }
 
@@ -398,12 +536,17 @@ QString HistoryDaemon::queryEvents(int type, const QVariantMap &sort, const QVar
     History::Filter theFilter = History::Filter::fromProperties(filter);
     History::PluginEventView *view = mBackend->queryEvents((History::EventType)type, theSort, theFilter);
 
-    if (!view) {
+    // views with a filter the backend cannot handle are refused right away
+    if (!view || !view->IsValid()) {
+        delete view;
         return QString();
     }
 
+    // the clients subscribing to the view only get the changes matching it
+    view->setSubscriptionFilter((History::EventType)type, theFilter);
+
     // FIXME: maybe we should keep a list of views to manually remove them at some point?
-    view->setParent(this);
+    view->setParent(DatabaseWorker::current()->context());
     return view->objectPath();
 }
 
@@ -431,76 +574,193 @@ bool HistoryDaemon::writeEvents(const QList<QVariantMap> &events, const QVariant
         return false;
     }
 
-    QList<QVariantMap> newEvents;
-    QList<QVariantMap> modifiedEvents;
-    QMap<QString, QVariantMap> threads;
+    EventBatchWriter writer(mBackend.data());
+    if (!writer.write(events, properties)) {
+        return false;
+    }
+    scheduleCheckpoint();
 
-    mBackend->beginBatchOperation();
+    // and last but not least, notify the results
+    if (!writer.newEvents().isEmpty() && notify) {
+        mDBus.notifyEventsAdded(writer.newEvents());
+    }
+    if (!writer.modifiedEvents().isEmpty() && notify) {
+        mDBus.notifyEventsModified(writer.modifiedEvents());
+    }
+    if (!writer.threads().isEmpty() && notify) {
+        mDBus.notifyThreadsModified(writer.threads());
+    }
+    return true;
+}
 
-    Q_FOREACH(const QVariantMap &event, events) {
-        History::EventType type = (History::EventType) event[History::FieldType].toInt();
-        History::EventWriteResult result = History::EventWriteNone;
+/// imports the threads and events from the stream, committing them in chunks and updating the threads once at the end
+bool HistoryDaemon::importEvents(int fd)
+{
+    if (!mBackend) {
+        return false;
+    }
 
-        // get the threads for the events to notify their modifications
-        QString accountId = event[History::FieldAccountId].toString();
-        QString threadId = event[History::FieldThreadId].toString();
-        QVariantMap savedEvent = event;
+    QFile stream;
+    if (!stream.open(fd, QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open the import stream:" << stream.errorString();
+        return false;
+    }
 
-        // and finally write the event
-        switch (type) {
-        case History::EventTypeText:
-            result = mBackend->writeTextEvent(savedEvent);
-            break;
-        case History::EventTypeVoice:
-            result = mBackend->writeVoiceEvent(savedEvent);
-            break;
-        case History::EventTypeNull:
-            qWarning("HistoryDaemon::writeEvents: Got EventTypeNull, ignoring this event!");
-            continue;
-        }
+    // plugins not supporting it keep updating the threads on each event
+    bool deferred = mBackend->beginImport();
 
-        // only get the thread AFTER the event is written to make sure it is up-to-date
-        QVariantMap thread = getSingleThread(type, accountId, threadId, properties);
-        QString hash = hashThread(thread);
-        threads[hash] = thread;
+    // the threads might already exist with a different id, the events are moved to the existing ones
+    QMap<QString, QString> threadIds;
+    QList<QVariantMap> records;
+    bool success = true;
+    int pending = 0;
+    int imported = 0;
 
-        // set the participants field in the event
-        if (type == History::EventTypeVoice) {
-            savedEvent[History::FieldParticipants] = thread[History::FieldParticipants];
+    mBackend->beginBatchOperation();
+    while (success && History::RecordStream::readFrame(&stream, records, &success)) {
+        Q_FOREACH(const QVariantMap &record, records) {
+            if (!importRecord(record, threadIds)) {
+                success = false;
+                break;
+            }
+            imported++;
+            if (++pending == importChunkSize) {
+                mBackend->endBatchOperation();
+                mBackend->beginBatchOperation();
+                pending = 0;
+            }
         }
+    }
 
+    if (success) {
+        mBackend->endBatchOperation();
+    } else {
+        // only the last chunk is lost, the ones before it are already committed
+        qWarning() << "Import failed after" << imported << "records";
+        mBackend->rollbackBatchOperation();
+    }
 
-        // check if the event was a new one or a modification to an existing one
-        switch (result) {
-        case History::EventWriteCreated:
-            newEvents << savedEvent;
-            break;
-        case History::EventWriteModified:
-            modifiedEvents << savedEvent;
-            break;
-        case History::EventWriteError:
-            mBackend->rollbackBatchOperation();
+    if (deferred) {
+        mBackend->endImport();
+    }
+    scheduleCheckpoint();
+
+    // a single notification instead of one per record
+    mDBus.notifyHistoryReset();
+    return success;
+}
+
+bool HistoryDaemon::importRecord(const QVariantMap &record, QMap<QString, QString> &threadIds)
+{
+    History::EventType type = (History::EventType) record[History::FieldType].toInt();
+    QString accountId = record[History::FieldAccountId].toString();
+    QString threadKey = hashThread(record);
+
+    if (History::RecordStream::isThread(record)) {
+        QVariantMap properties = record;
+        properties[History::FieldParticipantIds] = record[History::FieldParticipants];
+        QVariantMap thread = mBackend->threadForProperties(accountId, type, properties);
+        if (thread.isEmpty()) {
+            thread = mBackend->createThreadForProperties(accountId, type, properties);
+        }
+        if (thread.isEmpty()) {
+            qWarning() << "Failed to import thread" << threadKey;
             return false;
-        case History::EventWriteNone:
-            break;
         }
+        threadIds[threadKey] = thread[History::FieldThreadId].toString();
+        return true;
     }
 
-    mBackend->endBatchOperation();
+    QVariantMap event = record;
+    if (threadIds.contains(threadKey)) {
+        event[History::FieldThreadId] = threadIds[threadKey];
+    }
 
-    // and last but not least, notify the results
-    if (!newEvents.isEmpty() && notify) {
-        mDBus.notifyEventsAdded(newEvents);
+    History::EventWriteResult result = History::EventWriteError;
+    switch (type) {
+    case History::EventTypeText: {
+        // the stream decodes the attachments as a plain list
+        QList<QVariantMap> attachments;
+        Q_FOREACH(const QVariant &attachment, record[History::FieldAttachments].toList()) {
+            QVariantMap properties = attachment.toMap();
+            properties[History::FieldThreadId] = event[History::FieldThreadId];
+            attachments << properties;
+        }
+        event[History::FieldAttachments] = QVariant::fromValue(attachments);
+        result = mBackend->writeTextEvent(event);
+        break;
     }
-    if (!modifiedEvents.isEmpty() && notify) {
-        mDBus.notifyEventsModified(modifiedEvents);
+    case History::EventTypeVoice:
+        result = mBackend->writeVoiceEvent(event);
+        break;
+    case History::EventTypeNull:
+        break;
     }
-    if (!threads.isEmpty() && notify) {
-        mDBus.notifyThreadsModified(threads.values());
+
+    if (result == History::EventWriteError) {
+        qWarning() << "Failed to import event" << event[History::FieldEventId].toString() << "in thread" << threadKey;
+        return false;
     }
     return true;
 }
 
+/// writes all the threads, and then all the events, to the stream
+bool HistoryDaemon::exportEvents(int fd)
+{
+    if (!mBackend) {
+        return false;
+    }
+
+    QFile stream;
+    if (!stream.open(fd, QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open the export stream:" << stream.errorString();
+        return false;
+    }
+
+    QList<History::EventType> types;
+    types << History::EventTypeText << History::EventTypeVoice;
+
+    Q_FOREACH(History::EventType type, types) {
+        History::PluginThreadView *view = mBackend->queryThreads(type);
+        if (!view) {
+            return false;
+        }
+        view->SetPageSize(History::RecordStream::FrameSize);
+        QList<QVariantMap> threads;
+        bool success = true;
+        while (success && !(threads = view->NextPage()).isEmpty()) {
+            QList<QVariantMap> records;
+            Q_FOREACH(const QVariantMap &thread, threads) {
+                records << History::RecordStream::threadRecord(thread);
+            }
+            success = History::RecordStream::writeFrame(&stream, records);
+        }
+        delete view;
+        if (!success) {
+            return false;
+        }
+    }
+
+    Q_FOREACH(History::EventType type, types) {
+        History::PluginEventView *view = mBackend->queryEvents(type, History::Sort(History::FieldTimestamp, Qt::AscendingOrder));
+        if (!view) {
+            return false;
+        }
+        view->SetPageSize(History::RecordStream::FrameSize);
+        QList<QVariantMap> events;
+        bool success = true;
+        while (success && !(events = view->NextPage()).isEmpty()) {
+            success = History::RecordStream::writeFrame(&stream, events);
+        }
+        delete view;
+        if (!success) {
+            return false;
+        }
+    }
+
+    return stream.flush();
+}
+
 bool HistoryDaemon::removeEvents(const QList<QVariantMap> &events)
 {
     if (!mBackend) {
@@ -566,6 +826,7 @@ bool HistoryDaemon::removeEvents(const QList<QVariantMap> &events)
     }
 
     mBackend->endBatchOperation();
+    scheduleCheckpoint();
 
     mDBus.notifyEventsRemoved(events);
     if (!removedThreads.isEmpty()) {
@@ -594,6 +855,7 @@ void HistoryDaemon::markThreadsAsRead(const QList<QVariantMap> &threads)
 
         mBackend->endBatchOperation();
     }
+    scheduleCheckpoint();
 
     if (!modifiedThreads.isEmpty()) {
         mDBus.notifyThreadsModified(modifiedThreads);
@@ -615,6 +877,7 @@ bool HistoryDaemon::removeThreads(const QList<QVariantMap> &threads)
         }
     }
     mBackend->endBatchOperation();
+    scheduleCheckpoint();
     mDBus.notifyThreadsRemoved(threads);
     return true;
 }
@@ -648,11 +911,8 @@ void HistoryDaemon::onCallEnded(const Tp::CallChannelPtr &channel, bool missed)
     }
 
     QString accountId = channel->property(History::FieldAccountId).toString();
-    QVariantMap thread = threadForProperties(accountId,
-                                             History::EventTypeVoice,
-                                             properties,
-                                             matchFlagsForChannel(channel),
-                                             true);
+    History::MatchFlags matchFlags = matchFlagsForChannel(channel);
+
     // fill the call info
     QDateTime timestamp = channel->property(History::FieldTimestamp).toDateTime();
 
@@ -664,42 +924,56 @@ void HistoryDaemon::onCallEnded(const Tp::CallChannelPtr &channel, bool missed)
         QDateTime activeTime = channel->property("activeTimestamp").toDateTime();
         duration = activeTime.secsTo(QDateTime::currentDateTime());
     }
+    QString senderId = incoming ? channel->initiatorContact()->id() : "self";
 
-    QString eventId = QString("%1:%2").arg(thread[History::FieldThreadId].toString()).arg(timestamp.toString());
-    QVariantMap event;
-    event[History::FieldType] = History::EventTypeVoice;
-    event[History::FieldAccountId] = thread[History::FieldAccountId];
-    event[History::FieldThreadId] = thread[History::FieldThreadId];
-    event[History::FieldEventId] = eventId;
-    event[History::FieldSenderId] = incoming ? channel->initiatorContact()->id() : "self";
-    event[History::FieldTimestamp] = timestamp.toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldNewEvent] = missed; // only mark as a new (unseen) event if it is a missed call
-    event[History::FieldMissed] = missed;
-    event[History::FieldDuration] = duration;
-    // FIXME: check what to do when there are more than just one remote participant
-    event[History::FieldRemoteParticipant] = participants[0].toMap()[History::FieldIdentifier];
-    writeEvents(QList<QVariantMap>() << event, properties);
+    mWorker.enqueue([=]() {
+        QVariantMap thread = threadForProperties(accountId,
+                                                 History::EventTypeVoice,
+                                                 properties,
+                                                 matchFlags,
+                                                 true);
+
+        QString eventId = QString("%1:%2").arg(thread[History::FieldThreadId].toString()).arg(timestamp.toString());
+        QVariantMap event;
+        event[History::FieldType] = History::EventTypeVoice;
+        event[History::FieldAccountId] = thread[History::FieldAccountId];
+        event[History::FieldThreadId] = thread[History::FieldThreadId];
+        event[History::FieldEventId] = eventId;
+        event[History::FieldSenderId] = senderId;
+        event[History::FieldTimestamp] = timestamp.toString("yyyy-MM-ddTHH:mm:ss.zzz");
+        event[History::FieldNewEvent] = missed; // only mark as a new (unseen) event if it is a missed call
+        event[History::FieldMissed] = missed;
+        event[History::FieldDuration] = duration;
+        // FIXME: check what to do when there are more than just one remote participant
+        event[History::FieldRemoteParticipant] = participants[0].toMap()[History::FieldIdentifier];
+        writeEvents(QList<QVariantMap>() << event, properties);
+    });
 }
 
 void HistoryDaemon::onTextChannelInvalidated(const Tp::TextChannelPtr channel)
 {
     mRolesMap.remove(channel->objectPath());
     QString accountId = channel->property(History::FieldAccountId).toString();
+    QString threadId = channel->targetId();
     QVariantMap properties = propertiesFromChannel(channel);
+    History::MatchFlags matchFlags = matchFlagsForChannel(channel);
+    bool isPhone = History::TelepathyHelper::instance()->accountForId(accountId)->protocolName() == "ofono";
 
-    // first try to fetch the existing thread to see if there is any.
-    QVariantMap thread = threadForProperties(accountId,
-                                             History::EventTypeText,
-                                             properties,
-                                             matchFlagsForChannel(channel),
-                                             false);
+    mWorker.enqueue([=]() {
+        // first try to fetch the existing thread to see if there is any.
+        QVariantMap thread = threadForProperties(accountId,
+                                                 History::EventTypeText,
+                                                 properties,
+                                                 matchFlags,
+                                                 false);
 
-    QVariantMap roomInfo = thread[History::FieldChatRoomInfo].toMap();
-    if ((roomInfo.contains("Persistent") && !roomInfo["Persistent"].toBool()) && History::TelepathyHelper::instance()->accountForId(accountId)->protocolName() != "ofono") {
-        writeInformationEvent(thread, History::InformationTypeSelfLeaving);
-        // update backend
-        updateRoomProperties(channel, QVariantMap{{"Joined", false}});
-    }
+        QVariantMap roomInfo = thread[History::FieldChatRoomInfo].toMap();
+        if ((roomInfo.contains("Persistent") && !roomInfo["Persistent"].toBool()) && !isPhone) {
+            writeInformationEvent(thread, History::InformationTypeSelfLeaving);
+            // update backend
+            updateRoomProperties(accountId, threadId, History::EventTypeText, QVariantMap{{"Joined", false}}, QStringList());
+        }
+    });
 
     channel->disconnect(this);
 }
@@ -709,34 +983,56 @@ void HistoryDaemon::onTextChannelAvailable(const Tp::TextChannelPtr channel)
     // for Rooms we need to explicitly create the thread to allow users to send messages to groups even
     // before they receive any message.
     // for other types, we can wait until messages are received
-    bool notify = false;
-    if (channel->targetHandleType() == Tp::HandleTypeRoom) {
-        QString accountId = channel->property(History::FieldAccountId).toString();
-        QVariantMap properties = propertiesFromChannel(channel);
+    if (channel->targetHandleType() != Tp::HandleTypeRoom) {
+        return;
+    }
+
+    QString accountId = channel->property(History::FieldAccountId).toString();
+    QString threadId = channel->targetId();
+    QVariantMap properties = propertiesFromChannel(channel);
+    History::MatchFlags matchFlags = matchFlagsForChannel(channel);
+    bool requested = channel->isRequested();
+    bool isPhone = History::TelepathyHelper::instance()->accountForId(accountId)->protocolName() == "ofono";
+    QVariantList participants = participantsFromChannel(channel);
+    QStringList invitees;
+    Q_FOREACH(const Tp::ContactPtr contact, channel->groupRemotePendingContacts(false)) {
+        invitees << contact->alias();
+    }
+
+    // the membership and roles changes are queued after this one, so they always find the thread
+    connect(channel.data(), SIGNAL(groupMembersChanged(const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Channel::GroupMemberChangeDetails &)),
+            SLOT(onGroupMembersChanged(const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Channel::GroupMemberChangeDetails &)));
+
+    ChannelInterfaceRolesInterface *roles_interface = channel->optionalInterface<ChannelInterfaceRolesInterface>();
+    connect(roles_interface, SIGNAL(RolesChanged(const HandleRolesMap&, const HandleRolesMap&)), SLOT(onRolesChanged(const HandleRolesMap&, const HandleRolesMap&)));
+
+    mWorker.enqueue([=]() {
+        bool notify = false;
 
         // first try to fetch the existing thread to see if there is any.
         QVariantMap thread = threadForProperties(accountId,
                                                  History::EventTypeText,
                                                  properties,
-                                                 matchFlagsForChannel(channel),
+                                                 matchFlags,
                                                  false);
         if (thread.isEmpty()) {
             // if there no existing thread, create one
-            properties["Requested"] = channel->isRequested();
+            QVariantMap newProperties = properties;
+            newProperties["Requested"] = requested;
             thread = threadForProperties(accountId,
                                          History::EventTypeText,
-                                         properties,
-                                         matchFlagsForChannel(channel),
+                                         newProperties,
+                                         matchFlags,
                                          true);
 
             // write information event including all initial invitees
-            Q_FOREACH(const Tp::ContactPtr contact, channel->groupRemotePendingContacts(false)) {
-                writeInformationEvent(thread, History::InformationTypeInvitationSent, contact->alias(), QString(), QString(), false);
+            Q_FOREACH(const QString &alias, invitees) {
+                writeInformationEvent(thread, History::InformationTypeInvitationSent, alias, QString(), QString(), false);
             }
 
             // update participants only if the thread is not available previously. Otherwise we'll wait for membersChanged event
             // for reflect in conversation information events for modified participants.
-            updateRoomParticipants(channel, false);
+            updateRoomParticipants(accountId, threadId, participants, false);
             notify = true;
         }
 
@@ -744,43 +1040,43 @@ void HistoryDaemon::onTextChannelAvailable(const Tp::TextChannelPtr channel)
         if (!thread[History::FieldChatRoomInfo].toMap()["Joined"].toBool()) {
             // only write self joined notification if protocol is not a phone one.
             // FIXME (rmescandon): as a first solution, let's take only ofono as phone protocol
-            if (History::TelepathyHelper::instance()->accountForId(accountId)->protocolName() != "ofono") {
+            if (!isPhone) {
                 writeInformationEvent(thread, History::InformationTypeSelfJoined);
             }
             // update backend
-            updateRoomProperties(channel, QVariantMap{{"Joined", true}}, false);
+            updateRoomProperties(accountId, threadId, History::EventTypeText, QVariantMap{{"Joined", true}}, QStringList(), false);
             notify = true;
         }
 
-        Tp::AbstractInterface *room_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceRoomInterface>();
-        Tp::AbstractInterface *room_config_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceRoomConfigInterface>();
-        Tp::AbstractInterface *subject_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceSubjectInterface>();
-        ChannelInterfaceRolesInterface *roles_interface = channel->optionalInterface<ChannelInterfaceRolesInterface>();
-
-        QList<Tp::AbstractInterface*> interfaces;
-        interfaces << room_interface << room_config_interface << subject_interface << roles_interface;
-        for (auto interface : interfaces) {
-            if (interface) {
-                interface->setMonitorProperties(true);
-                interface->setProperty(History::FieldAccountId, accountId);
-                interface->setProperty(History::FieldThreadId, thread[History::FieldThreadId].toString());
-                interface->setProperty(History::FieldType, thread[History::FieldType].toInt());
-                connect(interface, SIGNAL(propertiesChanged(const QVariantMap &,const QStringList &)),
-                                   SLOT(onRoomPropertiesChanged(const QVariantMap &,const QStringList &)));
-                // update the stored info
-                Q_EMIT interface->propertiesChanged(getInterfaceProperties(interface), QStringList());
-            }
+        if (notify) {
+            updateRoomParticipants(accountId, threadId, participants, true);
         }
 
-        connect(channel.data(), SIGNAL(groupMembersChanged(const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Channel::GroupMemberChangeDetails &)),
-                SLOT(onGroupMembersChanged(const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Contacts &, const Tp::Channel::GroupMemberChangeDetails &)));
-
-        connect(roles_interface, SIGNAL(RolesChanged(const HandleRolesMap&, const HandleRolesMap&)), SLOT(onRolesChanged(const HandleRolesMap&, const HandleRolesMap&)));
-    }
-
-    if (notify) {
-        updateRoomParticipants(channel, true);
-    }
+        // now that the thread is known, start monitoring the room properties
+        QString storedThreadId = thread[History::FieldThreadId].toString();
+        int type = thread[History::FieldType].toInt();
+        mWorker.post([=]() {
+            Tp::AbstractInterface *room_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceRoomInterface>();
+            Tp::AbstractInterface *room_config_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceRoomConfigInterface>();
+            Tp::AbstractInterface *subject_interface = channel->optionalInterface<Tp::Client::ChannelInterfaceSubjectInterface>();
+            ChannelInterfaceRolesInterface *roles_interface = channel->optionalInterface<ChannelInterfaceRolesInterface>();
+
+            QList<Tp::AbstractInterface*> interfaces;
+            interfaces << room_interface << room_config_interface << subject_interface << roles_interface;
+            for (auto interface : interfaces) {
+                if (interface) {
+                    interface->setMonitorProperties(true);
+                    interface->setProperty(History::FieldAccountId, accountId);
+                    interface->setProperty(History::FieldThreadId, storedThreadId);
+                    interface->setProperty(History::FieldType, type);
+                    connect(interface, SIGNAL(propertiesChanged(const QVariantMap &,const QStringList &)),
+                                       SLOT(onRoomPropertiesChanged(const QVariantMap &,const QStringList &)));
+                    // update the stored info
+                    Q_EMIT interface->propertiesChanged(getInterfaceProperties(interface), QStringList());
+                }
+            }
+        });
+    });
 }
 
 void HistoryDaemon::onGroupMembersChanged(const Tp::Contacts &groupMembersAdded,
@@ -791,9 +1087,6 @@ void HistoryDaemon::onGroupMembersChanged(const Tp::Contacts &groupMembersAdded,
 {
     Tp::TextChannelPtr channel(qobject_cast<Tp::TextChannel*>(sender()));
 
-    QVariantMap properties;
-    QVariantMap thread;
-
     // information events for members updates.
     bool hasRemotePendingMembersAdded = groupRemotePendingMembersAdded.size() > 0;
     bool hasMembersAdded = groupMembersAdded.size() > 0;
@@ -801,99 +1094,114 @@ void HistoryDaemon::onGroupMembersChanged(const Tp::Contacts &groupMembersAdded,
     Tp::ContactPtr selfContact = channel->connection()->selfContact();
     bool selfContactIsPending = channel->groupRemotePendingContacts(true).contains(selfContact);
 
+    QString accountId = channel->property(History::FieldAccountId).toString();
+    QString threadId = channel->targetId();
+    QString selfId = channel->groupSelfContact()->id();
+    QVariantList participants = participantsFromChannel(channel);
+    QVariantMap properties;
+    History::MatchFlags matchFlags = matchFlagsForChannel(channel);
+
+    QList<QVariantMap> remotePendingAdded;
+    QList<QVariantMap> membersAdded;
+    QList<QVariantMap> membersRemoved;
+    bool selfRemoved = false;
+    History::InformationType selfRemovedType = History::InformationTypeSelfLeaving;
+
     if (hasRemotePendingMembersAdded || hasMembersAdded || hasMembersRemoved) {
         properties = propertiesFromChannel(channel);
-        thread = threadForProperties(channel->property(History::FieldAccountId).toString(),
-                                                       History::EventTypeText,
-                                                       properties,
-                                                       matchFlagsForChannel(channel),
-                                                       false);
-        if (!thread.isEmpty() && !selfContactIsPending) {
-            QList<QVariantMap> added;
-            QList<QVariantMap> removed;
-            QList<QVariantMap> modified;
-            if (hasRemotePendingMembersAdded) {
-                Q_FOREACH (const Tp::ContactPtr& contact, groupRemotePendingMembersAdded) {
-                    if (!foundInThread(contact, thread)) {
-                        writeInformationEvent(thread, History::InformationTypeInvitationSent, contact->alias(), QString(), QString(), true);
-                        QVariantMap participant;
-                        participant[History::FieldIdentifier] = contact->id();
-                        participant[History::FieldAlias] = contact->alias();
+        Q_FOREACH (const Tp::ContactPtr& contact, groupRemotePendingMembersAdded) {
+            remotePendingAdded << contactToMap(contact);
+        }
+        Q_FOREACH (const Tp::ContactPtr& contact, groupMembersAdded) {
+            membersAdded << contactToMap(contact);
+        }
+        Q_FOREACH (const Tp::ContactPtr& contact, groupMembersRemoved) {
+            membersRemoved << contactToMap(contact);
+        }
+
+        if (hasMembersRemoved && channel->groupSelfContactRemoveInfo().isValid()) {
+            selfRemoved = true;
+            // evaluate if we are leaving by our own or we are kicked
+            if (channel->groupSelfContactRemoveInfo().hasReason()) {
+                switch (channel->groupSelfContactRemoveInfo().reason()) {
+                case ChannelGroupChangeReasonKicked:
+                    selfRemovedType = History::InformationTypeSelfKicked;
+                    break;
+// As ChannelGroupChangeReasonGone is not in telepathy, we need to ignore the warning
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch"
+                case ChannelGroupChangeReasonGone:
+                    selfRemovedType = History::InformationTypeGroupGone;
+                    break;
+#pragma GCC diagnostic pop
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    mWorker.enqueue([=]() {
+        if (hasRemotePendingMembersAdded || hasMembersAdded || hasMembersRemoved) {
+            QVariantMap thread = threadForProperties(accountId,
+                                                     History::EventTypeText,
+                                                     properties,
+                                                     matchFlags,
+                                                     false);
+            if (!thread.isEmpty() && !selfContactIsPending) {
+                QList<QVariantMap> added;
+                QList<QVariantMap> removed;
+                QList<QVariantMap> modified;
+                Q_FOREACH (const QVariantMap &contact, remotePendingAdded) {
+                    QString contactId = contact[History::FieldIdentifier].toString();
+                    if (!foundInThread(contactId, thread)) {
+                        writeInformationEvent(thread, History::InformationTypeInvitationSent, contact[History::FieldAlias].toString(), QString(), QString(), true);
+                        QVariantMap participant = contact;
                         participant[History::FieldParticipantState] = History::ParticipantStateRemotePending;
                         added << participant;
                     }
                 }
 
-            }
-            if (hasMembersAdded) {
-                Q_FOREACH (const Tp::ContactPtr& contact, groupMembersAdded) {
+                Q_FOREACH (const QVariantMap &contact, membersAdded) {
                     // if this member was not previously regular member in thread, notify about his join
-                    if (!foundAsMemberInThread(contact, thread) && contact->id() != channel->groupSelfContact()->id()) {
+                    QString contactId = contact[History::FieldIdentifier].toString();
+                    if (!foundAsMemberInThread(contactId, thread) && contactId != selfId) {
 
-                        writeInformationEvent(thread, History::InformationTypeJoined, contact->alias(), QString(), QString(), true);
+                        writeInformationEvent(thread, History::InformationTypeJoined, contact[History::FieldAlias].toString(), QString(), QString(), true);
 
-                        QVariantMap participant;
-                        participant[History::FieldIdentifier] = contact->id();
-                        participant[History::FieldAlias] = contact->alias();
+                        QVariantMap participant = contact;
                         participant[History::FieldParticipantState] = History::ParticipantStateRegular;
                         added << participant;
                     }
                 }
-            }
 
-            if (hasMembersRemoved) {
-                if (channel->groupSelfContactRemoveInfo().isValid()) {
-                    // evaluate if we are leaving by our own or we are kicked
-                    History::InformationType type = History::InformationTypeSelfLeaving;
-                    if (channel->groupSelfContactRemoveInfo().hasReason()) {
-                        switch (channel->groupSelfContactRemoveInfo().reason()) {
-                        case ChannelGroupChangeReasonKicked:
-                            type = History::InformationTypeSelfKicked;
-                            break;
-// As ChannelGroupChangeReasonGone is not in telepathy, we need to ignore the warning
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wswitch"
-                        case ChannelGroupChangeReasonGone:
-                            type = History::InformationTypeGroupGone;
-                            break;
-#pragma GCC diagnostic pop
-                        default:
-                            break;
-                        }
-                    }
+                if (selfRemoved) {
                     if (thread[History::FieldChatRoomInfo].toMap()["Joined"].toBool()) {
-                        writeInformationEvent(thread, type);
+                        writeInformationEvent(thread, selfRemovedType);
                         // update backend
-                        updateRoomProperties(channel, QVariantMap{{"Joined", false}}, true);
+                        updateRoomProperties(accountId, threadId, History::EventTypeText, QVariantMap{{"Joined", false}}, QStringList(), true);
                     }
                 }
                 else // don't notify any other group member removal if we are leaving the group
                 {
-                    Q_FOREACH (const Tp::ContactPtr& contact, groupMembersRemoved) {
+                    Q_FOREACH (const QVariantMap &contact, membersRemoved) {
                         // inform about removed members other than us
-                        if (contact->id() != channel->groupSelfContact()->id()) {
-                            writeInformationEvent(thread, History::InformationTypeLeaving, contact->alias(), QString(), QString(), true);
+                        if (contact[History::FieldIdentifier].toString() != selfId) {
+                            writeInformationEvent(thread, History::InformationTypeLeaving, contact[History::FieldAlias].toString(), QString(), QString(), true);
                         }
-                        QVariantMap participant;
-                        participant[History::FieldIdentifier] = contact->id();
-                        participant[History::FieldAlias] = contact->alias();
-                        removed << participant;
+                        removed << contact;
                     }
                 }
+                mDBus.notifyThreadParticipantsChanged(thread, added, removed, QList<QVariantMap>());
             }
-            mDBus.notifyThreadParticipantsChanged(thread, added, removed, QList<QVariantMap>());
         }
-    }
 
-    updateRoomParticipants(channel, !selfContactIsPending);
+        updateRoomParticipants(accountId, threadId, participants, !selfContactIsPending);
+    });
 }
 
-void HistoryDaemon::updateRoomParticipants(const Tp::TextChannelPtr channel, bool notify)
+QVariantList HistoryDaemon::participantsFromChannel(const Tp::TextChannelPtr &channel)
 {
-    if (!channel) {
-        return;
-    }
-
     QVariantList participants;
     QStringList contactsAdded;
 
@@ -941,9 +1249,13 @@ void HistoryDaemon::updateRoomParticipants(const Tp::TextChannelPtr channel, boo
         participants << QVariant::fromValue(participant);
     }
 
-    QString accountId = channel->property(History::FieldAccountId).toString();
-    QString threadId = channel->targetId();
+    return participants;
+}
+
+void HistoryDaemon::updateRoomParticipants(const QString &accountId, const QString &threadId, const QVariantList &participants, bool notify)
+{
     if (mBackend->updateRoomParticipants(accountId, threadId, History::EventTypeText, participants)) {
+        scheduleCheckpoint();
         if (notify) {
             QVariantMap updatedThread = getSingleThread(History::EventTypeText, accountId, threadId, QVariantMap());
             mDBus.notifyThreadsModified(QList<QVariantMap>() << updatedThread);
@@ -951,12 +1263,8 @@ void HistoryDaemon::updateRoomParticipants(const Tp::TextChannelPtr channel, boo
     }
 }
 
-void HistoryDaemon::updateRoomRoles(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap, bool notify)
+QVariantMap HistoryDaemon::participantsRolesFromChannel(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap)
 {
-    if (!channel) {
-        return;
-    }
-
     QVariantMap participantsRoles;
 
     Q_FOREACH(const Tp::ContactPtr contact, channel->groupRemotePendingContacts(false)) {
@@ -972,10 +1280,14 @@ void HistoryDaemon::updateRoomRoles(const Tp::TextChannelPtr &channel, const Rol
         }
     }
 
+    return participantsRoles;
+}
+
+void HistoryDaemon::updateRoomRoles(const QString &accountId, const QString &threadId, const QVariantMap &participantsRoles, uint selfRoles, bool notify)
+{
     // update participants roles
-    QString accountId = channel->property(History::FieldAccountId).toString();
-    QString threadId = channel->targetId();
     if (mBackend->updateRoomParticipantsRoles(accountId, threadId, History::EventTypeText, participantsRoles)) {
+        scheduleCheckpoint();
         if (notify) {
             QVariantMap updatedThread = getSingleThread(History::EventTypeText, accountId, threadId, QVariantMap());
             mDBus.notifyThreadsModified(QList<QVariantMap>() << updatedThread);
@@ -983,8 +1295,7 @@ void HistoryDaemon::updateRoomRoles(const Tp::TextChannelPtr &channel, const Rol
     }
 
     // update self roles in room properties
-    uint selfRoles = rolesMap[channel->groupSelfContact()->handle().at(0)];
-    updateRoomProperties(channel, QVariantMap{{"SelfRoles", selfRoles}});
+    updateRoomProperties(accountId, threadId, History::EventTypeText, QVariantMap{{"SelfRoles", selfRoles}}, QStringList());
 }
 
 void HistoryDaemon::onRoomPropertiesChanged(const QVariantMap &properties,const QStringList &invalidated)
@@ -993,26 +1304,21 @@ void HistoryDaemon::onRoomPropertiesChanged(const QVariantMap &properties,const
     QString threadId = sender()->property(History::FieldThreadId).toString();
     History::EventType type = (History::EventType)sender()->property(History::FieldType).toInt();
 
-    // get thread before updating to see if there are changes to insert as information events
-    QVariantMap thread = getSingleThread(type, accountId, threadId, QVariantMap());
-    if (!thread.empty()) {
-        writeRoomChangesInformationEvents(thread, properties);
-    }
-
-    updateRoomProperties(accountId, threadId, type, properties, invalidated);
-}
+    mWorker.enqueue([=]() {
+        // get thread before updating to see if there are changes to insert as information events
+        QVariantMap thread = getSingleThread(type, accountId, threadId, QVariantMap());
+        if (!thread.empty()) {
+            writeRoomChangesInformationEvents(thread, properties);
+        }
 
-void HistoryDaemon::updateRoomProperties(const Tp::TextChannelPtr &channel, const QVariantMap &properties, bool notify)
-{
-    QString accountId = channel->property(History::FieldAccountId).toString();
-    QString threadId = channel->targetId();
-    History::EventType type = History::EventTypeText;
-    updateRoomProperties(accountId, threadId, type, properties, QStringList(), notify);
+        updateRoomProperties(accountId, threadId, type, properties, invalidated);
+    });
 }
 
 void HistoryDaemon::updateRoomProperties(const QString &accountId, const QString &threadId, History::EventType type, const QVariantMap &properties, const QStringList &invalidated, bool notify)
 {
     if (mBackend->updateRoomInfo(accountId, threadId, type, properties, invalidated)) {
+        scheduleCheckpoint();
         if (notify) {
             QVariantMap thread = getSingleThread(type, accountId, threadId, QVariantMap());
             mDBus.notifyThreadsModified(QList<QVariantMap>() << thread);
@@ -1022,20 +1328,19 @@ void HistoryDaemon::updateRoomProperties(const QString &accountId, const QString
 
 void HistoryDaemon::onMessageReceived(const Tp::TextChannelPtr textChannel, const Tp::ReceivedMessage &message)
 {
+    // ignore delivery reports for now.
+    // FIXME: maybe we should set the readTimestamp when a delivery report is received
+    if (message.isRescued()) {
+        return;
+    }
+
     QString eventId;
     QString senderId;
 
     QString accountId = textChannel->property(History::FieldAccountId).toString();
-    QString threadId = textChannel->property(History::FieldThreadId).toString();
+    QString channelThreadId = textChannel->property(History::FieldThreadId).toString();
     QVariantMap properties = propertiesFromChannel(textChannel);
-
-    if (threadId.isNull()) {
-        threadId = threadIdForProperties(accountId,
-                                         History::EventTypeText,
-                                         properties,
-                                         matchFlagsForChannel(textChannel),
-                                         true);
-    }
+    History::MatchFlags matchFlags = matchFlagsForChannel(textChannel);
 
     History::MessageStatus status = History::MessageStatusUnknown;
     if (!message.sender() || message.sender()->handle().at(0) == textChannel->connection()->selfHandle()) {
@@ -1049,222 +1354,185 @@ void HistoryDaemon::onMessageReceived(const Tp::TextChannelPtr textChannel, cons
     } else {
         eventId = message.messageToken();
     }
- 
-    // ignore delivery reports for now.
-    // FIXME: maybe we should set the readTimestamp when a delivery report is received
-    if (message.isRescued()) {
-        return;
-    }
 
-    if (message.isDeliveryReport() && message.deliveryDetails().hasOriginalToken()) {
-        // at this point we assume the delivery report is for a message that was already
-        // sent and properly saved at our database, so we can safely get it here to update
-        QVariantMap textEvent = getSingleEvent(History::EventTypeText, accountId, threadId, message.deliveryDetails().originalToken());
-        if (textEvent.isEmpty()) {
-            qWarning() << "Cound not find the original event to update with delivery details.";
-            return;
-        }
+    bool isDeliveryReport = message.isDeliveryReport() && message.deliveryDetails().hasOriginalToken();
+    QString originalToken = isDeliveryReport ? message.deliveryDetails().originalToken() : QString();
+    Tp::DeliveryStatus deliveryStatus = isDeliveryReport ? message.deliveryDetails().status() : Tp::DeliveryStatusUnknown;
 
-        // FIXME: if this message is already read, don't allow reverting the status.
-        // we need to check if this is the right place to do it.
-        if (textEvent[History::FieldMessageStatus].toInt() == History::MessageStatusRead) {
-            qWarning() << "Skipping delivery report as it is trying to revert the Read status of an existing message to the following status:" << message.deliveryDetails().status();
-            return;
-        }
+    History::MessageType type = message.hasNonTextContent() ? History::MessageTypeMultiPart : History::MessageTypeText;
+    QString subject = message.hasNonTextContent() ? message.header()["subject"].variant().toString() : QString();
+    Tp::MessagePartList parts = message.parts();
+    QString text = message.text();
+    QString received = message.received().toString("yyyy-MM-ddTHH:mm:ss.zzz");
+    QString sent = message.sent().toString("yyyy-MM-ddTHH:mm:ss.zzz");
+    QString supersededToken = message.supersededToken();
+    QString readTimestamp = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
 
-        textEvent[History::FieldMessageStatus] = (int) fromTelepathyDeliveryStatus(message.deliveryDetails().status());
-        if (!writeEvents(QList<QVariantMap>() << textEvent, properties)) {
-            qWarning() << "Failed to save the new message status!";
-        }
-
-        return;
-    }
-    int count = 1;
-    QList<QVariantMap> attachments;
-    History::MessageType type = History::MessageTypeText;
-    QString subject;
-
-    if (message.hasNonTextContent()) {
-        QString normalizedAccountId = QString(QCryptographicHash::hash(accountId.toLatin1(), QCryptographicHash::Md5).toHex());
-        QString normalizedThreadId = QString(QCryptographicHash::hash(threadId.toLatin1(), QCryptographicHash::Md5).toHex());
-        QString normalizedEventId = QString(QCryptographicHash::hash(eventId.toLatin1(), QCryptographicHash::Md5).toHex());
-        QString mmsStoragePath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-
-        type = History::MessageTypeMultiPart;
-        subject = message.header()["subject"].variant().toString();
-
-        QDir dir(mmsStoragePath);
-        if (!dir.exists("history-service") && !dir.mkpath("history-service")) {
-            qDebug() << "Failed to create dir";
-            return;
+    mWorker.enqueue([=]() {
+        QString threadId = channelThreadId;
+        if (threadId.isNull()) {
+            threadId = threadIdForProperties(accountId,
+                                             History::EventTypeText,
+                                             properties,
+                                             matchFlags,
+                                             true);
         }
-        dir.cd("history-service");
 
-        Q_FOREACH(const Tp::MessagePart &part, message.parts()) {
-            // ignore the header part
-            if (part["content-type"].variant().toString().isEmpty()) {
-                continue;
-            }
-            mmsStoragePath = dir.absoluteFilePath(QString("attachments/%1/%2/%3/").
-                                                  arg(normalizedAccountId,
-                                                      normalizedThreadId,
-                                                      normalizedEventId));
-
-            QFile file(mmsStoragePath+QString::number(count++));
-            if (!dir.mkpath(mmsStoragePath) || !file.open(QIODevice::WriteOnly)) {
-                qWarning() << "Failed to save attachment";
-                continue;
+        if (isDeliveryReport) {
+            // at this point we assume the delivery report is for a message that was already
+            // sent and properly saved at our database, so we can safely get it here to update
+            QVariantMap textEvent = getSingleEvent(History::EventTypeText, accountId, threadId, originalToken);
+            if (textEvent.isEmpty()) {
+                qWarning() << "Cound not find the original event to update with delivery details.";
+                return;
             }
-            file.write(part["content"].variant().toByteArray());
-            file.close();
-
-            QVariantMap attachment;
-            attachment[History::FieldAccountId] = accountId;
-            attachment[History::FieldThreadId] = threadId;
-            attachment[History::FieldEventId] = eventId;
-            attachment[History::FieldAttachmentId] = part["identifier"].variant();
-            attachment[History::FieldContentType] = part["content-type"].variant();
-            attachment[History::FieldFilePath] = file.fileName();
-            attachment[History::FieldStatus] = (int) History::AttachmentDownloaded;
-            attachments << attachment;
-        }
-    }
-
-    QVariantMap event;
-    event[History::FieldType] = History::EventTypeText;
-    event[History::FieldAccountId] = accountId;
-    event[History::FieldThreadId] = threadId;
-    event[History::FieldEventId] = eventId;
-    event[History::FieldSenderId] = senderId;
-    event[History::FieldTimestamp] = message.received().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldSentTime] = message.sent().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldNewEvent] = true; // message is always unread until it reaches HistoryDaemon::onMessageRead
-    event[History::FieldMessage] = message.text();
-    event[History::FieldMessageType] = (int)type;
-    event[History::FieldMessageStatus] = (int)status;
-    event[History::FieldReadTimestamp] = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldSubject] = subject;
-    event[History::FieldAttachments] = QVariant::fromValue(attachments);
-
-    writeEvents(QList<QVariantMap>() << event, properties);
-
-    // if this messages supersedes another one, remove the original message
-    if (!message.supersededToken().isEmpty()) {
-        event[History::FieldEventId] = message.supersededToken();
-        removeEvents(QList<QVariantMap>() << event);
-    }
-}
 
-QVariantMap HistoryDaemon::getSingleEventFromTextChannel(const Tp::TextChannelPtr textChannel, const QString &messageId)
-{
-    QVariantMap properties = propertiesFromChannel(textChannel);
+            // FIXME: if this message is already read, don't allow reverting the status.
+            // we need to check if this is the right place to do it.
+            if (textEvent[History::FieldMessageStatus].toInt() == History::MessageStatusRead) {
+                qWarning() << "Skipping delivery report as it is trying to revert the Read status of an existing message to the following status:" << deliveryStatus;
+                return;
+            }
 
-    QVariantMap thread = threadForProperties(textChannel->property(History::FieldAccountId).toString(),
-                                                                     History::EventTypeText,
-                                                                     properties,
-                                                                     matchFlagsForChannel(textChannel),
-                                                                     false);
-    if (thread.isEmpty()) {
-        qWarning() << "Cound not find the thread related to this eventId.";
-        return QVariantMap();
-    }
+            textEvent[History::FieldMessageStatus] = (int) fromTelepathyDeliveryStatus(deliveryStatus);
+            if (!writeEvents(QList<QVariantMap>() << textEvent, properties)) {
+                qWarning() << "Failed to save the new message status!";
+            }
 
-    QVariantMap textEvent = getSingleEvent((int)History::EventTypeText,
-                                           textChannel->property(History::FieldAccountId).toString(),
-                                           thread[History::FieldThreadId].toString(),
-                                           messageId);
+            return;
+        }
 
-    return textEvent;
+        QList<QVariantMap> attachments;
+        if (type == History::MessageTypeMultiPart && !saveAttachments(accountId, threadId, eventId, parts, attachments)) {
+            return;
+        }
 
+        QVariantMap event;
+        event[History::FieldType] = History::EventTypeText;
+        event[History::FieldAccountId] = accountId;
+        event[History::FieldThreadId] = threadId;
+        event[History::FieldEventId] = eventId;
+        event[History::FieldSenderId] = senderId;
+        event[History::FieldTimestamp] = received;
+        event[History::FieldSentTime] = sent;
+        event[History::FieldNewEvent] = true; // message is always unread until it reaches HistoryDaemon::onMessageRead
+        event[History::FieldMessage] = text;
+        event[History::FieldMessageType] = (int)type;
+        event[History::FieldMessageStatus] = (int)status;
+        event[History::FieldReadTimestamp] = readTimestamp;
+        event[History::FieldSubject] = subject;
+        event[History::FieldAttachments] = QVariant::fromValue(attachments);
+
+        writeEvents(QList<QVariantMap>() << event, properties);
+
+        // if this messages supersedes another one, remove the original message
+        if (!supersededToken.isEmpty()) {
+            event[History::FieldEventId] = supersededToken;
+            removeEvents(QList<QVariantMap>() << event);
+        }
+    });
 }
 
 void HistoryDaemon::onMessageSent(const Tp::TextChannelPtr textChannel, const Tp::Message &message, const QString &messageToken)
 {
+    QString accountId = textChannel->property(History::FieldAccountId).toString();
     QVariantMap properties = propertiesFromChannel(textChannel);
-    QList<QVariantMap> attachments;
-    History::MessageType type = History::MessageTypeText;
-    int count = 1;
-    QString subject;
+    History::MatchFlags matchFlags = matchFlagsForChannel(textChannel);
+    History::MessageType type = message.hasNonTextContent() ? History::MessageTypeMultiPart : History::MessageTypeText;
+    Tp::MessagePartList parts = message.parts();
+    QString text = message.text();
+    QString timestamp = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
     QString eventId;
 
     if (messageToken.isEmpty()) {
-        eventId = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
+        eventId = timestamp;
     } else {
         eventId = messageToken;
     }
- 
-    QVariantMap thread = threadForProperties(textChannel->property(History::FieldAccountId).toString(),
-                                              History::EventTypeText,
-                                              properties,
-                                              matchFlagsForChannel(textChannel),
-                                              true);
-    if (message.hasNonTextContent()) {
-        QString normalizedAccountId = QString(QCryptographicHash::hash(thread[History::FieldAccountId].toString().toLatin1(), QCryptographicHash::Md5).toHex());
-        QString normalizedThreadId = QString(QCryptographicHash::hash(thread[History::FieldThreadId].toString().toLatin1(), QCryptographicHash::Md5).toHex());
-        QString normalizedEventId = QString(QCryptographicHash::hash(eventId.toLatin1(), QCryptographicHash::Md5).toHex());
-        QString mmsStoragePath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-
-        type = History::MessageTypeMultiPart;
-        subject = message.header()["subject"].variant().toString();
-
-        QDir dir(mmsStoragePath);
-        if (!dir.exists("history-service") && !dir.mkpath("history-service")) {
-            qDebug() << "Failed to create dir";
+
+    History::MessageStatus status = History::MessageStatusAccepted;
+    if (textChannel->deliveryReportingSupport() & Tp::DeliveryReportingSupportFlagReceiveSuccesses) {
+        status = History::MessageStatusUnknown;
+    }
+
+    mWorker.enqueue([=]() {
+        QVariantMap thread = threadForProperties(accountId,
+                                                 History::EventTypeText,
+                                                 properties,
+                                                 matchFlags,
+                                                 true);
+        QList<QVariantMap> attachments;
+        if (type == History::MessageTypeMultiPart &&
+                !saveAttachments(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString(),
+                                 eventId, parts, attachments)) {
             return;
         }
-        dir.cd("history-service");
 
-        Q_FOREACH(const Tp::MessagePart &part, message.parts()) {
-            // ignore the header part
-            if (part["content-type"].variant().toString().isEmpty()) {
-                continue;
-            }
-            mmsStoragePath = dir.absoluteFilePath(QString("attachments/%1/%2/%3/").
-                                                  arg(normalizedAccountId,
-                                                      normalizedThreadId,
-                                                      normalizedEventId));
-
-            QFile file(mmsStoragePath+QString::number(count++));
-            if (!dir.mkpath(mmsStoragePath) || !file.open(QIODevice::WriteOnly)) {
-                qWarning() << "Failed to save attachment";
-                continue;
-            }
-            file.write(part["content"].variant().toByteArray());
-            file.close();
-
-            QVariantMap attachment;
-            attachment[History::FieldAccountId] = thread[History::FieldAccountId];
-            attachment[History::FieldThreadId] = thread[History::FieldThreadId];
-            attachment[History::FieldEventId] = eventId;
-            attachment[History::FieldAttachmentId] = part["identifier"].variant();
-            attachment[History::FieldContentType] = part["content-type"].variant();
-            attachment[History::FieldFilePath] = file.fileName();
-            attachment[History::FieldStatus] = (int) History::AttachmentDownloaded;
-            attachments << attachment;
-        }
-    }
+        QVariantMap event;
+        event[History::FieldType] = History::EventTypeText;
+        event[History::FieldAccountId] = thread[History::FieldAccountId];
+        event[History::FieldThreadId] = thread[History::FieldThreadId];
+        event[History::FieldEventId] = eventId;
+        event[History::FieldSenderId] = "self";
+        event[History::FieldTimestamp] = timestamp;
+        event[History::FieldSentTime] = timestamp;
+        event[History::FieldNewEvent] =  false; // outgoing messages are never new (unseen)
+        event[History::FieldMessage] = text;
+        event[History::FieldMessageType] = type;
+        event[History::FieldMessageStatus] = (int)status;
+        event[History::FieldReadTimestamp] = timestamp;
+        event[History::FieldSubject] = "";
+        event[History::FieldAttachments] = QVariant::fromValue(attachments);
+
+        writeEvents(QList<QVariantMap>() << event, properties);
+    });
+}
 
-    QVariantMap event;
-    event[History::FieldType] = History::EventTypeText;
-    event[History::FieldAccountId] = thread[History::FieldAccountId];
-    event[History::FieldThreadId] = thread[History::FieldThreadId];
-    event[History::FieldEventId] = eventId;
-    event[History::FieldSenderId] = "self";
-    event[History::FieldTimestamp] = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldSentTime] = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldNewEvent] =  false; // outgoing messages are never new (unseen)
-    event[History::FieldMessage] = message.text();
-    event[History::FieldMessageType] = type;
-    if (textChannel->deliveryReportingSupport() & Tp::DeliveryReportingSupportFlagReceiveSuccesses) {
-        event[History::FieldMessageStatus] = (int)History::MessageStatusUnknown;
-    } else {
-        event[History::FieldMessageStatus] = (int)History::MessageStatusAccepted;
+bool HistoryDaemon::saveAttachments(const QString &accountId, const QString &threadId, const QString &eventId,
+                                    const Tp::MessagePartList &parts, QList<QVariantMap> &attachments)
+{
+    QString normalizedAccountId = QString(QCryptographicHash::hash(accountId.toLatin1(), QCryptographicHash::Md5).toHex());
+    QString normalizedThreadId = QString(QCryptographicHash::hash(threadId.toLatin1(), QCryptographicHash::Md5).toHex());
+    QString normalizedEventId = QString(QCryptographicHash::hash(eventId.toLatin1(), QCryptographicHash::Md5).toHex());
+    QString mmsStoragePath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    int count = 1;
+
+    QDir dir(mmsStoragePath);
+    if (!dir.exists("history-service") && !dir.mkpath("history-service")) {
+        qDebug() << "Failed to create dir";
+        return false;
     }
-    event[History::FieldReadTimestamp] = QDateTime::currentDateTime().toString("yyyy-MM-ddTHH:mm:ss.zzz");
-    event[History::FieldSubject] = "";
-    event[History::FieldAttachments] = QVariant::fromValue(attachments);
+    dir.cd("history-service");
 
-    writeEvents(QList<QVariantMap>() << event, properties);
+    Q_FOREACH(const Tp::MessagePart &part, parts) {
+        // ignore the header part
+        if (part["content-type"].variant().toString().isEmpty()) {
+            continue;
+        }
+        mmsStoragePath = dir.absoluteFilePath(QString("attachments/%1/%2/%3/").
+                                              arg(normalizedAccountId,
+                                                  normalizedThreadId,
+                                                  normalizedEventId));
+
+        QFile file(mmsStoragePath+QString::number(count++));
+        if (!dir.mkpath(mmsStoragePath) || !file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to save attachment";
+            continue;
+        }
+        file.write(part["content"].variant().toByteArray());
+        file.close();
+
+        QVariantMap attachment;
+        attachment[History::FieldAccountId] = accountId;
+        attachment[History::FieldThreadId] = threadId;
+        attachment[History::FieldEventId] = eventId;
+        attachment[History::FieldAttachmentId] = part["identifier"].variant();
+        attachment[History::FieldContentType] = part["content-type"].variant();
+        attachment[History::FieldFilePath] = file.fileName();
+        attachment[History::FieldStatus] = (int) History::AttachmentDownloaded;
+        attachments << attachment;
+    }
+    return true;
 }
 
 History::MatchFlags HistoryDaemon::matchFlagsForChannel(const Tp::ChannelPtr &channel)
@@ -1280,9 +1548,13 @@ History::MatchFlags HistoryDaemon::matchFlagsForChannel(const Tp::ChannelPtr &ch
 
 QString HistoryDaemon::hashThread(const QVariantMap &thread)
 {
-    QString hash = QString::number(thread[History::FieldType].toInt());
-    hash += "#-#" + thread[History::FieldAccountId].toString();
-    hash += "#-#" + thread[History::FieldThreadId].toString();
+    return EventBatchWriter::hashThread(thread);
+}
+
+QString HistoryDaemon::hashEvent(const QVariantMap &event)
+{
+    QString hash = hashThread(event);
+    hash += "#-#" + event[History::FieldEventId].toString();
     return hash;
 }
 
@@ -1333,16 +1605,8 @@ void HistoryDaemon::writeRoomChangesInformationEvents(const QVariantMap &thread,
     }
 }
 
-void HistoryDaemon::writeRolesInformationEvents(const QVariantMap &thread, const Tp::ChannelPtr &channel, const RolesMap &rolesMap)
+QStringList HistoryDaemon::adminIdsFromChannel(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap)
 {
-    if (thread.isEmpty()) {
-        return;
-    }
-
-    if (!thread[History::FieldChatRoomInfo].toMap()["Joined"].toBool()) {
-        return;
-    }
-
     // list of identifiers for current channel admins
     QStringList adminIds;
 
@@ -1352,6 +1616,18 @@ void HistoryDaemon::writeRolesInformationEvents(const QVariantMap &thread, const
             adminIds << contact->id();
         }
     }
+    return adminIds;
+}
+
+void HistoryDaemon::writeRolesInformationEvents(const QVariantMap &thread, const QStringList &adminIds, uint selfRoles)
+{
+    if (thread.isEmpty()) {
+        return;
+    }
+
+    if (!thread[History::FieldChatRoomInfo].toMap()["Joined"].toBool()) {
+        return;
+    }
 
     Q_FOREACH (QVariant participant, thread[History::FieldParticipants].toList()) {
         QString participantId = participant.toMap()[History::FieldIdentifier].toString();
@@ -1364,9 +1640,9 @@ void HistoryDaemon::writeRolesInformationEvents(const QVariantMap &thread, const
     }
 
     //evaluate now self roles
-    if (rolesMap[channel->groupSelfContact()->handle().at(0)] & AdminRole) {
-        uint selfRoles = thread[History::FieldChatRoomInfo].toMap()["SelfRoles"].toUInt();
-        if (! (selfRoles & AdminRole)) {
+    if (selfRoles & AdminRole) {
+        uint storedSelfRoles = thread[History::FieldChatRoomInfo].toMap()["SelfRoles"].toUInt();
+        if (! (storedSelfRoles & AdminRole)) {
             writeInformationEvent(thread, History::InformationTypeSelfAdminGranted);
         }
     }
@@ -23,12 +23,15 @@
 #define HISTORYDAEMON_H
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QSharedPointer>
+#include <QTimer>
 #include "types.h"
 #include "textchannelobserver.h"
 #include "callchannelobserver.h"
 #include "historyservicedbus.h"
+#include "databaseworker.h"
 #include "plugin.h"
 #include "rolesinterface.h"
 
@@ -41,6 +44,10 @@ public:
     ~HistoryDaemon();
 
     static HistoryDaemon *instance();
+    DatabaseWorker *worker();
+    DatabaseWorker *viewWorker();
+
+    // the methods below access the backend, so they should only be called from the worker thread
 
     QVariantMap propertiesFromChannel(const Tp::ChannelPtr &textChannel);
     QVariantMap threadForProperties(const QString &accountId,
@@ -58,12 +65,17 @@ public:
     QString queryEvents(int type, const QVariantMap &sort, const QVariantMap &filter);
     QVariantMap getSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties);
     QVariantMap getSingleEvent(int type, const QString &accountId, const QString &threadId, const QString &eventId);
-    QVariantMap getSingleEventFromTextChannel(const Tp::TextChannelPtr textChannel, const QString &messageId);
 
     bool writeEvents(const QList<QVariantMap> &events, const QVariantMap &properties, bool notify = true);
     bool removeEvents(const QList<QVariantMap> &events);
     bool removeThreads(const QList<QVariantMap> &threads);
     void markThreadsAsRead(const QList<QVariantMap> &threads);
+    bool importEvents(int fd);
+    bool exportEvents(int fd);
+
+    // the keys identifying threads and events
+    static QString hashThread(const QVariantMap &thread);
+    static QString hashEvent(const QVariantMap &event);
 
 private Q_SLOTS:
     void onObserverCreated();
@@ -77,21 +89,27 @@ private Q_SLOTS:
                                const Tp::Contacts &groupRemotePendingMembersAdded, const Tp::Contacts &groupMembersRemoved,
                                const Tp::Channel::GroupMemberChangeDetails &details);
     void onRolesChanged(const HandleRolesMap &added, const HandleRolesMap &removed);
+    void onCheckpointTimeout();
 
 protected:
     History::MatchFlags matchFlagsForChannel(const Tp::ChannelPtr &channel);
-    void updateRoomParticipants(const Tp::TextChannelPtr channel, bool notify = true);
-    void updateRoomRoles(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap, bool notify = true);
-    QString hashThread(const QVariantMap &thread);
+    QVariantList participantsFromChannel(const Tp::TextChannelPtr &channel);
+    QVariantMap participantsRolesFromChannel(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap);
+    QStringList adminIdsFromChannel(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap);
+    void updateRoomParticipants(const QString &accountId, const QString &threadId, const QVariantList &participants, bool notify = true);
+    void updateRoomRoles(const QString &accountId, const QString &threadId, const QVariantMap &participantsRoles, uint selfRoles, bool notify = true);
+    void scheduleCheckpoint();
+    bool importRecord(const QVariantMap &record, QMap<QString, QString> &threadIds);
+    void startReaders();
     static QVariantMap getInterfaceProperties(const Tp::AbstractInterface *interface);
-    void updateRoomProperties(const Tp::TextChannelPtr &channel, const QVariantMap &properties, bool notify = true);
     void updateRoomProperties(const QString &accountId, const QString &threadId, History::EventType type, const QVariantMap &properties, const QStringList &invalidated, bool notify = true);
 
     void writeInformationEvent(const QVariantMap &thread, History::InformationType type, const QString &subject = QString(), const QString &sender = QString("self"), const QString &text = QString(), bool notify = true);
 
     void writeRoomChangesInformationEvents(const QVariantMap &thread, const QVariantMap &interfaceProperties);
-    void writeRolesInformationEvents(const QVariantMap &thread, const Tp::ChannelPtr &channel, const RolesMap &rolesMap);
-    void writeRolesChangesInformationEvents(const QVariantMap &thread, const Tp::ChannelPtr &channel, const RolesMap &rolesMap);
+    void writeRolesInformationEvents(const QVariantMap &thread, const QStringList &adminIds, uint selfRoles);
+    bool saveAttachments(const QString &accountId, const QString &threadId, const QString &eventId,
+                         const Tp::MessagePartList &parts, QList<QVariantMap> &attachments);
 
     static History::MessageStatus fromTelepathyDeliveryStatus(Tp::DeliveryStatus deliveryStatus);
     static History::ChatType fromTelepathyHandleType(const Tp::HandleType &type);
@@ -104,6 +122,12 @@ private:
     History::PluginPtr mBackend;
     HistoryServiceDBus mDBus;
     QMap<QString, RolesMap> mRolesMap;
+    QTimer mCheckpointTimer;
+    QElapsedTimer mCheckpointPending;
+    QElapsedTimer mContactCacheSaved;
+    DatabaseWorker mWorker;
+    QList<DatabaseWorker*> mReaders;
+    int mNextReader;
 };
 
 #endif
@@ -22,14 +22,46 @@
 #include "historydaemon.h"
 #include "historyservicedbus.h"
 #include "historyserviceadaptor.h"
+#include "payloadcodec_p.h"
+#include "plugineventview.h"
+#include "pluginthreadview.h"
 #include "types.h"
+#include <QDebug>
+#include <QThread>
+#include <algorithm>
 
 Q_DECLARE_METATYPE(QList< QVariantMap >)
 
+// the bus signals of each kind of change, the encoded ones have the "Encoded" suffix
+static const char *changeSignalNames[NotificationCoalescer::KindCount] = {
+    "ThreadsAdded",
+    "ThreadsModified",
+    "ThreadsRemoved",
+    "EventsAdded",
+    "EventsModified",
+    "EventsRemoved"
+};
+
 HistoryServiceDBus::HistoryServiceDBus(QObject *parent) :
-    QObject(parent), mAdaptor(0), mSignalsTimer(-1)
+    QObject(parent), mAdaptor(0), mPlainBroadcasts(0), mEncodedSignals(0)
 {
     qDBusRegisterMetaType<QList<QVariantMap> >();
+
+    mNotifications.setKeyFunction(NotificationCoalescer::ThreadsAdded, &HistoryDaemon::hashThread);
+    mNotifications.setKeyFunction(NotificationCoalescer::ThreadsModified, &HistoryDaemon::hashThread);
+    mNotifications.setKeyFunction(NotificationCoalescer::ThreadsRemoved, &HistoryDaemon::hashThread);
+    mNotifications.setKeyFunction(NotificationCoalescer::EventsAdded, &HistoryDaemon::hashEvent);
+    mNotifications.setKeyFunction(NotificationCoalescer::EventsModified, &HistoryDaemon::hashEvent);
+    mNotifications.setKeyFunction(NotificationCoalescer::EventsRemoved, &HistoryDaemon::hashEvent);
+    connect(&mNotifications, &NotificationCoalescer::batchReady, this, &HistoryServiceDBus::processSignals);
+
+    mClientsWatcher.setConnection(QDBusConnection::sessionBus());
+    mClientsWatcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(&mClientsWatcher, SIGNAL(serviceUnregistered(QString)), SLOT(onClientUnregistered(QString)));
+}
+
+HistoryServiceDBus::~HistoryServiceDBus()
+{
 }
 
 bool HistoryServiceDBus::connectToBus()
@@ -47,46 +79,90 @@ bool HistoryServiceDBus::connectToBus()
 
 void HistoryServiceDBus::notifyThreadsAdded(const QList<QVariantMap> &threads)
 {
-    mThreadsAdded << threads;
-    triggerSignals();
+    // notifications come from the database worker, the signals need to be sent from here
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyThreadsAdded", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, threads));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::ThreadsAdded, threads);
 }
 
 void HistoryServiceDBus::notifyThreadsModified(const QList<QVariantMap> &threads)
 {
-    mThreadsModified << threads;
-    triggerSignals();
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyThreadsModified", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, threads));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::ThreadsModified, threads);
 }
 
 void HistoryServiceDBus::notifyThreadsRemoved(const QList<QVariantMap> &threads)
 {
-    mThreadsRemoved << threads;
-    triggerSignals();
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyThreadsRemoved", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, threads));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::ThreadsRemoved, threads);
 }
 
 void HistoryServiceDBus::notifyEventsAdded(const QList<QVariantMap> &events)
 {
-    mEventsAdded << events;
-    triggerSignals();
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyEventsAdded", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, events));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::EventsAdded, events);
 }
 
 void HistoryServiceDBus::notifyEventsModified(const QList<QVariantMap> &events)
 {
-    mEventsModified << events;
-    triggerSignals();
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyEventsModified", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, events));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::EventsModified, events);
 }
 
 void HistoryServiceDBus::notifyEventsRemoved(const QList<QVariantMap> &events)
 {
-    mEventsRemoved << events;
-    triggerSignals();
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyEventsRemoved", Qt::QueuedConnection, Q_ARG(QList<QVariantMap>, events));
+        return;
+    }
+
+    mNotifications.add(NotificationCoalescer::EventsRemoved, events);
+}
+
+void HistoryServiceDBus::notifyHistoryReset()
+{
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyHistoryReset", Qt::QueuedConnection);
+        return;
+    }
+
+    // whatever is still queued is outdated by the reset, the clients query their views again
+    mNotifications.clear();
+    Q_EMIT HistoryReset();
 }
 
-void HistoryServiceDBus::notifyThreadParticipantsChanged(const QVariantMap &thread,
+void HistoryServiceDBus::notifyThreadParticipantsChanged(const QVariantMap &threadProperties,
                                                    const QList<QVariantMap> &added,
                                                    const QList<QVariantMap> &removed,
                                                    const QList<QVariantMap> &modified)
 {
-    Q_EMIT ThreadParticipantsChanged(thread, added, removed, modified);
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "notifyThreadParticipantsChanged", Qt::QueuedConnection,
+                                  Q_ARG(QVariantMap, threadProperties), Q_ARG(QList<QVariantMap>, added),
+                                  Q_ARG(QList<QVariantMap>, removed), Q_ARG(QList<QVariantMap>, modified));
+        return;
+    }
+
+    Q_EMIT ThreadParticipantsChanged(threadProperties, added, removed, modified);
 }
 
 QVariantMap HistoryServiceDBus::ThreadForProperties(const QString &accountId,
@@ -95,16 +171,24 @@ QVariantMap HistoryServiceDBus::ThreadForProperties(const QString &accountId,
                                                     int matchFlags,
                                                     bool create)
 {
-    return HistoryDaemon::instance()->threadForProperties(accountId,
-                                                            (History::EventType) type,
-                                                            properties,
-                                                            (History::MatchFlags) matchFlags,
-                                                          create);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->threadForProperties(accountId,
+                                                                          (History::EventType) type,
+                                                                          properties,
+                                                                          (History::MatchFlags) matchFlags,
+                                                                          create));
+    });
+    return QVariantMap();
 }
 
 QList<QVariantMap> HistoryServiceDBus::ParticipantsForThreads(const QList<QVariantMap> &threadIds)
 {
-    return HistoryDaemon::instance()->participantsForThreads(threadIds);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, QVariant::fromValue(HistoryDaemon::instance()->participantsForThreads(threadIds)));
+    });
+    return QList<QVariantMap>();
 }
 
 QVariantMap HistoryServiceDBus::ThreadForParticipants(const QString &accountId,
@@ -116,120 +200,236 @@ QVariantMap HistoryServiceDBus::ThreadForParticipants(const QString &accountId,
     QVariantMap properties;
     properties[History::FieldParticipants] = participants;
 
-    return HistoryDaemon::instance()->threadForProperties(accountId,
-                                                            (History::EventType) type,
-                                                            properties,
-                                                            (History::MatchFlags) matchFlags,
-                                                            create);
+    return ThreadForProperties(accountId, type, properties, matchFlags, create);
 }
 
 bool HistoryServiceDBus::WriteEvents(const QList<QVariantMap> &events)
 {
-    return HistoryDaemon::instance()->writeEvents(events, QVariantMap());
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->writeEvents(events, QVariantMap()));
+    });
+    return false;
 }
 
 bool HistoryServiceDBus::RemoveThreads(const QList<QVariantMap> &threads)
 {
-    return HistoryDaemon::instance()->removeThreads(threads);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->removeThreads(threads));
+    });
+    return false;
 }
 
 void HistoryServiceDBus::MarkThreadsAsRead(const QList<QVariantMap> &threads)
 {
-    return HistoryDaemon::instance()->markThreadsAsRead(threads);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        HistoryDaemon::instance()->markThreadsAsRead(threads);
+        sendReply(message, QVariant());
+    });
 }
 
 bool HistoryServiceDBus::RemoveEvents(const QList<QVariantMap> &events)
 {
-    return HistoryDaemon::instance()->removeEvents(events);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->removeEvents(events));
+    });
+    return false;
 }
 
 QString HistoryServiceDBus::QueryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties)
 {
-    return HistoryDaemon::instance()->queryThreads(type, sort, filter, properties);
+    QDBusMessage message = delayReply();
+    // the view is created in one of the reader threads and gets its calls delivered there
+    HistoryDaemon::instance()->viewWorker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->queryThreads(type, sort, filter, properties));
+    });
+    return QString();
 }
 
 QString HistoryServiceDBus::QueryEvents(int type, const QVariantMap &sort, const QVariantMap &filter)
 {
-    return HistoryDaemon::instance()->queryEvents(type, sort, filter);
+    QDBusMessage message = delayReply();
+    // the view is created in one of the reader threads and gets its calls delivered there
+    HistoryDaemon::instance()->viewWorker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->queryEvents(type, sort, filter));
+    });
+    return QString();
 }
 
 QVariantMap HistoryServiceDBus::GetSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties)
 {
-    return HistoryDaemon::instance()->getSingleThread(type, accountId, threadId, properties);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->getSingleThread(type, accountId, threadId, properties));
+    });
+    return QVariantMap();
 }
 
 QVariantMap HistoryServiceDBus::GetSingleEvent(int type, const QString &accountId, const QString &threadId, const QString &eventId)
 {
-    return HistoryDaemon::instance()->getSingleEvent(type, accountId, threadId, eventId);
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->getSingleEvent(type, accountId, threadId, eventId));
+    });
+    return QVariantMap();
 }
 
-void HistoryServiceDBus::timerEvent(QTimerEvent *event)
+bool HistoryServiceDBus::ImportEvents(const QDBusUnixFileDescriptor &fd)
 {
-    if (event->timerId() == mSignalsTimer) {
-        killTimer(mSignalsTimer);
-        mSignalsTimer = -1;
-        processSignals();
-    }
+    QDBusMessage message = delayReply();
+    // the descriptor is duplicated by QDBusUnixFileDescriptor, it stays open while the task holds a copy
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->importEvents(fd.fileDescriptor()));
+    });
+    return false;
 }
 
-void HistoryServiceDBus::filterDuplicatesAndAdd(QList<QVariantMap> &targetList, const QList<QVariantMap> newItems, const QStringList &propertiesToCompare)
+bool HistoryServiceDBus::ExportEvents(const QDBusUnixFileDescriptor &fd)
 {
-    Q_FOREACH (const QVariantMap &item, newItems) {
-        Q_FOREACH(const QVariantMap &existing, targetList) {
-            bool found = true;
-            Q_FOREACH(const QString &prop, propertiesToCompare) {
-                if (item[prop] != existing[prop]) {
-                    found = false;
-                    break;
-                }
-            }
+    QDBusMessage message = delayReply();
+    HistoryDaemon::instance()->worker()->enqueue([=]() {
+        sendReply(message, HistoryDaemon::instance()->exportEvents(fd.fileDescriptor()));
+    });
+    return false;
+}
 
-            if (!found) {
-                targetList << item;
-            }
-        }
-    }
+QVariantMap HistoryServiceDBus::NotificationStatistics()
+{
+    QVariantMap statistics = mNotifications.statistics();
+    statistics["plainBroadcasts"] = mPlainBroadcasts;
+    statistics["encodedSignals"] = mEncodedSignals;
+    return statistics;
 }
 
-void HistoryServiceDBus::triggerSignals()
+/// the encoded signals are sent to each registered client in the version it requested
+int HistoryServiceDBus::RegisterPayloadEncoding(int version)
 {
-    if (mSignalsTimer >= 0) {
-        killTimer(mSignalsTimer);
+    version = qMin(version, (int) History::PayloadCodec::Version);
+    if (version < 1) {
+        return 0;
     }
 
-    mSignalsTimer = startTimer(100);
+    QString client = message().service();
+    watchClient(client);
+    mClients[client] = version;
+    return version;
 }
 
-void HistoryServiceDBus::processSignals()
+/// the plain signals are broadcast while one of the clients didn't register for the encoded ones,
+/// or while no client is known, as clients that only listen to the signals never call the service
+bool HistoryServiceDBus::hasPlainClients() const
 {
-    if (!mThreadsAdded.isEmpty()) {
-        Q_EMIT ThreadsAdded(mThreadsAdded);
-        mThreadsAdded.clear();
+    if (mClients.isEmpty()) {
+        return true;
     }
+    return std::find(mClients.constBegin(), mClients.constEnd(), 0) != mClients.constEnd();
+}
 
-    if (!mThreadsModified.isEmpty()) {
-        Q_EMIT ThreadsModified(mThreadsModified);
-        mThreadsModified.clear();
+/// the clients calling the service are watched, so that they can be forgotten once they leave the bus
+void HistoryServiceDBus::watchClient(const QString &service)
+{
+    if (!mClients.contains(service)) {
+        mClients[service] = 0;
+        mClientsWatcher.addWatchedService(service);
     }
+}
 
-    if (!mThreadsRemoved.isEmpty()) {
-        Q_EMIT ThreadsRemoved(mThreadsRemoved);
-        mThreadsRemoved.clear();
-    }
+void HistoryServiceDBus::onClientUnregistered(const QString &service)
+{
+    mClientsWatcher.removeWatchedService(service);
+    mClients.remove(service);
+    History::PluginThreadView::removeSubscriber(service);
+    History::PluginEventView::removeSubscriber(service);
+}
+
+/// the calls are answered once the database worker gets to them, so that the
+/// main loop is free to dispatch other calls and the telepathy signals meanwhile
+QDBusMessage HistoryServiceDBus::delayReply()
+{
+    setDelayedReply(true);
+    watchClient(message().service());
+    return message();
+}
+
+void HistoryServiceDBus::sendReply(const QDBusMessage &message, const QVariant &result)
+{
+    QDBusMessage reply = result.isValid() ? message.createReply(result) : message.createReply();
+    QDBusConnection::sessionBus().send(reply);
+}
 
-    if (!mEventsAdded.isEmpty()) {
-        Q_EMIT EventsAdded(mEventsAdded);
-        mEventsAdded.clear();
+void HistoryServiceDBus::processSignals(NotificationCoalescer::Kind kind, const QList<QVariantMap> &items)
+{
+    // the broadcast goes together with the changes sent to the subscribed views, so that the clients
+    // subscribing meanwhile get each of them only once
+    std::function<void()> broadcast = [&]() {
+        broadcastChanges(kind, items);
+    };
+
+    switch (kind) {
+    case NotificationCoalescer::ThreadsAdded:
+    case NotificationCoalescer::ThreadsModified:
+    case NotificationCoalescer::ThreadsRemoved:
+        History::PluginThreadView::notifySubscribers(changeSignalNames[kind], items, broadcast);
+        break;
+    case NotificationCoalescer::EventsAdded:
+    case NotificationCoalescer::EventsModified:
+    case NotificationCoalescer::EventsRemoved:
+        History::PluginEventView::notifySubscribers(changeSignalNames[kind], items, broadcast);
+        break;
+    case NotificationCoalescer::KindCount:
+        break;
     }
+}
 
-    if (!mEventsModified.isEmpty()) {
-        Q_EMIT EventsModified(mEventsModified);
-        mEventsModified.clear();
+/// the clients registered through RegisterPayloadEncoding get the encoded changes sent to them only,
+/// and the plain ones are only broadcast while a client that didn't register might be listening
+void HistoryServiceDBus::broadcastChanges(NotificationCoalescer::Kind kind, const QList<QVariantMap> &items)
+{
+    if (hasPlainClients()) {
+        mPlainBroadcasts++;
+        switch (kind) {
+        case NotificationCoalescer::ThreadsAdded:
+            Q_EMIT ThreadsAdded(items);
+            break;
+        case NotificationCoalescer::ThreadsModified:
+            Q_EMIT ThreadsModified(items);
+            break;
+        case NotificationCoalescer::ThreadsRemoved:
+            Q_EMIT ThreadsRemoved(items);
+            break;
+        case NotificationCoalescer::EventsAdded:
+            Q_EMIT EventsAdded(items);
+            break;
+        case NotificationCoalescer::EventsModified:
+            Q_EMIT EventsModified(items);
+            break;
+        case NotificationCoalescer::EventsRemoved:
+            Q_EMIT EventsRemoved(items);
+            break;
+        case NotificationCoalescer::KindCount:
+            break;
+        }
     }
 
-    if (!mEventsRemoved.isEmpty()) {
-        Q_EMIT EventsRemoved(mEventsRemoved);
-        mEventsRemoved.clear();
+    // the items are encoded once for each version in use
+    QMap<int, QByteArray> payloads;
+    QString encodedSignal = QString(changeSignalNames[kind]) + "Encoded";
+    QMap<QString, int>::const_iterator it = mClients.constBegin();
+    for (; it != mClients.constEnd(); ++it) {
+        if (it.value() < 1) {
+            continue;
+        }
+        QByteArray &payload = payloads[it.value()];
+        if (payload.isEmpty()) {
+            payload = History::PayloadCodec::encode(items, it.value());
+        }
+        QDBusMessage message = QDBusMessage::createTargetedSignal(it.key(), History::DBusObjectPath,
+                                                                  History::DBusInterface, encodedSignal);
+        message << payload;
+        QDBusConnection::sessionBus().send(message);
+        mEncodedSignals++;
     }
 }
-
@@ -23,7 +23,11 @@
 #define HISTORYSERVICEDBUS_H
 
 #include <QDBusContext>
+#include <QDBusMessage>
+#include <QDBusServiceWatcher>
+#include <QDBusUnixFileDescriptor>
 #include <QObject>
+#include "notificationcoalescer.h"
 #include "types.h"
 
 class HistoryServiceAdaptor;
@@ -33,20 +37,23 @@ class HistoryServiceDBus : public QObject, public QDBusContext
     Q_OBJECT
 public:
     explicit HistoryServiceDBus(QObject *parent = 0);
+    ~HistoryServiceDBus();
 
     bool connectToBus();
 
-    void notifyThreadsAdded(const QList<QVariantMap> &threads);
-    void notifyThreadsModified(const QList<QVariantMap> &threads);
-    void notifyThreadsRemoved(const QList<QVariantMap> &threads);
-    void notifyThreadParticipantsChanged(const QVariantMap &thread,
+    // these can be called from any thread
+    Q_INVOKABLE void notifyThreadsAdded(const QList<QVariantMap> &threads);
+    Q_INVOKABLE void notifyThreadsModified(const QList<QVariantMap> &threads);
+    Q_INVOKABLE void notifyThreadsRemoved(const QList<QVariantMap> &threads);
+    Q_INVOKABLE void notifyThreadParticipantsChanged(const QVariantMap &threadProperties,
                                    const QList<QVariantMap> &added,
                                    const QList<QVariantMap> &removed,
                                    const QList<QVariantMap> &modified);
 
-    void notifyEventsAdded(const QList<QVariantMap> &events);
-    void notifyEventsModified(const QList<QVariantMap> &events);
-    void notifyEventsRemoved(const QList<QVariantMap> &events);
+    Q_INVOKABLE void notifyEventsAdded(const QList<QVariantMap> &events);
+    Q_INVOKABLE void notifyEventsModified(const QList<QVariantMap> &events);
+    Q_INVOKABLE void notifyEventsRemoved(const QList<QVariantMap> &events);
+    Q_INVOKABLE void notifyHistoryReset();
 
     // functions exposed on DBUS
     QVariantMap ThreadForParticipants(const QString &accountId,
@@ -64,6 +71,8 @@ public:
     bool RemoveThreads(const QList <QVariantMap> &threads);
     bool RemoveEvents(const QList <QVariantMap> &events);
     void MarkThreadsAsRead(const QList <QVariantMap> &threads);
+    bool ImportEvents(const QDBusUnixFileDescriptor &fd);
+    bool ExportEvents(const QDBusUnixFileDescriptor &fd);
 
     // views
     QString QueryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties);
@@ -71,6 +80,9 @@ public:
     QVariantMap GetSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties);
     QVariantMap GetSingleEvent(int type, const QString &accountId, const QString &threadId, const QString &eventId);
 
+    int RegisterPayloadEncoding(int version);
+    QVariantMap NotificationStatistics();
+
 Q_SIGNALS:
     // signals that will be relayed into the bus
     void ThreadsAdded(const QList<QVariantMap> &threads);
@@ -84,24 +96,27 @@ Q_SIGNALS:
     void EventsAdded(const QList<QVariantMap> &events);
     void EventsModified(const QList<QVariantMap> &events);
     void EventsRemoved(const QList<QVariantMap> &events);
+    void HistoryReset();
 
 protected:
-    void timerEvent(QTimerEvent *event) override;
+    QDBusMessage delayReply();
+    static void sendReply(const QDBusMessage &message, const QVariant &result);
+    void broadcastChanges(NotificationCoalescer::Kind kind, const QList<QVariantMap> &items);
+    bool hasPlainClients() const;
+    void watchClient(const QString &service);
 
 protected Q_SLOTS:
-    void filterDuplicatesAndAdd(QList<QVariantMap> &targetList, const QList<QVariantMap> newItems, const QStringList &propertiesToCompare);
-    void triggerSignals();
-    void processSignals();
+    void processSignals(NotificationCoalescer::Kind kind, const QList<QVariantMap> &items);
+    void onClientUnregistered(const QString &service);
 
 private:
     HistoryServiceAdaptor *mAdaptor;
-    QList<QVariantMap> mThreadsAdded;
-    QList<QVariantMap> mThreadsModified;
-    QList<QVariantMap> mThreadsRemoved;
-    QList<QVariantMap> mEventsAdded;
-    QList<QVariantMap> mEventsModified;
-    QList<QVariantMap> mEventsRemoved;
-    int mSignalsTimer;
+    NotificationCoalescer mNotifications;
+    QDBusServiceWatcher mClientsWatcher;
+    // the payload encoding version of each client calling the service, 0 for the plain signals
+    QMap<QString, int> mClients;
+    qint64 mPlainBroadcasts;
+    qint64 mEncodedSignals;
 };
 
 #endif // HISTORYSERVICEDBUS_H
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "notificationcoalescer.h"
+#include <QTimerEvent>
+
+NotificationCoalescer::NotificationCoalescer(QObject *parent)
+    : QObject(parent), mDelay(100), mMaximumDelay(500), mMaximumBatchSize(200), mPendingItems(0), mTimer(-1),
+      mBatchCount(0), mItemCount(0), mDuplicateCount(0), mClearedCount(0), mLargestBatch(0), mTotalLatency(0), mMaximumLatency(0)
+{
+}
+
+NotificationCoalescer::~NotificationCoalescer()
+{
+}
+
+/// sets how the items of the given kind are identified, items without a key function are never merged
+void NotificationCoalescer::setKeyFunction(Kind kind, const KeyFunction &function)
+{
+    mKeyFunctions[kind] = function;
+}
+
+void NotificationCoalescer::setDelay(int msecs)
+{
+    mDelay = msecs;
+}
+
+void NotificationCoalescer::setMaximumDelay(int msecs)
+{
+    mMaximumDelay = msecs;
+}
+
+void NotificationCoalescer::setMaximumBatchSize(int size)
+{
+    mMaximumBatchSize = size;
+}
+
+void NotificationCoalescer::add(Kind kind, const QList<QVariantMap> &items)
+{
+    if (items.isEmpty()) {
+        return;
+    }
+
+    if (mPendingItems == 0) {
+        mOldestItem.start();
+    }
+
+    Batch &batch = mBatches[kind];
+    const KeyFunction &key = mKeyFunctions[kind];
+    Q_FOREACH(const QVariantMap &item, items) {
+        if (!key) {
+            batch.items << item;
+            mPendingItems++;
+            continue;
+        }
+
+        // the latest properties win, but the item keeps its place in the batch
+        QString itemKey = key(item);
+        QHash<QString, int>::const_iterator it = batch.positions.constFind(itemKey);
+        if (it != batch.positions.constEnd()) {
+            batch.items[it.value()] = item;
+            mDuplicateCount++;
+        } else {
+            batch.positions[itemKey] = batch.items.count();
+            batch.items << item;
+            mPendingItems++;
+        }
+    }
+
+    if (mPendingItems >= mMaximumBatchSize) {
+        flush();
+    } else {
+        scheduleFlush();
+    }
+}
+
+void NotificationCoalescer::flush()
+{
+    if (mTimer >= 0) {
+        killTimer(mTimer);
+        mTimer = -1;
+    }
+
+    if (mPendingItems == 0) {
+        return;
+    }
+
+    qint64 latency = mOldestItem.elapsed();
+    mBatchCount++;
+    mItemCount += mPendingItems;
+    mLargestBatch = qMax(mLargestBatch, mPendingItems);
+    mTotalLatency += latency;
+    mMaximumLatency = qMax(mMaximumLatency, latency);
+    mPendingItems = 0;
+
+    // take the batches first, the receivers might queue new items
+    QList<QVariantMap> batches[KindCount];
+    for (int kind = 0; kind < KindCount; ++kind) {
+        batches[kind].swap(mBatches[kind].items);
+        mBatches[kind].positions.clear();
+    }
+
+    for (int kind = 0; kind < KindCount; ++kind) {
+        if (!batches[kind].isEmpty()) {
+            Q_EMIT batchReady((Kind) kind, batches[kind]);
+        }
+    }
+}
+
+/// drops the queued items without sending them, e.g. when they got outdated
+void NotificationCoalescer::clear()
+{
+    if (mTimer >= 0) {
+        killTimer(mTimer);
+        mTimer = -1;
+    }
+
+    mClearedCount += mPendingItems;
+    mPendingItems = 0;
+    for (int kind = 0; kind < KindCount; ++kind) {
+        mBatches[kind].items.clear();
+        mBatches[kind].positions.clear();
+    }
+}
+
+int NotificationCoalescer::pendingItems() const
+{
+    return mPendingItems;
+}
+
+QVariantMap NotificationCoalescer::statistics() const
+{
+    QVariantMap statistics;
+    statistics["batches"] = mBatchCount;
+    statistics["items"] = mItemCount;
+    statistics["duplicates"] = mDuplicateCount;
+    statistics["cleared"] = mClearedCount;
+    statistics["largestBatch"] = mLargestBatch;
+    statistics["averageBatch"] = mBatchCount > 0 ? (double) mItemCount / mBatchCount : 0.0;
+    statistics["maximumLatency"] = mMaximumLatency;
+    statistics["averageLatency"] = mBatchCount > 0 ? (double) mTotalLatency / mBatchCount : 0.0;
+    return statistics;
+}
+
+void NotificationCoalescer::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() == mTimer) {
+        flush();
+    }
+}
+
+void NotificationCoalescer::scheduleFlush()
+{
+    // wait for the burst to end, but don't hold the oldest item past the maximum delay
+    int remaining = qMax(0, mMaximumDelay - (int) mOldestItem.elapsed());
+    if (mTimer >= 0) {
+        killTimer(mTimer);
+    }
+    mTimer = startTimer(qMin(mDelay, remaining));
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOTIFICATIONCOALESCER_H
+#define NOTIFICATIONCOALESCER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVariantMap>
+#include <functional>
+
+/// Collects the change notifications into batches, so that a burst of changes goes out as a few signals.
+/// A batch is sent once no changes arrived for the delay, but never later than the maximum delay after
+/// its first change, or as soon as it holds the maximum batch size. Items with the same key replace the
+/// ones already queued, so each thread or event is sent once per batch with its latest properties.
+class NotificationCoalescer : public QObject
+{
+    Q_OBJECT
+public:
+    // batches are flushed in this order
+    enum Kind {
+        ThreadsAdded,
+        ThreadsModified,
+        ThreadsRemoved,
+        EventsAdded,
+        EventsModified,
+        EventsRemoved,
+        KindCount
+    };
+    Q_ENUM(Kind)
+
+    typedef std::function<QString(const QVariantMap&)> KeyFunction;
+
+    explicit NotificationCoalescer(QObject *parent = 0);
+    ~NotificationCoalescer();
+
+    void setKeyFunction(Kind kind, const KeyFunction &function);
+    void setDelay(int msecs);
+    void setMaximumDelay(int msecs);
+    void setMaximumBatchSize(int size);
+
+    void add(Kind kind, const QList<QVariantMap> &items);
+    void flush();
+    void clear();
+    int pendingItems() const;
+
+    // batches and items sent, duplicates merged, items cleared without being sent, batch sizes and
+    // the time the batches were held (in ms)
+    QVariantMap statistics() const;
+
+Q_SIGNALS:
+    void batchReady(NotificationCoalescer::Kind kind, const QList<QVariantMap> &items);
+
+protected:
+    void timerEvent(QTimerEvent *event) override;
+
+private:
+    void scheduleFlush();
+
+    struct Batch {
+        QList<QVariantMap> items;
+        QHash<QString, int> positions;
+    };
+
+    Batch mBatches[KindCount];
+    KeyFunction mKeyFunctions[KindCount];
+    int mDelay;
+    int mMaximumDelay;
+    int mMaximumBatchSize;
+    int mPendingItems;
+    int mTimer;
+    QElapsedTimer mOldestItem;
+
+    qint64 mBatchCount;
+    qint64 mItemCount;
+    qint64 mDuplicateCount;
+    qint64 mClearedCount;
+    int mLargestBatch;
+    qint64 mTotalLatency;
+    qint64 mMaximumLatency;
+};
+
+#endif // NOTIFICATIONCOALESCER_H
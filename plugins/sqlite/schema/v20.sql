@@ -0,0 +1,10 @@
+CREATE INDEX IF NOT EXISTS threads_thread_idx ON threads (accountId, threadId, type);
+CREATE INDEX IF NOT EXISTS threads_timestamp_idx ON threads (type, lastEventTimestamp);
+CREATE INDEX IF NOT EXISTS thread_participants_thread_idx ON thread_participants (accountId, threadId, type);
+CREATE INDEX IF NOT EXISTS thread_participants_participant_idx ON thread_participants (accountId, type, participantId);
+CREATE INDEX IF NOT EXISTS text_events_event_idx ON text_events (accountId, threadId, eventId);
+CREATE INDEX IF NOT EXISTS text_events_timestamp_idx ON text_events (accountId, threadId, timestamp);
+CREATE INDEX IF NOT EXISTS voice_events_event_idx ON voice_events (accountId, threadId, eventId);
+CREATE INDEX IF NOT EXISTS voice_events_timestamp_idx ON voice_events (accountId, threadId, timestamp);
+CREATE INDEX IF NOT EXISTS text_event_attachments_event_idx ON text_event_attachments (accountId, threadId, eventId);
+CREATE INDEX IF NOT EXISTS chat_room_info_thread_idx ON chat_room_info (accountId, threadId, type);
@@ -0,0 +1,132 @@
+DROP TRIGGER text_events_insert_trigger;
+CREATE TRIGGER text_events_insert_trigger AFTER INSERT ON text_events
+FOR EACH ROW WHEN new.messageType!=2
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+END;
+
+DROP TRIGGER text_events_update_trigger;
+CREATE TRIGGER text_events_update_trigger AFTER UPDATE ON text_events
+FOR EACH ROW WHEN old.messageType!=2 OR new.messageType!=2
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - (CASE WHEN old.messageType!=2 THEN 1 ELSE 0 END),
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.messageType!=2 AND old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0;
+    UPDATE threads SET count=ifnull(count, 0) + (CASE WHEN new.messageType!=2 THEN 1 ELSE 0 END),
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.messageType!=2 AND new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0 AND new.messageType!=2 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+    UPDATE threads SET lastEventId=(SELECT eventId FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        messageType!=2
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND lastEventId=old.eventId AND
+        (new.messageType=2 OR new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND
+        (new.messageType=2 OR new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+END;
+
+DROP TRIGGER text_events_delete_trigger;
+CREATE TRIGGER text_events_delete_trigger AFTER DELETE ON text_events
+FOR EACH ROW WHEN old.messageType!=2
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - 1,
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0;
+    UPDATE threads SET lastEventId=(SELECT eventId FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        messageType!=2
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND lastEventId=old.eventId;
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND lastEventTimestamp=old.timestamp;
+    DELETE from text_event_attachments WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=old.eventId;
+END;
+
+DROP TRIGGER voice_events_insert_trigger;
+CREATE TRIGGER voice_events_insert_trigger AFTER INSERT ON voice_events
+FOR EACH ROW
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+END;
+
+DROP TRIGGER voice_events_update_trigger;
+CREATE TRIGGER voice_events_update_trigger AFTER UPDATE ON voice_events
+FOR EACH ROW
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - 1,
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1;
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+    UPDATE threads SET lastEventId=(SELECT eventId FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND lastEventId=old.eventId AND
+        (new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND
+        (new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+END;
+
+DROP TRIGGER voice_events_delete_trigger;
+CREATE TRIGGER voice_events_delete_trigger AFTER DELETE ON voice_events
+FOR EACH ROW
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - 1,
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1;
+    UPDATE threads SET lastEventId=(SELECT eventId FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND lastEventId=old.eventId;
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND lastEventTimestamp=old.timestamp;
+END;
+
+UPDATE threads SET count=(SELECT count(eventId) FROM text_events WHERE
+    accountId=threads.accountId AND threadId=threads.threadId AND messageType!=2),
+    unreadCount=(SELECT count(eventId) FROM text_events WHERE
+    accountId=threads.accountId AND threadId=threads.threadId AND newEvent='1' AND messageType!=2)
+    WHERE type=0;
+UPDATE threads SET count=(SELECT count(eventId) FROM voice_events WHERE
+    accountId=threads.accountId AND threadId=threads.threadId),
+    unreadCount=(SELECT count(eventId) FROM voice_events WHERE
+    accountId=threads.accountId AND threadId=threads.threadId AND newEvent='1')
+    WHERE type=1;
@@ -0,0 +1,2 @@
+CREATE INDEX IF NOT EXISTS text_events_timestamp_only_idx ON text_events (timestamp);
+CREATE INDEX IF NOT EXISTS voice_events_timestamp_only_idx ON voice_events (timestamp);
@@ -0,0 +1,67 @@
+CREATE TABLE cache_generation (
+    id INTEGER PRIMARY KEY,
+    generation INTEGER
+);
+
+CREATE TRIGGER threads_insert_generation_trigger AFTER INSERT ON threads
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER threads_update_generation_trigger AFTER UPDATE ON threads
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER threads_delete_generation_trigger AFTER DELETE ON threads
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER thread_participants_insert_generation_trigger AFTER INSERT ON thread_participants
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER thread_participants_update_generation_trigger AFTER UPDATE ON thread_participants
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER thread_participants_delete_generation_trigger AFTER DELETE ON thread_participants
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER chat_room_info_insert_generation_trigger AFTER INSERT ON chat_room_info
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER chat_room_info_update_generation_trigger AFTER UPDATE ON chat_room_info
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
+
+CREATE TRIGGER chat_room_info_delete_generation_trigger AFTER DELETE ON chat_room_info
+FOR EACH ROW
+BEGIN
+    INSERT OR REPLACE INTO cache_generation (id, generation)
+        VALUES (0, ifnull((SELECT generation FROM cache_generation WHERE id=0), 0) + 1);
+END;
@@ -0,0 +1,27 @@
+CREATE TABLE bulk_import (
+    id INTEGER PRIMARY KEY
+);
+
+DROP TRIGGER text_events_insert_trigger;
+CREATE TRIGGER text_events_insert_trigger AFTER INSERT ON text_events
+FOR EACH ROW WHEN new.messageType!=2 AND NOT EXISTS (SELECT 1 FROM bulk_import)
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+END;
+
+DROP TRIGGER voice_events_insert_trigger;
+CREATE TRIGGER voice_events_insert_trigger AFTER INSERT ON voice_events
+FOR EACH ROW WHEN NOT EXISTS (SELECT 1 FROM bulk_import)
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+END;
@@ -0,0 +1,22 @@
+CREATE VIRTUAL TABLE text_events_fts USING fts5(message, subject, content='text_events', content_rowid='rowid', prefix='2 3');
+
+INSERT INTO text_events_fts(text_events_fts) VALUES('rebuild');
+
+CREATE TRIGGER text_events_fts_insert_trigger AFTER INSERT ON text_events
+FOR EACH ROW
+BEGIN
+    INSERT INTO text_events_fts(rowid, message, subject) VALUES (new.rowid, new.message, new.subject);
+END;
+
+CREATE TRIGGER text_events_fts_delete_trigger AFTER DELETE ON text_events
+FOR EACH ROW
+BEGIN
+    INSERT INTO text_events_fts(text_events_fts, rowid, message, subject) VALUES ('delete', old.rowid, old.message, old.subject);
+END;
+
+CREATE TRIGGER text_events_fts_update_trigger AFTER UPDATE OF message, subject ON text_events
+FOR EACH ROW
+BEGIN
+    INSERT INTO text_events_fts(text_events_fts, rowid, message, subject) VALUES ('delete', old.rowid, old.message, old.subject);
+    INSERT INTO text_events_fts(rowid, message, subject) VALUES (new.rowid, new.message, new.subject);
+END;
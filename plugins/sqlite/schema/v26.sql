@@ -0,0 +1,66 @@
+DROP TRIGGER text_events_update_trigger;
+DROP TRIGGER voice_events_update_trigger;
+
+UPDATE text_events SET timestamp=CAST(strftime('%s', timestamp) AS INTEGER) * 1000 + CAST(substr(timestamp, 21, 3) AS INTEGER)
+    WHERE typeof(timestamp)='text';
+UPDATE text_events SET sentTime=CAST(strftime('%s', sentTime) AS INTEGER) * 1000 + CAST(substr(sentTime, 21, 3) AS INTEGER)
+    WHERE typeof(sentTime)='text';
+UPDATE text_events SET readTimestamp=CAST(strftime('%s', readTimestamp) AS INTEGER) * 1000 + CAST(substr(readTimestamp, 21, 3) AS INTEGER)
+    WHERE typeof(readTimestamp)='text';
+UPDATE voice_events SET timestamp=CAST(strftime('%s', timestamp) AS INTEGER) * 1000 + CAST(substr(timestamp, 21, 3) AS INTEGER)
+    WHERE typeof(timestamp)='text';
+UPDATE threads SET lastEventTimestamp=CAST(strftime('%s', lastEventTimestamp) AS INTEGER) * 1000 + CAST(substr(lastEventTimestamp, 21, 3) AS INTEGER)
+    WHERE typeof(lastEventTimestamp)='text';
+
+CREATE TRIGGER text_events_update_trigger AFTER UPDATE ON text_events
+FOR EACH ROW WHEN old.messageType!=2 OR new.messageType!=2
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - (CASE WHEN old.messageType!=2 THEN 1 ELSE 0 END),
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.messageType!=2 AND old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0;
+    UPDATE threads SET count=ifnull(count, 0) + (CASE WHEN new.messageType!=2 THEN 1 ELSE 0 END),
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.messageType!=2 AND new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=0 AND new.messageType!=2 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+    UPDATE threads SET lastEventId=(SELECT eventId FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        messageType!=2
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND lastEventId=old.eventId AND
+        (new.messageType=2 OR new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM text_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=0 AND
+        (new.messageType=2 OR new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+END;
+
+CREATE TRIGGER voice_events_update_trigger AFTER UPDATE ON voice_events
+FOR EACH ROW
+BEGIN
+    UPDATE threads SET count=ifnull(count, 0) - 1,
+        unreadCount=ifnull(unreadCount, 0) - (CASE WHEN old.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1;
+    UPDATE threads SET count=ifnull(count, 0) + 1,
+        unreadCount=ifnull(unreadCount, 0) + (CASE WHEN new.newEvent=1 THEN 1 ELSE 0 END)
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1;
+    UPDATE threads SET lastEventId=new.eventId, lastEventTimestamp=new.timestamp
+        WHERE accountId=new.accountId AND threadId=new.threadId AND type=1 AND
+        (lastEventId IS NULL OR new.timestamp >= lastEventTimestamp);
+    UPDATE threads SET lastEventId=(SELECT eventId FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId
+        ORDER BY timestamp DESC LIMIT 1)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND lastEventId=old.eventId AND
+        (new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+    UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM voice_events WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        eventId=threads.lastEventId)
+        WHERE accountId=old.accountId AND threadId=old.threadId AND type=1 AND
+        (new.timestamp < old.timestamp OR new.accountId!=old.accountId OR new.threadId!=old.threadId);
+END;
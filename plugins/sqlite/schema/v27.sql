@@ -0,0 +1,2 @@
+ALTER TABLE threads ADD COLUMN participantsFingerprint varchar(255);
+CREATE INDEX IF NOT EXISTS threads_participants_fingerprint_idx ON threads (accountId, type, participantsFingerprint);
@@ -32,6 +32,8 @@
 #include <QFile>
 #include <QDir>
 #include <QDateTime>
+#include <QThread>
+#include <QThreadStorage>
 
 Q_DECLARE_OPAQUE_POINTER(sqlite3*)
 Q_DECLARE_METATYPE(sqlite3*)
@@ -65,8 +67,32 @@ void normalizeId(sqlite3_context *context, int argc, sqlite3_value **argv)
     sqlite3_result_text(context, strdup(normalizedId.toUtf8().data()), -1, &free);
 }
 
+// the maximum number of prepared statements kept by the query cache
+static const int maxCachedQueries = 64;
+
+// settings used by the "wal" and "full" durability profiles
+static const int pageSize = 4096;
+static const qint64 mmapSize = 64 * 1024 * 1024;
+// negative values are in KiB instead of pages
+static const int cacheSize = -8192;
+// the size the write-ahead log file is truncated to once it gets checkpointed
+static const qint64 journalSizeLimit = 4 * 1024 * 1024;
+
+// removes the read-only connection of a thread when the thread finishes
+class ReadConnection
+{
+public:
+    explicit ReadConnection(const QString &connectionName) : name(connectionName) { }
+    ~ReadConnection() { QSqlDatabase::removeDatabase(name); }
+
+    QString name;
+};
+
+static QThreadStorage<ReadConnection*> readConnections;
+static QAtomicInt readConnectionCount;
+
 SQLiteDatabase::SQLiteDatabase(QObject *parent) :
-    QObject(parent), mSchemaVersion(0)
+    QObject(parent), mSchemaVersion(0), mWalEnabled(false), mQueryCacheHits(0), mQueryCacheMisses(0)
 {
     initializeDatabase();
 }
@@ -113,6 +139,70 @@ QSqlDatabase SQLiteDatabase::database() const
     return mDatabase;
 }
 
+/// returns a read-only connection to be used by the calling thread.
+/// Each thread gets its own connection, so that views in different threads can be paged
+/// at the same time. The primary connection is returned in the thread that owns it and
+/// whenever the database is not in WAL mode, as readers would block the writer otherwise.
+QSqlDatabase SQLiteDatabase::readConnection()
+{
+    if (!mWalEnabled || QThread::currentThread() == thread()) {
+        return mDatabase;
+    }
+
+    if (readConnections.hasLocalData()) {
+        return QSqlDatabase::database(readConnections.localData()->name);
+    }
+
+    QString connectionName = QString("history-reader-%1").arg(readConnectionCount.fetchAndAddRelaxed(1));
+    readConnections.setLocalData(new ReadConnection(connectionName));
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    database.setDatabaseName(mDatabasePath);
+    database.setConnectOptions("QSQLITE_OPEN_READONLY");
+    if (!database.open()) {
+        qCritical() << "Failed to open read-only connection:" << database.lastError();
+        return database;
+    }
+
+    registerFunctions(database);
+
+    QSqlQuery query(database);
+    query.exec("PRAGMA temp_store = MEMORY");
+    query.exec(QString("PRAGMA mmap_size = %1").arg(mmapSize));
+    query.exec(QString("PRAGMA cache_size = %1").arg(cacheSize));
+    return database;
+}
+
+/// whether readConnection() returns connections that can be used from other threads
+bool SQLiteDatabase::concurrentReadsEnabled() const
+{
+    return mWalEnabled;
+}
+
+QString SQLiteDatabase::databasePath() const
+{
+    return mDatabasePath;
+}
+
+int SQLiteDatabase::schemaVersion() const
+{
+    return mSchemaVersion;
+}
+
+/// returns a counter increased by the triggers every time a thread, its participants or its room info change,
+/// so that data derived from them and saved to disk can be checked for being up-to-date
+qint64 SQLiteDatabase::cacheGeneration()
+{
+    QSqlQuery query = cachedQuery("SELECT generation FROM cache_generation WHERE id=0");
+    if (!query.exec()) {
+        qCritical() << "Failed to get the cache generation:" << query.lastError();
+        return -1;
+    }
+    qint64 generation = query.next() ? query.value(0).toLongLong() : 0;
+    query.finish();
+    return generation;
+}
+
 bool SQLiteDatabase::beginTransation()
 {
     return mDatabase.transaction();
@@ -132,6 +222,8 @@ bool SQLiteDatabase::rollbackTransaction()
 /// tests.
 bool SQLiteDatabase::reopen()
 {
+    // the cached statements belong to the connection being closed
+    clearQueryCache();
     mDatabase.close();
     mDatabase.open();
 
@@ -140,6 +232,97 @@ bool SQLiteDatabase::reopen()
     return createOrUpdateDatabase();
 }
 
+/// writes the pages stored in the write-ahead log back to the database file.
+/// Automatic checkpoints are disabled in WAL mode, so this needs to be called
+/// periodically, ideally when there are no writes going on.
+/// A passive checkpoint is tried first, as it doesn't wait for the readers; if some of the log
+/// could not be written back because a reader was still using it, a truncating checkpoint waits
+/// for the readers to finish and empties the log file.
+bool SQLiteDatabase::checkpoint()
+{
+    if (!mWalEnabled) {
+        return false;
+    }
+
+    if (runCheckpoint("PASSIVE")) {
+        return true;
+    }
+
+    if (!runCheckpoint("TRUNCATE")) {
+        qWarning() << "The database checkpoint could not write back the whole log";
+        return false;
+    }
+    return true;
+}
+
+/// runs a checkpoint in the given mode, returning whether all the frames of the log were written back
+bool SQLiteDatabase::runCheckpoint(const QString &mode)
+{
+    QSqlQuery query(mDatabase);
+    if (!query.exec(QString("PRAGMA wal_checkpoint(%1)").arg(mode)) || !query.next()) {
+        qWarning() << "Failed to checkpoint the database:" << query.lastError();
+        return false;
+    }
+
+    // the columns are whether the checkpoint was blocked, the number of frames in the log and the number
+    // of them written back to the database. Passive checkpoints are never blocked, but leave out the frames
+    // still in use by the readers
+    bool busy = query.value(0).toInt() != 0;
+    int logFrames = query.value(1).toInt();
+    int checkpointedFrames = query.value(2).toInt();
+    query.finish();
+    return !busy && logFrames == checkpointedFrames;
+}
+
+/// returns a query already prepared with the given statement, reusing the one
+/// from a previous call if it is still in the cache.
+/// The same statement must not be used again while its results are being read.
+QSqlQuery SQLiteDatabase::cachedQuery(const QString &statement)
+{
+    if (mQueryCache.contains(statement)) {
+        mQueryCacheHits++;
+        mQueryCacheUsage.removeOne(statement);
+        mQueryCacheUsage.append(statement);
+
+        // reset the statement in case the previous user did not read all the results
+        QSqlQuery query = mQueryCache[statement];
+        query.finish();
+        return query;
+    }
+
+    mQueryCacheMisses++;
+    QSqlQuery query(mDatabase);
+    query.setForwardOnly(true);
+    if (!query.prepare(statement)) {
+        qCritical() << "Failed to prepare statement:" << statement << "Error:" << query.lastError();
+        return query;
+    }
+
+    // evict the least recently used statement
+    if (mQueryCache.count() >= maxCachedQueries) {
+        mQueryCache.remove(mQueryCacheUsage.takeFirst());
+    }
+    mQueryCache[statement] = query;
+    mQueryCacheUsage.append(statement);
+    return query;
+}
+
+void SQLiteDatabase::clearQueryCache()
+{
+    mQueryCache.clear();
+    mQueryCacheUsage.clear();
+}
+
+int SQLiteDatabase::queryCacheHits() const
+{
+    return mQueryCacheHits;
+}
+
+int SQLiteDatabase::queryCacheMisses() const
+{
+    return mQueryCacheMisses;
+}
+
 QString SQLiteDatabase::dumpSchema() const
 {
     // query copied from sqlite3's shell.c
@@ -211,16 +394,10 @@ bool SQLiteDatabase::upgradeNeeded(int version) const
     return true;
 }
 
-bool SQLiteDatabase::createOrUpdateDatabase()
+void SQLiteDatabase::registerFunctions(const QSqlDatabase &database)
 {
-    bool create = !QFile(mDatabasePath).exists();
-
-    if (!mDatabase.open()) {
-        return false;
-    }
-
     // create the comparePhoneNumbers custom sqlite functions
-    sqlite3 *handle = database().driver()->handle().value<sqlite3*>();
+    sqlite3 *handle = database.driver()->handle().value<sqlite3*>();
     sqlite3_create_function(handle, "comparePhoneNumbers", 2, SQLITE_ANY, NULL, &comparePhoneNumbers, NULL, NULL);
     sqlite3_create_function(handle, "compareNormalizedPhoneNumbers", 2, SQLITE_ANY, NULL, &compareNormalizedPhoneNumbers, NULL, NULL);
 
@@ -230,6 +407,17 @@ bool SQLiteDatabase::createOrUpdateDatabase()
 #ifdef TRACE_SQLITE
     sqlite3_trace(handle, &trace, NULL);
 #endif
+}
+
+bool SQLiteDatabase::createOrUpdateDatabase()
+{
+    bool create = !QFile(mDatabasePath).exists();
+
+    if (!mDatabase.open()) {
+        return false;
+    }
+
+    registerFunctions(mDatabase);
 
     parseVersionInfo();
 
@@ -237,6 +425,8 @@ bool SQLiteDatabase::createOrUpdateDatabase()
     // use memory to create temporary tables
     query.exec("PRAGMA temp_store = MEMORY");
 
+    applyDurabilityProfile(create);
+
     QStringList statements;
     int existingVersion = 0;
     int upgradeToVersion = 0;
@@ -311,6 +501,13 @@ bool SQLiteDatabase::createOrUpdateDatabase()
                 }
             }
         }
+        if (existingVersion < 27) {
+            if (!updateParticipantsFingerprints()) {
+                qCritical() << "Failed to fill the participants fingerprints.";
+                rollbackTransaction();
+                return false;
+            }
+        }
     }
 
     finishTransaction();
@@ -318,6 +515,56 @@ bool SQLiteDatabase::createOrUpdateDatabase()
     return true;
 }
 
+/// sets the journal and the caching options of the connection according to the
+/// HISTORY_SQLITE_PROFILE environment variable:
+///  - "wal" (default): write-ahead log synced only on checkpoints
+///  - "full": write-ahead log synced on every commit
+///  - "legacy": rollback journal, the behavior of older versions
+bool SQLiteDatabase::applyDurabilityProfile(bool create)
+{
+    QString profile = qgetenv("HISTORY_SQLITE_PROFILE");
+    if (profile.isEmpty()) {
+        profile = "wal";
+    }
+
+    mWalEnabled = false;
+    QSqlQuery query(mDatabase);
+    if (profile == "legacy") {
+        query.exec("PRAGMA journal_mode = DELETE");
+        query.exec("PRAGMA synchronous = FULL");
+        return true;
+    } else if (profile != "wal" && profile != "full") {
+        qWarning() << "Unknown database profile" << profile << "- using wal";
+        profile = "wal";
+    }
+
+    // the page size can only be changed before any table gets created
+    if (create) {
+        query.exec(QString("PRAGMA page_size = %1").arg(pageSize));
+    }
+
+    // in-memory databases don't support WAL and keep using their own journal
+    if (!query.exec("PRAGMA journal_mode = WAL") || !query.next()) {
+        qWarning() << "Failed to set the journal mode:" << query.lastError();
+        return false;
+    }
+    mWalEnabled = query.value(0).toString().toLower() == "wal";
+    query.finish();
+
+    query.exec(QString("PRAGMA synchronous = %1").arg(profile == "full" ? "FULL" : "NORMAL"));
+    query.exec(QString("PRAGMA mmap_size = %1").arg(mmapSize));
+    query.exec(QString("PRAGMA cache_size = %1").arg(cacheSize));
+
+    // checkpoints are triggered by the daemon when it is idle instead of in the middle of a write
+    // and the log file is truncated after them, as it would otherwise keep the size of the biggest burst of writes
+    if (mWalEnabled) {
+        query.exec("PRAGMA wal_autocheckpoint = 0");
+        query.exec(QString("PRAGMA journal_size_limit = %1").arg(journalSizeLimit));
+    }
+
+    return true;
+}
+
 QStringList SQLiteDatabase::parseSchemaFile(const QString &fileName)
 {
     QFile schema(fileName);
@@ -376,6 +623,16 @@ void SQLiteDatabase::parseVersionInfo()
     mSchemaVersion = version.toInt();
 }
 
+// before v10 the timestamps were in local time, which the conversion to milliseconds took as UTC
+static QVariant localTimeToUtc(const QVariant &msecs)
+{
+    if (msecs.isNull()) {
+        return msecs;
+    }
+    QDateTime wallClock = QDateTime::fromMSecsSinceEpoch(msecs.toLongLong(), Qt::UTC);
+    return QDateTime(wallClock.date(), wallClock.time(), Qt::LocalTime).toMSecsSinceEpoch();
+}
+
 bool SQLiteDatabase::changeTimestampsToUtc()
 {
     // update the text events
@@ -405,8 +662,8 @@ bool SQLiteDatabase::changeTimestampsToUtc()
         query.bindValue(":accountId", event[History::FieldAccountId]);
         query.bindValue(":threadId", event[History::FieldThreadId]);
         query.bindValue(":eventId", event[History::FieldEventId]);
-        query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC().toString("yyyy-MM-ddTHH:mm:ss.zzz"));
-        query.bindValue(":readTimestamp", event[History::FieldReadTimestamp].toDateTime().toUTC().toString("yyyy-MM-ddTHH:mm:ss.zzz"));
+        query.bindValue(":timestamp", localTimeToUtc(event[History::FieldTimestamp]));
+        query.bindValue(":readTimestamp", localTimeToUtc(event[History::FieldReadTimestamp]));
         if (!query.exec()) {
             qWarning() << "Failed to update text event:" << query.lastError();
             return false;
@@ -438,7 +695,7 @@ bool SQLiteDatabase::changeTimestampsToUtc()
         query.bindValue(":accountId", event[History::FieldAccountId]);
         query.bindValue(":threadId", event[History::FieldThreadId]);
         query.bindValue(":eventId", event[History::FieldEventId]);
-        query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC().toString("yyyy-MM-ddTHH:mm:ss.zzz"));
+        query.bindValue(":timestamp", localTimeToUtc(event[History::FieldTimestamp]));
         if (!query.exec()) {
             qWarning() << "Failed to update voice event:" << query.lastError();
             return false;
@@ -448,6 +705,69 @@ bool SQLiteDatabase::changeTimestampsToUtc()
     return true;
 }
 
+/// the fingerprint stored with each thread to look it up by its participants in a single indexed query.
+/// It uses the matching rules of the account, so threads with participants considered equal share it.
+QString SQLiteDatabase::participantsFingerprint(const QString &accountId, const QStringList &normalizedParticipants)
+{
+    return History::Utils::participantsFingerprint(normalizedParticipants, History::Utils::matchFlagsForAccount(accountId));
+}
+
+bool SQLiteDatabase::updateParticipantsFingerprints()
+{
+    QSqlQuery query(database());
+    if (!query.exec("SELECT threads.accountId, threads.threadId, threads.type, thread_participants.normalizedId FROM threads "
+                    "LEFT JOIN thread_participants ON thread_participants.accountId=threads.accountId AND "
+                    "thread_participants.threadId=threads.threadId AND thread_participants.type=threads.type "
+                    "ORDER BY threads.accountId, threads.threadId, threads.type")) {
+        qWarning() << "Failed to read the thread participants:" << query.executedQuery() << query.lastError();
+        return false;
+    }
+
+    QList<QVariantMap> threads;
+    QVariantMap thread;
+    QStringList participants;
+    while (query.next()) {
+        QString accountId = query.value(0).toString();
+        QString threadId = query.value(1).toString();
+        int type = query.value(2).toInt();
+        if (thread.isEmpty() || thread[History::FieldAccountId] != accountId ||
+                thread[History::FieldThreadId] != threadId || thread[History::FieldType] != type) {
+            if (!thread.isEmpty()) {
+                thread[History::FieldParticipants] = participants;
+                threads << thread;
+            }
+            thread[History::FieldAccountId] = accountId;
+            thread[History::FieldThreadId] = threadId;
+            thread[History::FieldType] = type;
+            participants.clear();
+        }
+        if (!query.value(3).isNull()) {
+            participants << query.value(3).toString();
+        }
+    }
+    if (!thread.isEmpty()) {
+        thread[History::FieldParticipants] = participants;
+        threads << thread;
+    }
+    query.clear();
+
+    query.prepare("UPDATE threads SET participantsFingerprint=:fingerprint WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        QString accountId = thread[History::FieldAccountId].toString();
+        query.bindValue(":fingerprint", participantsFingerprint(accountId, thread[History::FieldParticipants].toStringList()));
+        query.bindValue(":accountId", accountId);
+        query.bindValue(":threadId", thread[History::FieldThreadId]);
+        query.bindValue(":type", thread[History::FieldType]);
+        if (!query.exec()) {
+            qWarning() << "Failed to update the participants fingerprint:" << query.executedQuery() << query.lastError();
+            return false;
+        }
+    }
+    query.clear();
+
+    return true;
+}
+
 bool SQLiteDatabase::convertOfonoGroupChatToRoom()
 {
     QSqlQuery query(database());
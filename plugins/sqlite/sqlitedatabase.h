@@ -22,8 +22,11 @@
 #ifndef SQLITEDATABASE_H
 #define SQLITEDATABASE_H
 
+#include <QHash>
 #include <QObject>
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStringList>
 
 class SQLiteDatabase : public QObject
 {
@@ -33,24 +36,42 @@ public:
 
     bool initializeDatabase();
     QSqlDatabase database() const;
+    QSqlDatabase readConnection();
+    bool concurrentReadsEnabled() const;
+    QString databasePath() const;
+    int schemaVersion() const;
+    qint64 cacheGeneration();
 
     bool beginTransation();
     bool finishTransaction();
     bool rollbackTransaction();
 
     bool reopen();
+    bool checkpoint();
+
+    // prepared statements for queries that are run over and over
+    QSqlQuery cachedQuery(const QString &statement);
+    void clearQueryCache();
+    int queryCacheHits() const;
+    int queryCacheMisses() const;
 
     QString dumpSchema() const;
     QStringList parseSchemaFile(const QString &fileName);
     bool runMultipleStatements(const QStringList &statements, bool useTransaction = true);
 
+    static QString participantsFingerprint(const QString &accountId, const QStringList &normalizedParticipants);
+
 protected:
     bool createOrUpdateDatabase();
+    bool applyDurabilityProfile(bool create);
+    bool runCheckpoint(const QString &mode);
+    static void registerFunctions(const QSqlDatabase &database);
     void parseVersionInfo();
 
     // data upgrade functions
     bool changeTimestampsToUtc();
     bool convertOfonoGroupChatToRoom();
+    bool updateParticipantsFingerprints();
 
 private:
     explicit SQLiteDatabase(QObject *parent = 0);
@@ -58,7 +79,12 @@ private:
     QString mDatabasePath;
     QSqlDatabase mDatabase;
     int mSchemaVersion;
-    
+    bool mWalEnabled;
+
+    QHash<QString, QSqlQuery> mQueryCache;
+    QStringList mQueryCacheUsage;
+    int mQueryCacheHits;
+    int mQueryCacheMisses;
 };
 
 #endif // SQLITEDATABASE_H
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlitefiltercompiler.h"
+#include "intersectionfilter.h"
+#include "unionfilter.h"
+#include "utils_p.h"
+#include <QDebug>
+#include <QStringList>
+
+static const QStringList threadColumns = QStringList() << History::FieldAccountId
+                                                       << History::FieldThreadId
+                                                       << History::FieldType
+                                                       << History::FieldLastEventId
+                                                       << History::FieldLastEventTimestamp
+                                                       << History::FieldCount
+                                                       << History::FieldUnreadCount
+                                                       << History::FieldChatType;
+
+static const QStringList eventColumns = QStringList() << History::FieldAccountId
+                                                      << History::FieldThreadId
+                                                      << History::FieldEventId
+                                                      << History::FieldSenderId
+                                                      << History::FieldTimestamp
+                                                      << History::FieldNewEvent;
+
+static const QStringList textEventColumns = QStringList() << History::FieldMessage
+                                                          << History::FieldMessageType
+                                                          << History::FieldMessageStatus
+                                                          << History::FieldReadTimestamp
+                                                          << History::FieldSubject
+                                                          << History::FieldInformationType
+                                                          << History::FieldSentTime;
+
+static const QStringList voiceEventColumns = QStringList() << History::FieldDuration
+                                                           << History::FieldMissed
+                                                           << History::FieldRemoteParticipant;
+
+// the columns stored as milliseconds since the epoch
+static const QStringList timestampColumns = QStringList() << History::FieldTimestamp
+                                                          << History::FieldSentTime
+                                                          << History::FieldReadTimestamp
+                                                          << History::FieldLastEventTimestamp;
+
+// the text event columns indexed in text_events_fts
+static const QStringList fullTextColumns = QStringList() << History::FieldMessage << History::FieldSubject;
+
+SQLiteFilterCompiler::SQLiteFilterCompiler(History::EventType type, Target target)
+{
+    QStringList columns;
+    switch (type) {
+    case History::EventTypeText:
+        mEventTable = "text_events";
+        columns = eventColumns + textEventColumns;
+        break;
+    case History::EventTypeVoice:
+        mEventTable = "voice_events";
+        columns = eventColumns + voiceEventColumns;
+        break;
+    case History::EventTypeNull:
+        break;
+    }
+
+    Q_FOREACH(const QString &column, columns) {
+        mColumns[column] = QString("%1.%2").arg(mEventTable, column);
+    }
+
+    // the thread queries join the last event, but the thread columns take precedence
+    if (target == TargetThreads) {
+        Q_FOREACH(const QString &column, threadColumns) {
+            mColumns[column] = QString("threads.%1").arg(column);
+        }
+    }
+}
+
+bool SQLiteFilterCompiler::compile(const History::Filter &filter)
+{
+    mCondition.clear();
+    mBindValues.clear();
+    mErrorString.clear();
+    mMatchColumn.clear();
+    mMatchQuery.clear();
+
+    Node root;
+    if (!parse(filter, root)) {
+        qWarning() << "Invalid filter:" << mErrorString;
+        return false;
+    }
+
+    mCondition = generate(root);
+    return true;
+}
+
+QString SQLiteFilterCompiler::condition() const
+{
+    return mCondition;
+}
+
+QVariantMap SQLiteFilterCompiler::bindValues() const
+{
+    return mBindValues;
+}
+
+QString SQLiteFilterCompiler::errorString() const
+{
+    return mErrorString;
+}
+
+QString SQLiteFilterCompiler::matchColumn() const
+{
+    return mMatchColumn;
+}
+
+QVariant SQLiteFilterCompiler::matchQuery() const
+{
+    return mMatchQuery;
+}
+
+QString SQLiteFilterCompiler::column(const QString &property) const
+{
+    return mColumns.value(property);
+}
+
+QString SQLiteFilterCompiler::escapeLikePattern(const QString &value)
+{
+    QString escaped = value;
+    escaped.replace("\\", "\\\\")
+           .replace("%", "\\%")
+           .replace("_", "\\_");
+    return escaped;
+}
+
+bool SQLiteFilterCompiler::parse(const History::Filter &filter, Node &node)
+{
+    History::Filters filters;
+    switch (filter.type()) {
+    case History::FilterTypeIntersection:
+        filters = History::IntersectionFilter(filter).filters();
+        node.kind = Node::And;
+        break;
+    case History::FilterTypeUnion:
+        filters = History::UnionFilter(filter).filters();
+        node.kind = Node::Or;
+        break;
+    default: {
+        QString property = filter.filterProperty();
+        QVariant value = filter.filterValue();
+
+        // empty filters match anything
+        if (property.isEmpty() || value.isNull()) {
+            node.kind = Node::Empty;
+            return true;
+        }
+
+        if (!mColumns.contains(property)) {
+            mErrorString = QString("unknown property %1").arg(property);
+            return false;
+        }
+
+        node.property = property;
+        node.column = mColumns[property];
+        node.value = value;
+
+        if (timestampColumns.contains(property)) {
+            node.value = History::Utils::timestampToMSecs(value);
+            if (node.value.isNull()) {
+                mErrorString = QString("invalid timestamp %1 for property %2").arg(value.toString(), property);
+                return false;
+            }
+        }
+
+        // FIXME: MatchCaseInsensitive and MatchPhoneNumber are not handled yet
+        History::MatchFlags flags = filter.matchFlags();
+        if (flags & History::MatchFullText) {
+            if (!fullTextColumns.contains(property)) {
+                mErrorString = QString("property %1 is not indexed for full-text search").arg(property);
+                return false;
+            }
+            node.kind = Node::FullText;
+            if (mMatchColumn.isEmpty()) {
+                mMatchColumn = property;
+                mMatchQuery = value;
+            }
+        } else if (flags & History::MatchContains) {
+            node.kind = Node::Contains;
+        } else if (flags & History::MatchNotEquals) {
+            node.kind = Node::NotEquals;
+        } else {
+            node.kind = Node::Equals;
+        }
+        return true;
+    }
+    }
+
+    Q_FOREACH(const History::Filter &innerFilter, filters) {
+        Node child;
+        if (!parse(innerFilter, child)) {
+            return false;
+        }
+        if (child.kind != Node::Empty) {
+            node.children << child;
+        }
+    }
+
+    // groups without conditions match anything, and a single condition needs no group
+    if (node.children.isEmpty()) {
+        node.kind = Node::Empty;
+    } else if (node.children.count() == 1) {
+        Node child = node.children.first();
+        node = child;
+    }
+    return true;
+}
+
+QString SQLiteFilterCompiler::generate(const Node &node)
+{
+    QStringList conditions;
+    QString bindId = QString(":filterValue%1").arg(mBindValues.count());
+
+    switch (node.kind) {
+    case Node::Empty:
+        return QString();
+    case Node::And:
+    case Node::Or:
+        Q_FOREACH(const Node &child, node.children) {
+            conditions << generate(child);
+        }
+        return QString("(%1)").arg(conditions.join(node.kind == Node::And ? " AND " : " OR "));
+    case Node::Equals:
+        mBindValues[bindId] = node.value;
+        return QString("%1=%2").arg(node.column, bindId);
+    case Node::NotEquals:
+        mBindValues[bindId] = node.value;
+        return QString("%1!=%2").arg(node.column, bindId);
+    case Node::Contains:
+        mBindValues[bindId] = QString("%%1%").arg(escapeLikePattern(node.value.toString()));
+        return QString("%1 LIKE %2 ESCAPE '\\'").arg(node.column, bindId);
+    case Node::FullText:
+        // the value is passed as is, so the fts5 query syntax is available for phrases and prefixes
+        mBindValues[bindId] = node.value;
+        return QString("%1.rowid IN (SELECT rowid FROM text_events_fts WHERE text_events_fts.%2 MATCH %3)")
+                .arg(mEventTable, node.property, bindId);
+    }
+    return QString();
+}
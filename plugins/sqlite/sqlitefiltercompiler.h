@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQLITEFILTERCOMPILER_H
+#define SQLITEFILTERCOMPILER_H
+
+#include "filter.h"
+#include "types.h"
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVariantMap>
+
+/// Turns a filter tree into the WHERE condition of the thread or event queries.
+/// The properties are resolved to qualified columns and every value is bound, so the
+/// same filter shape always produces the same statement, whatever the values are.
+class SQLiteFilterCompiler
+{
+public:
+    enum Target {
+        TargetThreads,
+        TargetEvents
+    };
+
+    struct Node {
+        enum Kind {
+            Empty,
+            And,
+            Or,
+            Equals,
+            NotEquals,
+            Contains,
+            FullText
+        };
+
+        Node() : kind(Empty) { }
+
+        Kind kind;
+        QString property;
+        QString column;
+        QVariant value;
+        QList<Node> children;
+    };
+
+    SQLiteFilterCompiler(History::EventType type, Target target);
+
+    bool compile(const History::Filter &filter);
+    QString condition() const;
+    QVariantMap bindValues() const;
+    QString errorString() const;
+
+    // the first full-text match of the filter, used to fetch the matching excerpts
+    QString matchColumn() const;
+    QVariant matchQuery() const;
+
+    QString column(const QString &property) const;
+    static QString escapeLikePattern(const QString &value);
+
+private:
+    bool parse(const History::Filter &filter, Node &node);
+    QString generate(const Node &node);
+
+    QString mEventTable;
+    QHash<QString, QString> mColumns;
+    QString mCondition;
+    QVariantMap mBindValues;
+    QString mErrorString;
+    QString mMatchColumn;
+    QVariant mMatchQuery;
+};
+
+#endif // SQLITEFILTERCOMPILER_H
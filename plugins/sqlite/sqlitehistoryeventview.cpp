@@ -21,25 +21,58 @@
 
 #include "sqlitehistoryeventview.h"
 #include "sqlitedatabase.h"
+#include "sqlitefiltercompiler.h"
 #include "sqlitehistoryplugin.h"
 #include "sort.h"
 #include <QDateTime>
 #include <QDebug>
 #include <QSqlError>
+#include <QSqlRecord>
 
 SQLiteHistoryEventView::SQLiteHistoryEventView(SQLiteHistoryPlugin *plugin,
                                              History::EventType type,
                                              const History::Sort &sort,
                                              const History::Filter &filter)
     : History::PluginEventView(),  mPlugin(plugin), mType(type), mSort(sort), mFilter(filter),
-      mQuery(SQLiteDatabase::instance()->database()), mPageSize(15), mOffset(0), mValid(true)
+      mQuery(SQLiteDatabase::instance()->readConnection()), mOffset(0), mValid(true), mHasCursor(false), mCursorPhase(0)
 {
+    SQLiteFilterCompiler compiler(type, SQLiteFilterCompiler::TargetEvents);
+    if (!compiler.compile(filter)) {
+        mValid = false;
+        return;
+    }
+    QString condition = compiler.condition();
+    QVariantMap filterValues = compiler.bindValues();
+
+    // full-text searches also return the matching excerpt of each event
+    if (!compiler.matchColumn().isEmpty()) {
+        mMatchColumn = compiler.matchColumn();
+        filterValues[":matchSnippetQuery"] = compiler.matchQuery();
+    }
+
+    // events sorted by timestamp can be paged straight from the index,
+    // without copying the whole result set into a temporary table
+    if (sort.sortField().trimmed() == History::FieldTimestamp && type != History::EventTypeNull) {
+        QString table = type == History::EventTypeText ? "text_events" : "voice_events";
+        mCursorColumn = QString("%1.timestamp").arg(table);
+        mRowIdColumn = QString("%1.rowid").arg(table);
+        mCondition = condition;
+        mFilterValues = filterValues;
+
+        // the cursor is read back from the last row of each page
+        mQuery.setForwardOnly(false);
+        if (!mQuery.prepare(mPlugin->sqlQueryForEvents(type, condition, QString(), mMatchColumn))) {
+            mValid = false;
+            Q_EMIT Invalidated();
+            qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+        }
+        mQuery.clear();
+        return;
+    }
+
     mTemporaryTable = QString("eventview%1%2").arg(QString::number((qulonglong)this), QDateTime::currentDateTimeUtc().toString("yyyyMMddhhmmsszzz"));
     mQuery.setForwardOnly(true);
 
-    // FIXME: validate the filter
-    QVariantMap filterValues;
-    QString condition = mPlugin->filterToString(filter, filterValues);
     QString order;
     if (!sort.sortField().isNull()) {
         // WORKAROUND: Supports multiple fields by split it using ','
@@ -54,7 +87,7 @@ SQLiteHistoryEventView::SQLiteHistoryEventView(SQLiteHistoryPlugin *plugin,
     }
 
     QString queryText = QString("CREATE TEMP TABLE %1 AS ").arg(mTemporaryTable);
-    queryText += mPlugin->sqlQueryForEvents(type, condition, order);
+    queryText += mPlugin->sqlQueryForEvents(type, condition, order, mMatchColumn);
 
     if (!mQuery.prepare(queryText)) {
         mValid = false;
@@ -77,19 +110,30 @@ SQLiteHistoryEventView::SQLiteHistoryEventView(SQLiteHistoryPlugin *plugin,
 
 SQLiteHistoryEventView::~SQLiteHistoryEventView()
 {
+    if (mTemporaryTable.isEmpty()) {
+        return;
+    }
+
     if (!mQuery.exec(QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable))) {
         qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
         return;
     }
 }
 
-QList<QVariantMap> SQLiteHistoryEventView::NextPage()
+QList<QVariantMap> SQLiteHistoryEventView::fetchPage(int pageSize)
 {
     QList<QVariantMap> events;
+    if (!mValid) {
+        return events;
+    }
+
+    if (!mCursorColumn.isEmpty()) {
+        return nextCursorPage(pageSize);
+    }
 
     // now prepare for selecting from it
     mQuery.prepare(QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
-                                                                      QString::number(mPageSize), QString::number(mOffset)));
+                                                                      QString::number(pageSize), QString::number(mOffset)));
     if (!mQuery.exec()) {
         mValid = false;
         Q_EMIT Invalidated();
@@ -98,13 +142,86 @@ QList<QVariantMap> SQLiteHistoryEventView::NextPage()
     }
 
     events = mPlugin->parseEventResults(mType, mQuery);
-    mOffset += mPageSize;
+    mOffset += pageSize;
     mQuery.clear();
 
     return events;
 }
 
+QList<QVariantMap> SQLiteHistoryEventView::nextCursorPage(int pageSize)
+{
+    QList<QVariantMap> events;
+    if (!mValid) {
+        return events;
+    }
+
+    QString direction = mSort.sortOrder() == Qt::AscendingOrder ? "ASC" : "DESC";
+
+    // events without a timestamp sort before all the others, so they get paged in their own phase
+    while (events.count() < pageSize && mCursorPhase < 2) {
+        bool nullKeys = (mCursorPhase == 0) == (mSort.sortOrder() == Qt::AscendingOrder);
+        QString condition = mPlugin->sqlSeekCondition(mCursorColumn, mRowIdColumn, mSort.sortOrder(), nullKeys, mHasCursor);
+        if (!mCondition.isEmpty()) {
+            condition = QString("%1 AND %2").arg(mCondition, condition);
+        }
+        int limit = pageSize - events.count();
+        QString order = QString("ORDER BY %1 %3, %2 %3 LIMIT :limit").arg(mCursorColumn, mRowIdColumn, direction);
+
+        // the statement only changes between the phases, so it is prepared again only then
+        QString queryText = mPlugin->sqlQueryForEvents(mType, condition, order, mMatchColumn);
+        if (queryText != mPreparedQuery) {
+            mPreparedQuery.clear();
+            if (!mQuery.prepare(queryText)) {
+                mValid = false;
+                Q_EMIT Invalidated();
+                qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+                return events;
+            }
+            mPreparedQuery = queryText;
+        }
+
+        mQuery.bindValue(":limit", limit);
+        Q_FOREACH(const QString &key, mFilterValues.keys()) {
+            mQuery.bindValue(key, mFilterValues[key]);
+        }
+        if (mHasCursor) {
+            mQuery.bindValue(":cursorRowId", mCursorRowId);
+            if (!nullKeys) {
+                mQuery.bindValue(":cursorKey", mCursorKey);
+                mQuery.bindValue(":cursorKey2", mCursorKey);
+            }
+        }
+
+        if (!mQuery.exec()) {
+            mValid = false;
+            Q_EMIT Invalidated();
+            qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+            return events;
+        }
+
+        events += mPlugin->parseEventResults(mType, mQuery);
+
+        // save the position of the last row and move to the next phase once this one is exhausted
+        int rows = 0;
+        if (mQuery.last()) {
+            rows = mQuery.at() + 1;
+            QSqlRecord record = mQuery.record();
+            mCursorKey = mQuery.value(record.indexOf("timestamp"));
+            mCursorRowId = mQuery.value(record.count() - 1);
+            mHasCursor = true;
+        }
+        mQuery.finish();
+
+        if (rows < limit) {
+            mHasCursor = false;
+            ++mCursorPhase;
+        }
+    }
+
+    return events;
+}
+
 bool SQLiteHistoryEventView::IsValid() const
 {
-    return mQuery.isActive();
+    return mValid;
 }
@@ -41,22 +41,34 @@ public:
                           const History::Filter &filter);
     ~SQLiteHistoryEventView();
 
-    QList<QVariantMap> NextPage();
     bool IsValid() const;
 
 protected:
-
+    QList<QVariantMap> fetchPage(int pageSize);
 
 private:
+    QList<QVariantMap> nextCursorPage(int pageSize);
+
     SQLiteHistoryPlugin *mPlugin;
     History::EventType mType;
     History::Sort mSort;
     History::Filter mFilter;
     QSqlQuery mQuery;
-    int mPageSize;
     int mOffset;
     bool mValid;
     QString mTemporaryTable;
+    QString mMatchColumn;
+
+    // cursor mode: used instead of the temporary table when the sort field is indexed
+    QString mCursorColumn;
+    QString mRowIdColumn;
+    QString mCondition;
+    QVariantMap mFilterValues;
+    QString mPreparedQuery;
+    QVariant mCursorKey;
+    QVariant mCursorRowId;
+    bool mHasCursor;
+    int mCursorPhase;
 };
 
 #endif // SQLITEHISTORYEVENTVIEW_H
@@ -25,17 +25,23 @@
 #include "sqlitedatabase.h"
 #include "sqlitehistoryeventview.h"
 #include "sqlitehistorythreadview.h"
-#include "intersectionfilter.h"
-#include "unionfilter.h"
 #include "thread.h"
 #include "contactmatcher_p.h"
+#include "pagepolicy_p.h"
 #include "utils_p.h"
 #include <QDateTime>
 #include <QDebug>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QSet>
 #include <QStringList>
 #include <QSqlError>
+#include <QSqlRecord>
 #include <QDBusMetaType>
 #include <QCryptographicHash>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
 
 static const QLatin1String timestampFormat("yyyy-MM-ddTHH:mm:ss.zzz");
 
@@ -49,21 +55,83 @@ QString generateThreadMapKey(const History::Thread &thread)
     return generateThreadMapKey(thread.accountId(), thread.threadId());
 }
 
+QString generateEventKey(const QString &accountId, const QString &threadId, const QString &eventId)
+{
+    return QString("%1#-#%2#-#%3").arg(accountId, threadId, eventId);
+}
+
+// the number of keys looked up by a single batched query, kept well below SQLite's limit of bound variables
+static const int maxKeysPerQuery = 100;
+
+// builds a condition matching any of the given keys, each key holding one value per column
+QString keysCondition(const QStringList &columns, const QList<QVariantList> &keys, QVariantMap &bindValues)
+{
+    QStringList terms;
+    for (int i = 0; i < keys.count(); ++i) {
+        QStringList parts;
+        for (int j = 0; j < columns.count(); ++j) {
+            QString bindId = QString(":key%1_%2").arg(QString::number(i), QString::number(j));
+            parts << QString("%1=%2").arg(columns[j], bindId);
+            bindValues[bindId] = keys[i][j];
+        }
+        terms << QString("(%1)").arg(parts.join(" AND "));
+    }
+    return terms.join(" OR ");
+}
+
+// the contact cache saved next to the database
+static const quint32 contactCacheMagic = 0x48534343;
+static const quint32 contactCacheFormat = 1;
+
+// the data stream can't save the lists of maps used for attachments and grouped threads
+QVariant toStreamableValue(const QVariant &value)
+{
+    if (value.userType() == qMetaTypeId<QList<QVariantMap> >()) {
+        QVariantList list;
+        Q_FOREACH(const QVariantMap &map, value.value<QList<QVariantMap> >()) {
+            list << toStreamableValue(map);
+        }
+        return list;
+    } else if (value.type() == QVariant::Map) {
+        QVariantMap map = value.toMap();
+        for (QVariantMap::iterator it = map.begin(); it != map.end(); ++it) {
+            it.value() = toStreamableValue(it.value());
+        }
+        return map;
+    } else if (value.type() == QVariant::List) {
+        QVariantList list = value.toList();
+        for (QVariantList::iterator it = list.begin(); it != list.end(); ++it) {
+            *it = toStreamableValue(*it);
+        }
+        return list;
+    }
+    return value;
+}
+
 SQLiteHistoryPlugin::SQLiteHistoryPlugin(QObject *parent) :
-    QObject(parent), mInitialised(false)
+    QObject(parent), mInitialised(false), mImporting(false), mSavedCacheGeneration(-1)
 {
     // just trigger the database creation or update
     SQLiteDatabase::instance();
+
+    // an import interrupted before it finished leaves the threads out of date
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    if (query.exec("SELECT count(*) FROM bulk_import") && query.next() && query.value(0).toInt() > 0) {
+        qWarning() << "Finishing an interrupted import";
+        updateThreadsAfterImport();
+    }
 }
 
 bool SQLiteHistoryPlugin::initialised()
 {
+    QReadLocker locker(&mCacheLock);
     return mInitialised;
 }
 
 void SQLiteHistoryPlugin::updateGroupedThreadsCache()
 {
     History::PluginThreadView *view = queryThreads(History::EventTypeText, History::Sort("timestamp", Qt::DescendingOrder), History::Filter());
+    view->SetPageSize(History::PagePolicy::MaximumPageSize);
     QList<QVariantMap> threads;
     while (view->IsValid()) {
         QList<QVariantMap> page = view->NextPage();
@@ -78,20 +146,8 @@ void SQLiteHistoryPlugin::updateGroupedThreadsCache()
 
 void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
 {
-    Q_FOREACH (QVariantMap properties, threads) {
-        // FIXME: it would be better to just use UTC all the way through the client,
-        // but that requires a lot of changes
-        // so instead we just convert to UTC here on the cache and convert back to local time
-        // when returning
-        QDateTime timestamp = QDateTime::fromString(properties[History::FieldTimestamp].toString(), Qt::ISODate);
-        properties[History::FieldTimestamp] = timestamp.toUTC().toString(timestampFormat);
-        QDateTime sentTime = QDateTime::fromString(properties[History::FieldSentTime].toString(), Qt::ISODate);
-        properties[History::FieldSentTime] = sentTime.toUTC().toString(timestampFormat);
-
-        // the same for readTimestamp
-        timestamp = QDateTime::fromString(properties[History::FieldReadTimestamp].toString(), Qt::ISODate);
-        properties[History::FieldReadTimestamp] = timestamp.toUTC().toString(timestampFormat);
-
+    QWriteLocker locker(&mCacheLock);
+    Q_FOREACH (const QVariantMap &properties, threads) {
         History::Thread thread = History::Thread::fromProperties(properties);
         const QString &threadKey = generateThreadMapKey(thread);
 
@@ -115,57 +171,68 @@ void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
             mConversationsCache[conversationKey] = groupedThreads;
             mConversationsCacheKeys.remove(threadKey);
             updateDisplayedThread(conversationKey);
+            indexThread(threadKey, thread);
             continue;
         }
-        // if not found, we have to iterate the list and compare phone numbers
+        // if not found, compare the phone numbers of the threads sharing the same participants fingerprint
         bool found = false;
-        QMap<QString, History::Threads>::iterator it = mConversationsCache.begin();
-        while (it != mConversationsCache.end()) {
-            const QString &conversationKey = it.key();
-            History::Threads groupedThreads = it.value();
+        QString fingerprint = groupingFingerprint(thread);
+        Q_FOREACH(const QString &candidateKey, mGroupingIndex.values(fingerprint)) {
+            const QString &conversationKey = mConversationsCacheKeys.value(candidateKey);
+            const History::Threads groupedThreads = mConversationsCache.value(conversationKey);
             Q_FOREACH(const History::Thread &groupedThread, groupedThreads) {
-                if (!History::Utils::shouldGroupThread(groupedThread) || thread.chatType() != groupedThread.chatType()) {
+                if (generateThreadMapKey(groupedThread) != candidateKey) {
                     continue;
                 }
                 found = History::Utils::compareNormalizedParticipants(thread.participants().identifiers(), groupedThread.participants().identifiers(), History::MatchPhoneNumber);
-                if (found) {
-                    Q_FOREACH(const History::Thread &groupedThread, groupedThreads) {
-                        mConversationsCacheKeys.remove(generateThreadMapKey(groupedThread));
-                    }
-                    mConversationsCache[conversationKey] += thread;
-                    updateDisplayedThread(conversationKey);
-                    break;
-                }
+                break;
             }
             if (found) {
+                Q_FOREACH(const History::Thread &groupedThread, groupedThreads) {
+                    mConversationsCacheKeys.remove(generateThreadMapKey(groupedThread));
+                }
+                mConversationsCache[conversationKey] += thread;
+                updateDisplayedThread(conversationKey);
                 break;
             }
-            it++;
         }
         if (!found) {
             mConversationsCache[threadKey] = History::Threads() << thread;
             mConversationsCacheKeys[threadKey] = threadKey;
         }
+        indexThread(threadKey, thread);
     }
 }
 
-bool SQLiteHistoryPlugin::lessThan(const QVariantMap &left, const QVariantMap &right) const
+/// the chat type is part of the fingerprint as threads of different chat types are never grouped
+QString SQLiteHistoryPlugin::groupingFingerprint(const History::Thread &thread)
 {
-    QVariant leftValue = left[History::FieldLastEventTimestamp];
-    QVariant rightValue = right[History::FieldLastEventTimestamp];
+    return QString("%1:%2").arg(QString::number(thread.chatType()),
+                                History::Utils::participantsFingerprint(thread.participants().identifiers(), History::MatchPhoneNumber));
+}
 
-    return leftValue < rightValue;
+void SQLiteHistoryPlugin::indexThread(const QString &threadKey, const History::Thread &thread)
+{
+    unindexThread(threadKey);
+    QString fingerprint = groupingFingerprint(thread);
+    mGroupingIndex.insert(fingerprint, threadKey);
+    mGroupingFingerprints[threadKey] = fingerprint;
+}
+
+void SQLiteHistoryPlugin::unindexThread(const QString &threadKey)
+{
+    if (mGroupingFingerprints.contains(threadKey)) {
+        mGroupingIndex.remove(mGroupingFingerprints.take(threadKey), threadKey);
+    }
 }
 
 void SQLiteHistoryPlugin::updateDisplayedThread(const QString &displayedThreadKey)
 {
     History::Threads threads = mConversationsCache[displayedThreadKey];
     History::Thread displayedThread = threads.first();
-    QVariantMap displayedProperties = displayedThread.properties();
     Q_FOREACH(const History::Thread &other, threads) {
-        if (lessThan(displayedProperties, other.properties())) {
+        if (displayedThread.timestamp() < other.timestamp()) {
             displayedThread = other;
-            displayedProperties = displayedThread.properties();
         }
     }
 
@@ -181,8 +248,10 @@ void SQLiteHistoryPlugin::updateDisplayedThread(const QString &displayedThreadKe
 
 void SQLiteHistoryPlugin::removeThreadFromCache(const QVariantMap &properties)
 {
+    QWriteLocker locker(&mCacheLock);
     History::Thread thread = History::Thread::fromProperties(properties);
     QString threadKey = generateThreadMapKey(thread);
+    unindexThread(threadKey);
  
     if (thread.type() != History::EventTypeText || !History::Utils::shouldGroupThread(thread)) {
         mConversationsCache.remove(threadKey);
@@ -242,16 +311,8 @@ QVariantMap SQLiteHistoryPlugin::cachedThreadProperties(const History::Thread &t
 {
     QVariantMap properties = thread.properties();
 
-    // FIXME: now we need to convert the timestamp back to local time
-    // remove this once we change the flow to use UTC for everything
-    QDateTime timestamp = QDateTime::fromString(properties[History::FieldTimestamp].toString(), Qt::ISODate);
-    timestamp.setTimeSpec(Qt::UTC);
-    properties[History::FieldTimestamp] = toLocalTimeString(timestamp);
-
-    // and the readTimestamp too
-    timestamp = QDateTime::fromString(properties[History::FieldReadTimestamp].toString(), Qt::ISODate);
-    timestamp.setTimeSpec(Qt::UTC);
-    properties[History::FieldReadTimestamp] = toLocalTimeString(timestamp);
+    // the event timestamps are already strings, but the thread one is kept as a QDateTime
+    properties[History::FieldTimestamp] = thread.timestamp().toString(timestampFormat);
     return properties;
 }
 
@@ -265,6 +326,13 @@ void SQLiteHistoryPlugin::generateContactCache()
 {
     QTime time;
     time.start();
+    if (loadContactCache()) {
+        qDebug() << "---- HistoryService: loaded the saved contact cache. elapsed time:" << time.elapsed() << "ms";
+        QWriteLocker locker(&mCacheLock);
+        mInitialised = true;
+        return;
+    }
+
     qDebug() << "---- HistoryService: start generating cached content";
     QSqlQuery query(SQLiteDatabase::instance()->database());
     if (!query.exec("SELECT DISTINCT accountId, normalizedId, alias, state FROM thread_participants")) {
@@ -289,7 +357,161 @@ void SQLiteHistoryPlugin::generateContactCache()
 
     qDebug() << "---- HistoryService: finished generating contact cache. elapsed time:" << time.elapsed() << "ms";
 
-    mInitialised = true;
+    {
+        QWriteLocker locker(&mCacheLock);
+        mInitialised = true;
+    }
+    saveContactCache();
+}
+
+QString SQLiteHistoryPlugin::contactCachePath() const
+{
+    QString databasePath = SQLiteDatabase::instance()->databasePath();
+    // there is nothing to save the cache next to for in-memory databases
+    if (databasePath.isEmpty() || databasePath == ":memory:") {
+        return QString();
+    }
+    return databasePath + "-cache";
+}
+
+/**
+ * @brief Loads the contact and grouped threads caches saved by \ref saveContactCache.
+ *
+ * The saved caches are only used if nothing changed in the threads since they were saved.
+ * The contact info is looked up again in the background, as the contacts might have changed meanwhile.
+ * @return true if the caches were loaded
+ */
+bool SQLiteHistoryPlugin::loadContactCache()
+{
+    QString path = contactCachePath();
+    if (path.isEmpty()) {
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint32 format = 0;
+    qint32 schemaVersion = 0;
+    qint64 generation = -1;
+    stream >> magic >> format >> schemaVersion >> generation;
+    if (stream.status() != QDataStream::Ok || magic != contactCacheMagic || format != contactCacheFormat ||
+        schemaVersion != SQLiteDatabase::instance()->schemaVersion() ||
+        generation != SQLiteDatabase::instance()->cacheGeneration()) {
+        qDebug() << "The saved contact cache is outdated, generating it again";
+        return false;
+    }
+
+    History::ContactMap contacts;
+    QMap<QString, QList<QVariantMap> > conversations;
+    stream >> contacts >> conversations;
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "Failed to read the saved contact cache";
+        return false;
+    }
+
+    QMap<QString, History::Threads> conversationsCache;
+    QMap<QString, QString> conversationsCacheKeys;
+    int threadCount = 0;
+    QMap<QString, QList<QVariantMap> >::const_iterator it = conversations.constBegin();
+    for (; it != conversations.constEnd(); ++it) {
+        History::Threads threads;
+        Q_FOREACH(const QVariantMap &properties, it.value()) {
+            History::Thread thread = History::Thread::fromProperties(properties);
+            threads << thread;
+            conversationsCacheKeys[generateThreadMapKey(thread)] = it.key();
+            threadCount++;
+        }
+        conversationsCache[it.key()] = threads;
+    }
+
+    // the generation counter starts over if the database gets replaced, so check the threads are all there too
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("SELECT count(*) FROM threads WHERE type=:type");
+    query.bindValue(":type", (int) History::EventTypeText);
+    if (!query.exec() || !query.next() || query.value(0).toInt() != threadCount) {
+        qDebug() << "The saved contact cache doesn't match the database, generating it again";
+        return false;
+    }
+    query.finish();
+
+    History::ContactMatcher::instance()->restoreContactInfo(contacts);
+    mSavedCacheGeneration = generation;
+
+    QWriteLocker locker(&mCacheLock);
+    mConversationsCache = conversationsCache;
+    mConversationsCacheKeys = conversationsCacheKeys;
+    mGroupingIndex.clear();
+    mGroupingFingerprints.clear();
+    Q_FOREACH(const History::Threads &threads, mConversationsCache) {
+        Q_FOREACH(const History::Thread &thread, threads) {
+            if (History::Utils::shouldGroupThread(thread)) {
+                indexThread(generateThreadMapKey(thread), thread);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Saves the contact and grouped threads caches next to the database, so that the next start
+ * doesn't need to generate them again.
+ *
+ * Nothing is written if the threads didn't change since the caches were last saved or loaded, as the
+ * contact info gets looked up again after loading them anyway.
+ */
+bool SQLiteHistoryPlugin::saveContactCache()
+{
+    QString path = contactCachePath();
+    if (path.isEmpty()) {
+        return false;
+    }
+
+    qint64 generation = SQLiteDatabase::instance()->cacheGeneration();
+    if (generation < 0) {
+        return false;
+    }
+    if (generation == mSavedCacheGeneration && QFile::exists(path)) {
+        return true;
+    }
+
+    QMap<QString, QList<QVariantMap> > conversations;
+    {
+        QReadLocker locker(&mCacheLock);
+        // don't save the caches while they are still being generated
+        if (!mInitialised) {
+            return false;
+        }
+        QMap<QString, History::Threads>::const_iterator it = mConversationsCache.constBegin();
+        for (; it != mConversationsCache.constEnd(); ++it) {
+            QList<QVariantMap> threads;
+            Q_FOREACH(const History::Thread &thread, it.value()) {
+                threads << toStreamableValue(thread.properties()).toMap();
+            }
+            conversations[it.key()] = threads;
+        }
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to save the contact cache:" << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << contactCacheMagic << contactCacheFormat << (qint32) SQLiteDatabase::instance()->schemaVersion() << generation;
+    stream << History::ContactMatcher::instance()->cachedContactInfo() << conversations;
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Failed to save the contact cache:" << file.errorString();
+        return false;
+    }
+    mSavedCacheGeneration = generation;
+    return true;
 }
 
 // Reader
@@ -310,15 +532,13 @@ History::PluginEventView *SQLiteHistoryPlugin::queryEvents(History::EventType ty
 
 QVariantMap SQLiteHistoryPlugin::markThreadAsRead(const QVariantMap &thread)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
     if (thread[History::FieldAccountId].toString().isEmpty() ||
            thread[History::FieldThreadId].toString().isEmpty()) {
         return QVariantMap();
     }
 
     // first check if the thread actually has anything to change
-    query.prepare("SELECT unreadCount from threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("SELECT unreadCount from threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
     query.bindValue(":accountId", thread[History::FieldAccountId].toString());
     query.bindValue(":threadId", thread[History::FieldThreadId].toString());
     query.bindValue(":type", (uint)History::EventTypeText);
@@ -329,12 +549,13 @@ QVariantMap SQLiteHistoryPlugin::markThreadAsRead(const QVariantMap &thread)
 
 
     int unreadCount = query.value(0).toUInt();
+    query.finish();
     if (unreadCount == 0) {
         // no messages to ack, so no need to update anything
         return QVariantMap();
     }
 
-    query.prepare("UPDATE text_events SET newEvent=:newEvent WHERE accountId=:accountId AND threadId=:threadId AND newEvent=1");
+    query = SQLiteDatabase::instance()->cachedQuery("UPDATE text_events SET newEvent=:newEvent WHERE accountId=:accountId AND threadId=:threadId AND newEvent=1");
     query.bindValue(":accountId", thread[History::FieldAccountId].toString());
     query.bindValue(":threadId", thread[History::FieldThreadId].toString());
     query.bindValue(":newEvent", false);
@@ -400,42 +621,184 @@ QString SQLiteHistoryPlugin::threadIdForProperties(const QString &accountId, His
 
 QList<QVariantMap> SQLiteHistoryPlugin::participantsForThreads(const QList<QVariantMap> &threadIds)
 {
-    QList<QVariantMap> results;
-    Q_FOREACH(const QVariantMap &thread, threadIds) {
-        QString accountId = thread[History::FieldAccountId].toString();
-        QString threadId = thread[History::FieldThreadId].toString();
-        History::EventType type = (History::EventType)thread[History::FieldType].toUInt();
-        QVariantMap result = thread;
+    // fetch the participants of several threads at once instead of querying them one by one
+    QHash<QString, QVariantList> participantsByThread;
+    QSet<QString> failedThreads;
+    QSqlQuery query(SQLiteDatabase::instance()->readConnection());
+    for (int start = 0; start < threadIds.count(); start += maxKeysPerQuery) {
+        QList<QVariantList> keys;
+        QStringList chunkThreads;
+        Q_FOREACH(const QVariantMap &thread, threadIds.mid(start, maxKeysPerQuery)) {
+            keys << (QVariantList() << thread[History::FieldAccountId].toString()
+                                    << thread[History::FieldThreadId].toString()
+                                    << thread[History::FieldType].toUInt());
+            chunkThreads << QString("%1#-#%2").arg(thread[History::FieldType].toUInt())
+                                             .arg(generateThreadMapKey(thread[History::FieldAccountId].toString(),
+                                                                       thread[History::FieldThreadId].toString()));
+        }
 
-        QSqlQuery query;
-        query.prepare("SELECT normalizedId, alias, state, roles FROM thread_participants "
-                      "WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
-        query.bindValue(":accountId", accountId);
-        query.bindValue(":threadId", threadId);
-        query.bindValue(":type", type);
-        QVariantList participants;
+        QVariantMap bindValues;
+        QString condition = keysCondition(QStringList() << "accountId" << "threadId" << "type", keys, bindValues);
+        query.prepare(QString("SELECT accountId, threadId, type, normalizedId, alias, state, roles FROM thread_participants "
+                              "WHERE %1").arg(condition));
+        Q_FOREACH(const QString &key, bindValues.keys()) {
+            query.bindValue(key, bindValues[key]);
+        }
         if (!query.exec()) {
             qWarning() << "Failed to retrieve participants. Error:" << query.lastError().text() << query.lastQuery();
-            results << result;
+            failedThreads += chunkThreads.toSet();
             continue;
         }
 
         while (query.next()) {
+            QString accountId = query.value(0).toString();
+            QString identifier = query.value(3).toString();
             QVariantMap participant;
-            QString identifier = query.value(0).toString();
             participant[History::FieldIdentifier] = identifier;
-            participant[History::FieldAlias] = query.value(1);
-            participant[History::FieldParticipantState] = query.value(2);
-            participant[History::FieldParticipantRoles] = query.value(3);
-            participants << History::ContactMatcher::instance()->contactInfo(accountId, identifier, true, participant);
+            participant[History::FieldAlias] = query.value(4);
+            participant[History::FieldParticipantState] = query.value(5);
+            participant[History::FieldParticipantRoles] = query.value(6);
+            QString threadKey = QString("%1#-#%2").arg(query.value(2).toUInt())
+                                                 .arg(generateThreadMapKey(accountId, query.value(1).toString()));
+            participantsByThread[threadKey] << History::ContactMatcher::instance()->contactInfo(accountId, identifier, true, participant);
         }
+        query.clear();
+    }
 
-        result[History::FieldParticipants] = participants;
+    QList<QVariantMap> results;
+    Q_FOREACH(const QVariantMap &thread, threadIds) {
+        QVariantMap result = thread;
+        QString threadKey = QString("%1#-#%2").arg(thread[History::FieldType].toUInt())
+                                             .arg(generateThreadMapKey(thread[History::FieldAccountId].toString(),
+                                                                       thread[History::FieldThreadId].toString()));
+        if (!failedThreads.contains(threadKey)) {
+            result[History::FieldParticipants] = participantsByThread.value(threadKey);
+        }
         results << result;
     }
     return results;
 }
 
+QHash<QString, QList<QVariantMap> > SQLiteHistoryPlugin::attachmentsForEvents(const QList<QVariantMap> &events)
+{
+    QHash<QString, QList<QVariantMap> > attachments;
+    QSqlQuery query(SQLiteDatabase::instance()->readConnection());
+    for (int start = 0; start < events.count(); start += maxKeysPerQuery) {
+        QList<QVariantList> keys;
+        Q_FOREACH(const QVariantMap &event, events.mid(start, maxKeysPerQuery)) {
+            keys << (QVariantList() << event[History::FieldAccountId]
+                                    << event[History::FieldThreadId]
+                                    << event[History::FieldEventId]);
+        }
+
+        QVariantMap bindValues;
+        QString condition = keysCondition(QStringList() << "accountId" << "threadId" << "eventId", keys, bindValues);
+        query.prepare(QString("SELECT accountId, threadId, eventId, attachmentId, contentType, filePath, status "
+                              "FROM text_event_attachments WHERE %1").arg(condition));
+        Q_FOREACH(const QString &key, bindValues.keys()) {
+            query.bindValue(key, bindValues[key]);
+        }
+        if (!query.exec()) {
+            qCritical() << "Error:" << query.lastError() << query.lastQuery();
+            continue;
+        }
+
+        while (query.next()) {
+            QVariantMap attachment;
+            attachment[History::FieldAccountId] = query.value(0);
+            attachment[History::FieldThreadId] = query.value(1);
+            attachment[History::FieldEventId] = query.value(2);
+            attachment[History::FieldAttachmentId] = query.value(3);
+            attachment[History::FieldContentType] = query.value(4);
+            attachment[History::FieldFilePath] = query.value(5);
+            attachment[History::FieldStatus] = query.value(6);
+            attachments[generateEventKey(query.value(0).toString(), query.value(1).toString(), query.value(2).toString())] << attachment;
+        }
+        query.clear();
+    }
+    return attachments;
+}
+
+QHash<QString, QVariantMap> SQLiteHistoryPlugin::chatRoomInfoForThreads(History::EventType type, const QList<QVariantMap> &threads)
+{
+    QHash<QString, QVariantMap> chatRoomInfos;
+    QSqlQuery query(SQLiteDatabase::instance()->readConnection());
+    for (int start = 0; start < threads.count(); start += maxKeysPerQuery) {
+        QList<QVariantList> keys;
+        Q_FOREACH(const QVariantMap &thread, threads.mid(start, maxKeysPerQuery)) {
+            keys << (QVariantList() << thread[History::FieldAccountId] << thread[History::FieldThreadId]);
+        }
+
+        QVariantMap bindValues;
+        QString condition = keysCondition(QStringList() << "accountId" << "threadId", keys, bindValues);
+        query.prepare(QString("SELECT accountId, threadId, roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, subject, actor, timestamp, joined, selfRoles "
+                              "FROM chat_room_info WHERE type=:type AND (%1)").arg(condition));
+        query.bindValue(":type", (int) type);
+        Q_FOREACH(const QString &key, bindValues.keys()) {
+            query.bindValue(key, bindValues[key]);
+        }
+        if (!query.exec()) {
+            qCritical() << "Failed to get chat room info for threads: Error:" << query.lastError() << query.lastQuery();
+            continue;
+        }
+
+        while (query.next()) {
+            QString threadKey = generateThreadMapKey(query.value(0).toString(), query.value(1).toString());
+            // there should be only one entry per room, keep the first one
+            if (chatRoomInfos.contains(threadKey)) {
+                continue;
+            }
+
+            QVariantMap chatRoomInfo;
+            if (query.value(2).isValid())
+                chatRoomInfo["RoomName"] = query.value(2);
+            if (query.value(3).isValid())
+                chatRoomInfo["Server"] = query.value(3);
+            if (query.value(4).isValid())
+                chatRoomInfo["Creator"] = query.value(4);
+            if (query.value(5).isValid())
+                chatRoomInfo["CreationTimestamp"] = toLocalTimeString(query.value(5).toDateTime());
+            if (query.value(6).isValid())
+                chatRoomInfo["Anonymous"] = query.value(6).toBool();
+            if (query.value(7).isValid())
+                chatRoomInfo["InviteOnly"] = query.value(7).toBool();
+            if (query.value(8).isValid())
+                chatRoomInfo["Limit"] = query.value(8).toInt();
+            if (query.value(9).isValid())
+                chatRoomInfo["Moderated"] = query.value(9).toBool();
+            if (query.value(10).isValid())
+                chatRoomInfo["Title"] = query.value(10);
+            if (query.value(11).isValid())
+                chatRoomInfo["Description"] = query.value(11);
+            if (query.value(12).isValid())
+                chatRoomInfo["Persistent"] = query.value(12).toBool();
+            if (query.value(13).isValid())
+                chatRoomInfo["Private"] = query.value(13).toBool();
+            if (query.value(14).isValid())
+                chatRoomInfo["PasswordProtected"] = query.value(14).toBool();
+            if (query.value(15).isValid())
+                chatRoomInfo["Password"] = query.value(15);
+            if (query.value(16).isValid())
+                chatRoomInfo["PasswordHint"] = query.value(16);
+            if (query.value(17).isValid())
+                chatRoomInfo["CanUpdateConfiguration"] = query.value(17).toBool();
+            if (query.value(18).isValid())
+                chatRoomInfo["Subject"] = query.value(18);
+            if (query.value(19).isValid())
+                chatRoomInfo["Actor"] = query.value(19);
+            if (query.value(20).isValid())
+                chatRoomInfo["Timestamp"] = toLocalTimeString(query.value(20).toDateTime());
+            if (query.value(21).isValid())
+                chatRoomInfo["Joined"] = query.value(21).toBool();
+            if (query.value(22).isValid())
+                chatRoomInfo["SelfRoles"] = query.value(22).toInt();
+            chatRoomInfos[threadKey] = chatRoomInfo;
+        }
+        query.clear();
+    }
+    return chatRoomInfos;
+}
+
 QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
                                                        History::EventType type,
                                                        const QStringList &participants,
@@ -446,28 +809,43 @@ QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
     }
 
     bool phoneCompare = (matchFlags & History::MatchPhoneNumber);
-    QSqlQuery query(SQLiteDatabase::instance()->database());
 
-    // select all the threads the first participant is listed in, and from that list
-    // check if any of the threads has all the other participants listed
-    // FIXME: find a better way to do this
-    QString queryString("SELECT threadId FROM thread_participants WHERE %1 AND type=:type AND accountId=:accountId "
-                        "AND (SELECT chatType FROM threads WHERE threads.threadId=thread_participants.threadId AND "
-                        "      threads.type=thread_participants.type)!=:chatType");
-
-    // FIXME: for now we just compare differently when using MatchPhoneNumber
-    QString firstParticipant = participants.first();
+    QStringList normalizedParticipants;
     if (phoneCompare) {
-        queryString = queryString.arg("compareNormalizedPhoneNumbers(normalizedId, :participantId)");
-        firstParticipant = History::PhoneUtils::normalizePhoneNumber(firstParticipant);
+        Q_FOREACH(const QString &participant, participants) {
+            normalizedParticipants << History::PhoneUtils::normalizePhoneNumber(participant);
+        }
+    } else {
+        normalizedParticipants = participants;
+    }
+
+    QSqlQuery query;
+    QString queryString;
+
+    // the stored fingerprints follow the matching rules of the account, so they can only be used when those
+    // rules don't tell apart participants the requested ones consider equal
+    if (!phoneCompare || (History::Utils::matchFlagsForAccount(accountId) & History::MatchPhoneNumber)) {
+        QStringList fingerprintParticipants;
+        Q_FOREACH(const QString &participant, participants) {
+            fingerprintParticipants << History::Utils::normalizeId(accountId, participant);
+        }
+
+        // we don't want to accidentally return a chat room for a multi-recipient conversation
+        query = SQLiteDatabase::instance()->cachedQuery("SELECT threadId FROM threads WHERE accountId=:accountId AND type=:type "
+                                                        "AND participantsFingerprint=:participantsFingerprint AND chatType!=:chatType");
+        query.bindValue(":participantsFingerprint", SQLiteDatabase::participantsFingerprint(accountId, fingerprintParticipants));
     } else {
-        queryString = queryString.arg("participantId=:participantId");
+        // select all the threads the first participant is listed in, and from that list
+        // check if any of the threads has all the other participants listed
+        query = SQLiteDatabase::instance()->cachedQuery("SELECT threadId FROM thread_participants WHERE "
+                                                        "compareNormalizedPhoneNumbers(normalizedId, :participantId) AND type=:type AND accountId=:accountId "
+                                                        "AND (SELECT chatType FROM threads WHERE threads.accountId=thread_participants.accountId AND "
+                                                        "      threads.threadId=thread_participants.threadId AND "
+                                                        "      threads.type=thread_participants.type)!=:chatType");
+        query.bindValue(":participantId", normalizedParticipants.first());
     }
-    query.prepare(queryString);
-    query.bindValue(":participantId", firstParticipant);
     query.bindValue(":type", type);
     query.bindValue(":accountId", accountId);
-    // we don't want to accidentally return a chat room for a multi-recipient conversation
     query.bindValue(":chatType", (int)History::ChatTypeRoom);
 
     if (!query.exec()) {
@@ -481,20 +859,12 @@ QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
     }
 
     QString existingThread;
-    QStringList normalizedParticipants;
-    if (phoneCompare) {
-        Q_FOREACH(const QString &participant, participants) {
-            normalizedParticipants << History::PhoneUtils::normalizePhoneNumber(participant);
-        }
-    } else {
-        normalizedParticipants = participants;
-    }
 
-    // now for each threadId, check if all the other participants are listed
+    // the candidates might still differ, as the fingerprints only group the participants, so compare them
     Q_FOREACH(const QString &threadId, threadIds) {
         queryString = "SELECT %1 FROM thread_participants WHERE "
                       "threadId=:threadId AND type=:type AND accountId=:accountId";
-        query.prepare(queryString.arg(phoneCompare ? "normalizedId" : "participantId"));
+        query = SQLiteDatabase::instance()->cachedQuery(queryString.arg(phoneCompare ? "normalizedId" : "participantId"));
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
         query.bindValue(":accountId", accountId);
@@ -529,11 +899,12 @@ QList<QVariantMap> SQLiteHistoryPlugin::eventsForThread(const QVariantMap &threa
     QString accountId = thread[History::FieldAccountId].toString();
     QString threadId = thread[History::FieldThreadId].toString();
     History::EventType type = (History::EventType) thread[History::FieldType].toInt();
-    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\"").arg(accountId, threadId);
-    QString queryText = sqlQueryForEvents(type, condition, "");
+    QString queryText = sqlQueryForEvents(type, "accountId=:accountId AND threadId=:threadId", QString());
 
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-    if (!query.exec(queryText)) {
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery(queryText);
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    if (!query.exec()) {
         qCritical() << "Error:" << query.lastError() << query.lastQuery();
         return results;
     }
@@ -554,6 +925,7 @@ QVariantMap SQLiteHistoryPlugin::getSingleThread(History::EventType type, const
     }
     if (grouped) {
         const QString &threadKey = generateThreadMapKey(accountId, threadId);
+        QReadLocker locker(&mCacheLock);
         // we have to find which conversation this thread belongs to
         if (mConversationsCacheKeys.contains(threadKey)) {
             // found the thread.
@@ -573,18 +945,19 @@ QVariantMap SQLiteHistoryPlugin::getSingleThread(History::EventType type, const
         return result;
     }
 
-    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\"").arg(accountId, threadId);
-    QString queryText = sqlQueryForThreads(type, condition, QString());
+    QString queryText = sqlQueryForThreads(type, "accountId=:accountId AND threadId=:threadId", QString());
     queryText += " LIMIT 1";
 
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-    if (!query.exec(queryText)) {
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery(queryText);
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    if (!query.exec()) {
         qCritical() << "Error:" << query.lastError() << query.lastQuery();
         return result;
     }
 
     QList<QVariantMap> results = parseThreadResults(type, query, properties);
-    query.clear();
+    query.finish();
     if (!results.isEmpty()) {
         result = results.first();
     }
@@ -596,18 +969,20 @@ QVariantMap SQLiteHistoryPlugin::getSingleEvent(History::EventType type, const Q
 {
     QVariantMap result;
 
-    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\" AND eventId=\"%3\"").arg(accountId, threadId, eventId);
-    QString queryText = sqlQueryForEvents(type, condition, QString());
+    QString queryText = sqlQueryForEvents(type, "accountId=:accountId AND threadId=:threadId AND eventId=:eventId", QString());
     queryText += " LIMIT 1";
 
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-    if (!query.exec(queryText)) {
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery(queryText);
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    query.bindValue(":eventId", eventId);
+    if (!query.exec()) {
         qCritical() << "Error:" << query.lastError() << query.lastQuery();
         return result;
     }
 
     QList<QVariantMap> results = parseEventResults(type, query);
-    query.clear();
+    query.finish();
     if (!results.isEmpty()) {
         result = results.first();
     }
@@ -617,14 +992,12 @@ QVariantMap SQLiteHistoryPlugin::getSingleEvent(History::EventType type, const Q
 
 bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const QString &threadId, History::EventType type, const QVariantList &participants)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
     if (accountId.isEmpty() || threadId.isEmpty()) {
         return false;
     }
 
     SQLiteDatabase::instance()->beginTransation();
-    QString deleteString("DELETE FROM thread_participants WHERE threadId=:threadId AND type=:type AND accountId=:accountId");
-    query.prepare(deleteString);
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("DELETE FROM thread_participants WHERE threadId=:threadId AND type=:type AND accountId=:accountId");
     query.bindValue(":accountId", accountId);
     query.bindValue(":threadId", threadId);
     query.bindValue(":type", type);
@@ -635,10 +1008,12 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
     }
 
     // and insert the participants
+    QStringList normalizedParticipants;
     Q_FOREACH(const QVariant &participantVariant, participants) {
         QVariantMap participant = participantVariant.toMap();
-        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
-                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
+        normalizedParticipants << History::Utils::normalizeId(accountId, participant["identifier"].toString());
+        query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
+                                                        "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
@@ -654,6 +1029,18 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
         }
     }
 
+    query = SQLiteDatabase::instance()->cachedQuery("UPDATE threads SET participantsFingerprint=:participantsFingerprint "
+                                                    "WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    query.bindValue(":participantsFingerprint", SQLiteDatabase::participantsFingerprint(accountId, normalizedParticipants));
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    query.bindValue(":type", type);
+    if (!query.exec()) {
+        qCritical() << "Error updating the participants fingerprint:" << query.lastError() << query.lastQuery();
+        SQLiteDatabase::instance()->rollbackTransaction();
+        return false;
+    }
+
     if (!SQLiteDatabase::instance()->finishTransaction()) {
         qCritical() << "Failed to commit the transaction.";
         return false;
@@ -673,14 +1060,14 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
 
 bool SQLiteHistoryPlugin::updateRoomParticipantsRoles(const QString &accountId, const QString &threadId, History::EventType type, const QVariantMap &participantsRoles)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QSqlQuery query;
     if (accountId.isEmpty() || threadId.isEmpty()) {
         return false;
     }
 
     SQLiteDatabase::instance()->beginTransation();
     Q_FOREACH(const QString &participantId, participantsRoles.keys()) {
-        query.prepare("UPDATE thread_participants SET roles=:roles WHERE accountId=:accountId AND threadId=:threadId AND type=:type AND participantId=:participantId");
+        query = SQLiteDatabase::instance()->cachedQuery("UPDATE thread_participants SET roles=:roles WHERE accountId=:accountId AND threadId=:threadId AND type=:type AND participantId=:participantId");
         query.bindValue(":roles", participantsRoles.value(participantId).toUInt());
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
@@ -830,13 +1217,11 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
             return thread;
         }
         chatRoomInfo = properties[History::FieldChatRoomInfo].toMap();
-        QSqlQuery query(SQLiteDatabase::instance()->database());
-
         QDateTime creationTimestamp = QDateTime::fromTime_t(chatRoomInfo["CreationTimestamp"].toUInt());
         QDateTime timestamp = QDateTime::fromTime_t(chatRoomInfo["Timestamp"].toUInt());
 
-        query.prepare("INSERT INTO chat_room_info (accountId, threadId, type, roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, subject, actor, timestamp, joined, selfRoles) "
-                      "VALUES (:accountId, :threadId, :type, :roomName, :server, :creator, :creationTimestamp, :anonymous, :inviteOnly, :participantLimit, :moderated, :title, :description, :persistent, :private, :passwordProtected, :password, :passwordHint, :canUpdateConfiguration, :subject, :actor, :timestamp, :joined, :selfRoles)");
+        QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO chat_room_info (accountId, threadId, type, roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, subject, actor, timestamp, joined, selfRoles) "
+                                                                  "VALUES (:accountId, :threadId, :type, :roomName, :server, :creator, :creationTimestamp, :anonymous, :inviteOnly, :participantLimit, :moderated, :title, :description, :persistent, :private, :passwordProtected, :password, :passwordHint, :canUpdateConfiguration, :subject, :actor, :timestamp, :joined, :selfRoles)");
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", (int) type);
@@ -881,9 +1266,13 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
         threadId = QString("broadcast:%1").arg(QString(QCryptographicHash::hash(participants.identifiers().join(";").toLocal8Bit(),QCryptographicHash::Md5).toHex()));;
     }
 
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-    query.prepare("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, lastEventTimestamp)"
-                  "VALUES (:accountId, :threadId, :type, :count, :unreadCount, :chatType, :lastEventTimestamp)");
+    QStringList normalizedParticipants;
+    Q_FOREACH(const History::Participant &participant, participants) {
+        normalizedParticipants << History::Utils::normalizeId(accountId, participant.identifier());
+    }
+
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, lastEventTimestamp, participantsFingerprint)"
+                                                              "VALUES (:accountId, :threadId, :type, :count, :unreadCount, :chatType, :lastEventTimestamp, :participantsFingerprint)");
     query.bindValue(":accountId", accountId);
     query.bindValue(":threadId", threadId);
     query.bindValue(":type", (int) type);
@@ -891,7 +1280,8 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
     query.bindValue(":unreadCount", 0);
     query.bindValue(":chatType", (int) chatType);
     // make sure threads are created with an up-to-date timestamp
-    query.bindValue(":lastEventTimestamp", QDateTime::currentDateTimeUtc().toString(timestampFormat));
+    query.bindValue(":lastEventTimestamp", QDateTime::currentMSecsSinceEpoch());
+    query.bindValue(":participantsFingerprint", SQLiteDatabase::participantsFingerprint(accountId, normalizedParticipants));
     if (!query.exec()) {
         qCritical() << "Error:" << query.lastError() << query.lastQuery();
         SQLiteDatabase::instance()->rollbackTransaction();
@@ -899,14 +1289,15 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
     }
 
     // and insert the participants
-    Q_FOREACH(const History::Participant &participant, participants) {
-        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
-                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
+    for (int i = 0; i < participants.count(); ++i) {
+        const History::Participant &participant = participants[i];
+        query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
+                                                        "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
         query.bindValue(":participantId", participant.identifier());
-        query.bindValue(":normalizedId", History::Utils::normalizeId(accountId, participant.identifier()));
+        query.bindValue(":normalizedId", normalizedParticipants[i]);
         query.bindValue(":alias", participant.alias());
         query.bindValue(":state", participant.state());
         query.bindValue(":roles", participant.roles());
@@ -956,9 +1347,7 @@ QVariantMap SQLiteHistoryPlugin::createThreadForParticipants(const QString &acco
 
 bool SQLiteHistoryPlugin::removeThread(const QVariantMap &thread)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    query.prepare("DELETE FROM threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("DELETE FROM threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
     query.bindValue(":accountId", thread[History::FieldAccountId]);
     query.bindValue(":threadId", thread[History::FieldThreadId]);
     query.bindValue(":type", thread[History::FieldType]);
@@ -975,7 +1364,7 @@ bool SQLiteHistoryPlugin::removeThread(const QVariantMap &thread)
 
 History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QSqlQuery query;
 
     // check if the event exists
     QVariantMap existingEvent = getSingleEvent((History::EventType) event[History::FieldType].toInt(),
@@ -988,13 +1377,13 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
     History::EventWriteResult result;
     if (existingEvent.isEmpty()) {
         // create new
-        query.prepare("INSERT INTO text_events (accountId, threadId, eventId, senderId, timestamp, newEvent, message, messageType, messageStatus, readTimestamp, subject, informationType, sentTime)"
-                      "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :message, :messageType, :messageStatus, :readTimestamp, :subject, :informationType, :sentTime)");
+        query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO text_events (accountId, threadId, eventId, senderId, timestamp, newEvent, message, messageType, messageStatus, readTimestamp, subject, informationType, sentTime)"
+                                                        "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :message, :messageType, :messageStatus, :readTimestamp, :subject, :informationType, :sentTime)");
         result = History::EventWriteCreated;
     } else {
         // update existing event
-        query.prepare("UPDATE text_events SET senderId=:senderId, timestamp=:timestamp, sentTime=:sentTime, newEvent=:newEvent, message=:message, messageType=:messageType, informationType=:informationType, "
-                      "messageStatus=:messageStatus, readTimestamp=:readTimestamp, subject=:subject, informationType=:informationType WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+        query = SQLiteDatabase::instance()->cachedQuery("UPDATE text_events SET senderId=:senderId, timestamp=:timestamp, sentTime=:sentTime, newEvent=:newEvent, message=:message, messageType=:messageType, informationType=:informationType, "
+                                                        "messageStatus=:messageStatus, readTimestamp=:readTimestamp, subject=:subject, informationType=:informationType WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
         result = History::EventWriteModified;
     }
 
@@ -1002,13 +1391,13 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
     query.bindValue(":senderId", event[History::FieldSenderId]);
-    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
-    query.bindValue(":sentTime", event[History::FieldSentTime].toDateTime().toUTC());
+    query.bindValue(":timestamp", History::Utils::timestampToMSecs(event[History::FieldTimestamp]));
+    query.bindValue(":sentTime", History::Utils::timestampToMSecs(event[History::FieldSentTime]));
     query.bindValue(":newEvent", event[History::FieldNewEvent]);
     query.bindValue(":message", event[History::FieldMessage]);
     query.bindValue(":messageType", event[History::FieldMessageType]);
     query.bindValue(":messageStatus", event[History::FieldMessageStatus]);
-    query.bindValue(":readTimestamp", event[History::FieldReadTimestamp].toDateTime().toUTC());
+    query.bindValue(":readTimestamp", History::Utils::timestampToMSecs(event[History::FieldReadTimestamp]));
     query.bindValue(":subject", event[History::FieldSubject].toString());
     query.bindValue(":informationType", event[History::FieldInformationType].toInt());
 
@@ -1023,8 +1412,8 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
     if (messageType == History::MessageTypeMultiPart) {
         // if the writing is an update, we need to remove the previous attachments
         if (result == History::EventWriteModified) {
-            query.prepare("DELETE FROM text_event_attachments WHERE accountId=:accountId AND threadId=:threadId "
-                          "AND eventId=:eventId");
+            query = SQLiteDatabase::instance()->cachedQuery("DELETE FROM text_event_attachments WHERE accountId=:accountId AND threadId=:threadId "
+                                                            "AND eventId=:eventId");
             query.bindValue(":accountId", event[History::FieldAccountId]);
             query.bindValue(":threadId", event[History::FieldThreadId]);
             query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1037,7 +1426,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
         // save the attachments
         QList<QVariantMap> attachments = qdbus_cast<QList<QVariantMap> >(event[History::FieldAttachments]);
         Q_FOREACH(const QVariantMap &attachment, attachments) {
-            query.prepare("INSERT INTO text_event_attachments VALUES (:accountId, :threadId, :eventId, :attachmentId, :contentType, :filePath, :status)");
+            query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO text_event_attachments VALUES (:accountId, :threadId, :eventId, :attachmentId, :contentType, :filePath, :status)");
             query.bindValue(":accountId", attachment[History::FieldAccountId]);
             query.bindValue(":threadId", attachment[History::FieldThreadId]);
             query.bindValue(":eventId", attachment[History::FieldEventId]);
@@ -1058,7 +1447,8 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
         return History::EventWriteError;
     }
 
-    if (result == History::EventWriteModified || result == History::EventWriteCreated) {
+    // the threads are only up-to-date, and cached, at the end of an import
+    if (!mImporting && (result == History::EventWriteModified || result == History::EventWriteCreated)) {
         QVariantMap existingThread = getSingleThread((History::EventType) event[History::FieldType].toInt(),
                                                      event[History::FieldAccountId].toString(),
                                                      event[History::FieldThreadId].toString(),
@@ -1072,9 +1462,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
 
 bool SQLiteHistoryPlugin::removeTextEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    query.prepare("DELETE FROM text_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("DELETE FROM text_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
     query.bindValue(":accountId", event[History::FieldAccountId]);
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1097,7 +1485,7 @@ bool SQLiteHistoryPlugin::removeTextEvent(const QVariantMap &event)
 
 History::EventWriteResult SQLiteHistoryPlugin::writeVoiceEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QSqlQuery query;
 
     // check if the event exists
     QVariantMap existingEvent = getSingleEvent((History::EventType) event[History::FieldType].toInt(),
@@ -1108,14 +1496,14 @@ History::EventWriteResult SQLiteHistoryPlugin::writeVoiceEvent(const QVariantMap
     History::EventWriteResult result;
     if (existingEvent.isEmpty()) {
         // create new
-        query.prepare("INSERT INTO voice_events (accountId, threadId, eventId, senderId, timestamp, newEvent, duration, missed, remoteParticipant) "
-                      "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :duration, :missed, :remoteParticipant)");
+        query = SQLiteDatabase::instance()->cachedQuery("INSERT INTO voice_events (accountId, threadId, eventId, senderId, timestamp, newEvent, duration, missed, remoteParticipant) "
+                                                        "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :duration, :missed, :remoteParticipant)");
         result = History::EventWriteCreated;
     } else {
         // update existing event
-        query.prepare("UPDATE voice_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, duration=:duration, "
-                      "missed=:missed, remoteParticipant=:remoteParticipant "
-                      "WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+        query = SQLiteDatabase::instance()->cachedQuery("UPDATE voice_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, duration=:duration, "
+                                                        "missed=:missed, remoteParticipant=:remoteParticipant "
+                                                        "WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
 
         result = History::EventWriteModified;
     }
@@ -1124,7 +1512,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeVoiceEvent(const QVariantMap
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
     query.bindValue(":senderId", event[History::FieldSenderId]);
-    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
+    query.bindValue(":timestamp", History::Utils::timestampToMSecs(event[History::FieldTimestamp]));
     query.bindValue(":newEvent", event[History::FieldNewEvent]);
     query.bindValue(":duration", event[History::FieldDuration]);
     query.bindValue(":missed", event[History::FieldMissed]);
@@ -1140,9 +1528,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeVoiceEvent(const QVariantMap
 
 bool SQLiteHistoryPlugin::removeVoiceEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    query.prepare("DELETE FROM voice_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    QSqlQuery query = SQLiteDatabase::instance()->cachedQuery("DELETE FROM voice_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
     query.bindValue(":accountId", event[History::FieldAccountId]);
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1170,16 +1556,87 @@ bool SQLiteHistoryPlugin::rollbackBatchOperation()
     return SQLiteDatabase::instance()->rollbackTransaction();
 }
 
+bool SQLiteHistoryPlugin::beginImport()
+{
+    // the event triggers skip the thread updates while there is a row in bulk_import
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    if (!query.exec("INSERT OR REPLACE INTO bulk_import (id) VALUES (0)")) {
+        qCritical() << "Failed to start the import:" << query.lastError() << query.lastQuery();
+        return false;
+    }
+    mImporting = true;
+    return true;
+}
+
+bool SQLiteHistoryPlugin::endImport()
+{
+    if (!updateThreadsAfterImport()) {
+        return false;
+    }
+
+    mImporting = false;
+    updateGroupedThreadsCache();
+    return true;
+}
+
+bool SQLiteHistoryPlugin::updateThreadsAfterImport()
+{
+    QStringList statements;
+    statements << "UPDATE threads SET count=(SELECT count(eventId) FROM text_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND messageType!=2), "
+                  "unreadCount=(SELECT count(eventId) FROM text_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND newEvent=1 AND messageType!=2), "
+                  "lastEventId=(SELECT eventId FROM text_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND messageType!=2 "
+                  "ORDER BY timestamp DESC LIMIT 1) "
+                  "WHERE type=0"
+               << "UPDATE threads SET count=(SELECT count(eventId) FROM voice_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId), "
+                  "unreadCount=(SELECT count(eventId) FROM voice_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND newEvent=1), "
+                  "lastEventId=(SELECT eventId FROM voice_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId "
+                  "ORDER BY timestamp DESC LIMIT 1) "
+                  "WHERE type=1"
+               << "UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM text_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND eventId=threads.lastEventId) "
+                  "WHERE type=0 AND lastEventId IS NOT NULL"
+               << "UPDATE threads SET lastEventTimestamp=(SELECT timestamp FROM voice_events WHERE "
+                  "accountId=threads.accountId AND threadId=threads.threadId AND eventId=threads.lastEventId) "
+                  "WHERE type=1 AND lastEventId IS NOT NULL"
+               << "DELETE FROM bulk_import";
+
+    SQLiteDatabase::instance()->beginTransation();
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    Q_FOREACH(const QString &statement, statements) {
+        if (!query.exec(statement)) {
+            qCritical() << "Failed to update the threads after the import:" << query.lastError() << query.lastQuery();
+            SQLiteDatabase::instance()->rollbackTransaction();
+            return false;
+        }
+    }
+    if (!SQLiteDatabase::instance()->finishTransaction()) {
+        qCritical() << "Failed to commit the transaction.";
+        return false;
+    }
+    return true;
+}
+
+bool SQLiteHistoryPlugin::checkpoint()
+{
+    return SQLiteDatabase::instance()->checkpoint();
+}
+
+bool SQLiteHistoryPlugin::supportsConcurrentReads()
+{
+    return SQLiteDatabase::instance()->concurrentReadsEnabled();
+}
+
 QString SQLiteHistoryPlugin::sqlQueryForThreads(History::EventType type, const QString &condition, const QString &order)
 {
     QString modifiedCondition = condition;
     if (!modifiedCondition.isEmpty()) {
         modifiedCondition.prepend(" AND ");
-        // FIXME: the filters should be implemented in a better way
-        modifiedCondition.replace("accountId=", "threads.accountId=");
-        modifiedCondition.replace("threadId=", "threads.threadId=");
-        modifiedCondition.replace("count=", "threads.count=");
-        modifiedCondition.replace("unreadCount=", "threads.unreadCount=");
     }
 
     QString modifiedOrder = order;
@@ -1218,6 +1675,8 @@ QString SQLiteHistoryPlugin::sqlQueryForThreads(History::EventType type, const Q
     fields << QString("%1.senderId").arg(table)
            << QString("%1.newEvent").arg(table);
     fields << extraFields;
+    // the rowid is used by the thread views to page through the results
+    fields << "threads.rowid";
 
     QString queryText = QString("SELECT %1 FROM threads LEFT JOIN %2 ON threads.threadId=%2.threadId AND "
                          "threads.accountId=%2.accountId AND threads.lastEventId=%2.eventId WHERE threads.type=%3 %4 %5")
@@ -1229,8 +1688,8 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
 {
     QList<QVariantMap> threads;
     QList<QVariantMap> threadsWithoutParticipants;
-    QSqlQuery attachmentsQuery(SQLiteDatabase::instance()->database());
-    QList<QVariantMap> attachments;
+    QList<QVariantMap> textThreads;
+    QList<QVariantMap> roomThreads;
     bool grouped = false;
     if (properties.contains(History::FieldGroupingProperty)) {
         grouped = properties[History::FieldGroupingProperty].toString() == History::FieldParticipants;
@@ -1247,6 +1706,8 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
         thread[History::FieldThreadId] = threadId;
         if (grouped) {
             const QString &threadKey = generateThreadMapKey(accountId, threadId);
+            // the views might be paged from the database reader threads
+            QReadLocker locker(&mCacheLock);
             if (mInitialised && type == History::EventTypeText && 
                 !mConversationsCache.contains(threadKey)) {
                 continue;
@@ -1266,110 +1727,21 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
 
         // the generic event fields
         thread[History::FieldSenderId] = query.value(6);
-        thread[History::FieldTimestamp] = toLocalTimeString(query.value(5).toDateTime());
+        thread[History::FieldTimestamp] = History::Utils::timestampToString(query.value(5));
         thread[History::FieldNewEvent] = query.value(7).toBool();
 
         // the next step is to get the last event
         switch (type) {
         case History::EventTypeText:
-            attachmentsQuery.prepare("SELECT attachmentId, contentType, filePath, status FROM text_event_attachments "
-                                "WHERE accountId=:accountId and threadId=:threadId and eventId=:eventId");
-            attachmentsQuery.bindValue(":accountId", query.value(0));
-            attachmentsQuery.bindValue(":threadId", query.value(1));
-            attachmentsQuery.bindValue(":eventId", query.value(2));
-            if (!attachmentsQuery.exec()) {
-                qCritical() << "Error:" << attachmentsQuery.lastError() << attachmentsQuery.lastQuery();
-            }
-
-            while (attachmentsQuery.next()) {
-                QVariantMap attachment;
-                attachment[History::FieldAccountId] = query.value(0);
-                attachment[History::FieldThreadId] = query.value(1);
-                attachment[History::FieldEventId] = query.value(2);
-                attachment[History::FieldAttachmentId] = attachmentsQuery.value(0);
-                attachment[History::FieldContentType] = attachmentsQuery.value(1);
-                attachment[History::FieldFilePath] = attachmentsQuery.value(2);
-                attachment[History::FieldStatus] = attachmentsQuery.value(3);
-                attachments << attachment;
-
-            }
-            attachmentsQuery.clear();
-            if (attachments.size() > 0) {
-                thread[History::FieldAttachments] = QVariant::fromValue(attachments);
-                attachments.clear();
-            }
             thread[History::FieldMessage] = query.value(8);
             thread[History::FieldMessageType] = query.value(9);
             thread[History::FieldMessageStatus] = query.value(10);
-            thread[History::FieldReadTimestamp] = toLocalTimeString(query.value(11).toDateTime());
+            thread[History::FieldReadTimestamp] = History::Utils::timestampToString(query.value(11));
             thread[History::FieldChatType] = query.value(12).toUInt();
-
             if (thread[History::FieldChatType].toInt() == History::ChatTypeRoom) {
-                QVariantMap chatRoomInfo;
-                QSqlQuery query1(SQLiteDatabase::instance()->database());
-
-                query1.prepare("SELECT roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, subject, actor, timestamp, joined, selfRoles FROM chat_room_info WHERE accountId=:accountId AND threadId=:threadId AND type=:type LIMIT 1");
-                query1.bindValue(":accountId", thread[History::FieldAccountId]);
-                query1.bindValue(":threadId", thread[History::FieldThreadId]);
-                query1.bindValue(":type", thread[History::FieldType].toInt());
-
-                if (!query1.exec()) {
-                    qCritical() << "Failed to get chat room info for thread: Error:" << query1.lastError() << query1.lastQuery();
-                    break;
-                }
-                query1.next();
-
-                if (query1.value(0).isValid())
-                    chatRoomInfo["RoomName"] = query1.value(0);
-                if (query1.value(1).isValid())
-                    chatRoomInfo["Server"] = query1.value(1);
-                if (query1.value(2).isValid())
-                    chatRoomInfo["Creator"] = query1.value(2);
-                if (query1.value(3).isValid())
-                    chatRoomInfo["CreationTimestamp"] = toLocalTimeString(query1.value(3).toDateTime());
-                if (query1.value(4).isValid())
-                    chatRoomInfo["Anonymous"] = query1.value(4).toBool();
-                if (query1.value(5).isValid())
-                    chatRoomInfo["InviteOnly"] = query1.value(5).toBool();
-                if (query1.value(6).isValid())
-                    chatRoomInfo["Limit"] = query1.value(6).toInt();
-                if (query1.value(7).isValid())
-                    chatRoomInfo["Moderated"] = query1.value(7).toBool();
-                if (query1.value(8).isValid())
-                    chatRoomInfo["Title"] = query1.value(8);
-                if (query1.value(9).isValid())
-                    chatRoomInfo["Description"] = query1.value(9);
-                if (query1.value(10).isValid())
-                    chatRoomInfo["Persistent"] = query1.value(10).toBool();
-                if (query1.value(11).isValid())
-                    chatRoomInfo["Private"] = query1.value(11).toBool();
-                if (query1.value(12).isValid())
-                    chatRoomInfo["PasswordProtected"] = query1.value(12).toBool();
-                if (query1.value(13).isValid())
-                    chatRoomInfo["Password"] = query1.value(13);
-                if (query1.value(14).isValid())
-                    chatRoomInfo["PasswordHint"] = query1.value(14);
-                if (query1.value(15).isValid())
-                    chatRoomInfo["CanUpdateConfiguration"] = query1.value(15).toBool();
-                if (query1.value(16).isValid())
-                    chatRoomInfo["Subject"] = query1.value(16);
-                if (query1.value(17).isValid())
-                    chatRoomInfo["Actor"] = query1.value(17);
-                if (query1.value(18).isValid())
-                    chatRoomInfo["Timestamp"] = toLocalTimeString(query1.value(18).toDateTime());
-                if (query1.value(19).isValid())
-                    chatRoomInfo["Joined"] = query1.value(19).toBool();
-                if (query1.value(20).isValid())
-                    chatRoomInfo["SelfRoles"] = query1.value(20).toInt();
-
-                thread[History::FieldChatRoomInfo] = chatRoomInfo;
-            }
-            if (!History::Utils::shouldIncludeParticipants(History::Thread::fromProperties(thread))) {
-                thread.remove(History::FieldParticipants);
-                threadsWithoutParticipants << thread;
-            } else {
-                threads << thread;
+                roomThreads << thread;
             }
+            textThreads << thread;
             break;
         case History::EventTypeVoice:
             thread[History::FieldMissed] = query.value(9);
@@ -1383,6 +1755,31 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
         }
     }
 
+    // fetch the attachments and the chat room info for the whole page at once
+    if (!textThreads.isEmpty()) {
+        QHash<QString, QList<QVariantMap> > attachments = attachmentsForEvents(textThreads);
+        QHash<QString, QVariantMap> chatRoomInfos = chatRoomInfoForThreads(type, roomThreads);
+
+        Q_FOREACH(QVariantMap thread, textThreads) {
+            QString accountId = thread[History::FieldAccountId].toString();
+            QString threadId = thread[History::FieldThreadId].toString();
+            QString eventKey = generateEventKey(accountId, threadId, thread[History::FieldEventId].toString());
+            if (attachments.contains(eventKey)) {
+                thread[History::FieldAttachments] = QVariant::fromValue(attachments[eventKey]);
+            }
+            if (thread[History::FieldChatType].toInt() == History::ChatTypeRoom) {
+                thread[History::FieldChatRoomInfo] = chatRoomInfos.value(generateThreadMapKey(accountId, threadId));
+            }
+
+            if (!History::Utils::shouldIncludeParticipants(History::Thread::fromProperties(thread))) {
+                thread.remove(History::FieldParticipants);
+                threadsWithoutParticipants << thread;
+            } else {
+                threads << thread;
+            }
+        }
+    }
+
     // get the participants
     threads = participantsForThreads(threads);
 
@@ -1392,7 +1789,8 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
     return threads;
 }
 
-QString SQLiteHistoryPlugin::sqlQueryForEvents(History::EventType type, const QString &condition, const QString &order)
+QString SQLiteHistoryPlugin::sqlQueryForEvents(History::EventType type, const QString &condition, const QString &order,
+                                              const QString &matchColumn)
 {
     QString modifiedCondition = condition;
     if (!modifiedCondition.isEmpty()) {
@@ -1404,17 +1802,26 @@ QString SQLiteHistoryPlugin::sqlQueryForEvents(History::EventType type, const QS
                                 "AND thread_participants.threadId=%1.threadId "
                                 "AND thread_participants.type=%2 GROUP BY accountId,threadId,type) as participants";
     QString queryText;
+    QString snippetField;
     switch (type) {
     case History::EventTypeText:
         // for text events we don't need the participants at all
         participantsField = "\"\" as participants";
+        // the excerpt of the text matching a full-text search, bound to :matchSnippetQuery. The matches are
+        // delimited with control characters, replaced by the markup once the text got escaped
+        if (!matchColumn.isEmpty()) {
+            snippetField = QString("(SELECT snippet(text_events_fts, -1, char(2), char(3), '...', 12) FROM text_events_fts "
+                                   "WHERE text_events_fts.%1 MATCH :matchSnippetQuery AND text_events_fts.rowid=text_events.rowid) as %2, ")
+                                   .arg(matchColumn, History::FieldMatchSnippet);
+        }
         queryText = QString("SELECT accountId, threadId, eventId, senderId, timestamp, newEvent, %1, "
-                            "message, messageType, messageStatus, readTimestamp, subject, informationType, sentTime FROM text_events %2 %3").arg(participantsField, modifiedCondition, order);
+                            "message, messageType, messageStatus, readTimestamp, subject, informationType, sentTime, %4rowid FROM text_events %2 %3")
+                            .arg(participantsField, modifiedCondition, order, snippetField);
         break;
     case History::EventTypeVoice:
         participantsField = participantsField.arg("voice_events", QString::number(type));
         queryText = QString("SELECT accountId, threadId, eventId, senderId, timestamp, newEvent, %1, "
-                            "duration, missed, remoteParticipant FROM voice_events %2 %3").arg(participantsField, modifiedCondition, order);
+                            "duration, missed, remoteParticipant, voice_events.rowid FROM voice_events %2 %3").arg(participantsField, modifiedCondition, order);
         break;
     case History::EventTypeNull:
         qWarning("SQLiteHistoryPlugin::sqlQueryForEvents: Got EventTypeNull, ignoring this event!");
@@ -1427,6 +1834,8 @@ QString SQLiteHistoryPlugin::sqlQueryForEvents(History::EventType type, const QS
 QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType type, QSqlQuery &query)
 {
     QList<QVariantMap> events;
+    QList<int> multiPartEvents;
+    int snippetColumn = query.record().indexOf(History::FieldMatchSnippet);
     while (query.next()) {
         QVariantMap event;
         History::MessageType messageType;
@@ -1444,7 +1853,7 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType typ
         event[History::FieldThreadId] = threadId;
         event[History::FieldEventId] = eventId;
         event[History::FieldSenderId] = query.value(3);
-        event[History::FieldTimestamp] = toLocalTimeString(query.value(4).toDateTime());
+        event[History::FieldTimestamp] = History::Utils::timestampToString(query.value(4));
         event[History::FieldNewEvent] = query.value(5).toBool();
         if (type != History::EventTypeText) {
             QStringList participants = query.value(6).toString().split("|,|");
@@ -1455,41 +1864,22 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType typ
         case History::EventTypeText:
             messageType = (History::MessageType) query.value(8).toInt();
             if (messageType == History::MessageTypeMultiPart)  {
-                QSqlQuery attachmentsQuery(SQLiteDatabase::instance()->database());
-                attachmentsQuery.prepare("SELECT attachmentId, contentType, filePath, status FROM text_event_attachments "
-                                    "WHERE accountId=:accountId and threadId=:threadId and eventId=:eventId");
-                attachmentsQuery.bindValue(":accountId", accountId);
-                attachmentsQuery.bindValue(":threadId", threadId);
-                attachmentsQuery.bindValue(":eventId", eventId);
-                if (!attachmentsQuery.exec()) {
-                    qCritical() << "Error:" << attachmentsQuery.lastError() << attachmentsQuery.lastQuery();
-                }
-
-                QList<QVariantMap> attachments;
-                while (attachmentsQuery.next()) {
-                    QVariantMap attachment;
-                    attachment[History::FieldAccountId] = accountId;
-                    attachment[History::FieldThreadId] = threadId;
-                    attachment[History::FieldEventId] = eventId;
-                    attachment[History::FieldAttachmentId] = attachmentsQuery.value(0);
-                    attachment[History::FieldContentType] = attachmentsQuery.value(1);
-                    attachment[History::FieldFilePath] = attachmentsQuery.value(2);
-                    attachment[History::FieldStatus] = attachmentsQuery.value(3);
-                    attachments << attachment;
-
-                }
-                attachmentsQuery.clear();
-                event[History::FieldAttachments] = QVariant::fromValue(attachments);
+                multiPartEvents << events.count();
             }
             event[History::FieldMessage] = query.value(7);
             event[History::FieldMessageType] = query.value(8);
             event[History::FieldMessageStatus] = query.value(9);
-            event[History::FieldReadTimestamp] = toLocalTimeString(query.value(10).toDateTime());
-            event[History::FieldSentTime] = toLocalTimeString(query.value(13).toDateTime());
+            event[History::FieldReadTimestamp] = History::Utils::timestampToString(query.value(10));
+            event[History::FieldSentTime] = History::Utils::timestampToString(query.value(13));
             if (!query.value(11).toString().isEmpty()) {
                 event[History::FieldSubject] = query.value(11).toString();
             }
             event[History::FieldInformationType] = query.value(12).toInt();
+            if (snippetColumn >= 0 && !query.value(snippetColumn).toString().isEmpty()) {
+                event[History::FieldMatchSnippet] = query.value(snippetColumn).toString().toHtmlEscaped()
+                                                                          .replace(QChar(2), "<b>")
+                                                                          .replace(QChar(3), "</b>");
+            }
             break;
         case History::EventTypeVoice:
             event[History::FieldDuration] = query.value(7).toInt();
@@ -1503,6 +1893,23 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType typ
 
         events << event;
     }
+
+    // and fetch the attachments of all the multipart events at once
+    if (!multiPartEvents.isEmpty()) {
+        QList<QVariantMap> keys;
+        Q_FOREACH(int index, multiPartEvents) {
+            keys << events[index];
+        }
+        QHash<QString, QList<QVariantMap> > attachments = attachmentsForEvents(keys);
+        Q_FOREACH(int index, multiPartEvents) {
+            QVariantMap &event = events[index];
+            QString eventKey = generateEventKey(event[History::FieldAccountId].toString(),
+                                                event[History::FieldThreadId].toString(),
+                                                event[History::FieldEventId].toString());
+            event[History::FieldAttachments] = QVariant::fromValue(attachments.value(eventKey));
+        }
+    }
+
     return events;
 }
 
@@ -1511,72 +1918,24 @@ QString SQLiteHistoryPlugin::toLocalTimeString(const QDateTime &timestamp)
     return QDateTime(timestamp.date(), timestamp.time(), Qt::UTC).toLocalTime().toString(timestampFormat);
 }
 
-QString SQLiteHistoryPlugin::filterToString(const History::Filter &filter, QVariantMap &bindValues, const QString &propertyPrefix) const
+QString SQLiteHistoryPlugin::sqlSeekCondition(const QString &sortColumn, const QString &rowIdColumn, Qt::SortOrder order,
+                                              bool nullKeys, bool hasCursor) const
 {
-    QString result;
-    History::Filters filters;
-    QString linking;
-    QString value;
-    int count;
-    QString filterProperty = filter.filterProperty();
-    QVariant filterValue = filter.filterValue();
-
-    switch (filter.type()) {
-    case History::FilterTypeIntersection:
-        filters = History::IntersectionFilter(filter).filters();
-        linking = " AND ";
-        // fall through
-    case History::FilterTypeUnion:
-        if (filter.type() == History::FilterTypeUnion) {
-            filters = History::UnionFilter(filter).filters();
-            linking = " OR ";
-        }
-
-        if (filters.isEmpty()) {
-            break;
-        }
-
-        result = "( ";
-        count = filters.count();
-        for (int i = 0; i < count; ++i) {
-            // run recursively through the inner filters
-            result += QString("(%1)").arg(filterToString(filters[i], bindValues, propertyPrefix));
-            if (i != count-1) {
-                result += linking;
-            }
-        }
-        result += " )";
-        break;
-    default:
-        if (filterProperty.isEmpty() || filterValue.isNull()) {
-            break;
-        }
-
-        QString bindId = QString(":filterValue%1").arg(bindValues.count());
-
-        QString propertyName = propertyPrefix.isNull() ? filterProperty : QString("%1.%2").arg(propertyPrefix, filterProperty);
-        // FIXME: need to check for other match flags and multiple match flags
-        if (filter.matchFlags() & History::MatchContains) {
-            // FIXME: maybe we should use QString("%1 LIKE '\%'||%2'\%'").arg(bindId) ?? needs more time for investigating
-            result = QString("%1 LIKE '\%%2\%' ESCAPE '\\'").arg(propertyName, escapeFilterValue(filterValue.toString()));
-        } else if (filter.matchFlags() & History::MatchNotEquals) {
-            result = QString("%1!=%2").arg(propertyName, bindId);
-            bindValues[bindId] = filterValue;
-        } else {
-            result = QString("%1=%2").arg(propertyName, bindId);
-            bindValues[bindId] = filterValue;
+    // NULL keys sort before every other value, so they are paged through separately
+    // and the remaining condition can be answered by a range scan on the sort index.
+    QString comparison = order == Qt::AscendingOrder ? ">" : "<";
+    if (nullKeys) {
+        QString condition = QString("%1 IS NULL").arg(sortColumn);
+        if (hasCursor) {
+            condition += QString(" AND %1%2:cursorRowId").arg(rowIdColumn, comparison);
         }
+        return condition;
     }
 
-    return result;
+    QString condition = QString("%1 IS NOT NULL").arg(sortColumn);
+    if (hasCursor) {
+        condition += QString(" AND %1%2=:cursorKey AND (%1%2:cursorKey2 OR %3%2:cursorRowId)").arg(sortColumn, comparison, rowIdColumn);
+    }
+    return condition;
 }
 
-QString SQLiteHistoryPlugin::escapeFilterValue(const QString &value) const
-{
-    QString escaped = value;
-    escaped.replace("\\", "\\\\")
-           .replace("'", "''")
-           .replace("%", "\\%")
-           .replace("_", "\\_");
-    return escaped;
-}
@@ -24,7 +24,9 @@
 
 #include "plugin.h"
 #include "thread.h"
+#include <QHash>
 #include <QObject>
+#include <QReadWriteLock>
 #include <QSqlQuery>
 
 class SQLiteHistoryReader;
@@ -88,31 +90,52 @@ public:
     bool beginBatchOperation();
     bool endBatchOperation();
     bool rollbackBatchOperation();
+    bool beginImport();
+    bool endImport();
+    bool checkpoint();
+    bool supportsConcurrentReads();
 
     // functions to be used internally
     QString sqlQueryForThreads(History::EventType type, const QString &condition, const QString &order);
     QList<QVariantMap> parseThreadResults(History::EventType type, QSqlQuery &query, const QVariantMap &properties = QVariantMap());
 
-    QString sqlQueryForEvents(History::EventType type, const QString &condition, const QString &order);
+    QString sqlQueryForEvents(History::EventType type, const QString &condition, const QString &order,
+                              const QString &matchColumn = QString());
     QList<QVariantMap> parseEventResults(History::EventType type, QSqlQuery &query);
 
     static QString toLocalTimeString(const QDateTime &timestamp);
 
-    QString filterToString(const History::Filter &filter, QVariantMap &bindValues, const QString &propertyPrefix = QString()) const;
-    QString escapeFilterValue(const QString &value) const;
+    QString sqlSeekCondition(const QString &sortColumn, const QString &rowIdColumn, Qt::SortOrder order,
+                             bool nullKeys, bool hasCursor) const;
 
     void generateContactCache();
+    bool loadContactCache();
+    bool saveContactCache();
 
 private:
-    bool lessThan(const QVariantMap &left, const QVariantMap &right) const;
     void updateGroupedThreadsCache();
+    bool updateThreadsAfterImport();
+    QString contactCachePath() const;
     void updateDisplayedThread(const QString &displayedThreadKey);
     void addThreadsToCache(const QList<QVariantMap> &threads);
     void removeThreadFromCache(const QVariantMap &thread);
+    static QString groupingFingerprint(const History::Thread &thread);
+    void indexThread(const QString &threadKey, const History::Thread &thread);
+    void unindexThread(const QString &threadKey);
+    QHash<QString, QList<QVariantMap> > attachmentsForEvents(const QList<QVariantMap> &events);
+    QHash<QString, QVariantMap> chatRoomInfoForThreads(History::EventType type, const QList<QVariantMap> &threads);
     QVariantMap cachedThreadProperties(const History::Thread &thread) const;
     QMap<QString, History::Threads> mConversationsCache;
     QMap<QString, QString> mConversationsCacheKeys;
+    // grouped threads indexed by their participants, so that new threads don't need to be compared to all the others
+    QMultiHash<QString, QString> mGroupingIndex;
+    QHash<QString, QString> mGroupingFingerprints;
+    // the views read the caches from the database reader threads
+    mutable QReadWriteLock mCacheLock;
     bool mInitialised;
+    bool mImporting;
+    // the cache generation of the saved caches, they don't need saving again until it moves
+    qint64 mSavedCacheGeneration;
 };
 
 #endif // SQLITEHISTORYPLUGIN_H
@@ -21,11 +21,13 @@
 
 #include "sqlitehistorythreadview.h"
 #include "sqlitedatabase.h"
+#include "sqlitefiltercompiler.h"
 #include "sqlitehistoryplugin.h"
 #include "sort.h"
 #include <QDateTime>
 #include <QDebug>
 #include <QSqlError>
+#include <QSqlRecord>
 
 SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
                                                  History::EventType type,
@@ -33,14 +35,38 @@ SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
                                                  const History::Filter &filter,
                                                  const QVariantMap &properties)
     : History::PluginThreadView(), mPlugin(plugin), mType(type), mSort(sort),
-      mFilter(filter), mPageSize(15), mQuery(SQLiteDatabase::instance()->database()), mOffset(0), mValid(true), mQueryProperties(properties)
+      mFilter(filter), mQuery(SQLiteDatabase::instance()->readConnection()), mOffset(0), mValid(true), mQueryProperties(properties),
+      mHasCursor(false), mCursorPhase(0)
 {
+    SQLiteFilterCompiler compiler(type, SQLiteFilterCompiler::TargetThreads);
+    if (!compiler.compile(filter)) {
+        mValid = false;
+        return;
+    }
+    QString condition = compiler.condition();
+    QVariantMap filterValues = compiler.bindValues();
+
+    // threads sorted by the last event timestamp can be paged straight from the index,
+    // without copying the whole result set into a temporary table
+    if (sort.sortField().trimmed() == History::FieldLastEventTimestamp) {
+        mCursorColumn = "threads.lastEventTimestamp";
+        mCondition = condition;
+        mFilterValues = filterValues;
+
+        // the cursor is read back from the last row of each page
+        mQuery.setForwardOnly(false);
+        if (!mQuery.prepare(mPlugin->sqlQueryForThreads(type, condition, QString()))) {
+            qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+            mValid = false;
+            Q_EMIT Invalidated();
+        }
+        mQuery.clear();
+        return;
+    }
+
     mTemporaryTable = QString("threadview%1%2").arg(QString::number((qulonglong)this), QDateTime::currentDateTimeUtc().toString("yyyyMMddhhmmsszzz"));
     mQuery.setForwardOnly(true);
 
-    // FIXME: validate the filter
-    QVariantMap filterValues;
-    QString condition = mPlugin->filterToString(filter, filterValues);
     QString order;
     if (!sort.sortField().isNull()) {
         // WORKAROUND: Supports multiple fields by split it using ','
@@ -79,19 +105,30 @@ SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
 
 SQLiteHistoryThreadView::~SQLiteHistoryThreadView()
 {
+    if (mTemporaryTable.isEmpty()) {
+        return;
+    }
+
     if (!mQuery.exec(QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable))) {
         qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
         return;
     }
 }
 
-QList<QVariantMap> SQLiteHistoryThreadView::NextPage()
+QList<QVariantMap> SQLiteHistoryThreadView::fetchPage(int pageSize)
 {
     QList<QVariantMap> threads;
+    if (!mValid) {
+        return threads;
+    }
+
+    if (!mCursorColumn.isEmpty()) {
+        return nextCursorPage(pageSize);
+    }
 
     // now prepare for selecting from it
     mQuery.prepare(QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
-                                                                      QString::number(mPageSize), QString::number(mOffset)));
+                                                                      QString::number(pageSize), QString::number(mOffset)));
     if (!mQuery.exec()) {
         qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
         mValid = false;
@@ -100,12 +137,86 @@ QList<QVariantMap> SQLiteHistoryThreadView::NextPage()
     }
 
     threads = mPlugin->parseThreadResults(mType, mQuery, mQueryProperties);
-    mOffset += mPageSize;
+    mOffset += pageSize;
     mQuery.clear();
 
     return threads;
 }
 
+QList<QVariantMap> SQLiteHistoryThreadView::nextCursorPage(int pageSize)
+{
+    QList<QVariantMap> threads;
+    if (!mValid) {
+        return threads;
+    }
+
+    QString direction = mSort.sortOrder() == Qt::AscendingOrder ? "ASC" : "DESC";
+
+    // the threads without a timestamp sort before all the others, so they get paged in their own phase.
+    // keep fetching until the page is full, as grouped threads might be filtered out by the plugin
+    while (threads.count() < pageSize && mCursorPhase < 2) {
+        bool nullKeys = (mCursorPhase == 0) == (mSort.sortOrder() == Qt::AscendingOrder);
+        QString condition = mPlugin->sqlSeekCondition(mCursorColumn, "threads.rowid", mSort.sortOrder(), nullKeys, mHasCursor);
+        if (!mCondition.isEmpty()) {
+            condition = QString("%1 AND %2").arg(mCondition, condition);
+        }
+        int limit = pageSize - threads.count();
+        QString order = QString("ORDER BY %1 %2, threads.rowid %2 LIMIT :limit").arg(mCursorColumn, direction);
+
+        // the statement only changes between the phases, so it is prepared again only then
+        QString queryText = mPlugin->sqlQueryForThreads(mType, condition, order);
+        if (queryText != mPreparedQuery) {
+            mPreparedQuery.clear();
+            if (!mQuery.prepare(queryText)) {
+                qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+                mValid = false;
+                Q_EMIT Invalidated();
+                return threads;
+            }
+            mPreparedQuery = queryText;
+        }
+
+        mQuery.bindValue(":limit", limit);
+        Q_FOREACH(const QString &key, mFilterValues.keys()) {
+            mQuery.bindValue(key, mFilterValues[key]);
+        }
+        if (mHasCursor) {
+            mQuery.bindValue(":cursorRowId", mCursorRowId);
+            if (!nullKeys) {
+                mQuery.bindValue(":cursorKey", mCursorKey);
+                mQuery.bindValue(":cursorKey2", mCursorKey);
+            }
+        }
+
+        if (!mQuery.exec()) {
+            qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+            mValid = false;
+            Q_EMIT Invalidated();
+            return threads;
+        }
+
+        threads += mPlugin->parseThreadResults(mType, mQuery, mQueryProperties);
+
+        // save the position of the last row and move to the next phase once this one is exhausted
+        int rows = 0;
+        if (mQuery.last()) {
+            rows = mQuery.at() + 1;
+            QSqlRecord record = mQuery.record();
+            mCursorKey = mQuery.value(record.indexOf("lastEventTimestamp"));
+            mCursorRowId = mQuery.value(record.count() - 1);
+            mHasCursor = true;
+        }
+        mQuery.finish();
+
+        if (rows < limit) {
+            mHasCursor = false;
+            ++mCursorPhase;
+        }
+    }
+
+    return threads;
+}
+
 bool SQLiteHistoryThreadView::IsValid() const
 {
     return mValid;
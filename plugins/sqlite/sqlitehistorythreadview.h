@@ -41,20 +41,33 @@ public:
                             const QVariantMap &properties);
     ~SQLiteHistoryThreadView();
 
-    QList<QVariantMap> NextPage();
     bool IsValid() const;
 
+protected:
+    QList<QVariantMap> fetchPage(int pageSize);
+
 private:
+    QList<QVariantMap> nextCursorPage(int pageSize);
+
     SQLiteHistoryPlugin *mPlugin;
     History::EventType mType;
     History::Sort mSort;
     History::Filter mFilter;
-    int mPageSize;
     QSqlQuery mQuery;
     QString mTemporaryTable;
     int mOffset;
     bool mValid;
     QVariantMap mQueryProperties;
+
+    // cursor mode: used instead of the temporary table when the sort field is indexed
+    QString mCursorColumn;
+    QString mCondition;
+    QVariantMap mFilterValues;
+    QString mPreparedQuery;
+    QVariant mCursorKey;
+    QVariant mCursorRowId;
+    bool mHasCursor;
+    int mCursorPhase;
 };
 
 #endif // SQLITEHISTORYTHREADVIEW_H
@@ -33,12 +33,31 @@
 #include <QContactDetailFilter>
 #include <QContactExtendedDetail>
 #include <QContactPhoneNumber>
+#include <QReadLocker>
+#include <QSet>
+#include <QThread>
+#include <QWriteLocker>
 
 using namespace QtContacts;
 
 namespace History
 {
 
+// how long to wait for more identifiers before looking up a batch, and the most identifiers in a batch
+static const int lookupBatchInterval = 20;
+static const int maxLookupBatchSize = 50;
+
+static QContactFetchHint lookupFetchHint()
+{
+    QContactFetchHint hint;
+    // FIXME: maybe we need to fetch the full contact?
+    hint.setDetailTypesHint(QList<QContactDetail::DetailType>() << QContactDetail::TypeDisplayLabel
+                                                                << QContactDetail::TypePhoneNumber
+                                                                << QContactDetail::TypeAvatar
+                                                                << QContactDetail::TypeExtendedDetail);
+    return hint;
+}
+
 ContactMatcher::ContactMatcher(QContactManager *manager, QObject *parent) :
     QObject(parent), mManager(manager)
 {
@@ -46,8 +65,28 @@ ContactMatcher::ContactMatcher(QContactManager *manager, QObject *parent) :
         mManager = new QContactManager("galera");
     }
 
-    // just trigger the creation of TelepathyHelper
-    connect(History::TelepathyHelper::instance(), SIGNAL(setupReady()), SLOT(onSetupReady()));
+    mLookupTimer.setSingleShot(true);
+    mLookupTimer.setInterval(lookupBatchInterval);
+    connect(&mLookupTimer, SIGNAL(timeout()), SLOT(flushLookups()));
+
+    // the addressable fields come from the accounts, which can only be used from the thread of
+    // TelepathyHelper, so they are worked out there even if the matcher lives in another thread
+    History::TelepathyHelper *helper = History::TelepathyHelper::instance();
+    connect(helper, &History::TelepathyHelper::accountAdded, helper, [this](const Tp::AccountPtr &account) {
+        updateAddressableFields(account);
+    });
+    connect(helper, &History::TelepathyHelper::setupReady, helper, [this]() {
+        loadAddressableFields();
+    });
+    if (helper->thread() == QThread::currentThread()) {
+        loadAddressableFields();
+    } else {
+        QTimer::singleShot(0, helper, [this]() {
+            loadAddressableFields();
+        });
+    }
+
+    connect(helper, SIGNAL(setupReady()), SLOT(onSetupReady()));
 
     QObject::connect(mManager, &QContactManager::contactsAdded,
                      this, &ContactMatcher::onContactsAdded);
@@ -73,7 +112,10 @@ ContactMatcher::~ContactMatcher()
         request->deleteLater();
     }
     mRequests.clear();
-    mContactMap.clear();
+    {
+        QWriteLocker locker(&mContactMapLock);
+        mContactMap.clear();
+    }
     mManager->deleteLater();
 }
 
@@ -93,15 +135,17 @@ ContactMatcher *ContactMatcher::instance(QContactManager *manager)
  */
 QVariantMap ContactMatcher::contactInfo(const QString &accountId, const QString &identifier, bool synchronous, const QVariantMap &properties)
 {
-    InternalContactMap &internalMap = mContactMap[accountId];
-
+    if (QThread::currentThread() != thread()) {
+        return contactInfoFromOtherThread(accountId, QStringList() << identifier, properties).value(0).toMap();
+    }
 
     QString normalizedId = normalizeId(identifier);
 
     QVariantMap map;
     // first do a simple string match on the map
-    if (internalMap.contains(normalizedId)) {
-        map = internalMap[normalizedId];
+    const QVariantMap *knownInfo = findContactInfo(accountId, normalizedId);
+    if (knownInfo) {
+        map = *knownInfo;
     } else if (History::TelepathyHelper::instance()->ready()) {
         // and if there was no match, asynchronously request the info, and return an empty map for now
         map = requestContactInfo(accountId, normalizedId, synchronous);
@@ -110,160 +154,224 @@ QVariantMap ContactMatcher::contactInfo(const QString &accountId, const QString
         mPendingRequests.append(info);
     }
 
-    map[History::FieldIdentifier] = normalizedId;
-    map[History::FieldAccountId] = accountId;
+    map = completeContactInfo(map, accountId, normalizedId, properties);
+    setContactInfo(accountId, normalizedId, map);
+    return map;
+}
 
-    QMapIterator<QString, QVariant> i(properties);
-    while (i.hasNext()) {
-        i.next();
-        if (!map.contains(i.key())) {
-            map[i.key()] = i.value();
-        }
+QVariantList ContactMatcher::contactInfo(const QString &accountId, const QStringList &identifiers, bool synchronous)
+{
+    if (QThread::currentThread() != thread()) {
+        return contactInfoFromOtherThread(accountId, identifiers, QVariantMap());
     }
 
-    mContactMap[accountId][normalizedId] = map;
-    return map;
+    return contactInfoForIdentifiers(accountId, identifiers, synchronous, QVariantMap());
 }
 
-QVariantList ContactMatcher::contactInfo(const QString &accountId, const QStringList &identifiers, bool synchronous)
+QVariantList ContactMatcher::contactInfoForIdentifiers(const QString &accountId, const QStringList &identifiers, bool synchronous, const QVariantMap &properties)
 {
+    // look all the unknown identifiers up at once instead of blocking on each of them
+    if (synchronous && identifiers.count() > 1 && History::TelepathyHelper::instance()->ready()) {
+        lookupContacts(accountId, identifiers);
+    }
+
     QVariantList contacts;
     Q_FOREACH(const QString &identifier, identifiers) {
-        contacts << contactInfo(accountId, identifier, synchronous);
+        contacts << contactInfo(accountId, identifier, synchronous, properties);
     }
     return contacts;
 }
 
+/// the contact map is only changed and the contact manager only used from the thread the matcher lives in,
+/// but other threads (like the database readers of the daemon) can read the map without waiting for that
+/// thread, which might be busy writing. The identifiers not known yet are returned without contact info,
+/// and looked up in the background like the asynchronous requests, so they are known the next time.
+QVariantList ContactMatcher::contactInfoFromOtherThread(const QString &accountId, const QStringList &identifiers, const QVariantMap &properties)
+{
+    QVariantList contacts;
+    QStringList unknownIdentifiers;
+    {
+        QReadLocker locker(&mContactMapLock);
+        Q_FOREACH(const QString &identifier, identifiers) {
+            QString normalizedId = normalizeId(identifier);
+            const QVariantMap *knownInfo = findContactInfo(accountId, normalizedId);
+            if (!knownInfo) {
+                unknownIdentifiers << normalizedId;
+            }
+            contacts << completeContactInfo(knownInfo ? *knownInfo : QVariantMap(), accountId, normalizedId, properties);
+        }
+    }
+
+    if (!unknownIdentifiers.isEmpty()) {
+        QMetaObject::invokeMethod(this, "contactInfoForIdentifiers", Qt::QueuedConnection,
+                                  Q_ARG(QString, accountId),
+                                  Q_ARG(QStringList, unknownIdentifiers),
+                                  Q_ARG(bool, false),
+                                  Q_ARG(QVariantMap, properties));
+    }
+    return contacts;
+}
+
+/// returns the info stored for the identifier, or null if it is not known. Unlike the map's operator[],
+/// this doesn't add the account to the map, which the other threads might be reading
+const QVariantMap *ContactMatcher::findContactInfo(const QString &accountId, const QString &identifier) const
+{
+    ContactMap::const_iterator accountIt = mContactMap.constFind(accountId);
+    if (accountIt == mContactMap.constEnd()) {
+        return 0;
+    }
+    InternalContactMap::const_iterator it = accountIt.value().constFind(identifier);
+    if (it == accountIt.value().constEnd()) {
+        return 0;
+    }
+    return &it.value();
+}
+
+/// adds the identifier, the account and the given properties not coming from the contact to the contact info
+QVariantMap ContactMatcher::completeContactInfo(const QVariantMap &info, const QString &accountId, const QString &identifier, const QVariantMap &properties)
+{
+    QVariantMap map = info;
+    map[History::FieldIdentifier] = identifier;
+    map[History::FieldAccountId] = accountId;
+
+    QMapIterator<QString, QVariant> i(properties);
+    while (i.hasNext()) {
+        i.next();
+        if (!map.contains(i.key())) {
+            map[i.key()] = i.value();
+        }
+    }
+    return map;
+}
+
 void ContactMatcher::watchIdentifier(const QString &accountId, const QString &identifier, const QVariantMap &currentInfo)
 {
     // only add the identifier to the map of watched identifiers
     QVariantMap map = currentInfo;
     map[History::FieldIdentifier] = identifier;
-    mContactMap[accountId][identifier] = map;
+    setContactInfo(accountId, identifier, map);
 }
 
-void ContactMatcher::onContactsAdded(QList<QContactId> ids)
+/// returns the contact info of all the identifiers known so far.
+/// Like the other methods changing the map, this should only be called from the thread the matcher lives in.
+ContactMap ContactMatcher::cachedContactInfo() const
 {
-    QList<QContact> contacts = mManager->contacts(ids);
-
-    // walk through the list of requested phone numbers
-    ContactMap::iterator it = mContactMap.begin();
-    ContactMap::iterator end = mContactMap.end();
-    for (; it != end; ++it) {
-        QString accountId = it.key();
+    return mContactMap;
+}
 
-        InternalContactMap &internalMap = it.value();
-        InternalContactMap::iterator it2 = internalMap.begin();
-        InternalContactMap::iterator end2 = internalMap.end();
-        for (; it2 != end2; ++it2) {
-            QString identifier = it2.key();
-            // skip entries that already have a match
-            if (hasMatch(it2.value())) {
+/**
+ * \brief Restores contact info saved by a previous run. The info is used right away for the identifiers
+ * not known yet, and each of them is looked up again asynchronously in case the contacts changed meanwhile.
+ */
+void ContactMatcher::restoreContactInfo(const ContactMap &contacts)
+{
+    bool ready = History::TelepathyHelper::instance()->ready();
+    ContactMap::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        const QString &accountId = it.key();
+        InternalContactMap::const_iterator infoIt = it.value().constBegin();
+        for (; infoIt != it.value().constEnd(); ++infoIt) {
+            if (findContactInfo(accountId, infoIt.key())) {
                 continue;
             }
-
-            // now for each entry not populated, check if it matches one of the newly added contacts
-            Q_FOREACH(const QContact &contact, contacts) {
-                QVariantMap map = matchAndUpdate(accountId, identifier, contact);
-                if (hasMatch(map)){
-                    break;
-                }
+            setContactInfo(accountId, infoIt.key(), infoIt.value());
+            if (ready) {
+                requestContactInfo(accountId, infoIt.key());
+            } else {
+                RequestInfo info{accountId, infoIt.key()};
+                mPendingRequests.append(info);
             }
         }
     }
 }
 
-void ContactMatcher::onContactsChanged(QList<QContactId> ids)
+void ContactMatcher::onContactsAdded(QList<QContactId> ids)
 {
     QList<QContact> contacts = mManager->contacts(ids);
 
-    // walk through the list of requested phone numbers
-    ContactMap::iterator it = mContactMap.begin();
-    ContactMap::iterator end = mContactMap.end();
-    for (; it != end; ++it) {
-        QString accountId = it.key();
-
-        InternalContactMap &internalMap = it.value();
-        InternalContactMap::iterator it2 = internalMap.begin();
-        InternalContactMap::iterator end2 = internalMap.end();
-        QStringList identifiersToMatch;
-
-        for (; it2 != end2; ++it2) {
-            QVariantMap &contactInfo = it2.value();
-            QString identifier = it2.key();
-
-            Q_FOREACH(const QContact &contact, contacts) {
-                bool previousMatch = (contactInfo.contains(History::FieldContactId) &&
-                                      contactInfo[History::FieldContactId].toString() == contact.id().toString());
-                QVariantMap map = matchAndUpdate(accountId, identifier, contact);
-                if (hasMatch(map)){
-                    break;
-                } else if (previousMatch) {
-                    // if there was a previous match but it does not match anymore, try to match the phone number
-                    // to a different contact
-                    identifiersToMatch << identifier;
-                    break;
-                }
+    // for each of the new contacts, check the identifiers it could match
+    Q_FOREACH(const QContact &contact, contacts) {
+        Q_FOREACH(const AccountIdentifier &entry, identifiersForContact(contact)) {
+            // skip entries that already have a match
+            const QVariantMap *knownInfo = findContactInfo(entry.first, entry.second);
+            if (knownInfo && hasMatch(*knownInfo)) {
+                continue;
             }
-        }
-
-        Q_FOREACH(const QString &identifier, identifiersToMatch) {
-            internalMap.remove(identifier);
-            requestContactInfo(accountId, identifier);
+            matchAndUpdate(entry.first, entry.second, contact);
         }
     }
 }
 
-void ContactMatcher::onContactsRemoved(QList<QContactId> ids)
+void ContactMatcher::onContactsChanged(QList<QContactId> ids)
 {
-    // search for entries that were matching this  contact
-    ContactMap::iterator it = mContactMap.begin();
-    ContactMap::iterator end = mContactMap.end();
-    for (; it != end; ++it) {
-        QString accountId = it.key();
-        InternalContactMap &internalMap = it.value();
-        InternalContactMap::iterator it2 = internalMap.begin();
-        InternalContactMap::iterator end2 = internalMap.end();
+    QList<QContact> contacts = mManager->contacts(ids);
+    QSet<AccountIdentifier> handledIdentifiers;
+    QList<AccountIdentifier> identifiersToMatch;
 
-        QStringList identifiersToMatch;
+    // the identifiers a changed contact can affect are the ones matched to it and the ones it matches now
+    Q_FOREACH(const QContact &contact, contacts) {
+        QString contactId = contact.id().toString();
+        QList<AccountIdentifier> entries = mContactIdIndex.values(contactId) + identifiersForContact(contact);
 
-        for (; it2 != end2; ++it2) {
-            QVariantMap &info = it2.value();
-            // skip entries that didn't have a match
-            if (!hasMatch(info)) {
+        Q_FOREACH(const AccountIdentifier &entry, entries) {
+            if (handledIdentifiers.contains(entry)) {
                 continue;
             }
 
-            Q_FOREACH(const QContactId &id, ids) {
-                if (id.toString() == info[History::FieldContactId].toString()) {
-                    identifiersToMatch << it2.key();
-                    break;
-                }
+            const QVariantMap *contactInfo = findContactInfo(entry.first, entry.second);
+            bool previousMatch = (contactInfo && contactInfo->contains(History::FieldContactId) &&
+                                  contactInfo->value(History::FieldContactId).toString() == contactId);
+            QVariantMap map = matchAndUpdate(entry.first, entry.second, contact);
+            if (hasMatch(map)) {
+                handledIdentifiers << entry;
+            } else if (previousMatch) {
+                // if there was a previous match but it does not match anymore, try to match the phone number
+                // to a different contact
+                handledIdentifiers << entry;
+                identifiersToMatch << entry;
             }
         }
+    }
 
-        // now make sure to try a new match on the phone numbers whose contact was removed
-        Q_FOREACH(const QString &identifier, identifiersToMatch) {
-            internalMap.remove(identifier);
-            Q_EMIT contactInfoChanged(accountId, identifier, contactInfo(accountId, identifier));
-        }
+    Q_FOREACH(const AccountIdentifier &entry, identifiersToMatch) {
+        removeContactInfo(entry.first, entry.second);
+        requestContactInfo(entry.first, entry.second);
+    }
+}
+
+void ContactMatcher::onContactsRemoved(QList<QContactId> ids)
+{
+    // search for entries that were matching the removed contacts
+    QList<AccountIdentifier> identifiersToMatch;
+    Q_FOREACH(const QContactId &id, ids) {
+        identifiersToMatch << mContactIdIndex.values(id.toString());
+    }
+
+    // now make sure to try a new match on the phone numbers whose contact was removed
+    Q_FOREACH(const AccountIdentifier &entry, identifiersToMatch) {
+        removeContactInfo(entry.first, entry.second);
+        Q_EMIT contactInfoChanged(entry.first, entry.second, contactInfo(entry.first, entry.second));
     }
 }
 
 void ContactMatcher::onDataChanged()
 {
-    ContactMap::iterator it = mContactMap.begin();
-    ContactMap::iterator end = mContactMap.end();
+    // invalidate the cache
+    ContactMap contactMap = mContactMap;
+    {
+        QWriteLocker locker(&mContactMapLock);
+        mContactMap.clear();
+    }
+    mContactIdIndex.clear();
+    mKeyIndex.clear();
+    mIdentifierKeys.clear();
 
+    ContactMap::const_iterator it = contactMap.constBegin();
+    ContactMap::const_iterator end = contactMap.constEnd();
     for (; it != end; ++it) {
         QString accountId = it.key();
-        InternalContactMap &internalMap = it.value();
-
-        // invalidate the cache
-        QStringList identifiers = internalMap.keys();
-        internalMap.clear();
 
-        Q_FOREACH(const QString &identifier, identifiers) {
+        Q_FOREACH(const QString &identifier, it.value().keys()) {
             QVariantMap info;
             info[History::FieldIdentifier] = identifier;
             Q_EMIT contactInfoChanged(accountId, identifier, info);
@@ -287,15 +395,16 @@ void ContactMatcher::onRequestStateChanged(QContactAbstractRequest::State state)
     if (state == QContactAbstractRequest::FinishedState) {
         request->deleteLater();
 
-        RequestInfo info = mRequests.take(request);
-        QContact contact;
-        if (!request->contacts().isEmpty()) {
-            contact = request->contacts().first();
+        QList<RequestInfo> lookups = mRequests.take(request);
+        Q_FOREACH(const RequestInfo &info, lookups) {
+            mPendingLookups.remove(AccountIdentifier(info.accountId, info.identifier));
         }
-        matchAndUpdate(info.accountId, info.identifier, contact);
+        matchLookupResults(lookups, request->contacts());
     } else if (state == QContactAbstractRequest::CanceledState) {
         request->deleteLater();
-        mRequests.remove(request);
+        Q_FOREACH(const RequestInfo &info, mRequests.take(request)) {
+            mPendingLookups.remove(AccountIdentifier(info.accountId, info.identifier));
+        }
     }
 
 }
@@ -314,25 +423,50 @@ QVariantMap ContactMatcher::requestContactInfo(const QString &accountId, const Q
     contactInfo[History::FieldAccountId] = accountId;
 
     if (addressableVCardFields.isEmpty()) {
-        mContactMap[accountId][identifier] = contactInfo;
+        setContactInfo(accountId, identifier, contactInfo);
         // FIXME: add support for generic accounts
         return contactInfo;
     }
 
-    bool phoneCompare = addressableVCardFields.contains("tel");
+    if (synchronous) {
+        QContactFetchHint hint = lookupFetchHint();
+        hint.setMaxCountHint(1);
+        QList<QContact> contacts = mManager->contacts(filterForIdentifier(accountId, normalizedId), QList<QContactSortOrder>(), hint);
+        if (contacts.isEmpty()) {
+            setContactInfo(accountId, identifier, contactInfo);
+            return contactInfo;
+        }
+        // for synchronous requests, return the results right away.
+        return matchAndUpdate(accountId, normalizedId, contacts.first());
+    }
 
-    QContactFetchHint hint;
-    hint.setMaxCountHint(1);
-    // FIXME: maybe we need to fetch the full contact?
-    hint.setDetailTypesHint(QList<QContactDetail::DetailType>() << QContactDetail::TypeDisplayLabel
-                                                                << QContactDetail::TypePhoneNumber
-                                                                << QContactDetail::TypeAvatar
-                                                                << QContactDetail::TypeExtendedDetail);
+    // check if there is a lookup already going on for the given contact, and if so just wait for it to finish
+    AccountIdentifier entry(accountId, normalizedId);
+    if (mPendingLookups.contains(entry)) {
+        return QVariantMap();
+    }
 
+    // otherwise queue it for the next batch
+    RequestInfo info;
+    info.accountId = accountId;
+    info.identifier = normalizedId;
+    mLookupBatch << info;
+    mPendingLookups << entry;
+    if (mLookupBatch.count() >= maxLookupBatchSize) {
+        flushLookups();
+    } else if (!mLookupTimer.isActive()) {
+        mLookupTimer.start();
+    }
+    return QVariantMap();
+}
+
+/// the filter matching the contacts the identifier could belong to, according to the addressable fields of the account
+QContactFilter ContactMatcher::filterForIdentifier(const QString &accountId, const QString &identifier)
+{
     QContactUnionFilter topLevelFilter;
-    Q_FOREACH(const QString &field, addressableVCardFields) {
+    Q_FOREACH(const QString &field, addressableFields(accountId)) {
         if (field == "tel") {
-            topLevelFilter.append(QContactPhoneNumber::match(normalizedId));
+            topLevelFilter.append(QContactPhoneNumber::match(identifier));
         } else {
             // FIXME: handle more fields
             // rely on a generic field filter
@@ -344,7 +478,7 @@ QVariantMap ContactMatcher::requestContactInfo(const QString &accountId, const Q
             QContactDetailFilter valueFilter = QContactDetailFilter();
             valueFilter.setDetailType(QContactExtendedDetail::Type, QContactExtendedDetail::FieldData);
             valueFilter.setMatchFlags(QContactFilter::MatchExactly);
-            valueFilter.setValue(normalizedId);
+            valueFilter.setValue(identifier);
 
             QContactIntersectionFilter intersectionFilter;
             intersectionFilter.append(nameFilter);
@@ -353,43 +487,96 @@ QVariantMap ContactMatcher::requestContactInfo(const QString &accountId, const Q
             topLevelFilter.append(intersectionFilter);
         }
     }
+    return topLevelFilter;
+}
 
-    if (synchronous) {
-        QList<QContact> contacts = mManager->contacts(topLevelFilter, QList<QContactSortOrder>(), hint);
-        if (contacts.isEmpty()) {
-            mContactMap[accountId][identifier] = contactInfo;
-            return contactInfo;
-        }
-        // for synchronous requests, return the results right away.
-        return matchAndUpdate(accountId, normalizedId, contacts.first());
-    } else {
-        // check if there is a request already going on for the given contact
-        Q_FOREACH(const RequestInfo &info, mRequests.values()) {
-            if (info.accountId != accountId) {
-                // skip to the next item
-                continue;
-            }
+/// starts a single fetch request for all the identifiers queued since the last one
+void ContactMatcher::flushLookups()
+{
+    mLookupTimer.stop();
+    if (mLookupBatch.isEmpty()) {
+        return;
+    }
 
-            if (info.identifier == normalizedId) {
-                // if so, just wait for it to finish
-                return QVariantMap();
-            }
-        }
+    QContactUnionFilter filter;
+    Q_FOREACH(const RequestInfo &info, mLookupBatch) {
+        filter.append(filterForIdentifier(info.accountId, info.identifier));
+    }
 
-        QContactFetchRequest *request = new QContactFetchRequest(this);
-        request->setFetchHint(hint);
-        request->setFilter(topLevelFilter);
-        request->setManager(mManager);
-        QObject::connect(request, &QContactFetchRequest::stateChanged,
-                         this, &ContactMatcher::onRequestStateChanged);
+    QContactFetchRequest *request = new QContactFetchRequest(this);
+    request->setFetchHint(lookupFetchHint());
+    request->setFilter(filter);
+    request->setManager(mManager);
+    QObject::connect(request, &QContactFetchRequest::stateChanged,
+                     this, &ContactMatcher::onRequestStateChanged);
 
+    mRequests[request] = mLookupBatch;
+    mLookupBatch.clear();
+    request->start();
+}
+
+/// synchronously looks up the unknown identifiers of the list, in batches, so that the
+/// contact info of all of them is known afterwards
+void ContactMatcher::lookupContacts(const QString &accountId, const QStringList &identifiers)
+{
+    if (addressableFields(accountId).isEmpty()) {
+        return;
+    }
+
+    QList<RequestInfo> lookups;
+    QSet<QString> queued;
+    Q_FOREACH(const QString &identifier, identifiers) {
+        QString normalizedId = normalizeId(identifier);
+        if (findContactInfo(accountId, normalizedId) || queued.contains(normalizedId)) {
+            continue;
+        }
         RequestInfo info;
         info.accountId = accountId;
         info.identifier = normalizedId;
-        mRequests[request] = info;
-        request->start();
+        lookups << info;
+        queued << normalizedId;
+    }
+
+    for (int i = 0; i < lookups.count(); i += maxLookupBatchSize) {
+        QList<RequestInfo> batch = lookups.mid(i, maxLookupBatchSize);
+        QContactUnionFilter filter;
+        Q_FOREACH(const RequestInfo &info, batch) {
+            filter.append(filterForIdentifier(info.accountId, info.identifier));
+        }
+        matchLookupResults(batch, mManager->contacts(filter, QList<QContactSortOrder>(), lookupFetchHint()));
+
+        // the identifiers without a contact are known now too, so they are not looked up again
+        Q_FOREACH(const RequestInfo &info, batch) {
+            if (!findContactInfo(accountId, info.identifier)) {
+                QVariantMap contactInfo;
+                contactInfo[History::FieldIdentifier] = info.identifier;
+                contactInfo[History::FieldAccountId] = accountId;
+                setContactInfo(accountId, info.identifier, contactInfo);
+            }
+        }
+    }
+}
+
+/// fans the contacts fetched for a batch out to the identifiers they were fetched for
+void ContactMatcher::matchLookupResults(const QList<RequestInfo> &lookups, const QList<QContact> &contacts)
+{
+    QList<QSet<QString> > keys;
+    Q_FOREACH(const QContact &contact, contacts) {
+        keys << contactKeys(contact).toSet();
+    }
+
+    Q_FOREACH(const RequestInfo &info, lookups) {
+        QSet<QString> identifierKeySet = identifierKeys(info.accountId, info.identifier).toSet();
+        for (int i = 0; i < contacts.count(); ++i) {
+            // only try the contacts sharing a phone number or address with the identifier
+            if (!keys[i].intersects(identifierKeySet)) {
+                continue;
+            }
+            if (hasMatch(matchAndUpdate(info.accountId, info.identifier, contacts[i]))) {
+                break;
+            }
+        }
     }
-    return QVariantMap();
 }
 
 QVariantList ContactMatcher::toVariantList(const QList<int> &list)
@@ -452,7 +639,7 @@ QVariantMap ContactMatcher::matchAndUpdate(const QString &accountId, const QStri
         contactInfo[History::FieldAlias] = QContactDisplayLabel(contact.detail(QContactDetail::TypeDisplayLabel)).label();
         contactInfo[History::FieldAvatar] = QContactAvatar(contact.detail(QContactDetail::TypeAvatar)).imageUrl().toString();
 
-        mContactMap[accountId][identifier] = contactInfo;
+        setContactInfo(accountId, identifier, contactInfo);
         Q_EMIT contactInfoChanged(accountId, identifier, contactInfo);
     }
 
@@ -460,34 +647,52 @@ QVariantMap ContactMatcher::matchAndUpdate(const QString &accountId, const QStri
     return contactInfo;
 }
 
-QStringList ContactMatcher::addressableFields(const QString &accountId)
+QStringList ContactMatcher::addressableFields(const QString &accountId) const
 {
-    if (mAddressableFields.contains(accountId)) {
-        return mAddressableFields[accountId];
+    {
+        QReadLocker locker(&mAddressableFieldsLock);
+        QMap<QString, QStringList>::const_iterator it = mAddressableFields.constFind(accountId);
+        if (it != mAddressableFields.constEnd()) {
+            return it.value();
+        }
     }
 
     // FIXME: hardcoding account IDs here is not a good idea, we have to fix addressable fields on
     // the protocols themselves
     if (accountId.startsWith("irc/irc")) {
-        QStringList empty;
-        mAddressableFields[accountId] = empty;
-        return empty;
+        return QStringList();
     }
 
-    Tp::AccountPtr account = History::TelepathyHelper::instance()->accountForId(accountId);
-    QStringList fields;
-    if (!account.isNull()) {
-        fields = account->protocolInfo().addressableVCardFields();
+    // fallback to phone number matching for the accounts not loaded yet
+    return QStringList() << "tel";
+}
+
+/// stores the addressable fields of the account, to be called from the thread of TelepathyHelper
+void ContactMatcher::updateAddressableFields(const Tp::AccountPtr &account)
+{
+    if (account.isNull()) {
+        return;
     }
 
-    // fallback to phone number matching in case everything else fails
-    if (fields.isEmpty()) {
-        fields << "tel";
+    QString accountId = account->uniqueIdentifier();
+    QStringList fields;
+    if (!accountId.startsWith("irc/irc")) {
+        fields = account->protocolInfo().addressableVCardFields();
+        // fallback to phone number matching in case everything else fails
+        if (fields.isEmpty()) {
+            fields << "tel";
+        }
     }
 
+    QWriteLocker locker(&mAddressableFieldsLock);
     mAddressableFields[accountId] = fields;
+}
 
-    return fields;
+void ContactMatcher::loadAddressableFields()
+{
+    Q_FOREACH(const Tp::AccountPtr &account, History::TelepathyHelper::instance()->accounts()) {
+        updateAddressableFields(account);
+    }
 }
 
 bool ContactMatcher::hasMatch(const QVariantMap &map) const
@@ -495,6 +700,92 @@ bool ContactMatcher::hasMatch(const QVariantMap &map) const
     return (map.contains(History::FieldContactId) && !map[History::FieldContactId].toString().isEmpty());
 }
 
+void ContactMatcher::setContactInfo(const QString &accountId, const QString &identifier, const QVariantMap &info)
+{
+    QWriteLocker locker(&mContactMapLock);
+    InternalContactMap &internalMap = mContactMap[accountId];
+    AccountIdentifier entry(accountId, identifier);
+
+    InternalContactMap::const_iterator it = internalMap.constFind(identifier);
+    if (it == internalMap.constEnd()) {
+        QStringList keys = identifierKeys(accountId, identifier);
+        Q_FOREACH(const QString &key, keys) {
+            mKeyIndex.insert(key, entry);
+        }
+        mIdentifierKeys[entry] = keys;
+    } else if (hasMatch(it.value())) {
+        mContactIdIndex.remove(it.value()[History::FieldContactId].toString(), entry);
+    }
+
+    if (hasMatch(info)) {
+        mContactIdIndex.insert(info[History::FieldContactId].toString(), entry);
+    }
+    internalMap[identifier] = info;
+}
+
+void ContactMatcher::removeContactInfo(const QString &accountId, const QString &identifier)
+{
+    QWriteLocker locker(&mContactMapLock);
+    InternalContactMap &internalMap = mContactMap[accountId];
+    InternalContactMap::iterator it = internalMap.find(identifier);
+    if (it == internalMap.end()) {
+        return;
+    }
+
+    AccountIdentifier entry(accountId, identifier);
+    if (hasMatch(it.value())) {
+        mContactIdIndex.remove(it.value()[History::FieldContactId].toString(), entry);
+    }
+    Q_FOREACH(const QString &key, mIdentifierKeys.take(entry)) {
+        mKeyIndex.remove(key, entry);
+    }
+    internalMap.erase(it);
+}
+
+/// the keys a contact detail needs to share with the identifier to match it in \ref matchAndUpdate:
+/// the identifier itself for the generic fields, and the comparison key of the phone number
+QStringList ContactMatcher::identifierKeys(const QString &accountId, const QString &identifier)
+{
+    QStringList keys;
+    keys << identifier;
+    if (addressableFields(accountId).contains("tel")) {
+        QString key = History::PhoneUtils::comparisonKey(History::PhoneUtils::normalizePhoneNumber(identifier));
+        if (key != identifier) {
+            keys << key;
+        }
+    }
+    return keys;
+}
+
+QStringList ContactMatcher::contactKeys(const QContact &contact) const
+{
+    QStringList keys;
+    Q_FOREACH(const QContactPhoneNumber number, contact.details(QContactDetail::TypePhoneNumber)) {
+        keys << History::PhoneUtils::comparisonKey(History::PhoneUtils::normalizePhoneNumber(number.number()));
+    }
+    Q_FOREACH(const QContactExtendedDetail detail, contact.details(QContactDetail::TypeExtendedDetail)) {
+        keys << detail.data().toString();
+    }
+    keys.removeDuplicates();
+    return keys;
+}
+
+/// returns the identifiers the contact could match, the ones sharing a key with any of its details
+QList<AccountIdentifier> ContactMatcher::identifiersForContact(const QContact &contact) const
+{
+    QList<AccountIdentifier> entries;
+    QSet<AccountIdentifier> found;
+    Q_FOREACH(const QString &key, contactKeys(contact)) {
+        Q_FOREACH(const AccountIdentifier &entry, mKeyIndex.values(key)) {
+            if (!found.contains(entry)) {
+                found << entry;
+                entries << entry;
+            }
+        }
+    }
+    return entries;
+}
+
 QString ContactMatcher::normalizeId(const QString &id)
 {
     QString normalizedId = id;
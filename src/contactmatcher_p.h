@@ -22,10 +22,16 @@
 #ifndef CONTACTMATCHER_P_H
 #define CONTACTMATCHER_P_H
 
+#include <QMultiHash>
 #include <QObject>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QTimer>
 #include <QVariantMap>
 #include <QContactFetchRequest>
 #include <QContactManager>
+#include <TelepathyQt/Types>
 
 using namespace QtContacts;
 
@@ -34,6 +40,8 @@ namespace History
 
 typedef QMap<QString, QVariantMap> InternalContactMap;
 typedef QMap<QString, InternalContactMap> ContactMap;
+// an account id and one of the identifiers of the contact map
+typedef QPair<QString, QString> AccountIdentifier;
 
 typedef struct {
     QString accountId;
@@ -51,6 +59,10 @@ public:
     // this will only watch for contact changes affecting the identifier, but won't fetch contact info
     void watchIdentifier(const QString &accountId, const QString &identifier, const QVariantMap &currentInfo = QVariantMap());
 
+    // the known contact info, to be saved and restored between runs
+    ContactMap cachedContactInfo() const;
+    void restoreContactInfo(const ContactMap &contacts);
+
     static QString normalizeId(const QString &id);
 
 Q_SIGNALS:
@@ -63,21 +75,51 @@ protected Q_SLOTS:
     void onDataChanged();
     void onRequestStateChanged(QContactAbstractRequest::State state);
     void onSetupReady();
+    void flushLookups();
 
 protected:
+    Q_INVOKABLE QVariantList contactInfoForIdentifiers(const QString &accountId, const QStringList &identifiers, bool synchronous, const QVariantMap &properties);
+    QVariantList contactInfoFromOtherThread(const QString &accountId, const QStringList &identifiers, const QVariantMap &properties);
+    const QVariantMap *findContactInfo(const QString &accountId, const QString &identifier) const;
+    static QVariantMap completeContactInfo(const QVariantMap &info, const QString &accountId, const QString &identifier, const QVariantMap &properties);
     QVariantMap requestContactInfo(const QString &accountId, const QString &identifier, bool synchronous = false);
+    QContactFilter filterForIdentifier(const QString &accountId, const QString &identifier);
+    void lookupContacts(const QString &accountId, const QStringList &identifiers);
+    void matchLookupResults(const QList<RequestInfo> &lookups, const QList<QContact> &contacts);
     QVariantList toVariantList(const QList<int> &list);
     QVariantMap matchAndUpdate(const QString &accountId, const QString &identifier, const QContact &contact);
-    QStringList addressableFields(const QString &accountId);
+    QStringList addressableFields(const QString &accountId) const;
+    void updateAddressableFields(const Tp::AccountPtr &account);
+    void loadAddressableFields();
     bool hasMatch(const QVariantMap &map) const;
 
+    // all the changes to the contact map go through these, so the indexes are kept in sync
+    void setContactInfo(const QString &accountId, const QString &identifier, const QVariantMap &info);
+    void removeContactInfo(const QString &accountId, const QString &identifier);
+    QStringList identifierKeys(const QString &accountId, const QString &identifier);
+    QStringList contactKeys(const QContact &contact) const;
+    QList<AccountIdentifier> identifiersForContact(const QContact &contact) const;
+
 private:
     explicit ContactMatcher(QContactManager *manager = 0, QObject *parent = 0);
     ~ContactMatcher();
 
     ContactMap mContactMap;
-    QMap<QContactFetchRequest*, RequestInfo> mRequests;
+    // only the thread the matcher lives in changes the contact map, the lock is for the other threads reading it
+    mutable QReadWriteLock mContactMapLock;
+    // reverse indexes of the contact map: the identifiers matched to each contact id,
+    // and the identifiers a contact with a given phone number or address could match
+    QMultiHash<QString, AccountIdentifier> mContactIdIndex;
+    QMultiHash<QString, AccountIdentifier> mKeyIndex;
+    QHash<AccountIdentifier, QStringList> mIdentifierKeys;
+    QMap<QContactFetchRequest*, QList<RequestInfo> > mRequests;
+    // the identifiers waiting for the next batch, and all the ones queued or being fetched
+    QList<RequestInfo> mLookupBatch;
+    QSet<AccountIdentifier> mPendingLookups;
+    QTimer mLookupTimer;
+    // filled from the thread of TelepathyHelper, which is not necessarily the one the matcher lives in
     QMap<QString, QStringList> mAddressableFields;
+    mutable QReadWriteLock mAddressableFieldsLock;
     QList<RequestInfo> mPendingRequests;
     QContactManager *mManager;
 };
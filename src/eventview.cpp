@@ -27,18 +27,36 @@
 #include "sort.h"
 #include "textevent.h"
 #include "voiceevent.h"
+#include "payloadcodec_p.h"
+#include <QDBusConnection>
 #include <QDBusInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDBusReply>
+#include <QDebug>
 
 namespace History
 {
 
+// the changes sent to the subscribed views, with the slots handling them in the plain and in the encoded form
+static const struct {
+    const char *name;
+    const char *slot;
+    const char *encodedSlot;
+} subscribedSignals[] = {
+    { "EventsAdded", SLOT(_d_subscribedEventsAdded(QList<QVariantMap>)), SLOT(_d_subscribedEventsAddedEncoded(QByteArray)) },
+    { "EventsModified", SLOT(_d_subscribedEventsModified(QList<QVariantMap>)), SLOT(_d_subscribedEventsModifiedEncoded(QByteArray)) },
+    { "EventsRemoved", SLOT(_d_subscribedEventsRemoved(QList<QVariantMap>)), SLOT(_d_subscribedEventsRemovedEncoded(QByteArray)) }
+};
+
 // ------------- EventViewPrivate ------------------------------------------------
 
 EventViewPrivate::EventViewPrivate(History::EventType theType,
                                    const History::Sort &theSort,
                                    const History::Filter &theFilter)
-    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0)
+    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0),
+      encodingVersion(PayloadCodec::requestedVersion()), queryWatcher(0), pageRequested(false),
+      pageSize(-1), readAhead(false)
 {
 }
 
@@ -90,6 +108,269 @@ void EventViewPrivate::_d_eventsRemoved(const Events &events)
     }
 }
 
+void EventViewPrivate::_d_subscribedEventsAdded(const QList<QVariantMap> &events)
+{
+    Q_Q(EventView);
+
+    // the service only sends the events matching this view
+    Events subscribed = eventsFromProperties(events);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->eventsAdded(subscribed);
+    }
+}
+
+void EventViewPrivate::_d_subscribedEventsModified(const QList<QVariantMap> &events)
+{
+    Q_Q(EventView);
+
+    // the service only sends the events matching this view
+    Events subscribed = eventsFromProperties(events);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->eventsModified(subscribed);
+    }
+}
+
+void EventViewPrivate::_d_subscribedEventsRemoved(const QList<QVariantMap> &events)
+{
+    Q_Q(EventView);
+
+    // the service only sends the events matching this view
+    Events subscribed = eventsFromProperties(events);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->eventsRemoved(subscribed);
+    }
+}
+
+void EventViewPrivate::_d_subscribedEventsAddedEncoded(const QByteArray &payload)
+{
+    _d_subscribedEventsAdded(decodeSubscribed(payload));
+}
+
+void EventViewPrivate::_d_subscribedEventsModifiedEncoded(const QByteArray &payload)
+{
+    _d_subscribedEventsModified(decodeSubscribed(payload));
+}
+
+void EventViewPrivate::_d_subscribedEventsRemovedEncoded(const QByteArray &payload)
+{
+    _d_subscribedEventsRemoved(decodeSubscribed(payload));
+}
+
+QList<QVariantMap> EventViewPrivate::decodeSubscribed(const QByteArray &payload)
+{
+    bool ok = false;
+    QList<QVariantMap> events = PayloadCodec::decode(payload, &ok);
+    if (!ok) {
+        qWarning() << "Failed to decode the subscribed events";
+        return QList<QVariantMap>();
+    }
+    return events;
+}
+
+QDBusPendingCall EventViewPrivate::callNextPage()
+{
+    if (encodingVersion > 0) {
+        return dbus->asyncCall("NextPageEncoded", encodingVersion);
+    }
+    return dbus->asyncCall("NextPage");
+}
+
+/// reads a page out of a NextPage or NextPageEncoded reply, falling back to the plain pages
+/// if the service doesn't support the encoding
+EventViewPrivate::PageResult EventViewPrivate::pageFromReply(const QDBusMessage &reply, QList<QVariantMap> &page)
+{
+    if (encodingVersion > 0) {
+        if (reply.type() == QDBusMessage::ErrorMessage &&
+            reply.errorName() != QDBusError::errorString(QDBusError::UnknownMethod)) {
+            return PageFailed;
+        }
+        QByteArray payload = reply.arguments().value(0).toByteArray();
+        if (payload.isEmpty()) {
+            encodingVersion = 0;
+            return PageRetry;
+        }
+        bool ok = false;
+        page = PayloadCodec::decode(payload, &ok);
+        return ok ? PageReady : PageFailed;
+    }
+
+    QDBusReply<QList<QVariantMap> > plainReply(reply);
+    if (!plainReply.isValid()) {
+        return PageFailed;
+    }
+    page = plainReply.value();
+    return PageReady;
+}
+
+bool EventViewPrivate::fetchNextPage(QList<QVariantMap> &page)
+{
+    Q_FOREVER {
+        QDBusPendingCall call = callNextPage();
+        call.waitForFinished();
+        PageResult result = pageFromReply(call.reply(), page);
+        if (result != PageRetry) {
+            return result == PageReady;
+        }
+    }
+}
+
+void EventViewPrivate::requestPage()
+{
+    Q_Q(EventView);
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(callNextPage(), q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        pageFinished(watcher->reply());
+    });
+}
+
+void EventViewPrivate::pageFinished(const QDBusMessage &reply)
+{
+    Q_Q(EventView);
+
+    QList<QVariantMap> page;
+    switch (pageFromReply(reply, page)) {
+    case PageRetry:
+        requestPage();
+        return;
+    case PageFailed:
+        pageRequested = false;
+        valid = false;
+        Q_EMIT q->invalidated();
+        return;
+    case PageReady:
+        pageRequested = false;
+        Q_EMIT q->pageReady(eventsFromProperties(page));
+        return;
+    }
+}
+
+/// handles the reply to QueryEvents, requesting the first page if it was asked for in the meantime
+void EventViewPrivate::queryFinished()
+{
+    Q_Q(EventView);
+
+    // a blocking call might have handled the reply already
+    QDBusPendingCallWatcher *watcher = queryWatcher;
+    if (!watcher) {
+        return;
+    }
+    queryWatcher = 0;
+    watcher->deleteLater();
+
+    QDBusPendingReply<QString> reply = *watcher;
+    if (!reply.isValid() || reply.value().isEmpty()) {
+        valid = false;
+        if (pageRequested) {
+            pageRequested = false;
+            Q_EMIT q->pageReady(Events());
+        }
+        Q_EMIT q->invalidated();
+        return;
+    }
+
+    objectPath = reply.value();
+    dbus = new QDBusInterface(History::DBusService, objectPath, History::EventViewInterface,
+                              QDBusConnection::sessionBus(), q);
+    sendPagingOptions();
+    subscribe(encodingVersion);
+    if (pageRequested) {
+        requestPage();
+    }
+}
+
+void EventViewPrivate::sendPagingOptions()
+{
+    // services not supporting these keep their fixed page size
+    if (pageSize >= 0) {
+        dbus->asyncCall("SetPageSize", pageSize);
+    }
+    if (readAhead) {
+        dbus->asyncCall("SetReadAhead", readAhead);
+    }
+}
+
+/// asks the service to send the changes matching this view straight to it, so that the ones
+/// broadcast to every client can be ignored. With the payload encoding they come through the *Encoded signals.
+void EventViewPrivate::subscribe(int version)
+{
+    Q_Q(EventView);
+
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    for (const auto &subscribedSignal : subscribedSignals) {
+        if (version > 0) {
+            connection.connect(History::DBusService, objectPath, History::EventViewInterface,
+                               QString(subscribedSignal.name) + "Encoded", q, subscribedSignal.encodedSlot);
+        } else {
+            connection.connect(History::DBusService, objectPath, History::EventViewInterface,
+                               subscribedSignal.name, q, subscribedSignal.slot);
+        }
+    }
+
+    QDBusPendingCall call = version > 0 ? dbus->asyncCall("SubscribeEncoded", version) : dbus->asyncCall("Subscribe");
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this, version](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        Q_Q(EventView);
+        if (watcher->isError()) {
+            // services not supporting the encoded subscriptions might still support the plain ones
+            if (version > 0 && watcher->error().type() == QDBusError::UnknownMethod) {
+                QDBusConnection connection = QDBusConnection::sessionBus();
+                for (const auto &subscribedSignal : subscribedSignals) {
+                    connection.disconnect(History::DBusService, objectPath, History::EventViewInterface,
+                                          QString(subscribedSignal.name) + "Encoded", q, subscribedSignal.encodedSlot);
+                }
+                subscribe(0);
+            }
+            // older services don't support subscriptions, keep filtering the broadcast changes then
+            return;
+        }
+
+        // the service replies before sending any change to this view, and the changes broadcast
+        // before the reply are not sent to it, so each change is handled exactly once
+        QObject::disconnect(Manager::instance(), SIGNAL(eventsAdded(History::Events)),
+                            q, SLOT(_d_eventsAdded(History::Events)));
+        QObject::disconnect(Manager::instance(), SIGNAL(eventsModified(History::Events)),
+                            q, SLOT(_d_eventsModified(History::Events)));
+        QObject::disconnect(Manager::instance(), SIGNAL(eventsRemoved(History::Events)),
+                            q, SLOT(_d_eventsRemoved(History::Events)));
+    });
+}
+
+bool EventViewPrivate::waitForQuery()
+{
+    if (queryWatcher) {
+        queryWatcher->waitForFinished();
+        queryFinished();
+    }
+    return valid;
+}
+
+Events EventViewPrivate::eventsFromProperties(const QList<QVariantMap> &eventsProperties)
+{
+    Events events;
+    Q_FOREACH(const QVariantMap &properties, eventsProperties) {
+        Event event;
+        switch (type) {
+        case EventTypeText:
+            event = TextEvent::fromProperties(properties);
+            break;
+        case EventTypeVoice:
+            event = VoiceEvent::fromProperties(properties);
+            break;
+        case EventTypeNull:
+            qWarning("EventView::nextPage(): Got EventTypeNull, ignoring this event!");
+            break;
+        }
+
+        if (!event.isNull()) {
+            events << event;
+        }
+    }
+    return events;
+}
+
 // ------------- EventView -------------------------------------------------------
 
 EventView::EventView(EventType type, const History::Sort &sort, const History::Filter &filter)
@@ -103,21 +384,14 @@ EventView::EventView(EventType type, const History::Sort &sort, const History::F
         return;
     }
 
-    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
-
-    QDBusReply<QString> reply = interface.call("QueryEvents",
-                                               (int) type,
-                                               sort.properties(),
-                                               filter.properties());
-    if (!reply.isValid()) {
-        Q_EMIT invalidated();
-        d_ptr->valid = false;
-        return;
-    }
-
-    d_ptr->objectPath = reply.value();
-    d_ptr->dbus = new QDBusInterface(History::DBusService, d_ptr->objectPath, History::EventViewInterface,
-                                     QDBusConnection::sessionBus(), this);
+    // the view is created in the background, nextPage() waits for it if needed
+    QDBusMessage message = QDBusMessage::createMethodCall(History::DBusService, History::DBusObjectPath,
+                                                          History::DBusInterface, "QueryEvents");
+    message << (int) type << sort.properties() << filter.properties();
+    d_ptr->queryWatcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(d_ptr->queryWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+        d_func()->queryFinished();
+    });
 
     connect(Manager::instance(),
             SIGNAL(eventsAdded(History::Events)),
@@ -137,8 +411,22 @@ EventView::EventView(EventType type, const History::Sort &sort, const History::F
 EventView::~EventView()
 {
     Q_D(EventView);
-    if (d->valid) {
-        d->dbus->call("Destroy");
+    if (d->queryWatcher) {
+        // the view is still being created, destroy it as soon as it is there
+        QDBusPendingCallWatcher *watcher = d->queryWatcher;
+        d->queryWatcher = 0;
+        watcher->disconnect(this);
+        watcher->setParent(Manager::instance());
+        connect(watcher, &QDBusPendingCallWatcher::finished, [](QDBusPendingCallWatcher *watcher) {
+            QDBusPendingReply<QString> reply = *watcher;
+            if (reply.isValid()) {
+                QDBusConnection::sessionBus().asyncCall(QDBusMessage::createMethodCall(History::DBusService, reply.value(),
+                                                                                       History::EventViewInterface, "Destroy"));
+            }
+            watcher->deleteLater();
+        });
+    } else if (d->valid) {
+        d->dbus->asyncCall("Destroy");
     }
 }
 
@@ -147,39 +435,68 @@ QList<Event> EventView::nextPage()
     Q_D(EventView);
     QList<Event> events;
 
-    if (!d->valid) {
+    // the page requested with requestNextPage() is the next one, it is delivered by pageReady()
+    if (d->pageRequested) {
+        qWarning() << "A page was already requested for this view";
         return events;
     }
 
-    QDBusReply<QList<QVariantMap> > reply = d->dbus->call("NextPage");
+    if (!d->waitForQuery()) {
+        return events;
+    }
 
-    if (!reply.isValid()) {
+    QList<QVariantMap> eventsProperties;
+    d->pageRequested = true;
+    bool fetched = d->fetchNextPage(eventsProperties);
+    d->pageRequested = false;
+    if (!fetched) {
         d->valid = false;
         Q_EMIT invalidated();
         return events;
     }
 
-    QList<QVariantMap> eventsProperties = reply.value();
-    Q_FOREACH(const QVariantMap &properties, eventsProperties) {
-        Event event;
-        switch (d->type) {
-        case EventTypeText:
-            event = TextEvent::fromProperties(properties);
-            break;
-        case EventTypeVoice:
-            event = VoiceEvent::fromProperties(properties);
-            break;
-        case EventTypeNull:
-            qWarning("EventView::nextPage(): Got EventTypeNull, ignoring this event!");
-            break;
-        }
+    return d->eventsFromProperties(eventsProperties);
+}
 
-        if (!event.isNull()) {
-            events << event;
-        }
+/// requests the next page without blocking, pageReady() is emitted once it arrives.
+/// Only one page is requested at a time.
+void EventView::requestNextPage()
+{
+    Q_D(EventView);
+    if (!d->valid) {
+        Q_EMIT pageReady(Events());
+        return;
     }
 
-    return events;
+    if (d->pageRequested) {
+        return;
+    }
+
+    d->pageRequested = true;
+    if (!d->queryWatcher) {
+        d->requestPage();
+    }
+}
+
+/// sets the number of items per page, or 0 to let the service grow the pages while they are
+/// requested in quick succession. The service caps the size to its own maximum.
+void EventView::setPageSize(int size)
+{
+    Q_D(EventView);
+    d->pageSize = size;
+    if (d->valid && !d->queryWatcher) {
+        d->dbus->asyncCall("SetPageSize", size);
+    }
+}
+
+/// makes the service prepare the next page while the current one is being processed
+void EventView::setReadAhead(bool enabled)
+{
+    Q_D(EventView);
+    d->readAhead = enabled;
+    if (d->valid && !d->queryWatcher) {
+        d->dbus->asyncCall("SetReadAhead", enabled);
+    }
 }
 
 bool EventView::isValid() const
@@ -45,6 +45,9 @@ public:
     virtual ~EventView();
 
     QList<Event> nextPage();
+    void requestNextPage();
+    void setPageSize(int size);
+    void setReadAhead(bool enabled);
     bool isValid() const;
 
 Q_SIGNALS:
@@ -53,11 +56,18 @@ Q_SIGNALS:
     void eventsRemoved(const History::Events &events);
     void threadsRemoved(const History::Threads &threads);
     void invalidated();
+    void pageReady(const History::Events &events);
 
 private:
     Q_PRIVATE_SLOT(d_func(), void _d_eventsAdded(const History::Events &events))
     Q_PRIVATE_SLOT(d_func(), void _d_eventsModified(const History::Events &events))
     Q_PRIVATE_SLOT(d_func(), void _d_eventsRemoved(const History::Events &events))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsAdded(const QList<QVariantMap> &events))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsModified(const QList<QVariantMap> &events))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsRemoved(const QList<QVariantMap> &events))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsAddedEncoded(const QByteArray &payload))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsModifiedEncoded(const QByteArray &payload))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedEventsRemovedEncoded(const QByteArray &payload))
     QScopedPointer<EventViewPrivate> d_ptr;
 };
 
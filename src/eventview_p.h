@@ -26,6 +26,7 @@
 #include "filter.h"
 #include "sort.h"
 #include <QDBusInterface>
+#include <QDBusPendingCallWatcher>
 
 namespace History
 {
@@ -45,6 +46,29 @@ namespace History
         QString objectPath;
         bool valid;
         QDBusInterface *dbus;
+        int encodingVersion;
+        QDBusPendingCallWatcher *queryWatcher;
+        bool pageRequested;
+        int pageSize;
+        bool readAhead;
+
+        enum PageResult {
+            PageReady,
+            PageRetry,
+            PageFailed
+        };
+
+        QDBusPendingCall callNextPage();
+        PageResult pageFromReply(const QDBusMessage &reply, QList<QVariantMap> &page);
+        bool fetchNextPage(QList<QVariantMap> &page);
+        void requestPage();
+        void pageFinished(const QDBusMessage &reply);
+        void queryFinished();
+        void sendPagingOptions();
+        void subscribe(int version);
+        QList<QVariantMap> decodeSubscribed(const QByteArray &payload);
+        bool waitForQuery();
+        Events eventsFromProperties(const QList<QVariantMap> &eventsProperties);
 
         Events filteredEvents(const Events &events);
 
@@ -52,6 +76,12 @@ namespace History
         void _d_eventsAdded(const History::Events &events);
         void _d_eventsModified(const History::Events &events);
         void _d_eventsRemoved(const History::Events &events);
+        void _d_subscribedEventsAdded(const QList<QVariantMap> &events);
+        void _d_subscribedEventsModified(const QList<QVariantMap> &events);
+        void _d_subscribedEventsRemoved(const QList<QVariantMap> &events);
+        void _d_subscribedEventsAddedEncoded(const QByteArray &payload);
+        void _d_subscribedEventsModifiedEncoded(const QByteArray &payload);
+        void _d_subscribedEventsRemovedEncoded(const QByteArray &payload);
 
         EventView *q_ptr;
     };
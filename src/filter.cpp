@@ -25,6 +25,7 @@
 #include "unionfilter.h"
 #include <typeinfo>
 #include <QDebug>
+#include <QRegExp>
 
 namespace History
 {
@@ -92,6 +93,21 @@ bool FilterPrivate::match(const QVariantMap properties) const
         return true;
     }
 
+    // an approximation of the full-text query, good enough to tell if a new event belongs to a search
+    if (matchFlags & History::MatchFullText) {
+        QString text = properties[filterProperty].toString();
+        Q_FOREACH(QString term, filterValue.toString().split(QRegExp("\\s+"), QString::SkipEmptyParts)) {
+            term.remove('"');
+            if (term.endsWith('*')) {
+                term.chop(1);
+            }
+            if (!text.contains(term, Qt::CaseInsensitive)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     // FIXME: use the MatchFlags
     if (matchFlags & History::MatchNotEquals) {
         return properties[filterProperty] != filterValue;
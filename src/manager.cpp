@@ -32,6 +32,7 @@
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusReply>
+#include <QMetaMethod>
 
 namespace History
 {
@@ -76,6 +77,18 @@ Manager::Manager()
     connect(d->dbus.data(),
             SIGNAL(eventsRemoved(History::Events)),
             SIGNAL(eventsRemoved(History::Events)));
+    connect(d->dbus.data(),
+            SIGNAL(threadReady(int, History::Thread)),
+            SIGNAL(threadReady(int, History::Thread)));
+    connect(d->dbus.data(),
+            SIGNAL(eventReady(int, History::Event)),
+            SIGNAL(eventReady(int, History::Event)));
+    connect(d->dbus.data(),
+            SIGNAL(eventsWritten(int, bool)),
+            SIGNAL(eventsWritten(int, bool)));
+    connect(d->dbus.data(),
+            SIGNAL(historyReset()),
+            SIGNAL(historyReset()));
 
     // watch for the service going up and down
     connect(&d->serviceWatcher, &QDBusServiceWatcher::serviceRegistered, [&](const QString &serviceName) {
@@ -101,6 +114,37 @@ Manager::~Manager()
 {
 }
 
+/// the change notifications are only received from the service while something is connected to them
+void Manager::connectNotify(const QMetaMethod &signal)
+{
+    updateWatchedChanges(signal);
+}
+
+void Manager::disconnectNotify(const QMetaMethod &signal)
+{
+    updateWatchedChanges(signal);
+}
+
+void Manager::updateWatchedChanges(const QMetaMethod &signal)
+{
+    Q_D(Manager);
+    static const QList<QPair<QMetaMethod, QString> > changeSignals = {
+        qMakePair(QMetaMethod::fromSignal(&Manager::threadsAdded), QString("ThreadsAdded")),
+        qMakePair(QMetaMethod::fromSignal(&Manager::threadsModified), QString("ThreadsModified")),
+        qMakePair(QMetaMethod::fromSignal(&Manager::threadsRemoved), QString("ThreadsRemoved")),
+        qMakePair(QMetaMethod::fromSignal(&Manager::eventsAdded), QString("EventsAdded")),
+        qMakePair(QMetaMethod::fromSignal(&Manager::eventsModified), QString("EventsModified")),
+        qMakePair(QMetaMethod::fromSignal(&Manager::eventsRemoved), QString("EventsRemoved"))
+    };
+
+    // an invalid signal means everything got disconnected
+    for (const auto &changeSignal : changeSignals) {
+        if (!signal.isValid() || signal == changeSignal.first) {
+            d->dbus->setChangesWatched(changeSignal.second, isSignalConnected(changeSignal.first));
+        }
+    }
+}
+
 Manager *Manager::instance()
 {
     static Manager *self = new Manager();
@@ -204,6 +248,53 @@ bool Manager::removeEvents(const Events &events)
     return d->dbus->removeEvents(events);
 }
 
+/**
+ * @brief Request the thread matching the given properties to the service
+ * @return The id identifying the request
+ *
+ * This is the asynchronous version of @ref threadForProperties. When finished, the signal
+ * @ref threadReady will be emitted with the returned id and the thread, which is null if none matched.
+ */
+int Manager::requestThreadForProperties(const QString &accountId,
+                                        EventType type,
+                                        const QVariantMap &properties,
+                                        MatchFlags matchFlags,
+                                        bool create)
+{
+    Q_D(Manager);
+    return d->dbus->requestThreadForProperties(accountId, type, properties, matchFlags, create);
+}
+
+/**
+ * @brief Asynchronous version of @ref getSingleThread, the result is delivered by @ref threadReady
+ * @return The id identifying the request
+ */
+int Manager::requestSingleThread(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties)
+{
+    Q_D(Manager);
+    return d->dbus->requestSingleThread(type, accountId, threadId, properties);
+}
+
+/**
+ * @brief Asynchronous version of @ref getSingleEvent, the result is delivered by @ref eventReady
+ * @return The id identifying the request
+ */
+int Manager::requestSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId)
+{
+    Q_D(Manager);
+    return d->dbus->requestSingleEvent(type, accountId, threadId, eventId);
+}
+
+/**
+ * @brief Asynchronous version of @ref writeEvents, the result is delivered by @ref eventsWritten
+ * @return The id identifying the request
+ */
+int Manager::requestWriteEvents(const Events &events)
+{
+    Q_D(Manager);
+    return d->dbus->requestWriteEvents(events);
+}
+
 bool Manager::isServiceRunning() const
 {
     Q_D(const Manager);
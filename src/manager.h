@@ -75,6 +75,15 @@ public:
 
     void markThreadsAsRead(const History::Threads &thread);
 
+    int requestThreadForProperties(const QString &accountId,
+                                   EventType type,
+                                   const QVariantMap &properties,
+                                   History::MatchFlags matchFlags = History::MatchCaseSensitive,
+                                   bool create = false);
+    int requestSingleThread(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties = QVariantMap());
+    int requestSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId);
+    int requestWriteEvents(const History::Events &events);
+
     bool isServiceRunning() const;
 
 Q_SIGNALS:
@@ -87,10 +96,22 @@ Q_SIGNALS:
     void eventsModified(const History::Events &events);
     void eventsRemoved(const History::Events &events);
 
+    void threadReady(int requestId, const History::Thread &thread);
+    void eventReady(int requestId, const History::Event &event);
+    void eventsWritten(int requestId, bool success);
+
+    // the history was replaced in bulk, the views need to be queried again
+    void historyReset();
+
     void serviceRunningChanged();
 
+protected:
+    void connectNotify(const QMetaMethod &signal);
+    void disconnectNotify(const QMetaMethod &signal);
+
 private:
     Manager();
+    void updateWatchedChanges(const QMetaMethod &signal);
     QScopedPointer<ManagerPrivate> d_ptr;
 };
 
@@ -25,8 +25,12 @@
 #include "thread.h"
 #include "textevent.h"
 #include "voiceevent.h"
+#include "payloadcodec_p.h"
 #include <QDBusReply>
 #include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusServiceWatcher>
 
 #include <QDebug>
 
@@ -35,35 +39,118 @@ Q_DECLARE_METATYPE(QList< QVariantMap >)
 namespace History
 {
 
+// the change notifications, with the slots handling them in the plain and in the encoded form
+static const struct {
+    const char *name;
+    const char *slot;
+    const char *encodedSlot;
+} changeSignals[] = {
+    { "ThreadsAdded", SLOT(onThreadsAdded(QList<QVariantMap>)), SLOT(onThreadsAddedEncoded(QByteArray)) },
+    { "ThreadsModified", SLOT(onThreadsModified(QList<QVariantMap>)), SLOT(onThreadsModifiedEncoded(QByteArray)) },
+    { "ThreadsRemoved", SLOT(onThreadsRemoved(QList<QVariantMap>)), SLOT(onThreadsRemovedEncoded(QByteArray)) },
+    { "EventsAdded", SLOT(onEventsAdded(QList<QVariantMap>)), SLOT(onEventsAddedEncoded(QByteArray)) },
+    { "EventsModified", SLOT(onEventsModified(QList<QVariantMap>)), SLOT(onEventsModifiedEncoded(QByteArray)) },
+    { "EventsRemoved", SLOT(onEventsRemoved(QList<QVariantMap>)), SLOT(onEventsRemovedEncoded(QByteArray)) }
+};
+
 ManagerDBus::ManagerDBus(QObject *parent) :
     QObject(parent), mAdaptor(0), mInterface(DBusService,
                                              DBusObjectPath,
-                                             DBusInterface)
+                                             DBusInterface),
+    mEncodingVersion(0), mEncodingPending(false), mLastRequestId(0)
 {
     qDBusRegisterMetaType<QList<QVariantMap> >();
     qRegisterMetaType<QList<QVariantMap> >();
 
-    // listen for signals coming from the bus
+    // listen for signals coming from the bus, the change notifications are only listened to
+    // while something is connected to them, see setChangesWatched()
     QDBusConnection connection = QDBusConnection::sessionBus();
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsAdded",
-                       this, SLOT(onThreadsAdded(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsModified",
-                       this, SLOT(onThreadsModified(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsRemoved",
-                       this, SLOT(onThreadsRemoved(QList<QVariantMap>)));
-
     connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadParticipantsChanged",
                        this, SLOT(onThreadParticipantsChanged(QVariantMap,
                                                         QList<QVariantMap>,
                                                         QList<QVariantMap>,
                                                         QList<QVariantMap>)));
+    connection.connect(DBusService, DBusObjectPath, DBusInterface, "HistoryReset",
+                       this, SIGNAL(historyReset()));
+
+    // the registration for the encoded notifications is lost when the service restarts
+    if (PayloadCodec::requestedVersion() > 0) {
+        QDBusServiceWatcher *watcher = new QDBusServiceWatcher(DBusService, connection,
+                                                               QDBusServiceWatcher::WatchForRegistration, this);
+        connect(watcher, SIGNAL(serviceRegistered(QString)), SLOT(registerPayloadEncoding()));
+        registerPayloadEncoding();
+    }
+}
+
+void ManagerDBus::registerPayloadEncoding()
+{
+    // the service might send the changes in either form until it handled the registration
+    mEncodingPending = true;
+    updateChangeConnections();
 
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsAdded",
-                       this, SLOT(onEventsAdded(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsModified",
-                       this, SLOT(onEventsModified(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsRemoved",
-                       this, SLOT(onEventsRemoved(QList<QVariantMap>)));
+    QDBusPendingCall call = mInterface.asyncCall("RegisterPayloadEncoding", PayloadCodec::requestedVersion());
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, [this](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<int> reply = *watcher;
+        setPayloadEncoding(reply.isValid() ? reply.value() : 0);
+        watcher->deleteLater();
+    });
+}
+
+/// switches between the plain and the encoded notifications, services not supporting the encoding
+/// keep sending the plain ones
+void ManagerDBus::setPayloadEncoding(int version)
+{
+    mEncodingVersion = version;
+    mEncodingPending = false;
+    updateChangeConnections();
+}
+
+/// starts or stops listening to one of the change notifications of the service. The processes
+/// whose views get the changes sent to them directly don't need to get the broadcast ones too.
+void ManagerDBus::setChangesWatched(const QString &name, bool watched)
+{
+    if (watched) {
+        mWatchedChanges.insert(name);
+    } else {
+        mWatchedChanges.remove(name);
+    }
+    updateChangeConnections();
+}
+
+/// listens to the watched change notifications in the form the service sends them: the encoded ones once
+/// the service accepted the encoding, the plain ones otherwise, and both while the registration is pending
+void ManagerDBus::updateChangeConnections()
+{
+    bool plain = mEncodingPending || mEncodingVersion == 0;
+    bool encoded = mEncodingPending || mEncodingVersion > 0;
+
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    for (const auto &changeSignal : changeSignals) {
+        QString name(changeSignal.name);
+        QString encodedName = name + "Encoded";
+        bool watched = mWatchedChanges.contains(name);
+
+        if ((watched && plain) != mPlainChanges.contains(name)) {
+            if (watched && plain) {
+                connection.connect(DBusService, DBusObjectPath, DBusInterface, name, this, changeSignal.slot);
+                mPlainChanges.insert(name);
+            } else {
+                connection.disconnect(DBusService, DBusObjectPath, DBusInterface, name, this, changeSignal.slot);
+                mPlainChanges.remove(name);
+            }
+        }
+
+        if ((watched && encoded) != mEncodedChanges.contains(name)) {
+            if (watched && encoded) {
+                connection.connect(DBusService, DBusObjectPath, DBusInterface, encodedName, this, changeSignal.encodedSlot);
+                mEncodedChanges.insert(name);
+            } else {
+                connection.disconnect(DBusService, DBusObjectPath, DBusInterface, encodedName, this, changeSignal.encodedSlot);
+                mEncodedChanges.remove(name);
+            }
+        }
+    }
 }
 
 Thread ManagerDBus::threadForParticipants(const QString &accountId,
@@ -95,7 +182,7 @@ Thread ManagerDBus::threadForProperties(const QString &accountId,
                                         bool create)
 {
     Thread thread;
-    // FIXME: move to async call if possible
+    // requestThreadForProperties() is the non-blocking variant
     QDBusReply<QVariantMap> reply = mInterface.call("ThreadForProperties", accountId, (int) type, properties, (int)matchFlags, create);
     if (reply.isValid()) {
         QVariantMap properties = reply.value();
@@ -188,6 +275,66 @@ Event ManagerDBus::getSingleEvent(EventType type, const QString &accountId, cons
     return event;
 }
 
+int ManagerDBus::requestThreadForProperties(const QString &accountId,
+                                            EventType type,
+                                            const QVariantMap &properties,
+                                            MatchFlags matchFlags,
+                                            bool create)
+{
+    return watchThreadReply(mInterface.asyncCall("ThreadForProperties", accountId, (int) type, properties,
+                                                 (int)matchFlags, create));
+}
+
+int ManagerDBus::requestSingleThread(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties)
+{
+    return watchThreadReply(mInterface.asyncCall("GetSingleThread", (int)type, accountId, threadId, properties));
+}
+
+int ManagerDBus::requestSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId)
+{
+    int requestId = ++mLastRequestId;
+    QDBusPendingCall call = mInterface.asyncCall("GetSingleEvent", (int)type, accountId, threadId, eventId);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, [this, requestId](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        Q_EMIT eventReady(requestId, reply.isValid() ? eventFromProperties(reply.value()) : Event());
+        watcher->deleteLater();
+    });
+    return requestId;
+}
+
+int ManagerDBus::requestWriteEvents(const Events &events)
+{
+    int requestId = ++mLastRequestId;
+    QList<QVariantMap> eventMap = eventsToProperties(events);
+    if (eventMap.isEmpty()) {
+        // keep the reply asynchronous, callers only get to know the id after we return
+        QMetaObject::invokeMethod(this, "eventsWritten", Qt::QueuedConnection, Q_ARG(int, requestId), Q_ARG(bool, false));
+        return requestId;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("WriteEvents", QVariant::fromValue(eventMap));
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, [this, requestId](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<bool> reply = *watcher;
+        Q_EMIT eventsWritten(requestId, reply.isValid() && reply.value());
+        watcher->deleteLater();
+    });
+    return requestId;
+}
+
+int ManagerDBus::watchThreadReply(const QDBusPendingCall &call)
+{
+    int requestId = ++mLastRequestId;
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, [this, requestId](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        Q_EMIT threadReady(requestId, reply.isValid() ? Thread::fromProperties(reply.value()) : Thread());
+        watcher->deleteLater();
+    });
+    return requestId;
+}
+
 void ManagerDBus::onThreadsAdded(const QList<QVariantMap> &threads)
 {
     Q_EMIT threadsAdded(threadsFromProperties(threads));
@@ -229,6 +376,36 @@ void ManagerDBus::onEventsRemoved(const QList<QVariantMap> &events)
     Q_EMIT eventsRemoved(eventsFromProperties(events));
 }
 
+void ManagerDBus::onThreadsAddedEncoded(const QByteArray &payload)
+{
+    Q_EMIT threadsAdded(threadsFromProperties(payload));
+}
+
+void ManagerDBus::onThreadsModifiedEncoded(const QByteArray &payload)
+{
+    Q_EMIT threadsModified(threadsFromProperties(payload));
+}
+
+void ManagerDBus::onThreadsRemovedEncoded(const QByteArray &payload)
+{
+    Q_EMIT threadsRemoved(threadsFromProperties(payload));
+}
+
+void ManagerDBus::onEventsAddedEncoded(const QByteArray &payload)
+{
+    Q_EMIT eventsAdded(eventsFromProperties(payload));
+}
+
+void ManagerDBus::onEventsModifiedEncoded(const QByteArray &payload)
+{
+    Q_EMIT eventsModified(eventsFromProperties(payload));
+}
+
+void ManagerDBus::onEventsRemovedEncoded(const QByteArray &payload)
+{
+    Q_EMIT eventsRemoved(eventsFromProperties(payload));
+}
+
 Threads ManagerDBus::threadsFromProperties(const QList<QVariantMap> &threadsProperties)
 {
     Threads threads;
@@ -242,6 +419,11 @@ Threads ManagerDBus::threadsFromProperties(const QList<QVariantMap> &threadsProp
     return threads;
 }
 
+Threads ManagerDBus::threadsFromProperties(const QByteArray &payload)
+{
+    return threadsFromProperties(PayloadCodec::decode(payload));
+}
+
 QList<QVariantMap> ManagerDBus::threadsToProperties(const Threads &threads)
 {
     QList<QVariantMap> threadsPropertyMap;
@@ -281,6 +463,11 @@ Events ManagerDBus::eventsFromProperties(const QList<QVariantMap> &eventsPropert
     return events;
 }
 
+Events ManagerDBus::eventsFromProperties(const QByteArray &payload)
+{
+    return eventsFromProperties(PayloadCodec::decode(payload));
+}
+
 QList<QVariantMap> ManagerDBus::eventsToProperties(const Events &events)
 {
     QList<QVariantMap> eventsPropertyMap;
@@ -24,6 +24,7 @@
 
 #include <QDBusInterface>
 #include <QObject>
+#include <QSet>
 #include "types.h"
 #include "event.h"
 #include "thread.h"
@@ -58,6 +59,16 @@ public:
     Event getSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId);
     void markThreadsAsRead(const History::Threads &threads);
 
+    int requestThreadForProperties(const QString &accountId,
+                                   EventType type,
+                                   const QVariantMap &properties,
+                                   History::MatchFlags matchFlags,
+                                   bool create);
+    int requestSingleThread(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties);
+    int requestSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId);
+    int requestWriteEvents(const History::Events &events);
+    void setChangesWatched(const QString &name, bool watched);
+
 Q_SIGNALS:
     // signals that will be triggered after processing bus signals
     void threadsAdded(const History::Threads &threads);
@@ -72,6 +83,13 @@ Q_SIGNALS:
     void eventsModified(const History::Events &events);
     void eventsRemoved(const History::Events &events);
 
+    // replies to the asynchronous requests
+    void threadReady(int requestId, const History::Thread &thread);
+    void eventReady(int requestId, const History::Event &event);
+    void eventsWritten(int requestId, bool success);
+
+    void historyReset();
+
 protected Q_SLOTS:
     void onThreadsAdded(const QList<QVariantMap> &threads);
     void onThreadsModified(const QList<QVariantMap> &threads);
@@ -83,18 +101,37 @@ protected Q_SLOTS:
     void onEventsAdded(const QList<QVariantMap> &events);
     void onEventsModified(const QList<QVariantMap> &events);
     void onEventsRemoved(const QList<QVariantMap> &events);
+    void onThreadsAddedEncoded(const QByteArray &payload);
+    void onThreadsModifiedEncoded(const QByteArray &payload);
+    void onThreadsRemovedEncoded(const QByteArray &payload);
+    void onEventsAddedEncoded(const QByteArray &payload);
+    void onEventsModifiedEncoded(const QByteArray &payload);
+    void onEventsRemovedEncoded(const QByteArray &payload);
+    void registerPayloadEncoding();
 
 protected:
     Threads threadsFromProperties(const QList<QVariantMap> &threadsProperties);
+    Threads threadsFromProperties(const QByteArray &payload);
     QList<QVariantMap> threadsToProperties(const Threads &threads);
 
     Event eventFromProperties(const QVariantMap &properties);
     Events eventsFromProperties(const QList<QVariantMap> &eventsProperties);
+    Events eventsFromProperties(const QByteArray &payload);
     QList<QVariantMap> eventsToProperties(const Events &events);
+    void setPayloadEncoding(int version);
+    void updateChangeConnections();
+    int watchThreadReply(const QDBusPendingCall &call);
 
 private:
     HistoryServiceAdaptor *mAdaptor;
     QDBusInterface mInterface;
+    int mEncodingVersion;
+    bool mEncodingPending;
+    int mLastRequestId;
+    QSet<QString> mWatchedChanges;
+    // the change notifications currently listened to in each form
+    QSet<QString> mPlainChanges;
+    QSet<QString> mEncodedChanges;
 };
 
 }
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pagepolicy_p.h"
+#include <QtGlobal>
+
+namespace History
+{
+
+// pages requested faster than this make the adaptive page size grow, slower ones reset it
+static const qint64 fastRequestInterval = 500;
+static const qint64 slowRequestInterval = 2000;
+
+PagePolicy::PagePolicy()
+    : mPageSize(DefaultPageSize), mAdaptive(false)
+{
+}
+
+/// sets the page size and returns the one actually used
+int PagePolicy::setPageSize(int size)
+{
+    mAdaptive = size == AdaptivePageSize;
+    mPageSize = mAdaptive ? DefaultPageSize : qBound(1, size, (int)MaximumPageSize);
+    mLastRequest.invalidate();
+    return mPageSize;
+}
+
+int PagePolicy::pageSize() const
+{
+    return mPageSize;
+}
+
+void PagePolicy::pageRequested()
+{
+    if (mAdaptive && mLastRequest.isValid()) {
+        qint64 interval = mLastRequest.elapsed();
+        if (interval < fastRequestInterval) {
+            mPageSize = qMin(mPageSize * 2, (int)MaximumPageSize);
+        } else if (interval > slowRequestInterval) {
+            mPageSize = DefaultPageSize;
+        }
+    }
+    mLastRequest.start();
+}
+
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAGEPOLICY_P_H
+#define PAGEPOLICY_P_H
+
+#include <QElapsedTimer>
+
+namespace History
+{
+
+/**
+ * Decides how many items the plugin views return per page. Clients either ask for a fixed size,
+ * capped by MaximumPageSize, or let the size adapt: it doubles while pages are requested in quick
+ * succession, as when flinging through a list, and goes back to the default once the client slows down.
+ */
+class PagePolicy
+{
+public:
+    static const int DefaultPageSize = 15;
+    static const int MaximumPageSize = 200;
+    // requesting this size enables the adaptive page size
+    static const int AdaptivePageSize = 0;
+
+    PagePolicy();
+
+    int setPageSize(int size);
+    int pageSize() const;
+
+    // to be called for every page a client asks for
+    void pageRequested();
+
+private:
+    int mPageSize;
+    bool mAdaptive;
+    QElapsedTimer mLastRequest;
+};
+
+}
+
+#endif // PAGEPOLICY_P_H
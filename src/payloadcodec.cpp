@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "payloadcodec_p.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDBusArgument>
+#include <QDBusVariant>
+#include <QHash>
+#include <QStringList>
+#include <QDebug>
+#include <QtGlobal>
+
+namespace History
+{
+
+// payload layout (version 1):
+//   quint8 magic, quint8 version,
+//   quint32 string count, the strings,
+//   quint32 item count, the items as map values.
+// Strings (field names and string values) are referred to by their index in the string table.
+static const quint8 payloadMagic = 0xb7;
+
+enum ValueTag {
+    TagInvalid = 0,
+    TagBool,
+    TagInt,
+    TagUInt,
+    TagLongLong,
+    TagULongLong,
+    TagDouble,
+    TagString,
+    TagStringList,
+    TagDateTime,
+    TagMap,
+    TagList,
+    TagVariant
+};
+
+// the values that come from the bus are still marshalled when they get forwarded by the service
+QVariant fromDBusArgument(const QDBusArgument &argument)
+{
+    switch (argument.currentType()) {
+    case QDBusArgument::BasicType:
+    case QDBusArgument::VariantType: {
+        QVariant value = argument.asVariant();
+        if (value.userType() == qMetaTypeId<QDBusVariant>()) {
+            value = value.value<QDBusVariant>().variant();
+        }
+        if (value.userType() == qMetaTypeId<QDBusArgument>()) {
+            return fromDBusArgument(value.value<QDBusArgument>());
+        }
+        return value;
+    }
+    case QDBusArgument::ArrayType: {
+        QVariantList list;
+        argument.beginArray();
+        while (!argument.atEnd()) {
+            list << fromDBusArgument(argument);
+        }
+        argument.endArray();
+        return list;
+    }
+    case QDBusArgument::StructureType: {
+        // the lists of maps are sent as arrays of structures holding just the map
+        QVariantList fields;
+        argument.beginStructure();
+        while (!argument.atEnd()) {
+            fields << fromDBusArgument(argument);
+        }
+        argument.endStructure();
+        return fields.count() == 1 ? fields.first() : QVariant(fields);
+    }
+    case QDBusArgument::MapType: {
+        QVariantMap map;
+        argument.beginMap();
+        while (!argument.atEnd()) {
+            argument.beginMapEntry();
+            QString key = fromDBusArgument(argument).toString();
+            map[key] = fromDBusArgument(argument);
+            argument.endMapEntry();
+        }
+        argument.endMap();
+        return map;
+    }
+    default:
+        return QVariant();
+    }
+}
+
+class PayloadWriter
+{
+public:
+    PayloadWriter() : mStream(&mBody, QIODevice::WriteOnly)
+    {
+        mStream.setVersion(QDataStream::Qt_5_0);
+    }
+
+    void writeString(const QString &string)
+    {
+        QHash<QString, quint32>::const_iterator it = mStringIndexes.constFind(string);
+        if (it != mStringIndexes.constEnd()) {
+            mStream << it.value();
+            return;
+        }
+        quint32 index = mStrings.count();
+        mStrings << string;
+        mStringIndexes.insert(string, index);
+        mStream << index;
+    }
+
+    void writeMap(const QVariantMap &map)
+    {
+        mStream << (quint32) map.count();
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+            writeString(it.key());
+            writeValue(it.value());
+        }
+    }
+
+    void writeValue(const QVariant &value)
+    {
+        int type = value.userType();
+        if (type == qMetaTypeId<QDBusArgument>()) {
+            writeValue(fromDBusArgument(value.value<QDBusArgument>()));
+            return;
+        } else if (type == qMetaTypeId<QDBusVariant>()) {
+            writeValue(value.value<QDBusVariant>().variant());
+            return;
+        } else if (type == qMetaTypeId<QList<QVariantMap> >()) {
+            QList<QVariantMap> maps = value.value<QList<QVariantMap> >();
+            mStream << (quint8) TagList << (quint32) maps.count();
+            Q_FOREACH(const QVariantMap &map, maps) {
+                mStream << (quint8) TagMap;
+                writeMap(map);
+            }
+            return;
+        }
+
+        switch (type) {
+        case QMetaType::UnknownType:
+            mStream << (quint8) TagInvalid;
+            break;
+        case QMetaType::Bool:
+            mStream << (quint8) TagBool << value.toBool();
+            break;
+        case QMetaType::Int:
+            mStream << (quint8) TagInt << (qint32) value.toInt();
+            break;
+        case QMetaType::UInt:
+            mStream << (quint8) TagUInt << (quint32) value.toUInt();
+            break;
+        case QMetaType::LongLong:
+            mStream << (quint8) TagLongLong << value.toLongLong();
+            break;
+        case QMetaType::ULongLong:
+            mStream << (quint8) TagULongLong << value.toULongLong();
+            break;
+        case QMetaType::Double:
+            mStream << (quint8) TagDouble << value.toDouble();
+            break;
+        case QMetaType::QString:
+            mStream << (quint8) TagString;
+            writeString(value.toString());
+            break;
+        case QMetaType::QStringList: {
+            QStringList list = value.toStringList();
+            mStream << (quint8) TagStringList << (quint32) list.count();
+            Q_FOREACH(const QString &string, list) {
+                writeString(string);
+            }
+            break;
+        }
+        case QMetaType::QDateTime:
+            mStream << (quint8) TagDateTime << value.toDateTime();
+            break;
+        case QMetaType::QVariantMap:
+            mStream << (quint8) TagMap;
+            writeMap(value.toMap());
+            break;
+        case QMetaType::QVariantList: {
+            QVariantList list = value.toList();
+            mStream << (quint8) TagList << (quint32) list.count();
+            Q_FOREACH(const QVariant &item, list) {
+                writeValue(item);
+            }
+            break;
+        }
+        default:
+            mStream << (quint8) TagVariant << value;
+            break;
+        }
+    }
+
+    QByteArray payload(int version) const
+    {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << payloadMagic << (quint8) version << (quint32) mStrings.count();
+        Q_FOREACH(const QString &string, mStrings) {
+            stream << string;
+        }
+        payload.append(mBody);
+        return payload;
+    }
+
+    QDataStream &stream()
+    {
+        return mStream;
+    }
+
+private:
+    QByteArray mBody;
+    QDataStream mStream;
+    QStringList mStrings;
+    QHash<QString, quint32> mStringIndexes;
+};
+
+class PayloadReader
+{
+public:
+    PayloadReader(const QByteArray &payload) : mStream(payload), mValid(true)
+    {
+        mStream.setVersion(QDataStream::Qt_5_0);
+    }
+
+    bool readHeader()
+    {
+        quint8 magic = 0;
+        quint8 version = 0;
+        quint32 count = 0;
+        mStream >> magic >> version >> count;
+        if (mStream.status() != QDataStream::Ok || magic != payloadMagic || version < 1 || version > PayloadCodec::Version) {
+            return false;
+        }
+        for (quint32 i = 0; i < count && mStream.status() == QDataStream::Ok; ++i) {
+            QString string;
+            mStream >> string;
+            mStrings << string;
+        }
+        return mStream.status() == QDataStream::Ok;
+    }
+
+    QString readString()
+    {
+        quint32 index = 0;
+        mStream >> index;
+        if (index >= (quint32) mStrings.count()) {
+            mValid = false;
+            return QString();
+        }
+        return mStrings[index];
+    }
+
+    QVariantMap readMap()
+    {
+        QVariantMap map;
+        quint32 count = 0;
+        mStream >> count;
+        for (quint32 i = 0; i < count && isValid(); ++i) {
+            QString key = readString();
+            map[key] = readValue();
+        }
+        return map;
+    }
+
+    QVariant readValue()
+    {
+        quint8 tag = TagInvalid;
+        mStream >> tag;
+        switch (tag) {
+        case TagInvalid:
+            return QVariant();
+        case TagBool: {
+            bool value;
+            mStream >> value;
+            return value;
+        }
+        case TagInt: {
+            qint32 value;
+            mStream >> value;
+            return value;
+        }
+        case TagUInt: {
+            quint32 value;
+            mStream >> value;
+            return value;
+        }
+        case TagLongLong: {
+            qint64 value;
+            mStream >> value;
+            return value;
+        }
+        case TagULongLong: {
+            quint64 value;
+            mStream >> value;
+            return value;
+        }
+        case TagDouble: {
+            double value;
+            mStream >> value;
+            return value;
+        }
+        case TagString:
+            return readString();
+        case TagStringList: {
+            QStringList list;
+            quint32 count = 0;
+            mStream >> count;
+            for (quint32 i = 0; i < count && isValid(); ++i) {
+                list << readString();
+            }
+            return list;
+        }
+        case TagDateTime: {
+            QDateTime value;
+            mStream >> value;
+            return value;
+        }
+        case TagMap:
+            return readMap();
+        case TagList: {
+            QVariantList list;
+            quint32 count = 0;
+            mStream >> count;
+            for (quint32 i = 0; i < count && isValid(); ++i) {
+                list << readValue();
+            }
+            return list;
+        }
+        case TagVariant: {
+            QVariant value;
+            mStream >> value;
+            return value;
+        }
+        default:
+            mValid = false;
+            return QVariant();
+        }
+    }
+
+    QDataStream &stream()
+    {
+        return mStream;
+    }
+
+    bool isValid() const
+    {
+        return mValid && mStream.status() == QDataStream::Ok;
+    }
+
+private:
+    QDataStream mStream;
+    QStringList mStrings;
+    bool mValid;
+};
+
+/// returns the encoded items, or an empty array if the requested version is not supported
+QByteArray PayloadCodec::encode(const QList<QVariantMap> &items, int version)
+{
+    if (version < 1 || version > Version) {
+        return QByteArray();
+    }
+
+    PayloadWriter writer;
+    writer.stream() << (quint32) items.count();
+    Q_FOREACH(const QVariantMap &item, items) {
+        writer.writeMap(item);
+    }
+    return writer.payload(version);
+}
+
+QList<QVariantMap> PayloadCodec::decode(const QByteArray &payload, bool *ok)
+{
+    QList<QVariantMap> items;
+    PayloadReader reader(payload);
+    bool valid = reader.readHeader();
+
+    quint32 count = 0;
+    if (valid) {
+        reader.stream() >> count;
+    }
+    for (quint32 i = 0; i < count && reader.isValid(); ++i) {
+        items << reader.readMap();
+    }
+    valid = valid && reader.isValid();
+
+    if (!valid) {
+        qWarning() << "Failed to decode the payload";
+        items.clear();
+    }
+    if (ok) {
+        *ok = valid;
+    }
+    return items;
+}
+
+/// clients opt in to the encoding by setting HISTORY_DBUS_ENCODING=binary in their environment
+int PayloadCodec::requestedVersion()
+{
+    static int version = qgetenv("HISTORY_DBUS_ENCODING") == "binary" ? Version : 0;
+    return version;
+}
+
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADCODEC_P_H
+#define PAYLOADCODEC_P_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVariantMap>
+
+namespace History
+{
+
+/**
+ * Encodes lists of thread and event properties in a compact binary form to be sent over the bus.
+ * Field names and string values are written only once per payload, and each value is tagged with its type
+ * instead of going through the variant marshalling of QtDBus.
+ */
+class PayloadCodec
+{
+public:
+    // the latest version of the encoding, clients and service agree on the version to use
+    static const int Version = 1;
+
+    static QByteArray encode(const QList<QVariantMap> &items, int version = Version);
+    static QList<QVariantMap> decode(const QByteArray &payload, bool *ok = 0);
+
+    // the version clients ask for, the encoding is only used if the client opted in
+    static int requestedVersion();
+};
+
+}
+
+#endif // PAYLOADCODEC_P_H
@@ -27,18 +27,47 @@
 #include <phonenumbers/phonenumbermatcher.h>
 #include <phonenumbers/phonenumberutil.h>
 
+#include <QCache>
 #include <QLocale>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 
 namespace History
 {
 
-PhoneUtils::PhoneUtils(QObject *parent) :
-    QObject(parent)
+// numbers shorter than this are only considered equal if they are exactly the same
+static const int minimumComparableLength = 7;
+
+// the number of parsed numbers to keep, a lot more than the contacts and participants usually seen at once
+static const int maxCachedNumbers = 4096;
+
+struct ParsedNumber
 {
-}
+    bool isPhoneNumber;
+    // the number with only the diallable characters
+    QString normalized;
+    // see PhoneUtils::comparisonKey()
+    QString comparisonKey;
+    // the country code, the national significant number and the extension,
+    // only set when the country code is part of the number
+    QString exactKey;
+};
 
-QString PhoneUtils::region()
+struct ParsedNumberCache
+{
+    ParsedNumberCache() : numbers(maxCachedNumbers), hits(0), misses(0) { }
+
+    QMutex mutex;
+    QCache<QString, ParsedNumber> numbers;
+    QString region;
+    int hits;
+    int misses;
+};
+
+Q_GLOBAL_STATIC(ParsedNumberCache, parsedNumberCache)
+
+static QString systemRegion()
 {
     QString countryCode = QLocale::system().name().split("_").last();
     if (countryCode.size() < 2) {
@@ -49,15 +78,109 @@ QString PhoneUtils::region()
     return countryCode;
 }
 
-QString PhoneUtils::normalizePhoneNumber(const QString &phoneNumber)
+/// parses the number with libphonenumber, in the region of the system locale which is only looked up once,
+/// and keeps what all the functions below need from it.
+/// The same few numbers are normalized and compared over and over, by the SQL functions and when
+/// matching contacts, and parsing them is by far the most expensive part of it.
+static ParsedNumber parseNumber(const QString &phoneNumber)
 {
     static i18n::phonenumbers::PhoneNumberUtil *phonenumberUtil = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
-    if (!isPhoneNumber(phoneNumber)) {
-        return phoneNumber;
+    ParsedNumberCache *cache = parsedNumberCache();
+
+    QString region;
+    {
+        QMutexLocker locker(&cache->mutex);
+        ParsedNumber *cached = cache->numbers.object(phoneNumber);
+        if (cached) {
+            cache->hits++;
+            return *cached;
+        }
+        cache->misses++;
+        if (cache->region.isEmpty()) {
+            cache->region = systemRegion();
+        }
+        region = cache->region;
     }
+
+    ParsedNumber parsed;
     std::string number = phoneNumber.toStdString();
-    phonenumberUtil->NormalizeDiallableCharsOnly(&number);
-    return QString::fromStdString(number);
+    i18n::phonenumbers::PhoneNumber parsedNumber;
+    i18n::phonenumbers::PhoneNumberUtil::ErrorType error = phonenumberUtil->Parse(number, region.toStdString(), &parsedNumber);
+
+    parsed.isPhoneNumber = false;
+    switch(error) {
+    case i18n::phonenumbers::PhoneNumberUtil::INVALID_COUNTRY_CODE_ERROR:
+        qWarning() << "Invalid country code for:" << phoneNumber;
+        break;
+    case i18n::phonenumbers::PhoneNumberUtil::NOT_A_NUMBER:
+        qWarning() << "The phone number is not a valid number:" << phoneNumber;
+        break;
+    case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_AFTER_IDD:
+    case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_NSN:
+    case i18n::phonenumbers::PhoneNumberUtil::TOO_LONG_NSN:
+        qWarning() << "Invalid phone number" << phoneNumber;
+        break;
+    default:
+        parsed.isPhoneNumber = true;
+        break;
+    }
+
+    parsed.normalized = phoneNumber;
+    if (parsed.isPhoneNumber) {
+        std::string normalized = number;
+        phonenumberUtil->NormalizeDiallableCharsOnly(&normalized);
+        parsed.normalized = QString::fromStdString(normalized);
+
+        if (parsed.normalized.startsWith("+")) {
+            std::string formatted;
+            phonenumberUtil->Format(parsedNumber, i18n::phonenumbers::PhoneNumberUtil::E164, &formatted);
+            parsed.exactKey = QString::fromStdString(formatted);
+            if (parsedNumber.has_extension()) {
+                parsed.exactKey += ";ext=" + QString::fromStdString(parsedNumber.extension());
+            }
+        }
+    }
+
+    // libphonenumber matches numbers when the national significant number of one of them ends with
+    // the other one, so the key is made of the last digits of it, leaving out the extension.
+    // A national significant number shorter than that is used whole, whatever the length of the string
+    // it was written in, so that it only matches the numbers with the same national significant number.
+    QString digits;
+    if (parsed.isPhoneNumber) {
+        std::string nationalNumber;
+        phonenumberUtil->GetNationalSignificantNumber(parsedNumber, &nationalNumber);
+        digits = QString::fromStdString(nationalNumber);
+    } else if (phoneNumber.size() >= minimumComparableLength) {
+        Q_FOREACH(const QChar &character, phoneNumber) {
+            if (character == '#' || character == ',' || character == ';') {
+                break;
+            }
+            if (character.isDigit()) {
+                digits += character;
+            }
+        }
+    }
+    if (digits.isEmpty()) {
+        parsed.comparisonKey = phoneNumber;
+    } else {
+        parsed.comparisonKey = digits.right(minimumComparableLength);
+    }
+
+    {
+        QMutexLocker locker(&cache->mutex);
+        cache->numbers.insert(phoneNumber, new ParsedNumber(parsed));
+    }
+    return parsed;
+}
+
+PhoneUtils::PhoneUtils(QObject *parent) :
+    QObject(parent)
+{
+}
+
+QString PhoneUtils::normalizePhoneNumber(const QString &phoneNumber)
+{
+    return parseNumber(phoneNumber).normalized;
 }
 
 bool PhoneUtils::comparePhoneNumbers(const QString &phoneNumberA, const QString &phoneNumberB)
@@ -81,7 +204,20 @@ bool PhoneUtils::compareNormalizedPhoneNumbers(const QString &numberA, const QSt
 
     static i18n::phonenumbers::PhoneNumberUtil *phonenumberUtil = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
 
-    if (numberA.size() < 7 || numberB.size() < 7) {
+    if (numberA.size() < minimumComparableLength || numberB.size() < minimumComparableLength) {
+        return false;
+    }
+
+    // most comparisons are settled by the keys: numbers with the same country code and national number
+    // are an exact match, and numbers with different comparison keys never match
+    ParsedNumber parsedA = parseNumber(numberA);
+    ParsedNumber parsedB = parseNumber(numberB);
+    if (!parsedA.exactKey.isEmpty() && parsedA.exactKey == parsedB.exactKey) {
+        return true;
+    }
+    // this also keeps numbers with a short national significant number from matching the longer numbers
+    // ending with it, like the numbers shorter than minimumComparableLength above
+    if (parsedA.comparisonKey != parsedB.comparisonKey) {
         return false;
     }
 
@@ -91,30 +227,43 @@ bool PhoneUtils::compareNormalizedPhoneNumbers(const QString &numberA, const QSt
     return (match > i18n::phonenumbers::PhoneNumberUtil::NO_MATCH);
 }
 
+/// returns a key that is the same for any two numbers considered equal by \ref compareNormalizedPhoneNumbers,
+/// so that numbers can be looked up in a hash before doing the more expensive comparison.
+QString PhoneUtils::comparisonKey(const QString &phoneNumber)
+{
+    // short numbers are keyed on their national significant number too, as they match the same number
+    // written with separators once normalized
+    return parseNumber(phoneNumber).comparisonKey;
+}
+
 bool PhoneUtils::isPhoneNumber(const QString &phoneNumber)
 {
-    static i18n::phonenumbers::PhoneNumberUtil *phonenumberUtil = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
-    i18n::phonenumbers::PhoneNumber number;
-    i18n::phonenumbers::PhoneNumberUtil::ErrorType error;
-    error = phonenumberUtil->Parse(phoneNumber.toStdString(), region().toStdString(), &number);
+    return parseNumber(phoneNumber).isPhoneNumber;
+}
 
-    switch(error) {
-    case i18n::phonenumbers::PhoneNumberUtil::INVALID_COUNTRY_CODE_ERROR:
-        qWarning() << "Invalid country code for:" << phoneNumber;
-        return false;
-    case i18n::phonenumbers::PhoneNumberUtil::NOT_A_NUMBER:
-        qWarning() << "The phone number is not a valid number:" << phoneNumber;
-        return false;
-    case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_AFTER_IDD:
-    case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_NSN:
-    case i18n::phonenumbers::PhoneNumberUtil::TOO_LONG_NSN:
-        qWarning() << "Invalid phone number" << phoneNumber;
-        return false;
-    default:
-        break;
-    }
-    return true;
+int PhoneUtils::cacheHits()
+{
+    ParsedNumberCache *cache = parsedNumberCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->hits;
 }
 
+int PhoneUtils::cacheMisses()
+{
+    ParsedNumberCache *cache = parsedNumberCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->misses;
 }
 
+/// drops the parsed numbers and the statistics, and looks the region up again, e.g. after a locale change
+void PhoneUtils::clearCache()
+{
+    ParsedNumberCache *cache = parsedNumberCache();
+    QMutexLocker locker(&cache->mutex);
+    cache->numbers.clear();
+    cache->region.clear();
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+}
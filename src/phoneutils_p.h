@@ -38,8 +38,12 @@ public:
     Q_INVOKABLE static bool compareNormalizedPhoneNumbers(const QString &numberA, const QString &numberB);
     Q_INVOKABLE static bool isPhoneNumber(const QString &identifier);
     Q_INVOKABLE static QString normalizePhoneNumber(const QString &identifier);
-private:
-    static QString region();
+    static QString comparisonKey(const QString &phoneNumber);
+
+    // statistics of the cache of parsed numbers shared by all the functions above
+    static int cacheHits();
+    static int cacheMisses();
+    static void clearCache();
 };
 
 }
@@ -92,8 +92,22 @@ public:
     virtual bool endBatchOperation() { return false; }
     virtual bool rollbackBatchOperation() { return false; }
 
+    // bulk imports: the events written until endImport() don't update their threads, endImport() updates
+    // the counters and the last events of all the threads at once
+    virtual bool beginImport() { return false; }
+    virtual bool endImport() { return false; }
+
+    // called by the daemon when no writes happened for a while, so that the plugin can flush its journals
+    virtual bool checkpoint() { return false; }
+
+    // whether the views can be created and paged from threads other than the one doing the writes
+    virtual bool supportsConcurrentReads() { return false; }
+
     // FIXME: this is hackish, but changing it required a broad refactory of HistoryDaemon
     virtual void generateContactCache() {}
+
+    // called by the daemon when idle, so that the next start doesn't need to generate the contact cache again
+    virtual bool saveContactCache() { return false; }
 };
 
 }
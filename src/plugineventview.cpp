@@ -23,16 +23,30 @@
 #include "plugineventview_p.h"
 #include "plugineventviewadaptor.h"
 #include "types.h"
+#include "payloadcodec_p.h"
 #include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
 
 Q_DECLARE_METATYPE(QList< QVariantMap >)
 
 namespace History {
 
+// the views with subscribers, notified from the main thread while the views live in the reader threads
+static QMutex subscriptionsMutex;
+static QSet<PluginEventView*> subscribedViews;
+
 PluginEventViewPrivate::PluginEventViewPrivate()
-    : adaptor(0)
+    : adaptor(0), readAheadEnabled(false), hasNextPage(false), type(EventTypeNull)
+{
+}
+
+bool PluginEventViewPrivate::matches(const QVariantMap &properties) const
 {
+    return properties[FieldType].toInt() == (int) type && (filter.isNull() || filter.match(properties));
 }
 
 PluginEventView::PluginEventView(QObject *parent) :
@@ -52,6 +66,9 @@ PluginEventView::~PluginEventView()
 {
     Q_D(PluginEventView);
     QDBusConnection::sessionBus().unregisterObject(d->objectPath);
+
+    QMutexLocker locker(&subscriptionsMutex);
+    subscribedViews.remove(this);
 }
 
 void PluginEventView::Destroy()
@@ -60,6 +77,87 @@ void PluginEventView::Destroy()
     deleteLater();
 }
 
+/// returns the next page, from the one read ahead if there is one
+QList<QVariantMap> PluginEventView::NextPage()
+{
+    Q_D(PluginEventView);
+    d->pagePolicy.pageRequested();
+
+    QList<QVariantMap> page;
+    if (d->hasNextPage) {
+        page = d->nextPage;
+        d->nextPage.clear();
+        d->hasNextPage = false;
+    } else {
+        page = fetchPage(d->pagePolicy.pageSize());
+    }
+
+    // prepare the following page once the reply to this one is on its way
+    if (d->readAheadEnabled && !page.isEmpty()) {
+        QMetaObject::invokeMethod(this, "readAhead", Qt::QueuedConnection);
+    }
+    return page;
+}
+
+QByteArray PluginEventView::NextPageEncoded(int version)
+{
+    return PayloadCodec::encode(NextPage(), version);
+}
+
+/// sets the number of items per page, capped to a maximum, or 0 to let it adapt to how fast
+/// the pages are requested. Returns the page size actually used.
+int PluginEventView::SetPageSize(int size)
+{
+    Q_D(PluginEventView);
+    return d->pagePolicy.setPageSize(size);
+}
+
+void PluginEventView::SetReadAhead(bool enabled)
+{
+    Q_D(PluginEventView);
+    d->readAheadEnabled = enabled;
+}
+
+void PluginEventView::readAhead()
+{
+    Q_D(PluginEventView);
+    if (d->hasNextPage || !IsValid()) {
+        return;
+    }
+
+    d->nextPage = fetchPage(d->pagePolicy.pageSize());
+    d->hasNextPage = true;
+}
+
+/// makes the calling client receive the changes matching the view, instead of having to filter
+/// the ones broadcast by the service.
+/// The reply is sent while holding the lock the changes are sent with, so that the client gets each change
+/// either broadcast before the reply or sent to it after the reply, never both.
+void PluginEventView::Subscribe()
+{
+    subscribe(0);
+}
+
+/// the same as Subscribe(), with the changes sent through the *Encoded signals
+void PluginEventView::SubscribeEncoded(int version)
+{
+    subscribe(qBound(0, version, (int) PayloadCodec::Version));
+}
+
+void PluginEventView::subscribe(int version)
+{
+    Q_D(PluginEventView);
+    if (!calledFromDBus()) {
+        return;
+    }
+
+    setDelayedReply(true);
+    QMutexLocker locker(&subscriptionsMutex);
+    d->subscribers[message().service()] = version;
+    subscribedViews.insert(this);
+    QDBusConnection::sessionBus().send(message().createReply());
+}
+
 bool PluginEventView::IsValid() const
 {
     return true;
@@ -71,4 +169,70 @@ QString PluginEventView::objectPath() const
     return d->objectPath;
 }
 
+/// sets which of the changed events get sent to the subscribers of this view
+void PluginEventView::setSubscriptionFilter(History::EventType type, const History::Filter &filter)
+{
+    Q_D(PluginEventView);
+    QMutexLocker locker(&subscriptionsMutex);
+    d->type = type;
+    d->filter = filter;
+}
+
+/// sends the events matching each subscribed view only to the clients subscribed to it
+void PluginEventView::notifySubscribers(const QString &signal, const QList<QVariantMap> &events, const std::function<void()> &broadcast)
+{
+    QMutexLocker locker(&subscriptionsMutex);
+    if (broadcast) {
+        broadcast();
+    }
+
+    Q_FOREACH(PluginEventView *view, subscribedViews) {
+        const PluginEventViewPrivate *d = view->d_func();
+        QList<QVariantMap> matching;
+        Q_FOREACH(const QVariantMap &properties, events) {
+            if (d->matches(properties)) {
+                matching << properties;
+            }
+        }
+        if (matching.isEmpty()) {
+            continue;
+        }
+
+        // the clients subscribed with the payload encoding get the *Encoded signals, encoded once for each version
+        QMap<int, QByteArray> payloads;
+        QMap<QString, int>::const_iterator it = d->subscribers.constBegin();
+        for (; it != d->subscribers.constEnd(); ++it) {
+            QDBusMessage message;
+            if (it.value() > 0) {
+                QByteArray &payload = payloads[it.value()];
+                if (payload.isEmpty()) {
+                    payload = PayloadCodec::encode(matching, it.value());
+                }
+                message = QDBusMessage::createTargetedSignal(it.key(), d->objectPath, EventViewInterface, signal + "Encoded");
+                message << payload;
+            } else {
+                message = QDBusMessage::createTargetedSignal(it.key(), d->objectPath, EventViewInterface, signal);
+                message << QVariant::fromValue(matching);
+            }
+            QDBusConnection::sessionBus().send(message);
+        }
+    }
+}
+
+/// stops sending the changes to a client that left the bus
+void PluginEventView::removeSubscriber(const QString &client)
+{
+    QMutexLocker locker(&subscriptionsMutex);
+    QSet<PluginEventView*>::iterator it = subscribedViews.begin();
+    while (it != subscribedViews.end()) {
+        PluginEventViewPrivate *d = (*it)->d_func();
+        d->subscribers.remove(client);
+        if (d->subscribers.isEmpty()) {
+            it = subscribedViews.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 }
@@ -26,6 +26,9 @@
 #include <QDBusContext>
 #include <QScopedPointer>
 #include <QVariantMap>
+#include <functional>
+#include "filter.h"
+#include "types.h"
 
 namespace History {
 
@@ -41,16 +44,36 @@ public:
 
     // DBus exposed methods
     Q_NOREPLY void Destroy();
-    virtual QList<QVariantMap> NextPage() = 0;
+    QList<QVariantMap> NextPage();
+    QByteArray NextPageEncoded(int version);
+    int SetPageSize(int size);
+    void SetReadAhead(bool enabled);
+    void Subscribe();
+    void SubscribeEncoded(int version);
     virtual bool IsValid() const;
 
     // other methods
     QString objectPath() const;
+    void setSubscriptionFilter(History::EventType type, const History::Filter &filter);
+
+    // the broadcast is sent under the same lock as the changes sent to the subscribers
+    static void notifySubscribers(const QString &signal, const QList<QVariantMap> &events,
+                                  const std::function<void()> &broadcast = std::function<void()>());
+    static void removeSubscriber(const QString &client);
 
 Q_SIGNALS:
     void Invalidated();
 
+protected:
+    // returns up to pageSize items following the ones returned so far
+    virtual QList<QVariantMap> fetchPage(int pageSize) = 0;
+
+private Q_SLOTS:
+    void readAhead();
+
 private:
+    void subscribe(int version);
+
     QScopedPointer<PluginEventViewPrivate> d_ptr;
 };
 
@@ -23,6 +23,11 @@
 #define PLUGINEVENTVIEW_P_H
 
 #include <QScopedPointer>
+#include <QStringList>
+#include <QVariantMap>
+#include "filter.h"
+#include "pagepolicy_p.h"
+#include "types.h"
 
 class EventViewAdaptor;
 
@@ -35,6 +40,16 @@ public:
 
     EventViewAdaptor *adaptor;
     QString objectPath;
+    PagePolicy pagePolicy;
+    bool readAheadEnabled;
+    bool hasNextPage;
+    QList<QVariantMap> nextPage;
+    History::EventType type;
+    History::Filter filter;
+    // the encoding version of each subscribed client, 0 for the plain signals
+    QMap<QString, int> subscribers;
+
+    bool matches(const QVariantMap &properties) const;
 };
 
 }
@@ -23,16 +23,30 @@
 #include "pluginthreadview_p.h"
 #include "pluginthreadviewadaptor.h"
 #include "types.h"
+#include "payloadcodec_p.h"
 #include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
 
 Q_DECLARE_METATYPE(QList< QVariantMap >)
 
 namespace History {
 
+// the views with subscribers, notified from the main thread while the views live in the reader threads
+static QMutex subscriptionsMutex;
+static QSet<PluginThreadView*> subscribedViews;
+
 PluginThreadViewPrivate::PluginThreadViewPrivate()
-    : adaptor(0)
+    : adaptor(0), readAheadEnabled(false), hasNextPage(false), type(EventTypeNull)
+{
+}
+
+bool PluginThreadViewPrivate::matches(const QVariantMap &properties) const
 {
+    return properties[FieldType].toInt() == (int) type && (filter.isNull() || filter.match(properties));
 }
 
 PluginThreadView::PluginThreadView(QObject *parent) :
@@ -52,6 +66,9 @@ PluginThreadView::~PluginThreadView()
 {
     Q_D(PluginThreadView);
     QDBusConnection::sessionBus().unregisterObject(d->objectPath);
+
+    QMutexLocker locker(&subscriptionsMutex);
+    subscribedViews.remove(this);
 }
 
 void PluginThreadView::Destroy()
@@ -60,6 +77,87 @@ void PluginThreadView::Destroy()
     deleteLater();
 }
 
+/// returns the next page, from the one read ahead if there is one
+QList<QVariantMap> PluginThreadView::NextPage()
+{
+    Q_D(PluginThreadView);
+    d->pagePolicy.pageRequested();
+
+    QList<QVariantMap> page;
+    if (d->hasNextPage) {
+        page = d->nextPage;
+        d->nextPage.clear();
+        d->hasNextPage = false;
+    } else {
+        page = fetchPage(d->pagePolicy.pageSize());
+    }
+
+    // prepare the following page once the reply to this one is on its way
+    if (d->readAheadEnabled && !page.isEmpty()) {
+        QMetaObject::invokeMethod(this, "readAhead", Qt::QueuedConnection);
+    }
+    return page;
+}
+
+QByteArray PluginThreadView::NextPageEncoded(int version)
+{
+    return PayloadCodec::encode(NextPage(), version);
+}
+
+/// sets the number of items per page, capped to a maximum, or 0 to let it adapt to how fast
+/// the pages are requested. Returns the page size actually used.
+int PluginThreadView::SetPageSize(int size)
+{
+    Q_D(PluginThreadView);
+    return d->pagePolicy.setPageSize(size);
+}
+
+void PluginThreadView::SetReadAhead(bool enabled)
+{
+    Q_D(PluginThreadView);
+    d->readAheadEnabled = enabled;
+}
+
+void PluginThreadView::readAhead()
+{
+    Q_D(PluginThreadView);
+    if (d->hasNextPage || !IsValid()) {
+        return;
+    }
+
+    d->nextPage = fetchPage(d->pagePolicy.pageSize());
+    d->hasNextPage = true;
+}
+
+/// makes the calling client receive the changes matching the view, instead of having to filter
+/// the ones broadcast by the service.
+/// The reply is sent while holding the lock the changes are sent with, so that the client gets each change
+/// either broadcast before the reply or sent to it after the reply, never both.
+void PluginThreadView::Subscribe()
+{
+    subscribe(0);
+}
+
+/// the same as Subscribe(), with the changes sent through the *Encoded signals
+void PluginThreadView::SubscribeEncoded(int version)
+{
+    subscribe(qBound(0, version, (int) PayloadCodec::Version));
+}
+
+void PluginThreadView::subscribe(int version)
+{
+    Q_D(PluginThreadView);
+    if (!calledFromDBus()) {
+        return;
+    }
+
+    setDelayedReply(true);
+    QMutexLocker locker(&subscriptionsMutex);
+    d->subscribers[message().service()] = version;
+    subscribedViews.insert(this);
+    QDBusConnection::sessionBus().send(message().createReply());
+}
+
 bool PluginThreadView::IsValid() const
 {
     return true;
@@ -71,4 +169,70 @@ QString PluginThreadView::objectPath() const
     return d->objectPath;
 }
 
+/// sets which of the changed threads get sent to the subscribers of this view
+void PluginThreadView::setSubscriptionFilter(History::EventType type, const History::Filter &filter)
+{
+    Q_D(PluginThreadView);
+    QMutexLocker locker(&subscriptionsMutex);
+    d->type = type;
+    d->filter = filter;
+}
+
+/// sends the threads matching each subscribed view only to the clients subscribed to it
+void PluginThreadView::notifySubscribers(const QString &signal, const QList<QVariantMap> &threads, const std::function<void()> &broadcast)
+{
+    QMutexLocker locker(&subscriptionsMutex);
+    if (broadcast) {
+        broadcast();
+    }
+
+    Q_FOREACH(PluginThreadView *view, subscribedViews) {
+        const PluginThreadViewPrivate *d = view->d_func();
+        QList<QVariantMap> matching;
+        Q_FOREACH(const QVariantMap &properties, threads) {
+            if (d->matches(properties)) {
+                matching << properties;
+            }
+        }
+        if (matching.isEmpty()) {
+            continue;
+        }
+
+        // the clients subscribed with the payload encoding get the *Encoded signals, encoded once for each version
+        QMap<int, QByteArray> payloads;
+        QMap<QString, int>::const_iterator it = d->subscribers.constBegin();
+        for (; it != d->subscribers.constEnd(); ++it) {
+            QDBusMessage message;
+            if (it.value() > 0) {
+                QByteArray &payload = payloads[it.value()];
+                if (payload.isEmpty()) {
+                    payload = PayloadCodec::encode(matching, it.value());
+                }
+                message = QDBusMessage::createTargetedSignal(it.key(), d->objectPath, ThreadViewInterface, signal + "Encoded");
+                message << payload;
+            } else {
+                message = QDBusMessage::createTargetedSignal(it.key(), d->objectPath, ThreadViewInterface, signal);
+                message << QVariant::fromValue(matching);
+            }
+            QDBusConnection::sessionBus().send(message);
+        }
+    }
+}
+
+/// stops sending the changes to a client that left the bus
+void PluginThreadView::removeSubscriber(const QString &client)
+{
+    QMutexLocker locker(&subscriptionsMutex);
+    QSet<PluginThreadView*>::iterator it = subscribedViews.begin();
+    while (it != subscribedViews.end()) {
+        PluginThreadViewPrivate *d = (*it)->d_func();
+        d->subscribers.remove(client);
+        if (d->subscribers.isEmpty()) {
+            it = subscribedViews.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 }
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recordstream_p.h"
+#include "payloadcodec_p.h"
+#include <QDebug>
+#include <QIODevice>
+#include <QtEndian>
+
+namespace History
+{
+
+// the threads carry the id of their last event too, so they are told apart by this field
+static const char *threadRecordField = "threadRecord";
+
+// the largest frame accepted, to not allocate whatever a broken stream says
+static const quint32 maximumFrameLength = 64 * 1024 * 1024;
+
+static bool readFully(QIODevice *device, char *data, qint64 size)
+{
+    // pipes and sockets might return less than asked for
+    qint64 done = 0;
+    while (done < size) {
+        qint64 read = device->read(data + done, size - done);
+        if (read <= 0 && !device->waitForReadyRead(-1)) {
+            return false;
+        }
+        done += qMax(read, qint64(0));
+    }
+    return true;
+}
+
+bool RecordStream::writeFrame(QIODevice *device, const QList<QVariantMap> &records)
+{
+    QByteArray payload = PayloadCodec::encode(records);
+    uchar length[4];
+    qToBigEndian<quint32>(payload.size(), length);
+    if (device->write(reinterpret_cast<const char*>(length), sizeof(length)) != sizeof(length) ||
+        device->write(payload) != payload.size()) {
+        qWarning() << "Failed to write the history stream:" << device->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool RecordStream::readFrame(QIODevice *device, QList<QVariantMap> &records, bool *ok)
+{
+    if (ok) {
+        *ok = true;
+    }
+    records.clear();
+
+    uchar length[4];
+    qint64 read = device->read(reinterpret_cast<char*>(length), 1);
+    if (read <= 0 && (!device->waitForReadyRead(-1) || device->read(reinterpret_cast<char*>(length), 1) <= 0)) {
+        // a clean end of the stream
+        return false;
+    }
+
+    bool valid = readFully(device, reinterpret_cast<char*>(length) + 1, sizeof(length) - 1);
+    quint32 size = qFromBigEndian<quint32>(length);
+    QByteArray payload;
+    if (valid && size <= maximumFrameLength) {
+        payload.resize(size);
+        valid = readFully(device, payload.data(), size);
+    } else {
+        valid = false;
+    }
+
+    if (valid) {
+        records = PayloadCodec::decode(payload, &valid);
+    }
+    if (!valid) {
+        qWarning() << "Broken history stream";
+        if (ok) {
+            *ok = false;
+        }
+        return false;
+    }
+    return true;
+}
+
+QVariantMap RecordStream::threadRecord(const QVariantMap &thread)
+{
+    QVariantMap record = thread;
+    record[threadRecordField] = true;
+    return record;
+}
+
+bool RecordStream::isThread(const QVariantMap &record)
+{
+    return record[threadRecordField].toBool();
+}
+
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDSTREAM_P_H
+#define RECORDSTREAM_P_H
+
+#include <QList>
+#include <QVariantMap>
+
+class QIODevice;
+
+namespace History
+{
+
+/**
+ * Reads and writes the stream used to import and export the history in bulk.
+ * The stream is a sequence of frames, each made of a 32-bit big-endian length followed by a list of
+ * records encoded with PayloadCodec. Thread records are marked as such, and the threads are written
+ * before the events in them.
+ */
+class RecordStream
+{
+public:
+    // the number of records written per frame
+    static const int FrameSize = 500;
+
+    static bool writeFrame(QIODevice *device, const QList<QVariantMap> &records);
+    // returns false at the end of the stream, or with ok set to false if the stream is broken
+    static bool readFrame(QIODevice *device, QList<QVariantMap> &records, bool *ok = 0);
+
+    static QVariantMap threadRecord(const QVariantMap &thread);
+    static bool isThread(const QVariantMap &record);
+};
+
+}
+
+#endif // RECORDSTREAM_P_H
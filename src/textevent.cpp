@@ -82,6 +82,9 @@ QVariantMap TextEventPrivate::properties() const
         attachmentsMap << attachment.properties();
     }
     map[FieldAttachments] = QVariant::fromValue(attachmentsMap);
+    if (!matchSnippet.isEmpty()) {
+        map[FieldMatchSnippet] = matchSnippet;
+    }
 
     return map;
 }
@@ -210,6 +213,18 @@ TextEventAttachments TextEvent::attachments() const
     return d->attachments;
 }
 
+QString TextEvent::matchSnippet() const
+{
+    Q_D(const TextEvent);
+    return d->matchSnippet;
+}
+
+void TextEvent::setMatchSnippet(const QString &value)
+{
+    Q_D(TextEvent);
+    d->matchSnippet = value;
+}
+
 Event TextEvent::fromProperties(const QVariantMap &properties)
 {
     Event event;
@@ -255,8 +270,10 @@ Event TextEvent::fromProperties(const QVariantMap &properties)
     }
 
     // and finally create the event
-    event = TextEvent(accountId, threadId, eventId, senderId, timestamp, sentTime, newEvent,
-                      message, messageType, messageStatus, readTimestamp, subject, informationType, attachments, participants);
+    TextEvent textEvent(accountId, threadId, eventId, senderId, timestamp, sentTime, newEvent,
+                        message, messageType, messageStatus, readTimestamp, subject, informationType, attachments, participants);
+    textEvent.setMatchSnippet(properties[FieldMatchSnippet].toString());
+    event = textEvent;
     return event;
 }
 
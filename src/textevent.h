@@ -86,6 +86,8 @@ public:
     QString subject() const;
     InformationType informationType() const;
     TextEventAttachments attachments() const;
+    QString matchSnippet() const;
+    void setMatchSnippet(const QString &value);
 
     static Event fromProperties(const QVariantMap &properties);
 };
@@ -58,6 +58,8 @@ public:
     InformationType informationType;
     TextEventAttachments attachments;
     QDateTime sentTime;
+    // the matching excerpt, only set on the results of a full-text search
+    QString matchSnippet;
 
     EventType type() const;
     QVariantMap properties() const;
@@ -25,19 +25,36 @@
 #include "manager.h"
 #include "sort.h"
 #include "thread.h"
+#include "payloadcodec_p.h"
+#include <QDBusConnection>
 #include <QDBusInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDBusReply>
 #include <QDebug>
 
 namespace History
 {
 
+// the changes sent to the subscribed views, with the slots handling them in the plain and in the encoded form
+static const struct {
+    const char *name;
+    const char *slot;
+    const char *encodedSlot;
+} subscribedSignals[] = {
+    { "ThreadsAdded", SLOT(_d_subscribedThreadsAdded(QList<QVariantMap>)), SLOT(_d_subscribedThreadsAddedEncoded(QByteArray)) },
+    { "ThreadsModified", SLOT(_d_subscribedThreadsModified(QList<QVariantMap>)), SLOT(_d_subscribedThreadsModifiedEncoded(QByteArray)) },
+    { "ThreadsRemoved", SLOT(_d_subscribedThreadsRemoved(QList<QVariantMap>)), SLOT(_d_subscribedThreadsRemovedEncoded(QByteArray)) }
+};
+
 // ------------- ThreadViewPrivate ------------------------------------------------
 
 ThreadViewPrivate::ThreadViewPrivate(History::EventType theType,
                                      const History::Sort &theSort,
                                      const History::Filter &theFilter)
-    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0)
+    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0),
+      encodingVersion(PayloadCodec::requestedVersion()), queryWatcher(0), pageRequested(false),
+      pageSize(-1), readAhead(false)
 {
 }
 
@@ -101,6 +118,259 @@ void ThreadViewPrivate::_d_threadParticipantsChanged(const History::Thread &thre
     }
 }
 
+void ThreadViewPrivate::_d_subscribedThreadsAdded(const QList<QVariantMap> &threads)
+{
+    Q_Q(ThreadView);
+
+    // the service only sends the threads matching this view
+    Threads subscribed = threadsFromProperties(threads);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->threadsAdded(subscribed);
+    }
+}
+
+void ThreadViewPrivate::_d_subscribedThreadsModified(const QList<QVariantMap> &threads)
+{
+    Q_Q(ThreadView);
+
+    // the service only sends the threads matching this view
+    Threads subscribed = threadsFromProperties(threads);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->threadsModified(subscribed);
+    }
+}
+
+void ThreadViewPrivate::_d_subscribedThreadsRemoved(const QList<QVariantMap> &threads)
+{
+    Q_Q(ThreadView);
+
+    // the service only sends the threads matching this view
+    Threads subscribed = threadsFromProperties(threads);
+    if (!subscribed.isEmpty()) {
+        Q_EMIT q->threadsRemoved(subscribed);
+    }
+}
+
+void ThreadViewPrivate::_d_subscribedThreadsAddedEncoded(const QByteArray &payload)
+{
+    _d_subscribedThreadsAdded(decodeSubscribed(payload));
+}
+
+void ThreadViewPrivate::_d_subscribedThreadsModifiedEncoded(const QByteArray &payload)
+{
+    _d_subscribedThreadsModified(decodeSubscribed(payload));
+}
+
+void ThreadViewPrivate::_d_subscribedThreadsRemovedEncoded(const QByteArray &payload)
+{
+    _d_subscribedThreadsRemoved(decodeSubscribed(payload));
+}
+
+QList<QVariantMap> ThreadViewPrivate::decodeSubscribed(const QByteArray &payload)
+{
+    bool ok = false;
+    QList<QVariantMap> threads = PayloadCodec::decode(payload, &ok);
+    if (!ok) {
+        qWarning() << "Failed to decode the subscribed threads";
+        return QList<QVariantMap>();
+    }
+    return threads;
+}
+
+QDBusPendingCall ThreadViewPrivate::callNextPage()
+{
+    if (encodingVersion > 0) {
+        return dbus->asyncCall("NextPageEncoded", encodingVersion);
+    }
+    return dbus->asyncCall("NextPage");
+}
+
+/// reads a page out of a NextPage or NextPageEncoded reply, falling back to the plain pages
+/// if the service doesn't support the encoding
+ThreadViewPrivate::PageResult ThreadViewPrivate::pageFromReply(const QDBusMessage &reply, QList<QVariantMap> &page)
+{
+    if (encodingVersion > 0) {
+        if (reply.type() == QDBusMessage::ErrorMessage &&
+            reply.errorName() != QDBusError::errorString(QDBusError::UnknownMethod)) {
+            qDebug() << "Error:" << reply.errorMessage();
+            return PageFailed;
+        }
+        QByteArray payload = reply.arguments().value(0).toByteArray();
+        if (payload.isEmpty()) {
+            encodingVersion = 0;
+            return PageRetry;
+        }
+        bool ok = false;
+        page = PayloadCodec::decode(payload, &ok);
+        return ok ? PageReady : PageFailed;
+    }
+
+    QDBusReply<QList<QVariantMap> > plainReply(reply);
+    if (!plainReply.isValid()) {
+        qDebug() << "Error:" << plainReply.error();
+        return PageFailed;
+    }
+    page = plainReply.value();
+    return PageReady;
+}
+
+bool ThreadViewPrivate::fetchNextPage(QList<QVariantMap> &page)
+{
+    Q_FOREVER {
+        QDBusPendingCall call = callNextPage();
+        call.waitForFinished();
+        PageResult result = pageFromReply(call.reply(), page);
+        if (result != PageRetry) {
+            return result == PageReady;
+        }
+    }
+}
+
+void ThreadViewPrivate::requestPage()
+{
+    Q_Q(ThreadView);
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(callNextPage(), q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        pageFinished(watcher->reply());
+    });
+}
+
+void ThreadViewPrivate::pageFinished(const QDBusMessage &reply)
+{
+    Q_Q(ThreadView);
+
+    QList<QVariantMap> page;
+    switch (pageFromReply(reply, page)) {
+    case PageRetry:
+        requestPage();
+        return;
+    case PageFailed:
+        pageRequested = false;
+        valid = false;
+        Q_EMIT q->invalidated();
+        return;
+    case PageReady:
+        pageRequested = false;
+        Q_EMIT q->pageReady(threadsFromProperties(page));
+        return;
+    }
+}
+
+/// handles the reply to QueryThreads, requesting the first page if it was asked for in the meantime
+void ThreadViewPrivate::queryFinished()
+{
+    Q_Q(ThreadView);
+
+    // a blocking call might have handled the reply already
+    QDBusPendingCallWatcher *watcher = queryWatcher;
+    if (!watcher) {
+        return;
+    }
+    queryWatcher = 0;
+    watcher->deleteLater();
+
+    QDBusPendingReply<QString> reply = *watcher;
+    if (!reply.isValid() || reply.value().isEmpty()) {
+        valid = false;
+        if (pageRequested) {
+            pageRequested = false;
+            Q_EMIT q->pageReady(Threads());
+        }
+        Q_EMIT q->invalidated();
+        return;
+    }
+
+    objectPath = reply.value();
+    dbus = new QDBusInterface(History::DBusService, objectPath, History::ThreadViewInterface,
+                              QDBusConnection::sessionBus(), q);
+    sendPagingOptions();
+    subscribe(encodingVersion);
+    if (pageRequested) {
+        requestPage();
+    }
+}
+
+void ThreadViewPrivate::sendPagingOptions()
+{
+    // services not supporting these keep their fixed page size
+    if (pageSize >= 0) {
+        dbus->asyncCall("SetPageSize", pageSize);
+    }
+    if (readAhead) {
+        dbus->asyncCall("SetReadAhead", readAhead);
+    }
+}
+
+/// asks the service to send the changes matching this view straight to it, so that the ones
+/// broadcast to every client can be ignored. With the payload encoding they come through the *Encoded signals.
+void ThreadViewPrivate::subscribe(int version)
+{
+    Q_Q(ThreadView);
+
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    for (const auto &subscribedSignal : subscribedSignals) {
+        if (version > 0) {
+            connection.connect(History::DBusService, objectPath, History::ThreadViewInterface,
+                               QString(subscribedSignal.name) + "Encoded", q, subscribedSignal.encodedSlot);
+        } else {
+            connection.connect(History::DBusService, objectPath, History::ThreadViewInterface,
+                               subscribedSignal.name, q, subscribedSignal.slot);
+        }
+    }
+
+    QDBusPendingCall call = version > 0 ? dbus->asyncCall("SubscribeEncoded", version) : dbus->asyncCall("Subscribe");
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this, version](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        Q_Q(ThreadView);
+        if (watcher->isError()) {
+            // services not supporting the encoded subscriptions might still support the plain ones
+            if (version > 0 && watcher->error().type() == QDBusError::UnknownMethod) {
+                QDBusConnection connection = QDBusConnection::sessionBus();
+                for (const auto &subscribedSignal : subscribedSignals) {
+                    connection.disconnect(History::DBusService, objectPath, History::ThreadViewInterface,
+                                          QString(subscribedSignal.name) + "Encoded", q, subscribedSignal.encodedSlot);
+                }
+                subscribe(0);
+            }
+            // older services don't support subscriptions, keep filtering the broadcast changes then
+            return;
+        }
+
+        // the service replies before sending any change to this view, and the changes broadcast
+        // before the reply are not sent to it, so each change is handled exactly once
+        QObject::disconnect(Manager::instance(), SIGNAL(threadsAdded(History::Threads)),
+                            q, SLOT(_d_threadsAdded(History::Threads)));
+        QObject::disconnect(Manager::instance(), SIGNAL(threadsModified(History::Threads)),
+                            q, SLOT(_d_threadsModified(History::Threads)));
+        QObject::disconnect(Manager::instance(), SIGNAL(threadsRemoved(History::Threads)),
+                            q, SLOT(_d_threadsRemoved(History::Threads)));
+    });
+}
+
+bool ThreadViewPrivate::waitForQuery()
+{
+    if (queryWatcher) {
+        queryWatcher->waitForFinished();
+        queryFinished();
+    }
+    return valid;
+}
+
+Threads ThreadViewPrivate::threadsFromProperties(const QList<QVariantMap> &threadsProperties)
+{
+    Threads threads;
+    Q_FOREACH(const QVariantMap &properties, threadsProperties) {
+        Thread thread = Thread::fromProperties(properties);
+        if (!thread.isNull()) {
+            threads << thread;
+        }
+    }
+    return threads;
+}
+
 // ------------- ThreadView -------------------------------------------------------
 
 ThreadView::ThreadView(History::EventType type,
@@ -117,23 +387,14 @@ ThreadView::ThreadView(History::EventType type,
         return;
     }
 
-    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
-
-    QDBusReply<QString> reply = interface.call("QueryThreads",
-                                               (int) type,
-                                               sort.properties(),
-                                               filter.properties(),
-                                               properties);
-    if (!reply.isValid()) {
-        Q_EMIT invalidated();
-        d_ptr->valid = false;
-        return;
-    }
-
-    d_ptr->objectPath = reply.value();
-
-    d_ptr->dbus = new QDBusInterface(History::DBusService, d_ptr->objectPath, History::ThreadViewInterface,
-                                     QDBusConnection::sessionBus(), this);
+    // the view is created in the background, nextPage() waits for it if needed
+    QDBusMessage message = QDBusMessage::createMethodCall(History::DBusService, History::DBusObjectPath,
+                                                          History::DBusInterface, "QueryThreads");
+    message << (int) type << sort.properties() << filter.properties() << properties;
+    d_ptr->queryWatcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(d_ptr->queryWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+        d_func()->queryFinished();
+    });
 
     connect(Manager::instance(),
             SIGNAL(threadsAdded(History::Threads)),
@@ -152,8 +413,22 @@ ThreadView::ThreadView(History::EventType type,
 ThreadView::~ThreadView()
 {
     Q_D(ThreadView);
-    if (d->valid) {
-        d->dbus->call("Destroy");
+    if (d->queryWatcher) {
+        // the view is still being created, destroy it as soon as it is there
+        QDBusPendingCallWatcher *watcher = d->queryWatcher;
+        d->queryWatcher = 0;
+        watcher->disconnect(this);
+        watcher->setParent(Manager::instance());
+        connect(watcher, &QDBusPendingCallWatcher::finished, [](QDBusPendingCallWatcher *watcher) {
+            QDBusPendingReply<QString> reply = *watcher;
+            if (reply.isValid()) {
+                QDBusConnection::sessionBus().asyncCall(QDBusMessage::createMethodCall(History::DBusService, reply.value(),
+                                                                                       History::ThreadViewInterface, "Destroy"));
+            }
+            watcher->deleteLater();
+        });
+    } else if (d->valid) {
+        d->dbus->asyncCall("Destroy");
     }
 }
 
@@ -161,28 +436,68 @@ Threads ThreadView::nextPage()
 {
     Threads threads;
     Q_D(ThreadView);
-    if (!d->valid) {
+    // the page requested with requestNextPage() is the next one, it is delivered by pageReady()
+    if (d->pageRequested) {
+        qWarning() << "A page was already requested for this view";
         return threads;
     }
 
-    QDBusReply<QList<QVariantMap> > reply = d->dbus->call("NextPage");
+    if (!d->waitForQuery()) {
+        return threads;
+    }
 
-    if (!reply.isValid()) {
-        qDebug() << "Error:" << reply.error();
+    QList<QVariantMap> threadsProperties;
+    d->pageRequested = true;
+    bool fetched = d->fetchNextPage(threadsProperties);
+    d->pageRequested = false;
+    if (!fetched) {
         d->valid = false;
         Q_EMIT invalidated();
         return threads;
     }
 
-    QList<QVariantMap> threadsProperties = reply.value();
-    Q_FOREACH(const QVariantMap &properties, threadsProperties) {
-        Thread thread = Thread::fromProperties(properties);
-        if (!thread.isNull()) {
-            threads << thread;
-        }
+    return d->threadsFromProperties(threadsProperties);
+}
+
+/// requests the next page without blocking, pageReady() is emitted once it arrives.
+/// Only one page is requested at a time.
+void ThreadView::requestNextPage()
+{
+    Q_D(ThreadView);
+    if (!d->valid) {
+        Q_EMIT pageReady(Threads());
+        return;
     }
 
-    return threads;
+    if (d->pageRequested) {
+        return;
+    }
+
+    d->pageRequested = true;
+    if (!d->queryWatcher) {
+        d->requestPage();
+    }
+}
+
+/// sets the number of items per page, or 0 to let the service grow the pages while they are
+/// requested in quick succession. The service caps the size to its own maximum.
+void ThreadView::setPageSize(int size)
+{
+    Q_D(ThreadView);
+    d->pageSize = size;
+    if (d->valid && !d->queryWatcher) {
+        d->dbus->asyncCall("SetPageSize", size);
+    }
+}
+
+/// makes the service prepare the next page while the current one is being processed
+void ThreadView::setReadAhead(bool enabled)
+{
+    Q_D(ThreadView);
+    d->readAhead = enabled;
+    if (d->valid && !d->queryWatcher) {
+        d->dbus->asyncCall("SetReadAhead", enabled);
+    }
 }
 
 bool ThreadView::isValid() const
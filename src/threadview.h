@@ -46,6 +46,9 @@ public:
     ~ThreadView();
 
     Threads nextPage();
+    void requestNextPage();
+    void setPageSize(int size);
+    void setReadAhead(bool enabled);
     bool isValid() const;
 
 Q_SIGNALS:
@@ -57,11 +60,18 @@ Q_SIGNALS:
                                    const History::Participants &removed,
                                    const History::Participants &modified);
     void invalidated();
+    void pageReady(const History::Threads &threads);
 
 private:
     Q_PRIVATE_SLOT(d_func(), void _d_threadsAdded(const History::Threads &threads))
     Q_PRIVATE_SLOT(d_func(), void _d_threadsModified(const History::Threads &threads))
     Q_PRIVATE_SLOT(d_func(), void _d_threadsRemoved(const History::Threads &threads))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsAdded(const QList<QVariantMap> &threads))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsModified(const QList<QVariantMap> &threads))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsRemoved(const QList<QVariantMap> &threads))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsAddedEncoded(const QByteArray &payload))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsModifiedEncoded(const QByteArray &payload))
+    Q_PRIVATE_SLOT(d_func(), void _d_subscribedThreadsRemovedEncoded(const QByteArray &payload))
     Q_PRIVATE_SLOT(d_func(), void _d_threadParticipantsChanged(const History::Thread &thread,
                                    const History::Participants &added,
                                    const History::Participants &removed,
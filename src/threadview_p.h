@@ -24,6 +24,7 @@
 
 #include "types.h"
 #include <QDBusInterface>
+#include <QDBusPendingCallWatcher>
 
 namespace History
 {
@@ -43,6 +44,29 @@ namespace History
         QString objectPath;
         bool valid;
         QDBusInterface *dbus;
+        int encodingVersion;
+        QDBusPendingCallWatcher *queryWatcher;
+        bool pageRequested;
+        int pageSize;
+        bool readAhead;
+
+        enum PageResult {
+            PageReady,
+            PageRetry,
+            PageFailed
+        };
+
+        QDBusPendingCall callNextPage();
+        PageResult pageFromReply(const QDBusMessage &reply, QList<QVariantMap> &page);
+        bool fetchNextPage(QList<QVariantMap> &page);
+        void requestPage();
+        void pageFinished(const QDBusMessage &reply);
+        void queryFinished();
+        void sendPagingOptions();
+        void subscribe(int version);
+        QList<QVariantMap> decodeSubscribed(const QByteArray &payload);
+        bool waitForQuery();
+        Threads threadsFromProperties(const QList<QVariantMap> &threadsProperties);
 
         Threads filteredThreads(const Threads &threads);
 
@@ -50,6 +74,12 @@ namespace History
         void _d_threadsAdded(const History::Threads &threads);
         void _d_threadsModified(const History::Threads &threads);
         void _d_threadsRemoved(const History::Threads &threads);
+        void _d_subscribedThreadsAdded(const QList<QVariantMap> &threads);
+        void _d_subscribedThreadsModified(const QList<QVariantMap> &threads);
+        void _d_subscribedThreadsRemoved(const QList<QVariantMap> &threads);
+        void _d_subscribedThreadsAddedEncoded(const QByteArray &payload);
+        void _d_subscribedThreadsModifiedEncoded(const QByteArray &payload);
+        void _d_subscribedThreadsRemovedEncoded(const QByteArray &payload);
         void _d_threadParticipantsChanged(const History::Thread &thread,
                                    const History::Participants &added,
                                    const History::Participants &removed,
@@ -52,7 +52,9 @@ enum MatchFlag {
     MatchCaseInsensitive = 0x02,
     MatchContains = 0x04,
     MatchPhoneNumber = 0x08,
-    MatchNotEquals = 0x10
+    MatchNotEquals = 0x10,
+    // the filter value is a full-text query (terms, "phrases" and prefix*) on the message or subject
+    MatchFullText = 0x20
 };
 
 Q_DECLARE_FLAGS(MatchFlags, MatchFlag)
@@ -203,6 +205,7 @@ static const char* FieldReadTimestamp = "readTimestamp";
 static const char* FieldSubject = "subject";
 static const char* FieldInformationType = "informationType";
 static const char* FieldAttachments = "attachments";
+static const char* FieldMatchSnippet = "matchSnippet";
 
 // text attachment fields
 
@@ -27,6 +27,7 @@
 #include <QDBusInterface>
 #include <QDBusConnection>
 #include <QDBusReply>
+#include <QDateTime>
 #include <QMap>
 
 namespace History {
@@ -46,16 +47,18 @@ bool Utils::shouldGroupThread(const Thread &thread)
 
 MatchFlags Utils::matchFlagsForAccount(const QString &accountId)
 {
-    static QMap<QString, History::MatchFlags> protocolFlags;
-    if (protocolFlags.isEmpty()) {
-        protocolFlags["ofono"] = MatchPhoneNumber;
-        protocolFlags["multimedia"] = MatchPhoneNumber;
-        protocolFlags["sip"] = MatchPhoneNumber;
-    }
+    // initialized only once, as this gets called from the database reader threads too
+    static const QMap<QString, History::MatchFlags> protocolFlags = []() {
+        QMap<QString, History::MatchFlags> flags;
+        flags["ofono"] = MatchPhoneNumber;
+        flags["multimedia"] = MatchPhoneNumber;
+        flags["sip"] = MatchPhoneNumber;
+        return flags;
+    }();
 
     QString protocol = protocolFromAccountId(accountId);
     if (protocolFlags.contains(protocol)) {
-        return protocolFlags[protocol];
+        return protocolFlags.value(protocol);
     }
 
     // default to phone number matching for now
@@ -144,6 +147,19 @@ bool Utils::compareNormalizedParticipants(const QStringList &participants1, cons
     return found;
 }
 
+/// returns the same fingerprint for any two lists of normalized participants considered equal by
+/// \ref compareNormalizedParticipants, so lists can be grouped in a hash before comparing them.
+/// Lists with different fingerprints are never equal, but lists sharing one still need to be compared.
+QString Utils::participantsFingerprint(const QStringList &participants, MatchFlags flags)
+{
+    QStringList keys;
+    Q_FOREACH(const QString &participant, participants) {
+        keys << ((flags & MatchPhoneNumber) ? PhoneUtils::comparisonKey(participant) : participant);
+    }
+    keys.sort();
+    return keys.join("|");
+}
+
 QString Utils::normalizeId(const QString &accountId, const QString &id)
 {
     QString normalizedId = id;
@@ -190,4 +206,43 @@ bool Utils::shouldIncludeParticipants(const QString &accountId, const ChatType &
     return true;
 }
 
+/// converts a timestamp in any of the forms accepted by the API (a QDateTime, an ISO string in local time
+/// or milliseconds since the epoch) to the milliseconds since the epoch used for storage, or a null value
+QVariant Utils::timestampToMSecs(const QVariant &timestamp)
+{
+    QDateTime dateTime;
+    switch (timestamp.type()) {
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return timestamp.toLongLong();
+    case QVariant::DateTime:
+        dateTime = timestamp.toDateTime();
+        break;
+    default:
+        dateTime = QDateTime::fromString(timestamp.toString(), Qt::ISODate);
+    }
+
+    if (!dateTime.isValid()) {
+        return QVariant(QVariant::LongLong);
+    }
+    return dateTime.toMSecsSinceEpoch();
+}
+
+/// the API form of a stored timestamp: an ISO string in local time, or a null string for a null value
+QString Utils::timestampToString(const QVariant &msecs)
+{
+    if (msecs.isNull()) {
+        return QString();
+    }
+
+    // formatting by hand is a lot cheaper than QDateTime::toString() on every row
+    QDateTime dateTime = QDateTime::fromMSecsSinceEpoch(msecs.toLongLong());
+    QDate date = dateTime.date();
+    QTime time = dateTime.time();
+    return QString::asprintf("%04d-%02d-%02dT%02d:%02d:%02d.%03d", date.year(), date.month(), date.day(),
+                             time.hour(), time.minute(), time.second(), time.msec());
+}
+
 }
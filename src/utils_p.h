@@ -35,11 +35,14 @@ public:
     static bool compareIds(const QString &accountId, const QString &id1, const QString & id2);
     static bool compareParticipants(const QStringList &participants1, const QStringList &participants2, MatchFlags flags);
     static bool compareNormalizedParticipants(const QStringList &participants1, const QStringList &participants2, MatchFlags flags);
+    static QString participantsFingerprint(const QStringList &participants, MatchFlags flags);
     static bool shouldGroupThread(const Thread &thread);
     static bool shouldIncludeParticipants(const Thread &thread);
     static bool shouldIncludeParticipants(const QString &accountId, const History::ChatType &type);
     static QString normalizeId(const QString &accountId, const QString &id);
     static QVariant getUserValue(const QString &interface, const QString &propName);
+    static QVariant timestampToMSecs(const QVariant &timestamp);
+    static QString timestampToString(const QVariant &msecs);
 
 private:
     Utils();
@@ -17,7 +17,9 @@
  */
 
 #include <QtTest/QtTest>
+#include <QContactManager>
 #include "telepathytest.h"
+#include "contactmatcher_p.h"
 #include "manager.h"
 #include "textevent.h"
 #include "historyeventmodel.h"
@@ -29,8 +31,11 @@ class HistoryEventModelTest : public TelepathyTest
 private Q_SLOTS:
     void initTestCase();
     void testTelepathyInitializedCorrectly();
+    void testContactInfoChangedRows();
 
 private:
+    History::TextEvent createTextEvent(const History::Thread &thread, const QString &eventId, const QDateTime &timestamp);
+    void checkContactInfoChangedRows(HistoryEventModel *model, const QList<QPair<int, int> > &ranges);
     History::Manager *mManager;
 };
 
@@ -39,6 +44,7 @@ void HistoryEventModelTest::initTestCase()
     initialize(0);
 
     mManager = History::Manager::instance();
+    History::ContactMatcher::instance(new QContactManager("memory"));
 }
 
 void HistoryEventModelTest::testTelepathyInitializedCorrectly()
@@ -93,5 +99,104 @@ void HistoryEventModelTest::testTelepathyInitializedCorrectly()
     QTRY_COMPARE(model.rowCount(), 0);
 }
 
+void HistoryEventModelTest::testContactInfoChangedRows()
+{
+    // the phone number participant is in threads from an account not matching phone numbers, but the
+    // contact info changes come from a phone account, which matches it against the formatted number
+    QString accountId("mock/mock/account0");
+    QString phoneAccountId("ofono/ofono/account0");
+
+    HistoryEventModel model;
+    model.setMatchContacts(true);
+
+    History::Thread phoneThread = mManager->threadForParticipants(accountId,
+                                                              History::EventTypeText,
+                                                              QStringList() << "555-123-4567",
+                                                              History::MatchCaseSensitive, true);
+    History::Thread otherThread = mManager->threadForParticipants(accountId,
+                                                              History::EventTypeText,
+                                                              QStringList() << "otherParticipant",
+                                                              History::MatchCaseSensitive, true);
+
+    QDateTime now = QDateTime::currentDateTime();
+    History::TextEvent firstEvent = createTextEvent(phoneThread, "contactEventId1", now.addSecs(-1));
+    History::TextEvent secondEvent = createTextEvent(phoneThread, "contactEventId2", now.addSecs(-2));
+    History::TextEvent thirdEvent = createTextEvent(phoneThread, "contactEventId3", now.addSecs(-3));
+    History::TextEvent otherEvent = createTextEvent(otherThread, "contactEventId4", now.addSecs(-4));
+    QVERIFY(mManager->writeEvents(History::Events() << firstEvent << secondEvent << thirdEvent << otherEvent));
+
+    HistoryQmlFilter *filter = new HistoryQmlFilter(this);
+    filter->setFilterProperty(History::FieldAccountId);
+    filter->setFilterValue(accountId);
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(this);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+
+    QTRY_COMPARE(model.rowCount(), 4);
+
+    // the rows of the participant are reported as one range
+    checkContactInfoChangedRows(&model, {{0, 2}});
+
+    // a row inserted before them shifts them down
+    History::TextEvent newEvent = createTextEvent(otherThread, "contactEventId5", now);
+    QVERIFY(mManager->writeEvents(History::Events() << newEvent));
+    QTRY_COMPARE(model.rowCount(), 5);
+    checkContactInfoChangedRows(&model, {{1, 3}});
+
+    // and a row of the participant inserted after the other participant's gets its own range
+    History::TextEvent newPhoneEvent = createTextEvent(phoneThread, "contactEventId6", now.addSecs(-5));
+    QVERIFY(mManager->writeEvents(History::Events() << newPhoneEvent));
+    QTRY_COMPARE(model.rowCount(), 6);
+    checkContactInfoChangedRows(&model, {{1, 3}, {5, 5}});
+
+    // removing the other participant's rows joins the ranges
+    QVERIFY(mManager->removeEvents(History::Events() << newEvent << otherEvent));
+    QTRY_COMPARE(model.rowCount(), 4);
+    checkContactInfoChangedRows(&model, {{0, 3}});
+
+    // the rows are all worked out again after the query changes
+    QSignalSpy rowsRemoved(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    sort->setSortOrder(HistoryQmlSort::AscendingOrder);
+    QTRY_VERIFY(!rowsRemoved.isEmpty());
+    QTRY_COMPARE(model.rowCount(), 4);
+    checkContactInfoChangedRows(&model, {{0, 3}});
+
+    mManager->removeThreads(History::Threads() << phoneThread << otherThread);
+    QTRY_COMPARE(model.rowCount(), 0);
+}
+
+History::TextEvent HistoryEventModelTest::createTextEvent(const History::Thread &thread, const QString &eventId, const QDateTime &timestamp)
+{
+    return History::TextEvent(thread.accountId(),
+                              thread.threadId(),
+                              eventId,
+                              thread.participants().identifiers().first(),
+                              timestamp,
+                              timestamp,
+                              false,
+                              "Hi there",
+                              History::MessageTypeText,
+                              History::MessageStatusRead,
+                              timestamp,
+                              QString(),
+                              History::InformationTypeNone,
+                              History::TextEventAttachments(),
+                              thread.participants());
+}
+
+void HistoryEventModelTest::checkContactInfoChangedRows(HistoryEventModel *model, const QList<QPair<int, int> > &ranges)
+{
+    QSignalSpy dataChanged(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    Q_EMIT History::ContactMatcher::instance()->contactInfoChanged("ofono/ofono/account0", "+15551234567", QVariantMap());
+    QCOMPARE(dataChanged.count(), ranges.count());
+    for (int i = 0; i < ranges.count(); ++i) {
+        QCOMPARE(dataChanged[i][0].value<QModelIndex>().row(), ranges[i].first);
+        QCOMPARE(dataChanged[i][1].value<QModelIndex>().row(), ranges[i].second);
+    }
+}
+
 QTEST_MAIN(HistoryEventModelTest)
 #include "HistoryEventModelTest.moc"
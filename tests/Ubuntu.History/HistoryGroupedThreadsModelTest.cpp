@@ -18,6 +18,8 @@
 
 #include <QtCore/QObject>
 #include <QtTest/QtTest>
+#include <QContactManager>
+#include "contactmatcher_p.h"
 #include "manager.h"
 #include "historygroupedthreadsmodel.h"
 
@@ -29,13 +31,16 @@ private Q_SLOTS:
     void initTestCase();
     void testCanFetchMore();
     void testThreadsUpdated();
+    void testContactInfoChangedRows();
 private:
+    void checkContactInfoChangedRows(HistoryGroupedThreadsModel *model, int row);
     History::Manager *mManager;
 };
 
 void HistoryGroupedThreadsModelTest::initTestCase()
 {
     mManager = History::Manager::instance();
+    History::ContactMatcher::instance(new QContactManager("memory"));
 }
 
 void HistoryGroupedThreadsModelTest::testCanFetchMore()
@@ -156,5 +161,72 @@ void HistoryGroupedThreadsModelTest::testThreadsUpdated()
     QTRY_COMPARE(model.rowCount(), 0);
 }
 
+void HistoryGroupedThreadsModelTest::testContactInfoChangedRows()
+{
+    HistoryGroupedThreadsModel model;
+    model.setMatchContacts(true);
+
+    HistoryQmlFilter *filter = new HistoryQmlFilter(this);
+    model.setFilter(filter);
+    model.setGroupingProperty(History::FieldParticipants);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(this);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("lastEventTimestamp");
+    model.setSort(sort);
+
+    // force updateQuery() to be called
+    model.componentComplete();
+
+    // the phone number participant is in a thread from an account not matching phone numbers, but the
+    // contact info changes come from a phone account, which matches it against the formatted number
+    History::Thread phoneThread = mManager->threadForParticipants("mock/mock/account0",
+                                                              History::EventTypeText,
+                                                              QStringList() << QString("555-123-4567"),
+                                                              History::MatchCaseSensitive, true);
+    History::Thread otherThread = mManager->threadForParticipants("mock/mock/account0",
+                                                              History::EventTypeText,
+                                                              QStringList() << QString("otherParticipant"),
+                                                              History::MatchCaseSensitive, true);
+
+    QDateTime now = QDateTime::currentDateTime();
+    History::TextEvent phoneEvent(phoneThread.accountId(), phoneThread.threadId(), "contactEventId1",
+                                  "555-123-4567", now.addSecs(-10), now.addSecs(-10), false, "Phone Message",
+                                  History::MessageTypeText);
+    History::TextEvent otherEvent(otherThread.accountId(), otherThread.threadId(), "contactEventId2",
+                                  "otherParticipant", now.addSecs(-5), now.addSecs(-5), false, "Other Message",
+                                  History::MessageTypeText);
+    mManager->writeEvents(History::Events() << phoneEvent << otherEvent);
+
+    QTRY_COMPARE(model.rowCount(), 2);
+    QTRY_COMPARE(model.index(1).data(HistoryModel::ThreadIdRole).toString(), phoneThread.threadId());
+    checkContactInfoChangedRows(&model, 1);
+
+    // a new event moves the group of the participant to the top
+    History::TextEvent newPhoneEvent(phoneThread.accountId(), phoneThread.threadId(), "contactEventId3",
+                                     "555-123-4567", now, now, false, "New Phone Message",
+                                     History::MessageTypeText);
+    mManager->writeEvents(History::Events() << newPhoneEvent);
+    QTRY_COMPARE(model.index(0).data(HistoryModel::ThreadIdRole).toString(), phoneThread.threadId());
+    checkContactInfoChangedRows(&model, 0);
+
+    // removing the other group keeps it there
+    mManager->removeThreads(History::Threads() << otherThread);
+    QTRY_COMPARE(model.rowCount(), 1);
+    checkContactInfoChangedRows(&model, 0);
+
+    mManager->removeThreads(History::Threads() << phoneThread);
+    QTRY_COMPARE(model.rowCount(), 0);
+}
+
+void HistoryGroupedThreadsModelTest::checkContactInfoChangedRows(HistoryGroupedThreadsModel *model, int row)
+{
+    QSignalSpy dataChanged(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    Q_EMIT History::ContactMatcher::instance()->contactInfoChanged("ofono/ofono/account0", "+15551234567", QVariantMap());
+    QCOMPARE(dataChanged.count(), 1);
+    QCOMPARE(dataChanged.first()[0].value<QModelIndex>().row(), row);
+    QCOMPARE(dataChanged.first()[1].value<QModelIndex>().row(), row);
+}
+
 QTEST_MAIN(HistoryGroupedThreadsModelTest)
 #include "HistoryGroupedThreadsModelTest.moc"
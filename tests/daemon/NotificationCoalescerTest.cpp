@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include "notificationcoalescer.h"
+
+Q_DECLARE_METATYPE(QList<QVariantMap>)
+
+class NotificationCoalescerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testDuplicates();
+    void testOrder();
+    void testMaximumBatchSize();
+    void testMaximumDelay();
+    void testStatistics();
+    void testClear();
+
+private:
+    QVariantMap item(const QString &id, int value = 0);
+    void setupCoalescer(NotificationCoalescer &coalescer);
+};
+
+void NotificationCoalescerTest::initTestCase()
+{
+    qRegisterMetaType<QList<QVariantMap> >();
+    qRegisterMetaType<NotificationCoalescer::Kind>();
+}
+
+QVariantMap NotificationCoalescerTest::item(const QString &id, int value)
+{
+    QVariantMap item;
+    item["id"] = id;
+    item["value"] = value;
+    return item;
+}
+
+void NotificationCoalescerTest::setupCoalescer(NotificationCoalescer &coalescer)
+{
+    for (int kind = 0; kind < NotificationCoalescer::KindCount; ++kind) {
+        coalescer.setKeyFunction((NotificationCoalescer::Kind) kind, [](const QVariantMap &item) {
+            return item["id"].toString();
+        });
+    }
+}
+
+void NotificationCoalescerTest::testDuplicates()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+    QSignalSpy batchReady(&coalescer, SIGNAL(batchReady(NotificationCoalescer::Kind,QList<QVariantMap>)));
+
+    coalescer.add(NotificationCoalescer::ThreadsModified, QList<QVariantMap>() << item("one", 1) << item("two", 1));
+    coalescer.add(NotificationCoalescer::ThreadsModified, QList<QVariantMap>() << item("one", 2));
+    coalescer.add(NotificationCoalescer::ThreadsModified, QList<QVariantMap>() << item("three", 1) << item("one", 3));
+    QCOMPARE(coalescer.pendingItems(), 3);
+
+    // the items are sent once with the latest properties, in the order they were first queued
+    QTRY_COMPARE(batchReady.count(), 1);
+    QList<QVariantMap> items = batchReady.first()[1].value<QList<QVariantMap> >();
+    QCOMPARE(items.count(), 3);
+    QCOMPARE(items[0], item("one", 3));
+    QCOMPARE(items[1], item("two", 1));
+    QCOMPARE(items[2], item("three", 1));
+}
+
+void NotificationCoalescerTest::testOrder()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+    QSignalSpy batchReady(&coalescer, SIGNAL(batchReady(NotificationCoalescer::Kind,QList<QVariantMap>)));
+
+    // the same key in different kinds is not merged
+    coalescer.add(NotificationCoalescer::EventsAdded, QList<QVariantMap>() << item("one"));
+    coalescer.add(NotificationCoalescer::ThreadsModified, QList<QVariantMap>() << item("one"));
+    coalescer.add(NotificationCoalescer::ThreadsAdded, QList<QVariantMap>() << item("one"));
+    coalescer.flush();
+
+    QCOMPARE(batchReady.count(), 3);
+    QCOMPARE(batchReady[0][0].value<NotificationCoalescer::Kind>(), NotificationCoalescer::ThreadsAdded);
+    QCOMPARE(batchReady[1][0].value<NotificationCoalescer::Kind>(), NotificationCoalescer::ThreadsModified);
+    QCOMPARE(batchReady[2][0].value<NotificationCoalescer::Kind>(), NotificationCoalescer::EventsAdded);
+    QCOMPARE(coalescer.pendingItems(), 0);
+}
+
+void NotificationCoalescerTest::testMaximumBatchSize()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+    coalescer.setMaximumBatchSize(10);
+    QSignalSpy batchReady(&coalescer, SIGNAL(batchReady(NotificationCoalescer::Kind,QList<QVariantMap>)));
+
+    for (int i = 0; i < 25; ++i) {
+        coalescer.add(NotificationCoalescer::EventsAdded, QList<QVariantMap>() << item(QString::number(i)));
+    }
+
+    // full batches go out right away, the rest waits for the delay
+    QCOMPARE(batchReady.count(), 2);
+    QCOMPARE(batchReady[0][1].value<QList<QVariantMap> >().count(), 10);
+    QCOMPARE(batchReady[1][1].value<QList<QVariantMap> >().count(), 10);
+    QCOMPARE(coalescer.pendingItems(), 5);
+    QTRY_COMPARE(batchReady.count(), 3);
+    QCOMPARE(batchReady[2][1].value<QList<QVariantMap> >().count(), 5);
+}
+
+void NotificationCoalescerTest::testMaximumDelay()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+    coalescer.setDelay(100);
+    coalescer.setMaximumDelay(300);
+    QSignalSpy batchReady(&coalescer, SIGNAL(batchReady(NotificationCoalescer::Kind,QList<QVariantMap>)));
+
+    // a steady stream of changes never leaves the quiet period, but still gets sent
+    QElapsedTimer timer;
+    timer.start();
+    int i = 0;
+    while (batchReady.isEmpty() && timer.elapsed() < 2000) {
+        coalescer.add(NotificationCoalescer::EventsAdded, QList<QVariantMap>() << item(QString::number(i++)));
+        QTest::qWait(20);
+    }
+
+    QCOMPARE(batchReady.count(), 1);
+    QVERIFY(timer.elapsed() < 1000);
+    QVERIFY(coalescer.statistics()["maximumLatency"].toLongLong() >= 300);
+}
+
+void NotificationCoalescerTest::testStatistics()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+
+    coalescer.add(NotificationCoalescer::ThreadsAdded, QList<QVariantMap>() << item("one") << item("two") << item("one"));
+    coalescer.flush();
+    coalescer.add(NotificationCoalescer::ThreadsAdded, QList<QVariantMap>() << item("one") << item("two")
+                                                                            << item("three") << item("four"));
+    coalescer.flush();
+    // flushing with nothing queued doesn't count as a batch
+    coalescer.flush();
+
+    QVariantMap statistics = coalescer.statistics();
+    QCOMPARE(statistics["batches"].toInt(), 2);
+    QCOMPARE(statistics["items"].toInt(), 6);
+    QCOMPARE(statistics["duplicates"].toInt(), 1);
+    QCOMPARE(statistics["largestBatch"].toInt(), 4);
+    QCOMPARE(statistics["averageBatch"].toDouble(), 3.0);
+}
+
+void NotificationCoalescerTest::testClear()
+{
+    NotificationCoalescer coalescer;
+    setupCoalescer(coalescer);
+    QSignalSpy batchReady(&coalescer, SIGNAL(batchReady(NotificationCoalescer::Kind,QList<QVariantMap>)));
+
+    coalescer.add(NotificationCoalescer::ThreadsAdded, QList<QVariantMap>() << item("one") << item("two"));
+    coalescer.add(NotificationCoalescer::EventsAdded, QList<QVariantMap>() << item("three"));
+    coalescer.clear();
+    QCOMPARE(coalescer.pendingItems(), 0);
+
+    // the cleared items are not sent, neither by the timer nor by the next flush
+    QTest::qWait(700);
+    coalescer.flush();
+    QCOMPARE(batchReady.count(), 0);
+
+    // and the items queued afterwards are sent as usual
+    coalescer.add(NotificationCoalescer::ThreadsAdded, QList<QVariantMap>() << item("one"));
+    coalescer.flush();
+    QCOMPARE(batchReady.count(), 1);
+    QCOMPARE(batchReady.first()[1].value<QList<QVariantMap> >(), QList<QVariantMap>() << item("one"));
+
+    QVariantMap statistics = coalescer.statistics();
+    QCOMPARE(statistics["cleared"].toInt(), 3);
+    QCOMPARE(statistics["items"].toInt(), 1);
+}
+
+QTEST_MAIN(NotificationCoalescerTest)
+#include "NotificationCoalescerTest.moc"
@@ -31,6 +31,25 @@
 
 QTCONTACTS_USE_NAMESPACE
 
+// looks the contact info up like the database reader threads of the daemon do
+class ContactInfoReader : public QThread
+{
+public:
+    ContactInfoReader(const QString &accountId, const QString &identifier)
+        : mAccountId(accountId), mIdentifier(identifier) { }
+    QVariantMap info;
+
+protected:
+    void run()
+    {
+        info = History::ContactMatcher::instance()->contactInfo(mAccountId, mIdentifier, true);
+    }
+
+private:
+    QString mAccountId;
+    QString mIdentifier;
+};
+
 class ContactMatcherTest : public TelepathyTest
 {
     Q_OBJECT
@@ -43,8 +62,12 @@ private Q_SLOTS:
     void testMatchExistingContact();
     void testContactAdded();
     void testContactRemoved();
+    void testContactChanged();
     void testSynchronousContactInfoRequest();
+    void testBatchedContactInfoRequest_data();
+    void testBatchedContactInfoRequest();
     void testWatchIdentifier();
+    void testContactInfoFromOtherThread();
 
 protected:
     QContact createContact(const QString &firstName, const QString &lastName, const QStringList &phoneNumbers = QStringList(), const QStringList &extendedDetails = QStringList());
@@ -155,6 +178,29 @@ void ContactMatcherTest::testContactRemoved()
     QVERIFY(!contactInfoSpy.first()[2].toMap().contains(History::FieldContactId));
 }
 
+void ContactMatcherTest::testContactChanged()
+{
+    QString identifier("99999999");
+    QString accountId("mock/ofono/account0");
+    History::ContactMatcher::instance()->watchIdentifier(accountId, identifier);
+
+    // create a contact that doesn't match the identifier yet
+    QContact contact = createContact("Changed", "Contact", QStringList() << "11111111");
+    QSignalSpy contactInfoSpy(History::ContactMatcher::instance(), SIGNAL(contactInfoChanged(QString,QString,QVariantMap)));
+
+    // and change its phone number to the watched one
+    QContactPhoneNumber phoneNumber = contact.detail<QContactPhoneNumber>();
+    phoneNumber.setNumber(identifier);
+    QVERIFY(contact.saveDetail(&phoneNumber));
+    QVERIFY(mContactManager->saveContact(&contact));
+    QTRY_COMPARE(contactInfoSpy.count(), 1);
+    QCOMPARE(contactInfoSpy.first()[0].toString(), accountId);
+    QCOMPARE(contactInfoSpy.first()[1].toString(), identifier);
+    QCOMPARE(contactInfoSpy.first()[2].toMap()[History::FieldContactId].toString(), contact.id().toString());
+
+    QVERIFY(mContactManager->removeContact(contact.id()));
+}
+
 void ContactMatcherTest::testSynchronousContactInfoRequest()
 {
     QString identifier("77777777");
@@ -173,6 +219,46 @@ void ContactMatcherTest::testSynchronousContactInfoRequest()
     QVERIFY(mContactManager->removeContact(contact.id()));
 }
 
+void ContactMatcherTest::testBatchedContactInfoRequest_data()
+{
+    QTest::addColumn<bool>("synchronous");
+
+    QTest::newRow("asynchronous") << false;
+    QTest::newRow("synchronous") << true;
+}
+
+void ContactMatcherTest::testBatchedContactInfoRequest()
+{
+    QFETCH(bool, synchronous);
+    QString accountId("mock/ofono/account0");
+    QString suffix = synchronous ? "1" : "2";
+    QStringList identifiers;
+    identifiers << "3333333" + suffix << "4444444" + suffix << "2222222" + suffix;
+
+    // the identifiers are looked up together, and each of them gets the contact it matches
+    QContact firstContact = createContact("First", "Batched", QStringList() << identifiers[0]);
+    QContact secondContact = createContact("Second", "Batched", QStringList() << identifiers[1]);
+    QSignalSpy contactInfoSpy(History::ContactMatcher::instance(), SIGNAL(contactInfoChanged(QString,QString,QVariantMap)));
+    QVariantList info = History::ContactMatcher::instance()->contactInfo(accountId, identifiers, synchronous);
+    QCOMPARE(info.count(), 3);
+    if (synchronous) {
+        QCOMPARE(info[0].toMap()[History::FieldContactId].toString(), firstContact.id().toString());
+        QCOMPARE(info[1].toMap()[History::FieldContactId].toString(), secondContact.id().toString());
+        QVERIFY(!info[2].toMap().contains(History::FieldContactId));
+    }
+
+    QTRY_COMPARE(contactInfoSpy.count(), 2);
+    QMap<QString, QString> contactIds;
+    Q_FOREACH(const QList<QVariant> &arguments, contactInfoSpy) {
+        contactIds[arguments[1].toString()] = arguments[2].toMap()[History::FieldContactId].toString();
+    }
+    QCOMPARE(contactIds[identifiers[0]], firstContact.id().toString());
+    QCOMPARE(contactIds[identifiers[1]], secondContact.id().toString());
+
+    QVERIFY(mContactManager->removeContact(firstContact.id()));
+    QVERIFY(mContactManager->removeContact(secondContact.id()));
+}
+
 void ContactMatcherTest::testWatchIdentifier()
 {
     QString identifier("88888888");
@@ -192,6 +278,34 @@ void ContactMatcherTest::testWatchIdentifier()
     QVERIFY(mContactManager->removeContact(contact.id()));
 }
 
+void ContactMatcherTest::testContactInfoFromOtherThread()
+{
+    QString identifier("66666666");
+    QString accountId("mock/ofono/account0");
+    QContact contact = createContact("Other", "Thread", QStringList() << identifier);
+    QSignalSpy contactInfoSpy(History::ContactMatcher::instance(), SIGNAL(contactInfoChanged(QString,QString,QVariantMap)));
+
+    // other threads don't wait for the matcher's thread, the identifier is not known yet
+    ContactInfoReader reader(accountId, identifier);
+    reader.start();
+    QVERIFY(reader.wait(5000));
+    QCOMPARE(reader.info[History::FieldIdentifier].toString(), identifier);
+    QCOMPARE(reader.info[History::FieldAccountId].toString(), accountId);
+    QVERIFY(!reader.info.contains(History::FieldContactId));
+
+    // but it gets looked up in the background
+    QTRY_COMPARE(contactInfoSpy.count(), 1);
+    QCOMPARE(contactInfoSpy.first()[1].toString(), identifier);
+    QCOMPARE(contactInfoSpy.first()[2].toMap()[History::FieldContactId].toString(), contact.id().toString());
+
+    // and is read from the cache the next time
+    reader.start();
+    QVERIFY(reader.wait(5000));
+    QCOMPARE(reader.info[History::FieldContactId].toString(), contact.id().toString());
+
+    QVERIFY(mContactManager->removeContact(contact.id()));
+}
+
 QContact ContactMatcherTest::createContact(const QString &firstName, const QString &lastName, const QStringList &phoneNumbers, const QStringList &extendedDetails)
 {
     QContact contact;
@@ -30,6 +30,8 @@ Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
 Q_DECLARE_METATYPE(History::Threads)
 Q_DECLARE_METATYPE(History::Events)
+Q_DECLARE_METATYPE(History::Thread)
+Q_DECLARE_METATYPE(History::Event)
 
 class ManagerTest : public QObject
 {
@@ -46,6 +48,7 @@ private Q_SLOTS:
     void testRemoveEvents();
     void testGetSingleEvent();
     void testRemoveThreads();
+    void testAsyncRequests();
     void cleanupTestCase();
 
 private:
@@ -58,6 +61,8 @@ void ManagerTest::initTestCase()
     qRegisterMetaType<History::MatchFlags>();
     qRegisterMetaType<History::Threads>();
     qRegisterMetaType<History::Events>();
+    qRegisterMetaType<History::Thread>();
+    qRegisterMetaType<History::Event>();
     mManager = History::Manager::instance();
 }
 
@@ -368,6 +373,50 @@ void ManagerTest::testRemoveThreads()
     QCOMPARE(removedThreads, threads);
 }
 
+void ManagerTest::testAsyncRequests()
+{
+    QSignalSpy threadReady(mManager, SIGNAL(threadReady(int, History::Thread)));
+    QSignalSpy eventReady(mManager, SIGNAL(eventReady(int, History::Event)));
+    QSignalSpy eventsWritten(mManager, SIGNAL(eventsWritten(int, bool)));
+
+    // create a thread and look it up again without blocking
+    QVariantMap properties;
+    properties[History::FieldParticipantIds] = QStringList() << "asyncParticipant";
+    int requestId = mManager->requestThreadForProperties("asyncAccountId", History::EventTypeText, properties,
+                                                         History::MatchCaseSensitive, true);
+    QTRY_COMPARE(threadReady.count(), 1);
+    QCOMPARE(threadReady.first()[0].toInt(), requestId);
+    History::Thread thread = threadReady.first()[1].value<History::Thread>();
+    QVERIFY(!thread.isNull());
+
+    requestId = mManager->requestSingleThread(thread.type(), thread.accountId(), thread.threadId());
+    QTRY_COMPARE(threadReady.count(), 2);
+    QCOMPARE(threadReady.last()[0].toInt(), requestId);
+    QVERIFY(threadReady.last()[1].value<History::Thread>() == thread);
+
+    // write an event and get it back
+    History::TextEvent textEvent(thread.accountId(), thread.threadId(), "asyncEventId", "self",
+                                 QDateTime::currentDateTime(), false, "Hello async world!", History::MessageTypeText);
+    requestId = mManager->requestWriteEvents(History::Events() << textEvent);
+    QTRY_COMPARE(eventsWritten.count(), 1);
+    QCOMPARE(eventsWritten.first()[0].toInt(), requestId);
+    QCOMPARE(eventsWritten.first()[1].toBool(), true);
+
+    requestId = mManager->requestSingleEvent(History::EventTypeText, thread.accountId(), thread.threadId(), "asyncEventId");
+    QTRY_COMPARE(eventReady.count(), 1);
+    QCOMPARE(eventReady.first()[0].toInt(), requestId);
+    History::TextEvent retrievedEvent = eventReady.first()[1].value<History::Event>();
+    QVERIFY(retrievedEvent == textEvent);
+    QCOMPARE(retrievedEvent.message(), textEvent.message());
+
+    // writing nothing fails, but still answers asynchronously
+    requestId = mManager->requestWriteEvents(History::Events());
+    QCOMPARE(eventsWritten.count(), 1);
+    QTRY_COMPARE(eventsWritten.count(), 2);
+    QCOMPARE(eventsWritten.last()[0].toInt(), requestId);
+    QCOMPARE(eventsWritten.last()[1].toBool(), false);
+}
+
 void ManagerTest::cleanupTestCase()
 {
     delete mManager;
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include "payloadcodec_p.h"
+#include "textevent.h"
+#include "thread.h"
+
+class PayloadCodecTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testRoundTrip();
+    void testThreadsAndEvents();
+    void testUnsupportedVersion();
+    void testInvalidPayload_data();
+    void testInvalidPayload();
+    void benchmarkEncoding();
+};
+
+void PayloadCodecTest::testRoundTrip()
+{
+    QVariantMap nested;
+    nested["someKey"] = "someValue";
+    nested["someNumber"] = 42;
+
+    QVariantMap item;
+    item["string"] = "theString";
+    item["int"] = -7;
+    item["uint"] = 7u;
+    item["longlong"] = Q_INT64_C(1234567890123);
+    item["double"] = 2.5;
+    item["bool"] = true;
+    item["stringList"] = QStringList() << "one" << "two" << "one";
+    item["dateTime"] = QDateTime(QDate(2016, 5, 4), QTime(3, 2, 1), Qt::UTC);
+    item["map"] = nested;
+    item["list"] = QVariantList() << 1 << "two" << nested;
+    item["mapList"] = QVariant::fromValue(QList<QVariantMap>() << nested << nested);
+    item["invalid"] = QVariant();
+    item["byteArray"] = QByteArray("bytes");
+
+    QList<QVariantMap> items;
+    items << item << nested;
+
+    bool ok = false;
+    QList<QVariantMap> decoded = History::PayloadCodec::decode(History::PayloadCodec::encode(items), &ok);
+    QVERIFY(ok);
+    QCOMPARE(decoded.count(), 2);
+    QCOMPARE(decoded[1], nested);
+
+    // lists of maps are decoded as lists of variants, everything else keeps its type
+    QVariantMap expected = item;
+    expected["mapList"] = QVariantList() << nested << nested;
+    QCOMPARE(decoded[0], expected);
+}
+
+void PayloadCodecTest::testThreadsAndEvents()
+{
+    History::TextEventAttachment attachment("theAccountId", "theThreadId", "theEventId", "theAttachment",
+                                            "text/plain", "/the/file/path");
+    History::TextEvent event("theAccountId", "theThreadId", "theEventId", "theSender", QDateTime::currentDateTime(),
+                             true, "Hello!", History::MessageTypeMultiPart, History::MessageStatusDelivered,
+                             QDateTime(), "theSubject", History::InformationTypeNone,
+                             History::TextEventAttachments() << attachment);
+    History::Thread thread("theAccountId", "theThreadId", History::EventTypeText,
+                           History::Participants::fromStringList(QStringList() << "one" << "two"), event.timestamp(), event, 3, 1);
+
+    QByteArray payload = History::PayloadCodec::encode(QList<QVariantMap>() << thread.properties());
+    QList<QVariantMap> decoded = History::PayloadCodec::decode(payload);
+    QCOMPARE(decoded.count(), 1);
+
+    History::Thread decodedThread = History::Thread::fromProperties(decoded.first());
+    QCOMPARE(decodedThread.threadId(), thread.threadId());
+    QCOMPARE(decodedThread.participants().identifiers(), thread.participants().identifiers());
+    QCOMPARE(decodedThread.count(), thread.count());
+    QCOMPARE(decodedThread.unreadCount(), thread.unreadCount());
+
+    History::TextEvent decodedEvent = History::TextEvent::fromProperties(History::PayloadCodec::decode(
+                                          History::PayloadCodec::encode(QList<QVariantMap>() << event.properties())).first());
+    QCOMPARE(decodedEvent, event);
+    QCOMPARE(decodedEvent.attachments().count(), 1);
+    QCOMPARE(decodedEvent.attachments().first().attachmentId(), attachment.attachmentId());
+    QCOMPARE(decodedEvent.attachments().first().filePath(), attachment.filePath());
+}
+
+void PayloadCodecTest::testUnsupportedVersion()
+{
+    QList<QVariantMap> items;
+    items << QVariantMap();
+    QVERIFY(History::PayloadCodec::encode(items, 0).isEmpty());
+    QVERIFY(History::PayloadCodec::encode(items, History::PayloadCodec::Version + 1).isEmpty());
+    QVERIFY(!History::PayloadCodec::encode(items, History::PayloadCodec::Version).isEmpty());
+}
+
+void PayloadCodecTest::testInvalidPayload_data()
+{
+    QTest::addColumn<QByteArray>("payload");
+
+    QVariantMap item;
+    item["key"] = "value";
+    QByteArray valid = History::PayloadCodec::encode(QList<QVariantMap>() << item);
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("truncated") << valid.left(valid.size() - 1);
+    QTest::newRow("wrong magic") << QByteArray("x") + valid.mid(1);
+    QByteArray newerVersion = valid;
+    newerVersion[1] = History::PayloadCodec::Version + 1;
+    QTest::newRow("newer version") << newerVersion;
+}
+
+void PayloadCodecTest::testInvalidPayload()
+{
+    QFETCH(QByteArray, payload);
+
+    bool ok = true;
+    QList<QVariantMap> decoded = History::PayloadCodec::decode(payload, &ok);
+    QVERIFY(!ok);
+    QVERIFY(decoded.isEmpty());
+}
+
+void PayloadCodecTest::benchmarkEncoding()
+{
+    // a page of a busy group chat
+    QList<QVariantMap> events;
+    for (int i = 0; i < 50; ++i) {
+        History::TextEvent event("theAccountId", "theThreadId", QString("event%1").arg(i), QString("sender%1").arg(i % 5),
+                                 QDateTime::currentDateTime(), false, "Hello there!", History::MessageTypeText);
+        events << event.properties();
+    }
+
+    QBENCHMARK {
+        QByteArray payload = History::PayloadCodec::encode(events);
+        QCOMPARE(History::PayloadCodec::decode(payload).count(), events.count());
+    }
+}
+
+QTEST_MAIN(PayloadCodecTest)
+#include "PayloadCodecTest.moc"
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QDBusInterface>
+#include <QDBusReply>
+
+#include "manager.h"
+#include "thread.h"
+#include "threadview.h"
+#include "types.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_METATYPE(History::Threads)
+
+class PayloadEncodingTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testNoPlainBroadcast();
+    void testSubscribedViewEncoded();
+
+private:
+    QVariantMap statistics();
+};
+
+void PayloadEncodingTest::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+    qRegisterMetaType<History::Threads>();
+
+    // the encoding needs to be requested before the manager registers it
+    qputenv("HISTORY_DBUS_ENCODING", "binary");
+    History::Manager::instance();
+}
+
+QVariantMap PayloadEncodingTest::statistics()
+{
+    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
+    QDBusReply<QVariantMap> reply = interface.call("NotificationStatistics");
+    return reply.value();
+}
+
+void PayloadEncodingTest::testNoPlainBroadcast()
+{
+    // this is the only client of the service, and it registered for the encoded changes,
+    // so the service should not marshal the plain ones anymore
+    QSignalSpy threadsAdded(History::Manager::instance(), SIGNAL(threadsAdded(History::Threads)));
+    QVariantMap before = statistics();
+    QVERIFY(!before.isEmpty());
+
+    History::Thread thread = History::Manager::instance()->threadForParticipants("encodedAccount", History::EventTypeText,
+                                                                                 QStringList() << "encodedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+    QTRY_COMPARE(threadsAdded.count(), 1);
+    QCOMPARE(threadsAdded.first().first().value<History::Threads>(), History::Threads() << thread);
+
+    QVariantMap after = statistics();
+    QCOMPARE(after["plainBroadcasts"].toLongLong(), before["plainBroadcasts"].toLongLong());
+    QVERIFY(after["encodedSignals"].toLongLong() > before["encodedSignals"].toLongLong());
+}
+
+void PayloadEncodingTest::testSubscribedViewEncoded()
+{
+    // the changes sent to the subscribed views are encoded too, and handled once
+    History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeVoice, History::Sort(),
+                                                                              History::Filter(History::FieldAccountId, "encodedAccount"));
+    QVERIFY(view->isValid());
+    QSignalSpy threadsAdded(view.data(), SIGNAL(threadsAdded(History::Threads)));
+
+    History::Thread thread = History::Manager::instance()->threadForParticipants("encodedAccount", History::EventTypeVoice,
+                                                                                 QStringList() << "encodedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+    QTRY_VERIFY(threadsAdded.count() > 0);
+    // give a duplicate notification the time to arrive
+    QTest::qWait(500);
+
+    History::Threads added;
+    Q_FOREACH(const QList<QVariant> &arguments, threadsAdded) {
+        added << arguments.first().value<History::Threads>();
+    }
+    QCOMPARE(added, History::Threads() << thread);
+    QCOMPARE(statistics()["plainBroadcasts"].toLongLong(), 0);
+}
+
+QTEST_MAIN(PayloadEncodingTest)
+#include "PayloadEncodingTest.moc"
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include "phoneutils_p.h"
+
+class PhoneUtilsBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void benchmarkNormalize_data();
+    void benchmarkNormalize();
+    void benchmarkCompare_data();
+    void benchmarkCompare();
+
+private:
+    QStringList numbers(int count) const;
+};
+
+QStringList PhoneUtilsBenchmark::numbers(int count) const
+{
+    QStringList result;
+    for (int i = 0; i < count; ++i) {
+        result << QString("+1 (556) %1").arg(i, 7, 10, QChar('0'));
+    }
+    return result;
+}
+
+void PhoneUtilsBenchmark::benchmarkNormalize_data()
+{
+    QTest::addColumn<int>("numberCount");
+
+    // more distinct numbers than the cache holds means every call parses the number again
+    QTest::newRow("100 numbers") << 100;
+    QTest::newRow("10000 numbers") << 10000;
+}
+
+void PhoneUtilsBenchmark::benchmarkNormalize()
+{
+    QFETCH(int, numberCount);
+
+    QStringList phoneNumbers = numbers(numberCount);
+    History::PhoneUtils::clearCache();
+    QBENCHMARK {
+        Q_FOREACH(const QString &phoneNumber, phoneNumbers) {
+            History::PhoneUtils::normalizePhoneNumber(phoneNumber);
+        }
+    }
+
+    int hits = History::PhoneUtils::cacheHits();
+    int misses = History::PhoneUtils::cacheMisses();
+    qDebug() << "Cache hit rate:" << (hits * 100.0 / qMax(hits + misses, 1)) << "%";
+}
+
+void PhoneUtilsBenchmark::benchmarkCompare_data()
+{
+    QTest::addColumn<bool>("sameNumber");
+    QTest::addColumn<bool>("withCountryCode");
+
+    QTest::newRow("same number with country code") << true << true;
+    QTest::newRow("same number without country code") << true << false;
+    QTest::newRow("different numbers") << false << true;
+}
+
+void PhoneUtilsBenchmark::benchmarkCompare()
+{
+    QFETCH(bool, sameNumber);
+    QFETCH(bool, withCountryCode);
+
+    // compare a number against a list of normalized ones, the way the SQL functions and the contact matching do
+    QStringList phoneNumbers;
+    Q_FOREACH(const QString &phoneNumber, numbers(100)) {
+        phoneNumbers << History::PhoneUtils::normalizePhoneNumber(phoneNumber);
+    }
+    QString number = sameNumber ? phoneNumbers.last() : QString("+15557654321");
+    if (!withCountryCode) {
+        number = number.mid(2);
+    }
+
+    History::PhoneUtils::clearCache();
+    QBENCHMARK {
+        Q_FOREACH(const QString &phoneNumber, phoneNumbers) {
+            History::PhoneUtils::compareNormalizedPhoneNumbers(number, phoneNumber);
+        }
+    }
+
+    int hits = History::PhoneUtils::cacheHits();
+    int misses = History::PhoneUtils::cacheMisses();
+    qDebug() << "Cache hit rate:" << (hits * 100.0 / qMax(hits + misses, 1)) << "%";
+}
+
+QTEST_MAIN(PhoneUtilsBenchmark)
+#include "PhoneUtilsBenchmark.moc"
@@ -31,6 +31,9 @@ private Q_SLOTS:
     void testIsPhoneNumber();
     void testComparePhoneNumbers_data();
     void testComparePhoneNumbers();
+    void testComparisonKey_data();
+    void testComparisonKey();
+    void testCacheStatistics();
 };
 
 void PhoneUtilsTest::testIsPhoneNumber_data()
@@ -72,6 +75,8 @@ void PhoneUtilsTest::testComparePhoneNumbers_data()
     QTest::newRow("both non phone numbers") << "abcdefg" << "abcdefg" << true;
     QTest::newRow("different non phone numbers") << "abcdefg" << "bcdefg" << false;
     QTest::newRow("phone number and custom string") << "abc12345678" << "12345678" << true;
+    QTest::newRow("short national number with separators") << "(23) 456" << "(2) 3456" << true;
+    QTest::newRow("short national number in a longer number") << "(23) 456" << "(555) 123-456" << false;
     // FIXME: check what other cases we need to test here"
 }
 
@@ -85,5 +90,57 @@ void PhoneUtilsTest::testComparePhoneNumbers()
     QCOMPARE(result, expectedResult);
 }
 
+void PhoneUtilsTest::testComparisonKey_data()
+{
+    QTest::addColumn<QString>("number1");
+    QTest::addColumn<QString>("number2");
+    QTest::addColumn<bool>("sameKey");
+
+    // numbers that compare equal need to share the key
+    QTest::newRow("string equal") << "12345678" << "12345678" << true;
+    QTest::newRow("number with dash") << "1234-5678" << "12345678" << true;
+    QTest::newRow("number with area code") << "12312345678" << "12345678" << true;
+    QTest::newRow("number with extension") << "12345678#123" << "12345678" << true;
+    QTest::newRow("number with country code") << "+1 (555) 123-4567" << "5551234567" << true;
+    QTest::newRow("short/emergency numbers") << "190" << "190" << true;
+    QTest::newRow("different numbers") << "12345678" << "1234567" << false;
+    QTest::newRow("different short numbers") << "190" << "911" << false;
+    QTest::newRow("short national number with separators") << "(23) 456" << "(2) 3456" << true;
+    QTest::newRow("short national number normalized") << "(23) 456" << "23456" << true;
+    QTest::newRow("short national number with leading zero") << "(06) 1234" << "061234" << true;
+    QTest::newRow("short national number in a longer number") << "(23) 456" << "(555) 123-456" << false;
+}
+
+void PhoneUtilsTest::testComparisonKey()
+{
+    QFETCH(QString, number1);
+    QFETCH(QString, number2);
+    QFETCH(bool, sameKey);
+
+    QCOMPARE(History::PhoneUtils::comparisonKey(number1) == History::PhoneUtils::comparisonKey(number2), sameKey);
+}
+
+void PhoneUtilsTest::testCacheStatistics()
+{
+    History::PhoneUtils::clearCache();
+    QCOMPARE(History::PhoneUtils::cacheHits(), 0);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 0);
+
+    // the number is only parsed the first time, whatever it is used for
+    QCOMPARE(History::PhoneUtils::normalizePhoneNumber("+1 (555) 123-4567"), QString("+15551234567"));
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 1);
+    QVERIFY(History::PhoneUtils::isPhoneNumber("+1 (555) 123-4567"));
+    QCOMPARE(History::PhoneUtils::cacheHits(), 1);
+
+    // and numbers sharing the country and national number don't need libphonenumber to be compared
+    QVERIFY(History::PhoneUtils::compareNormalizedPhoneNumbers("+15551234567", "+1-555-123-4567"));
+    QVERIFY(!History::PhoneUtils::compareNormalizedPhoneNumbers("+15551234567", "+15557654321"));
+    QVERIFY(History::PhoneUtils::cacheHits() > 1);
+
+    History::PhoneUtils::clearCache();
+    QCOMPARE(History::PhoneUtils::cacheHits(), 0);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 0);
+}
+
 QTEST_MAIN(PhoneUtilsTest)
 #include "PhoneUtilsTest.moc"
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QBuffer>
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+#include "recordstream_p.h"
+#include "thread.h"
+#include "voiceevent.h"
+
+class RecordStreamTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testRoundTrip();
+    void testBrokenStream();
+};
+
+void RecordStreamTest::testRoundTrip()
+{
+    History::VoiceEvent event("theAccountId", "theThreadId", "theEventId", "theSender", QDateTime::currentDateTime(), true, true);
+    History::Thread thread("theAccountId", "theThreadId", History::EventTypeVoice,
+                           History::Participants::fromStringList(QStringList() << "theSender"), event.timestamp(), event, 1, 1);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(History::RecordStream::writeFrame(&buffer, QList<QVariantMap>() << History::RecordStream::threadRecord(thread.properties())));
+    QVERIFY(History::RecordStream::writeFrame(&buffer, QList<QVariantMap>() << event.properties() << event.properties()));
+    buffer.seek(0);
+
+    QList<QVariantMap> records;
+    bool ok = false;
+    QVERIFY(History::RecordStream::readFrame(&buffer, records, &ok));
+    QVERIFY(ok);
+    QCOMPARE(records.count(), 1);
+    QVERIFY(History::RecordStream::isThread(records.first()));
+    QCOMPARE(History::Thread::fromProperties(records.first()).threadId(), thread.threadId());
+
+    // the thread carries its last event, but the events are not threads
+    QVERIFY(History::RecordStream::readFrame(&buffer, records, &ok));
+    QCOMPARE(records.count(), 2);
+    QVERIFY(!History::RecordStream::isThread(records.first()));
+    QCOMPARE(History::VoiceEvent::fromProperties(records.first()).eventId(), event.eventId());
+
+    // and the end of the stream is not an error
+    QVERIFY(!History::RecordStream::readFrame(&buffer, records, &ok));
+    QVERIFY(ok);
+    QVERIFY(records.isEmpty());
+}
+
+void RecordStreamTest::testBrokenStream()
+{
+    QVariantMap record;
+    record["key"] = "value";
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(History::RecordStream::writeFrame(&buffer, QList<QVariantMap>() << record));
+    QByteArray truncated = buffer.data().left(buffer.size() - 1);
+
+    QBuffer truncatedBuffer(&truncated);
+    truncatedBuffer.open(QIODevice::ReadOnly);
+    QList<QVariantMap> records;
+    bool ok = true;
+    QVERIFY(!History::RecordStream::readFrame(&truncatedBuffer, records, &ok));
+    QVERIFY(!ok);
+}
+
+QTEST_MAIN(RecordStreamTest)
+#include "RecordStreamTest.moc"
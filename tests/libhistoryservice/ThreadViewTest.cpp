@@ -42,6 +42,9 @@ private Q_SLOTS:
     void testNextPage();
     void testFilter();
     void testSort();
+    void testRequestNextPage();
+    void testThreadsAdded();
+    void testThreadsAddedWhileSubscribing();
 
 private:
     void populate();
@@ -124,6 +127,79 @@ void ThreadViewTest::testSort()
     QCOMPARE(allThreads.last().accountId(), QString("account00"));
 }
 
+void ThreadViewTest::testRequestNextPage()
+{
+    // page through the threads without blocking, the same way the models do
+    History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeText);
+    QSignalSpy pageReady(view.data(), SIGNAL(pageReady(History::Threads)));
+    History::Threads allThreads;
+    Q_FOREVER {
+        view->requestNextPage();
+        // only one page is requested at a time
+        view->requestNextPage();
+        QTRY_COMPARE(pageReady.count(), 1);
+        History::Threads threads = pageReady.takeFirst().first().value<History::Threads>();
+        if (threads.isEmpty()) {
+            break;
+        }
+        allThreads << threads;
+    }
+    QVERIFY(view->isValid());
+    QCOMPARE(allThreads.count(), THREAD_COUNT);
+
+    // and pages can still be requested synchronously afterwards
+    QVERIFY(view->nextPage().isEmpty());
+}
+
+void ThreadViewTest::testThreadsAdded()
+{
+    History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeVoice, History::Sort(),
+                                                                              History::Filter(History::FieldAccountId, "account10"));
+    QVERIFY(view->isValid());
+    QCOMPARE(view->nextPage().count(), 1);
+    QSignalSpy threadsAdded(view.data(), SIGNAL(threadsAdded(History::Threads)));
+
+    // threads not matching the view should not be notified to it
+    History::Manager::instance()->threadForParticipants("account10", History::EventTypeText,
+                                                        QStringList() << "newParticipant", History::MatchCaseSensitive, true);
+    History::Manager::instance()->threadForParticipants("account11", History::EventTypeVoice,
+                                                        QStringList() << "newParticipant", History::MatchCaseSensitive, true);
+    History::Thread thread = History::Manager::instance()->threadForParticipants("account10", History::EventTypeVoice,
+                                                                                 QStringList() << "newParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QTRY_VERIFY(threadsAdded.count() > 0);
+    Q_FOREACH(const QList<QVariant> &arguments, threadsAdded) {
+        Q_FOREACH(const History::Thread &added, arguments.first().value<History::Threads>()) {
+            QCOMPARE(added, thread);
+        }
+    }
+}
+
+void ThreadViewTest::testThreadsAddedWhileSubscribing()
+{
+    // threads added while the view is still subscribing should be notified exactly once
+    for (int i = 20; i < 25; ++i) {
+        QString accountId = QString("account%1").arg(i);
+        History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeVoice, History::Sort(),
+                                                                                  History::Filter(History::FieldAccountId, accountId));
+        QSignalSpy threadsAdded(view.data(), SIGNAL(threadsAdded(History::Threads)));
+        History::Thread thread = History::Manager::instance()->threadForParticipants(accountId, History::EventTypeVoice,
+                                                                                     QStringList() << "newParticipant",
+                                                                                     History::MatchCaseSensitive, true);
+        QVERIFY(!thread.isNull());
+        QTRY_VERIFY(threadsAdded.count() > 0);
+        // give a duplicate notification the time to arrive
+        QTest::qWait(500);
+
+        History::Threads added;
+        Q_FOREACH(const QList<QVariant> &arguments, threadsAdded) {
+            added << arguments.first().value<History::Threads>();
+        }
+        QCOMPARE(added.count(), 1);
+        QCOMPARE(added.first(), thread);
+    }
+}
+
 void ThreadViewTest::populate()
 {
     // create voice threads
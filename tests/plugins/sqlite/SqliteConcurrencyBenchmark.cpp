@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QTemporaryDir>
+#include "sqlitehistoryplugin.h"
+#include "sqlitedatabase.h"
+#include "contactmatcher_p.h"
+#include "intersectionfilter.h"
+#include "pluginthreadview.h"
+#include "plugineventview.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+
+static const int threadCount = 20;
+static const int eventsPerThread = 500;
+
+// pages through a thread list and a conversation in its own thread, the way a client model would
+class ViewClient : public QThread
+{
+public:
+    ViewClient(SQLiteHistoryPlugin *plugin, const QString &threadId)
+        : mPlugin(plugin), mThreadId(threadId), threads(0), events(0) { }
+
+    void run() override
+    {
+        History::PluginThreadView *threadView = mPlugin->queryThreads(History::EventTypeText,
+                                                                      History::Sort(History::FieldLastEventTimestamp, Qt::DescendingOrder));
+        QList<QVariantMap> page;
+        while (!(page = threadView->NextPage()).isEmpty()) {
+            threads += page.count();
+        }
+        delete threadView;
+
+        History::IntersectionFilter filter;
+        filter.append(History::Filter(History::FieldAccountId, "theAccountId"));
+        filter.append(History::Filter(History::FieldThreadId, mThreadId));
+        History::PluginEventView *eventView = mPlugin->queryEvents(History::EventTypeText,
+                                                                   History::Sort(History::FieldTimestamp, Qt::DescendingOrder),
+                                                                   filter);
+        while (!(page = eventView->NextPage()).isEmpty()) {
+            events += page.count();
+        }
+        delete eventView;
+    }
+
+private:
+    SQLiteHistoryPlugin *mPlugin;
+    QString mThreadId;
+
+public:
+    int threads;
+    int events;
+};
+
+class SqliteConcurrencyBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void benchmarkConcurrentViews_data();
+    void benchmarkConcurrentViews();
+
+private:
+    QTemporaryDir mDir;
+    SQLiteHistoryPlugin *mPlugin;
+    QStringList mThreadIds;
+};
+
+void SqliteConcurrencyBenchmark::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+
+    // the read-only connections need a database file in WAL mode
+    QVERIFY(mDir.isValid());
+    qputenv("HISTORY_SQLITE_DBPATH", mDir.filePath("history.sqlite").toUtf8());
+    qputenv("HISTORY_SQLITE_PROFILE", "wal");
+    mPlugin = new SQLiteHistoryPlugin(this);
+    QVERIFY(SQLiteDatabase::instance()->concurrentReadsEnabled());
+
+    // make sure the contact matcher lives in this thread, as in the daemon
+    History::ContactMatcher::instance();
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.prepare("INSERT INTO text_events (accountId, threadId, eventId, senderId, timestamp, newEvent, message) "
+                          "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :message)"));
+
+    QDateTime timestamp = QDateTime::currentDateTime().addDays(-1);
+    for (int i = 0; i < threadCount; ++i) {
+        QString participant = QString("participant%1").arg(i);
+        QVariantMap thread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText, QStringList() << participant);
+        QVERIFY(!thread.isEmpty());
+        mThreadIds << thread[History::FieldThreadId].toString();
+
+        SQLiteDatabase::instance()->beginTransation();
+        for (int j = 0; j < eventsPerThread; ++j) {
+            query.bindValue(":accountId", "theAccountId");
+            query.bindValue(":threadId", mThreadIds.last());
+            query.bindValue(":eventId", QString("event%1").arg(j));
+            query.bindValue(":senderId", participant);
+            query.bindValue(":timestamp", timestamp.addSecs(i * eventsPerThread + j).toMSecsSinceEpoch());
+            query.bindValue(":newEvent", false);
+            query.bindValue(":message", QString("Message number %1").arg(j));
+            QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+        }
+        SQLiteDatabase::instance()->finishTransaction();
+    }
+    SQLiteDatabase::instance()->checkpoint();
+}
+
+void SqliteConcurrencyBenchmark::benchmarkConcurrentViews_data()
+{
+    QTest::addColumn<int>("clients");
+
+    QTest::newRow("1 client") << 1;
+    QTest::newRow("2 clients") << 2;
+    QTest::newRow("4 clients") << 4;
+    QTest::newRow("8 clients") << 8;
+}
+
+void SqliteConcurrencyBenchmark::benchmarkConcurrentViews()
+{
+    QFETCH(int, clients);
+
+    QBENCHMARK {
+        QList<ViewClient*> viewClients;
+        for (int i = 0; i < clients; ++i) {
+            viewClients << new ViewClient(mPlugin, mThreadIds[i % mThreadIds.count()]);
+        }
+        Q_FOREACH(ViewClient *client, viewClients) {
+            client->start();
+        }
+
+        // the contact lookups of the clients are answered from this thread, so keep processing events
+        Q_FOREACH(ViewClient *client, viewClients) {
+            while (!client->wait(10)) {
+                QCoreApplication::processEvents();
+            }
+            QCOMPARE(client->threads, threadCount);
+            QCOMPARE(client->events, eventsPerThread);
+        }
+        qDeleteAll(viewClients);
+    }
+}
+
+QTEST_MAIN(SqliteConcurrencyBenchmark)
+#include "SqliteConcurrencyBenchmark.moc"
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include "sqlitehistoryplugin.h"
+#include "sqlitedatabase.h"
+#include "pluginthreadview.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+
+static const QString accountId("ofono/ofono/account0");
+
+class SqliteContactCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testLoadSavedCache();
+    void testOutdatedCache();
+    void testUnchangedCacheNotSaved();
+    void benchmarkColdStart_data();
+    void benchmarkColdStart();
+
+private:
+    QTemporaryDir mDir;
+    SQLiteHistoryPlugin *mPlugin;
+
+    QString cachePath() const;
+    int groupedThreadCount(SQLiteHistoryPlugin *plugin, const QString &threadId);
+};
+
+void SqliteContactCacheTest::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+
+    // the cache is only saved for databases stored in files
+    QVERIFY(mDir.isValid());
+    qputenv("HISTORY_SQLITE_DBPATH", mDir.filePath("history.sqlite").toUtf8());
+    mPlugin = new SQLiteHistoryPlugin(this);
+}
+
+QString SqliteContactCacheTest::cachePath() const
+{
+    return mDir.filePath("history.sqlite-cache");
+}
+
+int SqliteContactCacheTest::groupedThreadCount(SQLiteHistoryPlugin *plugin, const QString &threadId)
+{
+    QVariantMap properties;
+    properties[History::FieldGroupingProperty] = History::FieldParticipants;
+    QVariantMap thread = plugin->getSingleThread(History::EventTypeText, accountId, threadId, properties);
+    return thread[History::FieldGroupedThreads].toList().count();
+}
+
+void SqliteContactCacheTest::testLoadSavedCache()
+{
+    QVariantMap thread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "+1 555 123 4567");
+    QVERIFY(!thread.isEmpty());
+    QVariantMap otherThread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "5551234567");
+    QVERIFY(!otherThread.isEmpty());
+    QVariantMap differentThread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "5557654321");
+    QVERIFY(!differentThread.isEmpty());
+
+    // generating the cache saves it too
+    QFile::remove(cachePath());
+    mPlugin->generateContactCache();
+    QVERIFY(mPlugin->initialised());
+    QVERIFY(QFile::exists(cachePath()));
+
+    // and a new instance gets the same grouped threads without generating the cache again
+    SQLiteHistoryPlugin plugin;
+    QVERIFY(plugin.loadContactCache());
+    QCOMPARE(groupedThreadCount(&plugin, otherThread[History::FieldThreadId].toString()), 2);
+    QCOMPARE(groupedThreadCount(&plugin, differentThread[History::FieldThreadId].toString()), 1);
+
+    // new threads still get grouped with the loaded ones
+    QVariantMap newThread = plugin.createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "+15557654321");
+    QVERIFY(!newThread.isEmpty());
+    QCOMPARE(groupedThreadCount(&plugin, newThread[History::FieldThreadId].toString()), 2);
+}
+
+void SqliteContactCacheTest::testOutdatedCache()
+{
+    mPlugin->generateContactCache();
+    QVERIFY(mPlugin->saveContactCache());
+
+    SQLiteHistoryPlugin plugin;
+    QVERIFY(plugin.loadContactCache());
+
+    // any change to the threads makes the saved cache outdated
+    QVERIFY(!mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "5550001111").isEmpty());
+    SQLiteHistoryPlugin otherPlugin;
+    QVERIFY(!otherPlugin.loadContactCache());
+
+    // until it gets saved again
+    QVERIFY(mPlugin->saveContactCache());
+    QVERIFY(otherPlugin.loadContactCache());
+}
+
+void SqliteContactCacheTest::testUnchangedCacheNotSaved()
+{
+    mPlugin->generateContactCache();
+    QVERIFY(mPlugin->saveContactCache());
+
+    // empty the saved file, to find out whether it gets written again
+    QFile file(cachePath());
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.close();
+
+    // nothing changed in the threads, so there is nothing to save
+    QVERIFY(mPlugin->saveContactCache());
+    QCOMPARE(QFileInfo(cachePath()).size(), (qint64) 0);
+
+    // but the file is written again once the threads change
+    QVERIFY(!mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "5550002222").isEmpty());
+    QVERIFY(mPlugin->saveContactCache());
+    QVERIFY(QFileInfo(cachePath()).size() > 0);
+}
+
+void SqliteContactCacheTest::benchmarkColdStart_data()
+{
+    QTest::addColumn<bool>("savedCache");
+
+    QTest::newRow("generated") << false;
+    QTest::newRow("loaded") << true;
+}
+
+void SqliteContactCacheTest::benchmarkColdStart()
+{
+    QFETCH(bool, savedCache);
+
+    if (mPlugin->getSingleThread(History::EventTypeText, accountId, "5552000000").isEmpty()) {
+        mPlugin->beginBatchOperation();
+        for (int i = 0; i < 500; ++i) {
+            QVERIFY(!mPlugin->createThreadForParticipants(accountId, History::EventTypeText,
+                                                          QStringList() << QString("555%1").arg(2000000 + i)).isEmpty());
+        }
+        mPlugin->endBatchOperation();
+    }
+    mPlugin->generateContactCache();
+    QVERIFY(mPlugin->saveContactCache());
+
+    QVariantMap properties;
+    properties[History::FieldGroupingProperty] = History::FieldParticipants;
+
+    // the time it takes for a new daemon to answer the first thread query
+    QBENCHMARK {
+        if (!savedCache) {
+            QFile::remove(cachePath());
+        }
+        SQLiteHistoryPlugin plugin;
+        plugin.generateContactCache();
+        QVERIFY(plugin.initialised());
+        History::PluginThreadView *view = plugin.queryThreads(History::EventTypeText,
+                                                              History::Sort(History::FieldLastEventTimestamp, Qt::DescendingOrder),
+                                                              History::Filter(), properties);
+        QVERIFY(!view->NextPage().isEmpty());
+        delete view;
+    }
+}
+
+QTEST_MAIN(SqliteContactCacheTest)
+#include "SqliteContactCacheTest.moc"
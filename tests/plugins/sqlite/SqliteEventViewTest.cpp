@@ -40,7 +40,11 @@ private Q_SLOTS:
     void testFilter();
     void testSort();
     void testSortWithMultipleFields();
+    void testSortByTimestamp_data();
+    void testSortByTimestamp();
     void testFilterWithValueToExclude();
+    void testFullTextSearch();
+    void testFullTextSearchSnippetEscaped();
 
 private:
     SQLiteHistoryPlugin *mPlugin;
@@ -123,6 +127,68 @@ void SqliteEventViewTest::testFilterWithValueToExclude()
     delete view;
 }
 
+void SqliteEventViewTest::testFullTextSearch()
+{
+    // a phrase, paged through the temporary table
+    History::Filter filter(History::FieldMessage, "\"hello 1\"", History::MatchFullText);
+    History::PluginEventView *view = mPlugin->queryEvents(History::EventTypeText, History::Sort(History::FieldEventId), filter);
+    QVERIFY(view->IsValid());
+    QList<QVariantMap> events = view->NextPage();
+    QCOMPARE(events.count(), 2);
+    Q_FOREACH(const QVariantMap &event, events) {
+        QCOMPARE(event[History::FieldMessage].toString(), QString("Hello 1"));
+        QCOMPARE(event[History::FieldMatchSnippet].toString(), QString("<b>Hello 1</b>"));
+    }
+    QVERIFY(view->NextPage().isEmpty());
+    delete view;
+
+    // a prefix, paged by timestamp
+    filter.setFilterValue("4*");
+    view = mPlugin->queryEvents(History::EventTypeText, History::Sort(History::FieldTimestamp), filter);
+    QVERIFY(view->IsValid());
+    QList<QVariantMap> allEvents;
+    events = view->NextPage();
+    while (!events.isEmpty()) {
+        allEvents << events;
+        events = view->NextPage();
+    }
+    // "Hello 4" and "Hello 40" to "Hello 49" on both threads
+    QCOMPARE(allEvents.count(), 22);
+    Q_FOREACH(const QVariantMap &event, allEvents) {
+        QVERIFY(event[History::FieldMessage].toString().startsWith("Hello 4"));
+        QVERIFY(event[History::FieldMatchSnippet].toString().contains("<b>4"));
+    }
+    delete view;
+}
+
+void SqliteEventViewTest::testFullTextSearchSnippetEscaped()
+{
+    // the snippet is rich text, so the message itself must not be taken as markup
+    QVariantMap thread = mPlugin->createThreadForParticipants("account2", History::EventTypeText,
+                                                              QStringList() << "participant2");
+    History::TextEvent textEvent(thread[History::FieldAccountId].toString(),
+                                 thread[History::FieldThreadId].toString(),
+                                 "escapedEvent",
+                                 "participant2",
+                                 QDateTime::currentDateTime(),
+                                 QDateTime::currentDateTime(),
+                                 false,
+                                 "Tom & Jerry <3",
+                                 History::MessageTypeText);
+    QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+
+    History::Filter filter(History::FieldMessage, "jerry", History::MatchFullText);
+    History::PluginEventView *view = mPlugin->queryEvents(History::EventTypeText, History::Sort(History::FieldEventId), filter);
+    QVERIFY(view->IsValid());
+    QList<QVariantMap> events = view->NextPage();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first()[History::FieldMessage].toString(), QString("Tom & Jerry <3"));
+    QCOMPARE(events.first()[History::FieldMatchSnippet].toString(), QString("Tom &amp; <b>Jerry</b> &lt;3"));
+    delete view;
+
+    QVERIFY(mPlugin->removeTextEvent(textEvent.properties()));
+}
+
 void SqliteEventViewTest::testSort()
 {
     History::Sort ascendingSort(History::FieldEventId, Qt::AscendingOrder);
@@ -174,6 +240,49 @@ void SqliteEventViewTest::testSortWithMultipleFields()
     delete view;
 }
 
+void SqliteEventViewTest::testSortByTimestamp_data()
+{
+    QTest::addColumn<History::EventType>("type");
+    QTest::addColumn<int>("sortOrder");
+
+    QTest::newRow("text events ascending") << History::EventTypeText << (int) Qt::AscendingOrder;
+    QTest::newRow("text events descending") << History::EventTypeText << (int) Qt::DescendingOrder;
+    QTest::newRow("voice events ascending") << History::EventTypeVoice << (int) Qt::AscendingOrder;
+    QTest::newRow("voice events descending") << History::EventTypeVoice << (int) Qt::DescendingOrder;
+}
+
+void SqliteEventViewTest::testSortByTimestamp()
+{
+    QFETCH(History::EventType, type);
+    QFETCH(int, sortOrder);
+
+    // sorting by timestamp pages through the index instead of a temporary table,
+    // so make sure events sharing the same timestamp are neither skipped nor repeated
+    History::Sort sort(History::FieldTimestamp, (Qt::SortOrder) sortOrder);
+    History::PluginEventView *view = mPlugin->queryEvents(type, sort, History::Filter(History::FieldAccountId, "account1"));
+    QVERIFY(view->IsValid());
+    QList<QVariantMap> allEvents;
+    QList<QVariantMap> events = view->NextPage();
+    while (!events.isEmpty()) {
+        allEvents << events;
+        events = view->NextPage();
+    }
+
+    QCOMPARE(allEvents.count(), EVENT_COUNT);
+    QSet<QString> eventIds;
+    for (int i = 0; i < allEvents.count(); ++i) {
+        QCOMPARE(allEvents[i][History::FieldAccountId].toString(), QString("account1"));
+        eventIds << allEvents[i][History::FieldEventId].toString();
+        if (i > 0) {
+            QDateTime previous = QDateTime::fromString(allEvents[i-1][History::FieldTimestamp].toString(), Qt::ISODate);
+            QDateTime current = QDateTime::fromString(allEvents[i][History::FieldTimestamp].toString(), Qt::ISODate);
+            QVERIFY(sortOrder == Qt::AscendingOrder ? previous <= current : previous >= current);
+        }
+    }
+    QCOMPARE(eventIds.count(), EVENT_COUNT);
+    delete view;
+}
+
 void SqliteEventViewTest::populateDatabase()
 {
     mPlugin->beginBatchOperation();
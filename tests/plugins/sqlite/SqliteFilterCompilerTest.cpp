@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include "sqlitefiltercompiler.h"
+#include "intersectionfilter.h"
+#include "unionfilter.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(SQLiteFilterCompiler::Target)
+
+class SqliteFilterCompilerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testCompile_data();
+    void testCompile();
+    void testInvalidFilters_data();
+    void testInvalidFilters();
+    void testStableStatements();
+    void testMatchQuery();
+    void testEscapeLikePattern_data();
+    void testEscapeLikePattern();
+};
+
+void SqliteFilterCompilerTest::testCompile_data()
+{
+    QTest::addColumn<History::EventType>("type");
+    QTest::addColumn<SQLiteFilterCompiler::Target>("target");
+    QTest::addColumn<QVariantMap>("filterProperties");
+    QTest::addColumn<QString>("condition");
+    QTest::addColumn<QVariantMap>("bindValues");
+
+    QVariantMap bindValues;
+    QTest::newRow("empty filter") << History::EventTypeText << SQLiteFilterCompiler::TargetEvents
+                                  << History::Filter().properties() << QString() << bindValues;
+
+    History::Filter filter(History::FieldAccountId, "stringValue");
+    bindValues[":filterValue0"] = "stringValue";
+    QTest::newRow("string filter") << History::EventTypeText << SQLiteFilterCompiler::TargetEvents
+                                   << filter.properties() << "text_events.accountId=:filterValue0" << bindValues;
+    QTest::newRow("thread column on threads") << History::EventTypeText << SQLiteFilterCompiler::TargetThreads
+                                              << filter.properties() << "threads.accountId=:filterValue0" << bindValues;
+
+    filter = History::Filter(History::FieldSenderId, "stringValue");
+    QTest::newRow("event column on threads") << History::EventTypeVoice << SQLiteFilterCompiler::TargetThreads
+                                             << filter.properties() << "voice_events.senderId=:filterValue0" << bindValues;
+
+    filter = History::Filter(History::FieldMessageStatus, 12345, History::MatchNotEquals);
+    bindValues[":filterValue0"] = 12345;
+    QTest::newRow("not equals") << History::EventTypeText << SQLiteFilterCompiler::TargetEvents
+                                << filter.properties() << "text_events.messageStatus!=:filterValue0" << bindValues;
+
+    filter = History::Filter(History::FieldMessage, "50%_off", History::MatchContains);
+    bindValues[":filterValue0"] = "%50\\%\\_off%";
+    QTest::newRow("contains") << History::EventTypeText << SQLiteFilterCompiler::TargetEvents
+                              << filter.properties() << "text_events.message LIKE :filterValue0 ESCAPE '\\'" << bindValues;
+
+    filter = History::Filter(History::FieldSubject, "\"full text\" sea*", History::MatchFullText);
+    bindValues[":filterValue0"] = filter.filterValue();
+    QTest::newRow("full text") << History::EventTypeText << SQLiteFilterCompiler::TargetThreads << filter.properties()
+                               << "text_events.rowid IN (SELECT rowid FROM text_events_fts WHERE text_events_fts.subject MATCH :filterValue0)"
+                               << bindValues;
+
+    History::IntersectionFilter intersectionFilter;
+    intersectionFilter.append(History::Filter(History::FieldAccountId, "account"));
+    intersectionFilter.append(History::Filter());
+    History::UnionFilter unionFilter;
+    unionFilter.append(History::Filter(History::FieldThreadId, "thread0"));
+    unionFilter.append(History::Filter(History::FieldThreadId, "thread1"));
+    intersectionFilter.append(unionFilter);
+    bindValues.clear();
+    bindValues[":filterValue0"] = "account";
+    bindValues[":filterValue1"] = "thread0";
+    bindValues[":filterValue2"] = "thread1";
+    QTest::newRow("nested filters") << History::EventTypeVoice << SQLiteFilterCompiler::TargetEvents << intersectionFilter.properties()
+                                    << "(voice_events.accountId=:filterValue0 AND (voice_events.threadId=:filterValue1 OR voice_events.threadId=:filterValue2))"
+                                    << bindValues;
+
+    intersectionFilter.clear();
+    intersectionFilter.append(History::UnionFilter());
+    intersectionFilter.append(History::Filter(History::FieldCount, 3));
+    bindValues.clear();
+    bindValues[":filterValue0"] = 3;
+    QTest::newRow("groups with a single condition") << History::EventTypeText << SQLiteFilterCompiler::TargetThreads
+                                                    << intersectionFilter.properties() << "threads.count=:filterValue0" << bindValues;
+}
+
+void SqliteFilterCompilerTest::testCompile()
+{
+    QFETCH(History::EventType, type);
+    QFETCH(SQLiteFilterCompiler::Target, target);
+    QFETCH(QVariantMap, filterProperties);
+    QFETCH(QString, condition);
+    QFETCH(QVariantMap, bindValues);
+
+    SQLiteFilterCompiler compiler(type, target);
+    QVERIFY(compiler.compile(History::Filter::fromProperties(filterProperties)));
+    QCOMPARE(compiler.condition(), condition);
+    QCOMPARE(compiler.bindValues(), bindValues);
+}
+
+void SqliteFilterCompilerTest::testInvalidFilters_data()
+{
+    QTest::addColumn<History::EventType>("type");
+    QTest::addColumn<QVariantMap>("filterProperties");
+
+    QTest::newRow("unknown property") << History::EventTypeText << History::Filter("testProperty", "value").properties();
+    QTest::newRow("text property on voice events") << History::EventTypeVoice << History::Filter(History::FieldMessage, "value").properties();
+    QTest::newRow("full text on a column not indexed") << History::EventTypeText
+                                                      << History::Filter(History::FieldSenderId, "value", History::MatchFullText).properties();
+
+    History::UnionFilter unionFilter;
+    unionFilter.append(History::Filter(History::FieldAccountId, "account"));
+    unionFilter.append(History::Filter("testProperty", "value"));
+    QTest::newRow("unknown property in a group") << History::EventTypeText << unionFilter.properties();
+}
+
+void SqliteFilterCompilerTest::testInvalidFilters()
+{
+    QFETCH(History::EventType, type);
+    QFETCH(QVariantMap, filterProperties);
+
+    SQLiteFilterCompiler compiler(type, SQLiteFilterCompiler::TargetEvents);
+    QVERIFY(!compiler.compile(History::Filter::fromProperties(filterProperties)));
+    QVERIFY(!compiler.errorString().isEmpty());
+    QVERIFY(compiler.condition().isEmpty());
+}
+
+void SqliteFilterCompilerTest::testStableStatements()
+{
+    // filters of the same shape only differ on the bound values
+    History::IntersectionFilter first;
+    first.append(History::Filter(History::FieldAccountId, "account0"));
+    first.append(History::Filter(History::FieldMessage, "it's 100%", History::MatchContains));
+    History::IntersectionFilter second;
+    second.append(History::Filter(History::FieldAccountId, "account1"));
+    second.append(History::Filter(History::FieldMessage, "hello", History::MatchContains));
+
+    SQLiteFilterCompiler compiler(History::EventTypeText, SQLiteFilterCompiler::TargetEvents);
+    QVERIFY(compiler.compile(first));
+    QString condition = compiler.condition();
+    QVariantMap bindValues = compiler.bindValues();
+    QVERIFY(compiler.compile(second));
+    QCOMPARE(compiler.condition(), condition);
+    QVERIFY(compiler.bindValues() != bindValues);
+    QVERIFY(!condition.contains("account"));
+    QVERIFY(!condition.contains("100"));
+}
+
+void SqliteFilterCompilerTest::testMatchQuery()
+{
+    History::IntersectionFilter filter;
+    filter.append(History::Filter(History::FieldAccountId, "account"));
+    filter.append(History::Filter(History::FieldMessage, "hello*", History::MatchFullText));
+
+    SQLiteFilterCompiler compiler(History::EventTypeText, SQLiteFilterCompiler::TargetEvents);
+    QVERIFY(compiler.compile(filter));
+    QCOMPARE(compiler.matchColumn(), QString(History::FieldMessage));
+    QCOMPARE(compiler.matchQuery(), QVariant("hello*"));
+
+    QVERIFY(compiler.compile(History::Filter(History::FieldMessage, "hello")));
+    QVERIFY(compiler.matchColumn().isEmpty());
+}
+
+void SqliteFilterCompilerTest::testEscapeLikePattern_data()
+{
+    QTest::addColumn<QString>("originalString");
+    QTest::addColumn<QString>("escapedString");
+
+    QTest::newRow("backslash") << QString("\\") << QString("\\\\");
+    QTest::newRow("single quote") << QString("'") << QString("'");
+    QTest::newRow("percent") << QString("%") << QString("\\%");
+    QTest::newRow("underscore") << QString("_") << QString("\\_");
+    QTest::newRow("string with all of that") << QString("\\0\"'%_bla") << QString("\\\\0\"'\\%\\_bla");
+}
+
+void SqliteFilterCompilerTest::testEscapeLikePattern()
+{
+    QFETCH(QString, originalString);
+    QFETCH(QString, escapedString);
+
+    QCOMPARE(SQLiteFilterCompiler::escapeLikePattern(originalString), escapedString);
+}
+
+QTEST_MAIN(SqliteFilterCompilerTest)
+#include "SqliteFilterCompilerTest.moc"
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QSqlError>
+#include "sqlite3.h"
+#include "eventbatchwriter.h"
+#include "sqlitehistoryplugin.h"
+#include "sqlitedatabase.h"
+#include "textevent.h"
+#include "voiceevent.h"
+#include "pluginthreadview.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_OPAQUE_POINTER(sqlite3*)
+Q_DECLARE_METATYPE(sqlite3*)
+
+static int statementCount = 0;
+
+void countStatement(void* /* data */, const char *statement)
+{
+    // statements run by triggers are reported with a leading comment
+    if (!QByteArray(statement).startsWith("--")) {
+        statementCount++;
+    }
+}
+
+class SqlitePluginBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void benchmarkSingleInsert_data();
+    void benchmarkSingleInsert();
+    void benchmarkThreadPage_data();
+    void benchmarkThreadPage();
+    void benchmarkBatchWrite_data();
+    void benchmarkBatchWrite();
+    void benchmarkThreadForParticipants_data();
+    void benchmarkThreadForParticipants();
+
+private:
+    SQLiteHistoryPlugin *mPlugin;
+
+    sqlite3 *handle() const;
+
+    QVariantMap populateThread(History::EventType type, int eventCount);
+};
+
+void SqlitePluginBenchmark::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+
+    qputenv("HISTORY_SQLITE_DBPATH", ":memory:");
+    mPlugin = new SQLiteHistoryPlugin(this);
+}
+
+sqlite3 *SqlitePluginBenchmark::handle() const
+{
+    return SQLiteDatabase::instance()->database().driver()->handle().value<sqlite3*>();
+}
+
+QVariantMap SqlitePluginBenchmark::populateThread(History::EventType type, int eventCount)
+{
+    QVariantMap thread = mPlugin->createThreadForParticipants("theAccountId", type, QStringList() << "theParticipant");
+    if (thread.isEmpty()) {
+        return thread;
+    }
+
+    // write the events straight to the database, the triggers keep the thread up-to-date
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QString table = type == History::EventTypeText ? "text_events" : "voice_events";
+    query.prepare(QString("INSERT INTO %1 (accountId, threadId, eventId, senderId, timestamp, newEvent) "
+                          "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent)").arg(table));
+
+    QDateTime timestamp = QDateTime::currentDateTime().addDays(-1);
+    SQLiteDatabase::instance()->beginTransation();
+    for (int i = 0; i < eventCount; ++i) {
+        query.bindValue(":accountId", thread[History::FieldAccountId]);
+        query.bindValue(":threadId", thread[History::FieldThreadId]);
+        query.bindValue(":eventId", QString("event%1").arg(i));
+        query.bindValue(":senderId", "theParticipant");
+        query.bindValue(":timestamp", timestamp.addSecs(i).toMSecsSinceEpoch());
+        query.bindValue(":newEvent", i % 2 == 0);
+        if (!query.exec()) {
+            qCritical() << "Failed to populate thread:" << query.lastError();
+            SQLiteDatabase::instance()->rollbackTransaction();
+            return QVariantMap();
+        }
+    }
+    SQLiteDatabase::instance()->finishTransaction();
+
+    return thread;
+}
+
+void SqlitePluginBenchmark::benchmarkSingleInsert_data()
+{
+    QTest::addColumn<History::EventType>("type");
+    QTest::addColumn<int>("threadSize");
+
+    QTest::newRow("text, 100 events") << History::EventTypeText << 100;
+    QTest::newRow("text, 1000 events") << History::EventTypeText << 1000;
+    QTest::newRow("text, 10000 events") << History::EventTypeText << 10000;
+    QTest::newRow("voice, 100 events") << History::EventTypeVoice << 100;
+    QTest::newRow("voice, 1000 events") << History::EventTypeVoice << 1000;
+    QTest::newRow("voice, 10000 events") << History::EventTypeVoice << 10000;
+}
+
+void SqlitePluginBenchmark::benchmarkSingleInsert()
+{
+    QFETCH(History::EventType, type);
+    QFETCH(int, threadSize);
+
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    QVariantMap thread = populateThread(type, threadSize);
+    QVERIFY(!thread.isEmpty());
+    QString accountId = thread[History::FieldAccountId].toString();
+    QString threadId = thread[History::FieldThreadId].toString();
+
+    int written = 0;
+    QBENCHMARK {
+        QString eventId = QString("benchmarkEvent%1").arg(written++);
+        History::EventWriteResult result;
+        if (type == History::EventTypeText) {
+            History::TextEvent event(accountId, threadId, eventId, "theParticipant", QDateTime::currentDateTime(),
+                                     true, "Hello!", History::MessageTypeText);
+            result = mPlugin->writeTextEvent(event.properties());
+        } else {
+            History::VoiceEvent event(accountId, threadId, eventId, "theParticipant", QDateTime::currentDateTime(),
+                                      true, false, QTime(0, 1, 2));
+            result = mPlugin->writeVoiceEvent(event.properties());
+        }
+        QCOMPARE(result, History::EventWriteCreated);
+    }
+
+    // and make sure the counters are still right after all the writes
+    thread = mPlugin->getSingleThread(type, accountId, threadId);
+    QCOMPARE(thread[History::FieldCount].toInt(), threadSize + written);
+    QCOMPARE(thread[History::FieldUnreadCount].toInt(), (threadSize + 1) / 2 + written);
+}
+
+void SqlitePluginBenchmark::benchmarkThreadPage_data()
+{
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("15 threads") << 15;
+    QTest::newRow("150 threads") << 150;
+}
+
+void SqlitePluginBenchmark::benchmarkThreadPage()
+{
+    QFETCH(int, threadCount);
+
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    // chat rooms with participants and an attachment in the last event need the most data per thread
+    QDateTime timestamp = QDateTime::currentDateTime();
+    mPlugin->beginBatchOperation();
+    for (int i = 0; i < threadCount; ++i) {
+        QString threadId = QString("room%1").arg(i);
+        QVariantMap properties;
+        properties[History::FieldChatType] = (int) History::ChatTypeRoom;
+        properties[History::FieldThreadId] = threadId;
+        QVERIFY(!mPlugin->createThreadForProperties("theAccountId", History::EventTypeText, properties).isEmpty());
+
+        QVariantList participants;
+        for (int j = 0; j < 3; ++j) {
+            QVariantMap participant;
+            participant["identifier"] = QString("participant%1").arg(j);
+            participants << participant;
+        }
+        QVERIFY(mPlugin->updateRoomParticipants("theAccountId", threadId, History::EventTypeText, participants));
+
+        History::TextEventAttachment attachment("theAccountId", threadId, "theEventId", "theAttachment",
+                                                "text/plain", "/the/file/path");
+        History::TextEvent event("theAccountId", threadId, "theEventId", "participant0", timestamp.addSecs(i),
+                                 true, "Hello!", History::MessageTypeMultiPart, History::MessageStatusDelivered,
+                                 QDateTime(), QString(), History::InformationTypeNone,
+                                 History::TextEventAttachments() << attachment);
+        QCOMPARE(mPlugin->writeTextEvent(event.properties()), History::EventWriteCreated);
+    }
+    mPlugin->endBatchOperation();
+
+    History::Sort sort(History::FieldLastEventTimestamp, Qt::DescendingOrder);
+
+    // the number of queries needed to fill a page should not depend on the number of threads in it
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText, sort);
+    statementCount = 0;
+    sqlite3_trace(handle(), &countStatement, NULL);
+    QList<QVariantMap> threads = view->NextPage();
+    sqlite3_trace(handle(), NULL, NULL);
+    delete view;
+
+    QCOMPARE(threads.count(), 15);
+    QCOMPARE(threads.first()[History::FieldParticipants].toList().count(), 3);
+    QCOMPARE(threads.first()[History::FieldAttachments].value<QList<QVariantMap> >().count(), 1);
+    qDebug() << "Queries per page:" << statementCount;
+    QVERIFY(statementCount <= 4);
+
+    QBENCHMARK {
+        view = mPlugin->queryThreads(History::EventTypeText, sort);
+        view->NextPage();
+        delete view;
+    }
+}
+
+void SqlitePluginBenchmark::benchmarkBatchWrite_data()
+{
+    QTest::addColumn<int>("threadCount");
+    QTest::addColumn<int>("batchSize");
+
+    // the daemon writes the events of a batch through EventBatchWriter, which reads each thread once per batch,
+    // so batches of one event cost one thread read per event
+    QTest::newRow("1 thread, batches of 1") << 1 << 1;
+    QTest::newRow("1 thread, batches of 500") << 1 << 500;
+    QTest::newRow("10 threads, batches of 1") << 10 << 1;
+    QTest::newRow("10 threads, batches of 500") << 10 << 500;
+}
+
+void SqlitePluginBenchmark::benchmarkBatchWrite()
+{
+    QFETCH(int, threadCount);
+    QFETCH(int, batchSize);
+
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    QStringList threadIds;
+    for (int i = 0; i < threadCount; ++i) {
+        QVariantMap thread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText,
+                                                                  QStringList() << QString("participant%1").arg(i));
+        QVERIFY(!thread.isEmpty());
+        threadIds << thread[History::FieldThreadId].toString();
+    }
+
+    const int eventCount = 500;
+    int written = 0;
+    EventBatchWriter writer(mPlugin);
+    QBENCHMARK {
+        QList<QVariantMap> events;
+        for (int i = 0; i < eventCount; ++i) {
+            QString threadId = threadIds[i % threadCount];
+            History::TextEvent event("theAccountId", threadId, QString("event%1").arg(written++), "theParticipant",
+                                     QDateTime::currentDateTime(), true, "Hello!", History::MessageTypeText);
+            events << event.properties();
+            if (events.count() == batchSize) {
+                QVERIFY(writer.write(events));
+                QCOMPARE(writer.newEvents().count(), batchSize);
+                QCOMPARE(writer.threads().count(), qMin(batchSize, threadCount));
+                events.clear();
+            }
+        }
+    }
+}
+
+void SqlitePluginBenchmark::benchmarkThreadForParticipants_data()
+{
+    QTest::addColumn<QString>("accountId");
+    QTest::addColumn<int>("threadCount");
+    QTest::addColumn<int>("participantCount");
+
+    // phone accounts resolve threads through the participants fingerprint, while
+    // matching phone numbers on other accounts still compares every participant
+    QTest::newRow("fingerprint, 100 threads, 1 participant") << "ofono/ofono/account0" << 100 << 1;
+    QTest::newRow("fingerprint, 1000 threads, 1 participant") << "ofono/ofono/account0" << 1000 << 1;
+    QTest::newRow("fingerprint, 1000 threads, 5 participants") << "ofono/ofono/account0" << 1000 << 5;
+    QTest::newRow("scan, 100 threads, 1 participant") << "theAccountId" << 100 << 1;
+    QTest::newRow("scan, 1000 threads, 1 participant") << "theAccountId" << 1000 << 1;
+    QTest::newRow("scan, 1000 threads, 5 participants") << "theAccountId" << 1000 << 5;
+}
+
+void SqlitePluginBenchmark::benchmarkThreadForParticipants()
+{
+    QFETCH(QString, accountId);
+    QFETCH(int, threadCount);
+    QFETCH(int, participantCount);
+
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    // group threads share their first participant, the worst case for looking threads up by it
+    QStringList lastParticipants;
+    mPlugin->beginBatchOperation();
+    for (int i = 0; i < threadCount; ++i) {
+        QStringList participants;
+        if (participantCount > 1) {
+            participants << "+15550000000";
+        }
+        while (participants.count() < participantCount) {
+            participants << QString("+1556%1").arg(i * participantCount + participants.count(), 7, 10, QChar('0'));
+        }
+        QVERIFY(!mPlugin->createThreadForParticipants(accountId, History::EventTypeText, participants).isEmpty());
+        lastParticipants = participants;
+    }
+    mPlugin->endBatchOperation();
+
+    QBENCHMARK {
+        QVariantMap thread = mPlugin->threadForParticipants(accountId, History::EventTypeText, lastParticipants,
+                                                            History::MatchPhoneNumber);
+        QVERIFY(!thread.isEmpty());
+    }
+}
+
+QTEST_MAIN(SqlitePluginBenchmark)
+#include "SqlitePluginBenchmark.moc"
@@ -25,8 +25,7 @@
 #include "textevent.h"
 #include "texteventattachment.h"
 #include "voiceevent.h"
-#include "intersectionfilter.h"
-#include "unionfilter.h"
+#include "utils_p.h"
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
@@ -43,9 +42,11 @@ private Q_SLOTS:
     void testThreadForParticipants();
     void testEmptyThreadForParticipants();
     void testGetSingleThread();
+    void testGroupedThreads();
     void testRemoveThread();
     void testBatchOperation();
     void testRollback();
+    void testImport();
     void testQueryThreads();
     void testQueryEvents();
     void testWriteTextEvent_data();
@@ -59,10 +60,7 @@ private Q_SLOTS:
     void testEventsForThread();
     void testGetSingleEvent_data();
     void testGetSingleEvent();
-    void testFilterToString_data();
-    void testFilterToString();
-    void testEscapeFilterValue_data();
-    void testEscapeFilterValue();
+    void testQueryCache();
 
 private:
     SQLiteHistoryPlugin *mPlugin;
@@ -164,6 +162,16 @@ void SqlitePluginTest::testThreadForParticipants_data()
                                                                    << (QStringList() << "12345678" << "+19999999999")
                                                                    << History::MatchFlags(History::MatchPhoneNumber)
                                                                    << (QStringList() << "+554112345678" << "9999999");
+    QTest::newRow("phone account match by fingerprint") << "ofono/ofono/account0"
+                                                        << History::EventTypeText
+                                                        << (QStringList() << "+12345678901" << "+19999999999")
+                                                        << History::MatchFlags(History::MatchPhoneNumber)
+                                                        << (QStringList() << "9999999" << "2345678901");
+    QTest::newRow("phone account exact match by fingerprint") << "ofono/ofono/account0"
+                                                              << History::EventTypeVoice
+                                                              << (QStringList() << "+12345678901")
+                                                              << History::MatchFlags(History::MatchCaseSensitive)
+                                                              << (QStringList() << "+12345678901");
 }
 
 void SqlitePluginTest::testThreadForParticipants()
@@ -222,6 +230,37 @@ void SqlitePluginTest::testGetSingleThread()
     // FIXME: check that the last event data is also present
 }
 
+void SqlitePluginTest::testGroupedThreads()
+{
+    // reset the database
+    SQLiteDatabase::instance()->reopen();
+
+    // threads with the same phone number written in different ways are grouped together
+    QVariantMap thread = mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "+1 555 123 4567");
+    QVERIFY(!thread.isEmpty());
+    QVariantMap otherThread = mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "5551234567");
+    QVERIFY(!otherThread.isEmpty());
+    QVariantMap differentThread = mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "5557654321");
+    QVERIFY(!differentThread.isEmpty());
+
+    QVariantMap properties;
+    properties[History::FieldGroupingProperty] = History::FieldParticipants;
+    QVariantMap retrievedThread = mPlugin->getSingleThread(History::EventTypeText, "ofono/ofono/account0",
+                                                           otherThread[History::FieldThreadId].toString(), properties);
+    QCOMPARE(retrievedThread[History::FieldThreadId], otherThread[History::FieldThreadId]);
+    QCOMPARE(retrievedThread[History::FieldGroupedThreads].toList().count(), 2);
+
+    retrievedThread = mPlugin->getSingleThread(History::EventTypeText, "ofono/ofono/account0",
+                                               differentThread[History::FieldThreadId].toString(), properties);
+    QCOMPARE(retrievedThread[History::FieldGroupedThreads].toList().count(), 1);
+
+    // and removing a thread takes it out of the group
+    QVERIFY(mPlugin->removeThread(thread));
+    retrievedThread = mPlugin->getSingleThread(History::EventTypeText, "ofono/ofono/account0",
+                                               otherThread[History::FieldThreadId].toString(), properties);
+    QCOMPARE(retrievedThread[History::FieldGroupedThreads].toList().count(), 1);
+}
+
 void SqlitePluginTest::testRemoveThread()
 {
     // reset the database
@@ -278,6 +317,51 @@ void SqlitePluginTest::testRollback()
     QCOMPARE(query.value(0).toInt(), version);
 }
 
+void SqlitePluginTest::testImport()
+{
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    QVariantMap textThread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText, QStringList() << "theParticipant");
+    QVariantMap voiceThread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeVoice, QStringList() << "theParticipant");
+    QString textThreadId = textThread[History::FieldThreadId].toString();
+    QString voiceThreadId = voiceThread[History::FieldThreadId].toString();
+
+    QVERIFY(mPlugin->beginImport());
+    QDateTime timestamp = QDateTime::currentDateTime();
+    for (int i = 0; i < 10; ++i) {
+        History::TextEvent textEvent("theAccountId", textThreadId, QString("textEvent%1").arg(i), "theParticipant",
+                                     timestamp.addSecs(i), i % 2 == 0, "Hello!", History::MessageTypeText);
+        QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+        History::VoiceEvent voiceEvent("theAccountId", voiceThreadId, QString("voiceEvent%1").arg(i), "theParticipant",
+                                       timestamp.addSecs(i), i < 3, true);
+        QCOMPARE(mPlugin->writeVoiceEvent(voiceEvent.properties()), History::EventWriteCreated);
+    }
+
+    // the threads are left alone during the import
+    textThread = mPlugin->getSingleThread(History::EventTypeText, "theAccountId", textThreadId);
+    QCOMPARE(textThread[History::FieldCount].toInt(), 0);
+
+    // and updated at once at the end
+    QVERIFY(mPlugin->endImport());
+    textThread = mPlugin->getSingleThread(History::EventTypeText, "theAccountId", textThreadId);
+    QCOMPARE(textThread[History::FieldCount].toInt(), 10);
+    QCOMPARE(textThread[History::FieldUnreadCount].toInt(), 5);
+    QCOMPARE(textThread[History::FieldEventId].toString(), QString("textEvent9"));
+    voiceThread = mPlugin->getSingleThread(History::EventTypeVoice, "theAccountId", voiceThreadId);
+    QCOMPARE(voiceThread[History::FieldCount].toInt(), 10);
+    QCOMPARE(voiceThread[History::FieldUnreadCount].toInt(), 3);
+    QCOMPARE(voiceThread[History::FieldEventId].toString(), QString("voiceEvent9"));
+
+    // the writes after the import update the threads again
+    History::TextEvent textEvent("theAccountId", textThreadId, "textEvent10", "theParticipant",
+                                 timestamp.addSecs(10), true, "Hello!", History::MessageTypeText);
+    QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+    textThread = mPlugin->getSingleThread(History::EventTypeText, "theAccountId", textThreadId);
+    QCOMPARE(textThread[History::FieldCount].toInt(), 11);
+    QCOMPARE(textThread[History::FieldEventId].toString(), QString("textEvent10"));
+}
+
 void SqlitePluginTest::testQueryThreads()
 {
     // just make sure the returned view is of the correct type. The views are going to be tested in their own tests
@@ -351,15 +435,15 @@ void SqlitePluginTest::testWriteTextEvent()
         QCOMPARE(query.value("threadId"), event[History::FieldThreadId]);
         QCOMPARE(query.value("eventId"), event[History::FieldEventId]);
         QCOMPARE(query.value("senderId"), event[History::FieldSenderId]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("timestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("timestamp")),
                  event[History::FieldTimestamp].toString());
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("sentTime").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("sentTime")),
                  event[History::FieldSentTime].toString());
         QCOMPARE(query.value("newEvent"), event[History::FieldNewEvent]);
         QCOMPARE(query.value("message"), event[History::FieldMessage]);
         QCOMPARE(query.value("messageType"), event[History::FieldMessageType]);
         QCOMPARE(query.value("messageStatus"), event[History::FieldMessageStatus]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("readTimestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("readTimestamp")),
                  event[History::FieldReadTimestamp].toString());
         QCOMPARE(query.value("subject"), event[History::FieldSubject]);
     }
@@ -431,15 +515,15 @@ void SqlitePluginTest::testModifyTextEvent()
         QCOMPARE(query.value("threadId"), event[History::FieldThreadId]);
         QCOMPARE(query.value("eventId"), event[History::FieldEventId]);
         QCOMPARE(query.value("senderId"), event[History::FieldSenderId]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("timestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("timestamp")),
                  event[History::FieldTimestamp].toString());
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("sentTime").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("sentTime")),
                  event[History::FieldSentTime].toString());
         QCOMPARE(query.value("newEvent"), event[History::FieldNewEvent]);
         QCOMPARE(query.value("message"), event[History::FieldMessage]);
         QCOMPARE(query.value("messageType"), event[History::FieldMessageType]);
         QCOMPARE(query.value("messageStatus"), event[History::FieldMessageStatus]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("readTimestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("readTimestamp")),
                  event[History::FieldReadTimestamp].toString());
         QCOMPARE(query.value("subject"), event[History::FieldSubject]);
     }
@@ -511,7 +595,7 @@ void SqlitePluginTest::testWriteVoiceEvent()
         QCOMPARE(query.value("threadId"), event[History::FieldThreadId]);
         QCOMPARE(query.value("eventId"), event[History::FieldEventId]);
         QCOMPARE(query.value("senderId"), event[History::FieldSenderId]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("timestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("timestamp")),
                  event[History::FieldTimestamp].toString());
         QCOMPARE(query.value("newEvent"), event[History::FieldNewEvent]);
         QCOMPARE(query.value("missed"), event[History::FieldMissed]);
@@ -559,7 +643,7 @@ void SqlitePluginTest::testModifyVoiceEvent()
         QCOMPARE(query.value("threadId"), event[History::FieldThreadId]);
         QCOMPARE(query.value("eventId"), event[History::FieldEventId]);
         QCOMPARE(query.value("senderId"), event[History::FieldSenderId]);
-        QCOMPARE(mPlugin->toLocalTimeString(query.value("timestamp").toDateTime()),
+        QCOMPARE(History::Utils::timestampToString(query.value("timestamp")),
                  event[History::FieldTimestamp].toString());
         QCOMPARE(query.value("newEvent"), event[History::FieldNewEvent]);
         QCOMPARE(query.value("missed"), event[History::FieldMissed]);
@@ -731,110 +815,37 @@ void SqlitePluginTest::testGetSingleEvent()
     }
 }
 
-void SqlitePluginTest::testFilterToString_data()
+void SqlitePluginTest::testQueryCache()
 {
-    QTest::addColumn<QVariantMap>("filterProperties");
-    QTest::addColumn<QVariantMap>("filterValues");
-    QTest::addColumn<QString>("propertyPrefix");
-    QTest::addColumn<QString>("resultString");
-
-    History::Filter filter;
-    QVariantMap filterValues;
-    filter.setFilterProperty("testProperty");
-    filter.setFilterValue("stringValue");
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("simple string filter") << filter.properties() << filterValues << QString() << "testProperty=:filterValue0";
-
-    filter.setFilterValue(12345);
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("simple integer filter") << filter.properties() << filterValues << QString() << "testProperty=:filterValue0";
-
-    filter.setFilterValue(true);
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("simple true boolean filter") << filter.properties() << filterValues << QString() << "testProperty=:filterValue0";
-
-    filter.setFilterValue(false);
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("simple false boolean filter") << filter.properties() << filterValues << QString() << "testProperty=:filterValue0";
-
-    filter.setFilterValue(12345);
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("filter with a prefix") << filter.properties() << filterValues << QString("prefix") << "prefix.testProperty=:filterValue0";
-
-    filter.setFilterValue(12345);
-    filter.setMatchFlags(History::MatchNotEquals);
-    filterValues[":filterValue0"] = filter.filterValue();
-    QTest::newRow("filter not equals") << filter.properties() << filterValues << QString() << "testProperty!=:filterValue0";
-
-    filter.setMatchFlags(History::MatchContains);
-    filter.setFilterValue("partialString");
-    filterValues.clear();
-    QTest::newRow("match contains") << filter.properties() << filterValues << QString() << "testProperty LIKE '\%partialString\%' ESCAPE '\\'";
-
-    filter.setFilterValue("%");
-    filterValues.clear();
-    QTest::newRow("partial match escaped") << filter.properties() << filterValues << QString() << "testProperty LIKE '\%\\\%\%' ESCAPE '\\'";
-
-    History::IntersectionFilter intersectionFilter;
-    filter.setMatchFlags(History::MatchFlags());
-    filter.setFilterValue(12345);
-    intersectionFilter.append(filter);
-    filter.setFilterValue(true);
-    intersectionFilter.append(filter);
-    filter.setFilterValue("a string");
-    intersectionFilter.append(filter);
-    filterValues.clear();
-    filterValues[":filterValue0"] = 12345;
-    filterValues[":filterValue1"] = true;
-    filterValues[":filterValue2"] = "a string";
-    QTest::newRow("intersection filter") << intersectionFilter.properties() << filterValues << QString() << "( (testProperty=:filterValue0) AND (testProperty=:filterValue1) AND (testProperty=:filterValue2) )";
-
-    History::UnionFilter unionFilter;
-    filter.setFilterValue(12345);
-    unionFilter.append(filter);
-    filter.setFilterValue(true);
-    unionFilter.append(filter);
-    filter.setFilterValue("a string");
-    unionFilter.append(filter);
-    filterValues.clear();
-    filterValues[":filterValue0"] = 12345;
-    filterValues[":filterValue1"] = true;
-    filterValues[":filterValue2"] = "a string";
-    QTest::newRow("union filter") << unionFilter.properties() << filterValues << QString() << "( (testProperty=:filterValue0) OR (testProperty=:filterValue1) OR (testProperty=:filterValue2) )";
-}
-
-void SqlitePluginTest::testFilterToString()
-{
-    QFETCH(QVariantMap, filterProperties);
-    QFETCH(QVariantMap, filterValues);
-    QFETCH(QString, propertyPrefix);
-    QFETCH(QString, resultString);
-
-    QVariantMap resultValues;
-    QString result = mPlugin->filterToString(History::Filter::fromProperties(filterProperties), resultValues, propertyPrefix);
-    QCOMPARE(result, resultString);
-    QCOMPARE(resultValues, filterValues);
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
 
-}
+    QVariantMap thread = mPlugin->createThreadForParticipants("oneAccountId", History::EventTypeText, QStringList() << "oneParticipant");
+    QString threadId = thread[History::FieldThreadId].toString();
 
-void SqlitePluginTest::testEscapeFilterValue_data()
-{
-    QTest::addColumn<QString>("originalString");
-    QTest::addColumn<QString>("escapedString");
-
-    QTest::newRow("backslash") << QString("\\") << QString("\\\\");
-    QTest::newRow("single quote") << QString("'") << QString("''");
-    QTest::newRow("percent") << QString("%") << QString("\\%");
-    QTest::newRow("underscore") << QString("_") << QString("\\_");
-    QTest::newRow("string with all of that") << QString("\\0\"'%_bla") << QString("\\\\0\"''\\%\\_bla");
-}
+    // write the first event so that all the statements used by the write are prepared
+    History::TextEvent firstEvent("oneAccountId", threadId, "firstEvent", "oneParticipant", QDateTime::currentDateTime(),
+                                  true, "Hello", History::MessageTypeText);
+    QCOMPARE(mPlugin->writeTextEvent(firstEvent.properties()), History::EventWriteCreated);
 
-void SqlitePluginTest::testEscapeFilterValue()
-{
-    QFETCH(QString, originalString);
-    QFETCH(QString, escapedString);
+    int misses = SQLiteDatabase::instance()->queryCacheMisses();
+    int hits = SQLiteDatabase::instance()->queryCacheHits();
 
-    QCOMPARE(mPlugin->escapeFilterValue(originalString), escapedString);
+    // writing more events should not prepare any new statement
+    for (int i = 0; i < 5; ++i) {
+        History::TextEvent event("oneAccountId", threadId, QString("event%1").arg(i), "oneParticipant",
+                                 QDateTime::currentDateTime(), true, "Hello", History::MessageTypeText);
+        QCOMPARE(mPlugin->writeTextEvent(event.properties()), History::EventWriteCreated);
+    }
+    QCOMPARE(SQLiteDatabase::instance()->queryCacheMisses(), misses);
+    QVERIFY(SQLiteDatabase::instance()->queryCacheHits() > hits);
+
+    // and the reused statements need to return the right data
+    QVariantMap event = mPlugin->getSingleEvent(History::EventTypeText, "oneAccountId", threadId, "event3");
+    QCOMPARE(event[History::FieldEventId].toString(), QString("event3"));
+    thread = mPlugin->getSingleThread(History::EventTypeText, "oneAccountId", threadId);
+    QCOMPARE(thread[History::FieldCount].toInt(), 6);
+    QCOMPARE(mPlugin->eventsForThread(thread).count(), 6);
 }
 
 QTEST_MAIN(SqlitePluginTest)
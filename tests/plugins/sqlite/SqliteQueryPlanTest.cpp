@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QSqlError>
+#include "sqlite3.h"
+#include "sqlitehistoryplugin.h"
+#include "sqlitedatabase.h"
+#include "textevent.h"
+#include "voiceevent.h"
+#include "intersectionfilter.h"
+#include "pluginthreadview.h"
+#include "plugineventview.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_OPAQUE_POINTER(sqlite3*)
+Q_DECLARE_METATYPE(sqlite3*)
+
+// statements captured while running the plugin workload
+static QStringList capturedStatements;
+
+void captureStatement(void* /* data */, const char *statement)
+{
+    QString text = QString::fromUtf8(statement).trimmed();
+    if (!capturedStatements.contains(text)) {
+        capturedStatements << text;
+    }
+}
+
+class SqliteQueryPlanTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testNoFullTableScans();
+
+private:
+    SQLiteHistoryPlugin *mPlugin;
+
+    sqlite3 *handle() const;
+    void runWorkload();
+};
+
+void SqliteQueryPlanTest::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+
+    qputenv("HISTORY_SQLITE_DBPATH", ":memory:");
+    mPlugin = new SQLiteHistoryPlugin(this);
+}
+
+sqlite3 *SqliteQueryPlanTest::handle() const
+{
+    return SQLiteDatabase::instance()->database().driver()->handle().value<sqlite3*>();
+}
+
+void SqliteQueryPlanTest::runWorkload()
+{
+    QDateTime now = QDateTime::currentDateTime();
+
+    // regular text and voice threads
+    QVariantMap textThread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText,
+                                                                  QStringList() << "+1 (555) 123-4567");
+    QVERIFY(!textThread.isEmpty());
+    QString textThreadId = textThread[History::FieldThreadId].toString();
+    QVariantMap voiceThread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeVoice,
+                                                                   QStringList() << "+1 (555) 123-4567");
+    QVERIFY(!voiceThread.isEmpty());
+    QString voiceThreadId = voiceThread[History::FieldThreadId].toString();
+
+    // and a chat room
+    QVariantMap roomProperties;
+    roomProperties[History::FieldChatType] = (int) History::ChatTypeRoom;
+    roomProperties[History::FieldThreadId] = "theRoomId";
+    QVariantMap roomThread = mPlugin->createThreadForProperties("theAccountId", History::EventTypeText, roomProperties);
+    QVERIFY(!roomThread.isEmpty());
+
+    QVariantMap participant;
+    participant["identifier"] = "roomParticipant";
+    participant["alias"] = "Room Participant";
+    QVERIFY(mPlugin->updateRoomParticipants("theAccountId", "theRoomId", History::EventTypeText,
+                                            QVariantList() << participant));
+    QVariantMap roles;
+    roles["roomParticipant"] = 1;
+    QVERIFY(mPlugin->updateRoomParticipantsRoles("theAccountId", "theRoomId", History::EventTypeText, roles));
+    QVariantMap roomInfo;
+    roomInfo["Title"] = "The Title";
+    QVERIFY(mPlugin->updateRoomInfo("theAccountId", "theRoomId", History::EventTypeText, roomInfo));
+
+    // write and modify text events, including one with attachments
+    for (int i = 0; i < 10; ++i) {
+        History::TextEvent textEvent("theAccountId", textThreadId, QString("textEvent%1").arg(i), "+15551234567",
+                                     now.addSecs(i), now.addSecs(i), true, "Hello!", History::MessageTypeText);
+        QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+    }
+    History::TextEventAttachment attachment("theAccountId", textThreadId, "mmsEvent", "theAttachment",
+                                            "text/plain", "/the/file/path");
+    History::TextEvent mmsEvent("theAccountId", textThreadId, "mmsEvent", "+15551234567", now.addSecs(20),
+                                now.addSecs(20), true, "With attachments", History::MessageTypeMultiPart,
+                                History::MessageStatusPending, QDateTime(), "theSubject", History::InformationTypeNone,
+                                History::TextEventAttachments() << attachment);
+    QCOMPARE(mPlugin->writeTextEvent(mmsEvent.properties()), History::EventWriteCreated);
+    mmsEvent.setMessageStatus(History::MessageStatusDelivered);
+    QCOMPARE(mPlugin->writeTextEvent(mmsEvent.properties()), History::EventWriteModified);
+
+    // write voice events
+    for (int i = 0; i < 10; ++i) {
+        History::VoiceEvent voiceEvent("theAccountId", voiceThreadId, QString("voiceEvent%1").arg(i), "+15551234567",
+                                       now.addSecs(i), true, i % 2, QTime(0, 1, 2));
+        QCOMPARE(mPlugin->writeVoiceEvent(voiceEvent.properties()), History::EventWriteCreated);
+    }
+
+    // lookups
+    QVERIFY(!mPlugin->threadForParticipants("theAccountId", History::EventTypeText,
+                                            QStringList() << "+1 (555) 123-4567").isEmpty());
+    QVERIFY(!mPlugin->threadForParticipants("theAccountId", History::EventTypeText,
+                                            QStringList() << "5551234567",
+                                            History::MatchPhoneNumber).isEmpty());
+    QVERIFY(!mPlugin->getSingleThread(History::EventTypeText, "theAccountId", textThreadId).isEmpty());
+    QVERIFY(!mPlugin->getSingleEvent(History::EventTypeVoice, "theAccountId", voiceThreadId, "voiceEvent3").isEmpty());
+    QCOMPARE(mPlugin->eventsForThread(textThread).count(), 11);
+    QVERIFY(!mPlugin->participantsForThreads(QList<QVariantMap>() << textThread << voiceThread).isEmpty());
+
+    // thread and event views, the way the clients page through them
+    History::Sort threadSort(History::FieldLastEventTimestamp, Qt::DescendingOrder);
+    Q_FOREACH(History::EventType type, QList<History::EventType>() << History::EventTypeText << History::EventTypeVoice) {
+        History::PluginThreadView *threadView = mPlugin->queryThreads(type, threadSort);
+        QVERIFY(threadView->IsValid());
+        while (!threadView->NextPage().isEmpty()) {
+        }
+        delete threadView;
+    }
+
+    History::IntersectionFilter filter;
+    filter.append(History::Filter(History::FieldAccountId, "theAccountId"));
+    filter.append(History::Filter(History::FieldThreadId, textThreadId));
+    History::PluginEventView *eventView = mPlugin->queryEvents(History::EventTypeText,
+                                                                History::Sort(History::FieldTimestamp, Qt::DescendingOrder),
+                                                                filter);
+    QVERIFY(eventView->IsValid());
+    while (!eventView->NextPage().isEmpty()) {
+    }
+    delete eventView;
+
+    // and finally the write paths that modify or remove data
+    mPlugin->markThreadAsRead(textThread);
+    mPlugin->markThreadAsRead(voiceThread);
+    QVERIFY(mPlugin->removeTextEvent(mmsEvent.properties()));
+    QVERIFY(mPlugin->removeVoiceEvent(mPlugin->getSingleEvent(History::EventTypeVoice, "theAccountId",
+                                                              voiceThreadId, "voiceEvent0")));
+    QVERIFY(mPlugin->removeThread(voiceThread));
+}
+
+void SqliteQueryPlanTest::testNoFullTableScans()
+{
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    capturedStatements.clear();
+    sqlite3_trace(handle(), &captureStatement, NULL);
+    runWorkload();
+    sqlite3_trace(handle(), NULL, NULL);
+
+    QVERIFY(!capturedStatements.isEmpty());
+
+    // a full scan on any of the persistent tables means a lookup is missing an index.
+    // The temporary tables created by the views are scanned on purpose.
+    QRegExp fullScan("^SCAN (TABLE )?(threads|thread_participants|text_events|voice_events|"
+                     "text_event_attachments|chat_room_info)\\b");
+    QRegExp tempTablePrefix("^CREATE TEMP TABLE \\S+ AS ", Qt::CaseInsensitive);
+    QRegExp skipped("^(BEGIN|COMMIT|ROLLBACK|END|DROP|PRAGMA|SAVEPOINT|RELEASE)\\b", Qt::CaseInsensitive);
+    QRegExp viewPage("^SELECT \\* FROM (threadview|eventview)\\S+ LIMIT", Qt::CaseInsensitive);
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    Q_FOREACH(QString statement, capturedStatements) {
+        // statements executed by triggers are reported with a leading comment
+        if (statement.startsWith("--") || skipped.indexIn(statement) == 0 || viewPage.indexIn(statement) == 0) {
+            continue;
+        }
+        statement.remove(tempTablePrefix);
+
+        QVERIFY2(query.exec(QString("EXPLAIN QUERY PLAN %1").arg(statement)),
+                 qPrintable(query.lastError().text() + ": " + statement));
+        while (query.next()) {
+            QString detail = query.value(3).toString();
+            QVERIFY2(fullScan.indexIn(detail) != 0, qPrintable(detail + ": " + statement));
+        }
+    }
+}
+
+QTEST_MAIN(SqliteQueryPlanTest)
+#include "SqliteQueryPlanTest.moc"
@@ -24,6 +24,7 @@
 #include "textevent.h"
 #include "voiceevent.h"
 #include "unionfilter.h"
+#include "pagepolicy_p.h"
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
@@ -39,6 +40,10 @@ private Q_SLOTS:
     void testNextPage();
     void testFilter();
     void testSort();
+    void testSortByLastEventTimestamp();
+    void testPageSize();
+    void testAdaptivePageSize();
+    void testReadAhead();
 
 private:
     SQLiteHistoryPlugin *mPlugin;
@@ -128,6 +133,89 @@ void SqliteThreadViewTest::testSort()
     delete view;
 }
 
+void SqliteThreadViewTest::testSortByLastEventTimestamp()
+{
+    // sorting by the last event timestamp pages through the index instead of a temporary table,
+    // so make sure threads sharing the same timestamp are neither skipped nor repeated
+    Q_FOREACH(Qt::SortOrder order, QList<Qt::SortOrder>() << Qt::AscendingOrder << Qt::DescendingOrder) {
+        History::Sort sort(History::FieldLastEventTimestamp, order);
+        History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText, sort);
+        QVERIFY(view->IsValid());
+        QList<QVariantMap> allThreads;
+        QList<QVariantMap> threads = view->NextPage();
+        while (!threads.isEmpty()) {
+            allThreads << threads;
+            threads = view->NextPage();
+        }
+
+        QCOMPARE(allThreads.count(), THREAD_COUNT);
+        QSet<QString> threadKeys;
+        for (int i = 0; i < allThreads.count(); ++i) {
+            QCOMPARE(allThreads[i][History::FieldType].toInt(), (int) History::EventTypeText);
+            threadKeys << allThreads[i][History::FieldAccountId].toString() + allThreads[i][History::FieldThreadId].toString();
+            if (i > 0) {
+                QDateTime previous = QDateTime::fromString(allThreads[i-1][History::FieldTimestamp].toString(), Qt::ISODate);
+                QDateTime current = QDateTime::fromString(allThreads[i][History::FieldTimestamp].toString(), Qt::ISODate);
+                QVERIFY(order == Qt::AscendingOrder ? previous <= current : previous >= current);
+            }
+        }
+        QCOMPARE(threadKeys.count(), THREAD_COUNT);
+        delete view;
+    }
+}
+
+void SqliteThreadViewTest::testPageSize()
+{
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText);
+    QCOMPARE(view->NextPage().count(), (int) History::PagePolicy::DefaultPageSize);
+
+    QCOMPARE(view->SetPageSize(30), 30);
+    QCOMPARE(view->NextPage().count(), 5);
+    delete view;
+
+    // the requested size is capped by the service
+    view = mPlugin->queryThreads(History::EventTypeText);
+    QCOMPARE(view->SetPageSize(100000), (int) History::PagePolicy::MaximumPageSize);
+    QCOMPARE(view->NextPage().count(), THREAD_COUNT);
+    delete view;
+}
+
+void SqliteThreadViewTest::testAdaptivePageSize()
+{
+    // pages requested in quick succession get bigger
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeVoice);
+    QCOMPARE(view->SetPageSize(History::PagePolicy::AdaptivePageSize), (int) History::PagePolicy::DefaultPageSize);
+    QCOMPARE(view->NextPage().count(), 15);
+    QCOMPARE(view->NextPage().count(), 30);
+    QCOMPARE(view->NextPage().count(), 5);
+    QVERIFY(view->NextPage().isEmpty());
+    delete view;
+}
+
+void SqliteThreadViewTest::testReadAhead()
+{
+    Q_FOREACH(const History::Sort &sort, QList<History::Sort>() << History::Sort(History::FieldAccountId)
+                                                                << History::Sort(History::FieldLastEventTimestamp)) {
+        History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText, sort);
+        view->SetReadAhead(true);
+
+        // the pages read ahead are the same ones, in the same order
+        QStringList accountIds;
+        QList<QVariantMap> threads = view->NextPage();
+        while (!threads.isEmpty()) {
+            Q_FOREACH(const QVariantMap &thread, threads) {
+                accountIds << thread[History::FieldAccountId].toString();
+            }
+            QCoreApplication::processEvents();
+            threads = view->NextPage();
+        }
+        delete view;
+
+        QCOMPARE(accountIds.count(), THREAD_COUNT);
+        QCOMPARE(accountIds.toSet().count(), THREAD_COUNT);
+    }
+}
+
 void SqliteThreadViewTest::populateDatabase()
 {
     mPlugin->beginBatchOperation();
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlitehistoryplugin.h"
+#include "textevent.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+
+// writes synthetic text events straight to the sqlite plugin and reports the write throughput.
+// The durability profile is selected with the HISTORY_SQLITE_PROFILE environment variable.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = QCoreApplication::arguments();
+    if (args.size() < 2) {
+        qDebug() << "Usage: history-loadtest <database file> [events] [events per batch] [threads]";
+        qDebug() << "The database file is removed before the test starts.";
+        return 1;
+    }
+
+    QString databasePath = args[1];
+    int eventCount = args.size() > 2 ? args[2].toInt() : 10000;
+    int batchSize = args.size() > 3 ? qMax(1, args[3].toInt()) : 1;
+    int threadCount = args.size() > 4 ? qMax(1, args[4].toInt()) : 10;
+
+    Q_FOREACH(const QString &suffix, QStringList() << "" << "-wal" << "-shm" << "-journal") {
+        QFile::remove(databasePath + suffix);
+    }
+    qputenv("HISTORY_SQLITE_DBPATH", databasePath.toUtf8());
+
+    SQLiteHistoryPlugin plugin;
+    QStringList threadIds;
+    for (int i = 0; i < threadCount; ++i) {
+        QVariantMap thread = plugin.createThreadForParticipants("loadtest", History::EventTypeText,
+                                                                QStringList() << QString("participant%1").arg(i));
+        if (thread.isEmpty()) {
+            qCritical() << "Failed to create the threads";
+            return 1;
+        }
+        threadIds << thread[History::FieldThreadId].toString();
+    }
+
+    QDateTime timestamp = QDateTime::currentDateTime();
+    qint64 writeTime = 0;
+    qint64 checkpointTime = 0;
+    QElapsedTimer timer;
+
+    int written = 0;
+    while (written < eventCount) {
+        timer.start();
+        plugin.beginBatchOperation();
+        for (int i = 0; i < batchSize && written < eventCount; ++i, ++written) {
+            QString threadId = threadIds[written % threadCount];
+            History::TextEvent event("loadtest", threadId, QString("event%1").arg(written),
+                                     QString("participant%1").arg(written % threadCount),
+                                     timestamp.addMSecs(written), written % 2 == 0, "Synthetic message",
+                                     History::MessageTypeText);
+            if (plugin.writeTextEvent(event.properties()) != History::EventWriteCreated) {
+                qCritical() << "Failed to write event" << written;
+                plugin.rollbackBatchOperation();
+                return 1;
+            }
+        }
+        plugin.endBatchOperation();
+        writeTime += timer.nsecsElapsed();
+
+        // the daemon checkpoints when it is idle, measure it separately
+        timer.start();
+        plugin.checkpoint();
+        checkpointTime += timer.nsecsElapsed();
+    }
+
+    QString profile = qgetenv("HISTORY_SQLITE_PROFILE");
+    qDebug() << "Profile:" << (profile.isEmpty() ? QString("wal") : profile);
+    qDebug() << "Events written:" << written << "in batches of" << batchSize;
+    qDebug() << "Write time (ms):" << writeTime / 1000000.0;
+    qDebug() << "Checkpoint time (ms):" << checkpointTime / 1000000.0;
+    qDebug() << "Events per second:" << (writeTime > 0 ? written * 1000000000.0 / writeTime : 0);
+    return 0;
+}
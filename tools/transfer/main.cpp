@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "types.h"
+#include <QCoreApplication>
+#include <QDBusInterface>
+#include <QDBusReply>
+#include <QDBusUnixFileDescriptor>
+#include <QDebug>
+#include <QFile>
+#include <QStringList>
+
+// a transfer of a large history can take a while
+static const int transferTimeout = 60 * 60 * 1000;
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = QCoreApplication::arguments();
+    if (args.size() != 3 || (args[1] != "export" && args[1] != "import")) {
+        qDebug() << "Usage: history-transfer export|import file";
+        return 1;
+    }
+
+    bool exporting = args[1] == "export";
+    QFile file(args[2]);
+    if (!file.open(exporting ? QIODevice::WriteOnly | QIODevice::Truncate : QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << args[2] << ":" << file.errorString();
+        return 1;
+    }
+
+    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
+    interface.setTimeout(transferTimeout);
+    QDBusReply<bool> reply = interface.call(exporting ? "ExportEvents" : "ImportEvents",
+                                            QVariant::fromValue(QDBusUnixFileDescriptor(file.handle())));
+    if (!reply.isValid()) {
+        qWarning() << "The transfer failed:" << reply.error().message();
+        return 1;
+    }
+    if (!reply.value()) {
+        qWarning() << "The transfer did not complete, see the service log for details";
+        return 1;
+    }
+    return 0;
+}